@@ -0,0 +1,879 @@
+#include <time.h>
+#include "IMAGE.h"
+#include "WALK.h"
+#include "SPACE.h"
+#include "OWNER.h"
+
+/*******************************************************************************
+* Define
+*******************************************************************************/
+#define BENCH_IMAGE_DEFAULT     "bench.img"
+#define BENCH_ITERATIONS        5U       /* Repeats of the whole-tree benchmarks */
+#define BENCH_FORMAT_JSON       0U       /* One JSON object per line */
+#define BENCH_FORMAT_TSV        1U       /* A header line, then one tab separated line per benchmark */
+#define NS_PER_SECOND           1000000000ULL
+#define BENCH_FAT12_ENTRIES     (1024U * 1024U)  /* Entries of the synthetic table unpacked by the FAT12 benchmark */
+
+typedef struct
+{
+    uint32_t    cluster;                 /* First cluster of the entry */
+    uint32_t    size;                    /* File size, 0 for a directory */
+} t_benchItem;
+
+typedef struct
+{
+    t_benchItem *items;                  /* Files or directories of the image */
+    uint32_t    count;                   /* Number of items */
+    uint32_t    capacity;                /* Number of items the array can hold */
+} t_benchList;
+
+typedef struct
+{
+    t_benchList files;                   /* Every file of the image */
+    t_benchList dirs;                    /* Every directory, the root first */
+    pthread_mutex_t lock;                /* Protects the lists during the walk */
+} t_benchTree;
+
+typedef struct
+{
+    const char  *name;                   /* Benchmark name */
+    uint64_t    ops;                     /* Timed operations */
+    uint64_t    bytes;                   /* Bytes of file data read */
+    uint64_t    entries;                 /* Directory entries read */
+    uint64_t    clusters;                /* Clusters followed in the FAT */
+    uint64_t    totalNs;                 /* Time of all operations */
+    uint64_t    *latencies;              /* Time of each operation in ns */
+} t_benchResult;
+
+typedef struct
+{
+    t_imageConfig   image;               /* Layout of the generated image */
+    t_volumeConfig  volume;              /* Mount options */
+    const char      *path;               /* The image file */
+    uint8_t         generate;            /* 1 to create the image, 0 to use an existing one */
+    uint8_t         keep;                /* 1 to keep a generated image */
+    uint8_t         format;              /* BENCH_FORMAT_JSON or BENCH_FORMAT_TSV */
+    uint32_t        iterations;          /* Repeats of the whole-tree benchmarks */
+} t_benchOptions;
+
+/*******************************************************************************
+* Prototypes
+*******************************************************************************/
+
+/**
+ * Name: nowNs
+ * @brief Read the monotonic clock.
+ *
+ * @return The time in ns.
+ */
+uint64_t nowNs(void);
+
+/**
+ * Name: appendItem
+ * @brief Add an item at the end of a list, growing the array if it is full.
+ *
+ * @param list The list.
+ * @param cluster The first cluster of the entry.
+ * @param size The file size.
+ *
+ * @return 1 if the item was added, 0 if memory ran out.
+ */
+uint8_t appendItem(t_benchList *list, uint32_t cluster, uint32_t size);
+
+/**
+ * Name: collectItem
+ * @brief Walk callback sorting the entries of the image into files and directories.
+ *
+ * @param path The path of the entry.
+ * @param entry The directory entry.
+ * @param context The t_benchTree being filled.
+ *
+ * @return 1 to continue the walk, 0 if memory ran out.
+ */
+uint8_t collectItem(const char *path, const t_direcroryEntry *entry, void *context);
+
+/**
+ * Name: countWalk
+ * @brief Walk callback counting the entries of the image.
+ *
+ * @param path The path of the entry.
+ * @param entry The directory entry.
+ * @param context The uint64_t counter.
+ *
+ * @return 1.
+ */
+uint8_t countWalk(const char *path, const t_direcroryEntry *entry, void *context);
+
+/**
+ * Name: compareNs
+ * @brief qsort order of latencies.
+ *
+ * @param a The first latency.
+ * @param b The second latency.
+ *
+ * @return <0, 0 or >0.
+ */
+int compareNs(const void *a, const void *b);
+
+/**
+ * Name: initResult
+ * @brief Prepare a result for a number of operations.
+ *
+ * @param result The result.
+ * @param name The benchmark name.
+ * @param ops The number of operations that will be timed.
+ *
+ * @return 1 if the latency array was allocated, 0 otherwise.
+ */
+uint8_t initResult(t_benchResult *result, const char *name, uint64_t ops);
+
+/**
+ * Name: report
+ * @brief Print a result with its throughput and latency percentiles, then free it.
+ *
+ * @param options The options, for the format and the image layout.
+ * @param result The result.
+ */
+void report(const t_benchOptions *options, t_benchResult *result);
+
+/**
+ * Name: benchChains
+ * @brief Time the walk of the cluster chain of every file through nextCluster.
+ *
+ * @param options The options.
+ * @param vol The volume.
+ * @param tree The files and directories of the image.
+ */
+void benchChains(const t_benchOptions *options, t_volume *vol, const t_benchTree *tree);
+
+/**
+ * Name: benchDirectories
+ * @brief Time readDirEntry on the first sectors of every directory, then loadDirEntry
+ *        on every directory twice: first from the disk, then from the directory cache.
+ *
+ * @param options The options.
+ * @param vol The volume.
+ * @param tree The files and directories of the image.
+ */
+void benchDirectories(const t_benchOptions *options, t_volume *vol, const t_benchTree *tree);
+
+/**
+ * Name: benchFiles
+ * @brief Time loadFile on every file.
+ *
+ * @param options The options.
+ * @param vol The volume.
+ * @param tree The files and directories of the image.
+ */
+void benchFiles(const t_benchOptions *options, t_volume *vol, const t_benchTree *tree);
+
+/**
+ * Name: benchWalk
+ * @brief Time the listing of the whole tree with one walker thread and with one per CPU.
+ *
+ * @param options The options.
+ * @param vol The volume.
+ */
+void benchWalk(const t_benchOptions *options, t_volume *vol);
+
+/**
+ * Name: benchFreeSpace
+ * @brief Time the free space scan of the whole FAT with each kernel.
+ *
+ * @param options The options.
+ * @param vol The volume.
+ */
+void benchFreeSpace(const t_benchOptions *options, t_volume *vol);
+
+/**
+ * Name: benchOwnerMap
+ * @brief Time the build of the cluster owner map, then the lookup of the owner of the first
+ *        cluster of every file.
+ *
+ * @param options The options.
+ * @param vol The volume.
+ * @param tree The files and directories of the image.
+ */
+void benchOwnerMap(const t_benchOptions *options, t_volume *vol, const t_benchTree *tree);
+
+/**
+ * Name: benchFAT12Unpack
+ * @brief Time unpackFAT12 on a random table of BENCH_FAT12_ENTRIES entries with each kernel,
+ *        checking every kernel against the scalar one.
+ *
+ * @param options The options.
+ */
+void benchFAT12Unpack(const t_benchOptions *options);
+
+/**
+ * Name: parseOptions
+ * @brief Read the command line.
+ *
+ * @param argc The number of arguments.
+ * @param argv The arguments.
+ * @param options Receives the options.
+ *
+ * @return 1 if the command line is valid, 0 otherwise.
+ */
+uint8_t parseOptions(int argc, char **argv, t_benchOptions *options);
+
+/*******************************************************************************
+* Code
+*******************************************************************************/
+int main(int argc, char **argv)
+{
+    t_benchOptions options;
+    t_benchTree tree;
+    t_imageStats imageStats;
+    t_volume *vol = NULL;
+    int status = 1;
+
+    memset(&tree, 0, sizeof(tree));
+    pthread_mutex_init(&tree.lock, NULL);
+
+    if(parseOptions(argc, argv, &options) == 0)
+    {
+        printf("Usage: %s [--fat 12|16|32] [--spc N] [--depth N] [--fanout N] [--files N]\n"
+               "          [--min BYTES] [--max BYTES] [--dist uniform|log] [--frag PERCENT] [--seed N]\n"
+               "          [--image PATH] [--existing] [--keep] [--backend pread|mmap] [--queue N]\n"
+               "          [--iterations N] [--format json|tsv]\n", argv[0]);
+    }
+    else if((options.generate == 1) && (makeImage(options.path, &options.image, &imageStats) == 0))
+    {
+        printf("Cannot create the image %s.\n", options.path);
+    }
+    else if((vol = initFileFAT(options.path, &options.volume)) == NULL)
+    {
+        printf("Cannot open the image %s.\n", options.path);
+    }
+    else if((appendItem(&tree.dirs, 0, 0) == 0) || (walkVolume(vol, 1, collectItem, &tree) == 0))
+    {
+        printf("Cannot list the image %s.\n", options.path);
+    }
+    else
+    {
+        /* Report the geometry of the image actually measured */
+        options.image.fatType = fatType(vol);
+        options.image.secPerClus = (uint8_t)vol->bootInfo.secPerClus;
+
+        if(options.format == BENCH_FORMAT_TSV)
+        {
+            printf("bench\tfat\tspc\tfiles\tdirs\tops\tseconds\tmb_per_s\tentries_per_s\tclusters_per_s\t"
+                   "mean_ns\tp50_ns\tp90_ns\tp99_ns\tmax_ns\n");
+        }
+
+        benchChains(&options, vol, &tree);
+        benchDirectories(&options, vol, &tree);
+        benchFiles(&options, vol, &tree);
+        benchWalk(&options, vol);
+        benchFreeSpace(&options, vol);
+        benchOwnerMap(&options, vol, &tree);
+        benchFAT12Unpack(&options);
+        status = 0;
+    }
+
+    if(vol != NULL)
+    {
+        deinitFileFAT(vol);
+    }
+    if((options.generate == 1) && (options.keep == 0))
+    {
+        unlink(options.path);
+    }
+
+    free(tree.files.items);
+    free(tree.dirs.items);
+    pthread_mutex_destroy(&tree.lock);
+
+    return status;
+}
+
+uint64_t nowNs(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * NS_PER_SECOND + (uint64_t)now.tv_nsec;
+}
+
+uint8_t appendItem(t_benchList *list, uint32_t cluster, uint32_t size)
+{
+    t_benchItem *grown = NULL;
+    uint32_t capacity = 0;
+    uint8_t result = 1;
+
+    if(list->count == list->capacity)
+    {
+        capacity = (list->capacity == 0) ? 64 : list->capacity * 2;
+        grown = (t_benchItem*)realloc(list->items, capacity * sizeof(t_benchItem));
+        if(grown == NULL)
+        {
+            printf("The disk is empty.\n");
+            result = 0;
+        }
+        else
+        {
+            list->items = grown;
+            list->capacity = capacity;
+        }
+    }
+
+    if(result == 1)
+    {
+        list->items[list->count].cluster = cluster;
+        list->items[list->count].size = size;
+        list->count++;
+    }
+
+    return result;
+}
+
+uint8_t collectItem(const char *path, const t_direcroryEntry *entry, void *context)
+{
+    t_benchTree *tree = (t_benchTree*)context;
+    uint8_t result = 0;
+
+    (void)path;
+
+    pthread_mutex_lock(&tree->lock);
+    if((entry->attributes & ATTR_DIRECTORY) != 0)
+    {
+        result = appendItem(&tree->dirs, entry->startCluster, 0);
+    }
+    else
+    {
+        result = appendItem(&tree->files, entry->startCluster, entry->fileSize);
+    }
+    pthread_mutex_unlock(&tree->lock);
+
+    return result;
+}
+
+uint8_t countWalk(const char *path, const t_direcroryEntry *entry, void *context)
+{
+    (void)path;
+    (void)entry;
+
+    __atomic_add_fetch((uint64_t*)context, 1, __ATOMIC_RELAXED);
+
+    return 1;
+}
+
+int compareNs(const void *a, const void *b)
+{
+    uint64_t first = *(const uint64_t*)a;
+    uint64_t second = *(const uint64_t*)b;
+
+    return (first > second) - (first < second);
+}
+
+uint8_t initResult(t_benchResult *result, const char *name, uint64_t ops)
+{
+    memset(result, 0, sizeof(t_benchResult));
+    result->name = name;
+    result->latencies = (uint64_t*)malloc((ops > 0 ? ops : 1) * sizeof(uint64_t));
+
+    if(result->latencies == NULL)
+    {
+        printf("The disk is empty.\n");
+    }
+
+    return (result->latencies != NULL) ? 1 : 0;
+}
+
+void report(const t_benchOptions *options, t_benchResult *result)
+{
+    double seconds = 0;
+    double mbPerSec = 0;
+    double entriesPerSec = 0;
+    double clustersPerSec = 0;
+    uint64_t mean = 0;
+    uint64_t p50 = 0;
+    uint64_t p90 = 0;
+    uint64_t p99 = 0;
+    uint64_t max = 0;
+
+    if(result->ops > 0)
+    {
+        qsort(result->latencies, result->ops, sizeof(uint64_t), compareNs);
+        mean = result->totalNs / result->ops;
+        p50 = result->latencies[(result->ops - 1) * 50 / 100];
+        p90 = result->latencies[(result->ops - 1) * 90 / 100];
+        p99 = result->latencies[(result->ops - 1) * 99 / 100];
+        max = result->latencies[result->ops - 1];
+    }
+
+    seconds = (double)result->totalNs / NS_PER_SECOND;
+    if(seconds > 0)
+    {
+        mbPerSec = (double)result->bytes / (1024.0 * 1024.0) / seconds;
+        entriesPerSec = (double)result->entries / seconds;
+        clustersPerSec = (double)result->clusters / seconds;
+    }
+
+    if(options->format == BENCH_FORMAT_TSV)
+    {
+        printf("%s\t%u\t%u\t%u\t%u\t%llu\t%.6f\t%.2f\t%.0f\t%.0f\t%llu\t%llu\t%llu\t%llu\t%llu\n",
+               result->name, options->image.fatType, options->image.secPerClus,
+               options->image.filesPerDir, options->image.fanOut, (unsigned long long)result->ops, seconds,
+               mbPerSec, entriesPerSec, clustersPerSec, (unsigned long long)mean, (unsigned long long)p50,
+               (unsigned long long)p90, (unsigned long long)p99, (unsigned long long)max);
+    }
+    else
+    {
+        printf("{\"bench\":\"%s\",\"fat\":%u,\"spc\":%u,\"depth\":%u,\"fanout\":%u,\"files_per_dir\":%u,"
+               "\"frag\":%u,\"ops\":%llu,\"bytes\":%llu,\"entries\":%llu,\"clusters\":%llu,\"seconds\":%.6f,"
+               "\"mb_per_s\":%.2f,\"entries_per_s\":%.0f,\"clusters_per_s\":%.0f,"
+               "\"mean_ns\":%llu,\"p50_ns\":%llu,\"p90_ns\":%llu,\"p99_ns\":%llu,\"max_ns\":%llu}\n",
+               result->name, options->image.fatType, options->image.secPerClus, options->image.depth,
+               options->image.fanOut, options->image.filesPerDir, options->image.fragmentation,
+               (unsigned long long)result->ops, (unsigned long long)result->bytes,
+               (unsigned long long)result->entries, (unsigned long long)result->clusters, seconds,
+               mbPerSec, entriesPerSec, clustersPerSec, (unsigned long long)mean, (unsigned long long)p50,
+               (unsigned long long)p90, (unsigned long long)p99, (unsigned long long)max);
+    }
+
+    free(result->latencies);
+    result->latencies = NULL;
+}
+
+void benchChains(const t_benchOptions *options, t_volume *vol, const t_benchTree *tree)
+{
+    t_benchResult result;
+    uint64_t start = 0;
+    uint32_t clusterBytes = 0;
+    uint32_t index = 0;
+
+    clusterBytes = (uint32_t)vol->bootInfo.bytsPerSec * vol->bootInfo.secPerClus;
+
+    /* countExtents follows every link of the chain with nextCluster */
+    if(initResult(&result, "nextCluster", tree->files.count) == 1)
+    {
+        for(index = 0; index < tree->files.count; index++)
+        {
+            if(tree->files.items[index].cluster >= FIRST_CLUSTER)
+            {
+                start = nowNs();
+                countExtents(vol, tree->files.items[index].cluster);
+                result.latencies[result.ops] = nowNs() - start;
+                result.totalNs += result.latencies[result.ops];
+                result.clusters += ((uint64_t)tree->files.items[index].size + clusterBytes - 1) / clusterBytes;
+                result.ops++;
+            }
+        }
+
+        report(options, &result);
+    }
+}
+
+void benchDirectories(const t_benchOptions *options, t_volume *vol, const t_benchTree *tree)
+{
+    t_benchResult result;
+    t_dirList list = {NULL, 0, 0};
+    uint64_t start = 0;
+    uint32_t sector = 0;
+    uint32_t index = 0;
+    uint32_t pass = 0;
+    uint32_t cluster = 0;
+
+    /* readDirEntry parses the first cluster of a directory, or the whole FAT12/16 root directory */
+    if(initResult(&result, "readDirEntry", tree->dirs.count) == 1)
+    {
+        for(index = 0; index < tree->dirs.count; index++)
+        {
+            cluster = tree->dirs.items[index].cluster;
+            if((cluster == 0) && (fatType(vol) == FAT_32))
+            {
+                cluster = vol->bootInfo.rootClus;
+            }
+
+            if(cluster == 0)
+            {
+                sector = vol->local.rootDirStartSector;
+            }
+            else
+            {
+                sector = ((cluster - FIRST_CLUSTER) * vol->bootInfo.secPerClus) + vol->local.dataStartSector;
+            }
+
+            list.count = 0;
+            start = nowNs();
+            readDirEntry(vol, &list, sector);
+            result.latencies[result.ops] = nowNs() - start;
+            result.totalNs += result.latencies[result.ops];
+            result.entries += list.count;
+            result.ops++;
+        }
+
+        report(options, &result);
+    }
+
+    for(pass = 0; pass < 2; pass++)
+    {
+        if(initResult(&result, (pass == 0) ? "loadDirEntry" : "loadDirEntry.cached", tree->dirs.count) == 1)
+        {
+            for(index = 0; index < tree->dirs.count; index++)
+            {
+                start = nowNs();
+                loadDirEntry(vol, &list, tree->dirs.items[index].cluster);
+                result.latencies[result.ops] = nowNs() - start;
+                result.totalNs += result.latencies[result.ops];
+                result.entries += list.count;
+                result.ops++;
+            }
+
+            report(options, &result);
+        }
+    }
+
+    freeDirList(&list);
+}
+
+void benchFiles(const t_benchOptions *options, t_volume *vol, const t_benchTree *tree)
+{
+    t_benchResult result;
+    uint8_t *buff = NULL;
+    uint64_t start = 0;
+    uint64_t largest = 0;
+    uint32_t clusterBytes = 0;
+    uint32_t index = 0;
+
+    clusterBytes = (uint32_t)vol->bootInfo.bytsPerSec * vol->bootInfo.secPerClus;
+    for(index = 0; index < tree->files.count; index++)
+    {
+        largest = (tree->files.items[index].size > largest) ? tree->files.items[index].size : largest;
+    }
+
+    /* loadFile reads whole clusters */
+    buff = (uint8_t*)malloc(((largest + clusterBytes - 1) / clusterBytes + 1) * clusterBytes);
+
+    if(buff == NULL)
+    {
+        printf("The disk is empty.\n");
+    }
+    else if(initResult(&result, "loadFile", tree->files.count) == 1)
+    {
+        for(index = 0; index < tree->files.count; index++)
+        {
+            if(tree->files.items[index].cluster >= FIRST_CLUSTER)
+            {
+                start = nowNs();
+                loadFile(vol, buff, tree->files.items[index].cluster);
+                result.latencies[result.ops] = nowNs() - start;
+                result.totalNs += result.latencies[result.ops];
+                result.bytes += tree->files.items[index].size;
+                result.ops++;
+            }
+        }
+
+        report(options, &result);
+    }
+
+    free(buff);
+}
+
+void benchWalk(const t_benchOptions *options, t_volume *vol)
+{
+    static const uint32_t threads[2] = {1, WALK_THREADS_AUTO};
+    static const char *names[2] = {"walk.1", "walk.auto"};
+    t_benchResult result;
+    uint64_t start = 0;
+    uint64_t count = 0;
+    uint32_t index = 0;
+    uint32_t run = 0;
+
+    for(run = 0; run < 2; run++)
+    {
+        if(initResult(&result, names[run], options->iterations) == 1)
+        {
+            for(index = 0; index < options->iterations; index++)
+            {
+                count = 0;
+                start = nowNs();
+                walkVolume(vol, threads[run], countWalk, &count);
+                result.latencies[result.ops] = nowNs() - start;
+                result.totalNs += result.latencies[result.ops];
+                result.entries += count;
+                result.ops++;
+            }
+
+            report(options, &result);
+        }
+    }
+}
+
+void benchFreeSpace(const t_benchOptions *options, t_volume *vol)
+{
+    static const uint8_t kernels[3] = {SPACE_KERNEL_SCALAR, SPACE_KERNEL_SSE2, SPACE_KERNEL_AVX2};
+    static const char *names[3] = {"freeSpace.scalar", "freeSpace.sse2", "freeSpace.avx2"};
+    t_benchResult result;
+    t_freeSpace space;
+    uint64_t start = 0;
+    uint32_t index = 0;
+    uint32_t run = 0;
+    uint8_t used = 0;
+
+    for(run = 0; run < 3; run++)
+    {
+        if(initResult(&result, names[run], options->iterations) == 1)
+        {
+            for(index = 0; index < options->iterations; index++)
+            {
+                start = nowNs();
+                scanFreeSpace(vol, kernels[run], &space);
+                result.latencies[result.ops] = nowNs() - start;
+                result.totalNs += result.latencies[result.ops];
+                result.clusters += space.numClusters;
+                result.ops++;
+                used = space.kernel;
+                releaseFreeSpace(&space);
+            }
+
+            /* A kernel the CPU lacks ran as scalar, do not report it twice */
+            if(used == kernels[run])
+            {
+                report(options, &result);
+            }
+            else
+            {
+                free(result.latencies);
+            }
+        }
+    }
+}
+
+void benchOwnerMap(const t_benchOptions *options, t_volume *vol, const t_benchTree *tree)
+{
+    t_benchResult result;
+    t_ownerMap map;
+    uint64_t start = 0;
+    uint32_t index = 0;
+    uint8_t built = 0;
+
+    memset(&map, 0, sizeof(map));
+
+    if(initResult(&result, "ownerMap.build", options->iterations) == 1)
+    {
+        for(index = 0; index < options->iterations; index++)
+        {
+            /* The last map built is kept for the lookups */
+            releaseOwnerMap(&map);
+            start = nowNs();
+            built = buildOwnerMap(vol, OWNER_THREADS_AUTO, &map);
+            result.latencies[result.ops] = nowNs() - start;
+            result.totalNs += result.latencies[result.ops];
+            result.entries += map.numOwners;
+            result.ops++;
+        }
+
+        report(options, &result);
+    }
+
+    if((built == 1) && (initResult(&result, "ownerMap.lookup", tree->files.count) == 1))
+    {
+        for(index = 0; index < tree->files.count; index++)
+        {
+            if(tree->files.items[index].cluster >= FIRST_CLUSTER)
+            {
+                start = nowNs();
+                findClusterOwner(&map, tree->files.items[index].cluster, NULL);
+                result.latencies[result.ops] = nowNs() - start;
+                result.totalNs += result.latencies[result.ops];
+                result.clusters++;
+                result.ops++;
+            }
+        }
+
+        report(options, &result);
+    }
+
+    releaseOwnerMap(&map);
+}
+
+void benchFAT12Unpack(const t_benchOptions *options)
+{
+    static const uint8_t kernels[3] = {FAT12_KERNEL_SCALAR, FAT12_KERNEL_SSSE3, FAT12_KERNEL_AVX2};
+    static const char *names[3] = {"fat12Unpack.scalar", "fat12Unpack.ssse3", "fat12Unpack.avx2"};
+    t_benchResult result;
+    uint8_t *raw = NULL;
+    uint32_t *expected = NULL;
+    uint32_t *entries = NULL;
+    uint64_t start = 0;
+    uint32_t rawBytes = BENCH_FAT12_ENTRIES + BENCH_FAT12_ENTRIES / 2;
+    uint32_t seed = options->image.seed;
+    uint32_t index = 0;
+    uint32_t run = 0;
+    uint8_t used = 0;
+
+    raw = (uint8_t*)malloc(rawBytes);
+    expected = (uint32_t*)malloc(BENCH_FAT12_ENTRIES * sizeof(uint32_t));
+    entries = (uint32_t*)malloc(BENCH_FAT12_ENTRIES * sizeof(uint32_t));
+
+    if((raw == NULL) || (expected == NULL) || (entries == NULL))
+    {
+        printf("The disk is empty.\n");
+    }
+    else
+    {
+        for(index = 0; index < rawBytes; index++)
+        {
+            seed = seed * 1103515245U + 12345U;
+            raw[index] = (uint8_t)(seed >> SHIFT_16_BIT);
+        }
+        unpackFAT12(raw, 0, BENCH_FAT12_ENTRIES, FAT12_KERNEL_SCALAR, expected);
+
+        for(run = 0; run < 3; run++)
+        {
+            if(initResult(&result, names[run], options->iterations) == 1)
+            {
+                for(index = 0; index < options->iterations; index++)
+                {
+                    start = nowNs();
+                    used = unpackFAT12(raw, 0, BENCH_FAT12_ENTRIES, kernels[run], entries);
+                    result.latencies[result.ops] = nowNs() - start;
+                    result.totalNs += result.latencies[result.ops];
+                    result.clusters += BENCH_FAT12_ENTRIES;
+                    result.ops++;
+                }
+
+                /* An odd start and a length that is not a whole step exercise the scalar edges */
+                if((memcmp(entries, expected, BENCH_FAT12_ENTRIES * sizeof(uint32_t)) != 0) ||
+                   (unpackFAT12(raw + 1, 1, BENCH_FAT12_ENTRIES - 3, kernels[run], entries) != used) ||
+                   (memcmp(entries, expected + 1, (BENCH_FAT12_ENTRIES - 3) * sizeof(uint32_t)) != 0))
+                {
+                    printf("%s does not match the scalar kernel.\n", names[run]);
+                    free(result.latencies);
+                }
+                /* A kernel the CPU lacks ran as scalar, do not report it twice */
+                else if(used == kernels[run])
+                {
+                    report(options, &result);
+                }
+                else
+                {
+                    free(result.latencies);
+                }
+            }
+        }
+    }
+
+    free(raw);
+    free(expected);
+    free(entries);
+}
+
+uint8_t parseOptions(int argc, char **argv, t_benchOptions *options)
+{
+    const char *name = NULL;
+    const char *value = NULL;
+    int index = 0;
+    uint8_t result = 1;
+
+    /* A small FAT16 tree with contiguous files */
+    memset(options, 0, sizeof(t_benchOptions));
+    options->image.fatType = FAT_16;
+    options->image.secPerClus = 4;
+    options->image.depth = 2;
+    options->image.fanOut = 8;
+    options->image.filesPerDir = 32;
+    options->image.minFileSize = 0;
+    options->image.maxFileSize = 64 * 1024;
+    options->image.sizeDistribution = IMAGE_SIZE_LOG;
+    options->image.fragmentation = 0;
+    options->image.seed = 1;
+    defaultVolumeConfig(&options->volume);
+    options->path = BENCH_IMAGE_DEFAULT;
+    options->generate = 1;
+    options->iterations = BENCH_ITERATIONS;
+    options->format = BENCH_FORMAT_JSON;
+
+    for(index = 1; (index < argc) && (result == 1); index++)
+    {
+        name = argv[index];
+        value = (index + 1 < argc) ? argv[index + 1] : NULL;
+
+        if(strcmp(name, "--existing") == 0)
+        {
+            options->generate = 0;
+        }
+        else if(strcmp(name, "--keep") == 0)
+        {
+            options->keep = 1;
+        }
+        else if(value == NULL)
+        {
+            result = 0;
+        }
+        else
+        {
+            index++;
+            if(strcmp(name, "--fat") == 0)
+            {
+                options->image.fatType = (uint8_t)atoi(value);
+            }
+            else if(strcmp(name, "--spc") == 0)
+            {
+                options->image.secPerClus = (uint8_t)atoi(value);
+            }
+            else if(strcmp(name, "--depth") == 0)
+            {
+                options->image.depth = (uint32_t)atoi(value);
+            }
+            else if(strcmp(name, "--fanout") == 0)
+            {
+                options->image.fanOut = (uint32_t)atoi(value);
+            }
+            else if(strcmp(name, "--files") == 0)
+            {
+                options->image.filesPerDir = (uint32_t)atoi(value);
+            }
+            else if(strcmp(name, "--min") == 0)
+            {
+                options->image.minFileSize = (uint32_t)strtoul(value, NULL, 0);
+            }
+            else if(strcmp(name, "--max") == 0)
+            {
+                options->image.maxFileSize = (uint32_t)strtoul(value, NULL, 0);
+            }
+            else if(strcmp(name, "--dist") == 0)
+            {
+                options->image.sizeDistribution = (strcmp(value, "uniform") == 0) ? IMAGE_SIZE_UNIFORM : IMAGE_SIZE_LOG;
+            }
+            else if(strcmp(name, "--frag") == 0)
+            {
+                options->image.fragmentation = (uint8_t)atoi(value);
+            }
+            else if(strcmp(name, "--seed") == 0)
+            {
+                options->image.seed = (uint32_t)strtoul(value, NULL, 0);
+            }
+            else if(strcmp(name, "--image") == 0)
+            {
+                options->path = value;
+            }
+            else if(strcmp(name, "--backend") == 0)
+            {
+                options->volume.disk.backend = (strcmp(value, "mmap") == 0) ? HAL_BACKEND_MMAP : HAL_BACKEND_PREAD;
+            }
+            else if(strcmp(name, "--queue") == 0)
+            {
+                options->volume.disk.queueDepth = (uint32_t)atoi(value);
+            }
+            else if(strcmp(name, "--iterations") == 0)
+            {
+                options->iterations = (uint32_t)atoi(value);
+            }
+            else if(strcmp(name, "--format") == 0)
+            {
+                options->format = (strcmp(value, "tsv") == 0) ? BENCH_FORMAT_TSV : BENCH_FORMAT_JSON;
+            }
+            else
+            {
+                result = 0;
+            }
+        }
+    }
+
+    return result;
+}
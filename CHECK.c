@@ -0,0 +1,858 @@
+/*******************************************************************************
+* Include
+*******************************************************************************/
+#include "CHECK.h"
+
+/*******************************************************************************
+* Variables
+*******************************************************************************/
+static const char *const s_kindNames[CHECK_NUM_KINDS] =
+{
+    "crossLink", "loop", "freeCluster", "outOfRange", "badCluster", "sizeMismatch", "lostChain"
+};
+
+/*******************************************************************************
+* Prototypes
+*******************************************************************************/
+
+/**
+ * Name: loadTable
+ * @brief Point the check at the decoded FAT: the FAT cache when it is resident, otherwise
+ *        a table decoded for the check.
+ *
+ * @param ctx The check.
+ *
+ * @return 1 if every entry was decoded, 0 if a read failed or memory ran out.
+ */
+static uint8_t loadTable(t_checkContext *ctx);
+
+/**
+ * Name: nextLink
+ * @brief Follow one link of a chain.
+ *
+ * @param ctx The check.
+ * @param cluster The cluster.
+ *
+ * @return The next cluster, CHECK_END_OF_CHAIN if the cluster or its entry does not link to a data cluster.
+ */
+static uint32_t nextLink(const t_checkContext *ctx, uint32_t cluster);
+
+/**
+ * Name: findLoop
+ * @brief Look for a loop in a chain with Brent's algorithm, without marking anything.
+ *
+ * @param ctx The check.
+ * @param start The first cluster of the chain, a data cluster.
+ * @param entry Receives the first cluster the chain comes back to.
+ * @param length Receives the number of different clusters of the chain.
+ *
+ * @return 1 if the chain loops, 0 if it ends.
+ */
+static uint8_t findLoop(const t_checkContext *ctx, uint32_t start, uint32_t *entry, uint32_t *length);
+
+/**
+ * Name: claimCluster
+ * @brief Mark a cluster as reached by a chain.
+ *
+ * @param ctx The check.
+ * @param cluster The cluster, a data cluster.
+ *
+ * @return 1 if the cluster was not marked before, 0 otherwise.
+ */
+static uint8_t claimCluster(t_checkContext *ctx, uint32_t cluster);
+
+/**
+ * Name: addProblem
+ * @brief Count a problem and keep it in the report while the list has fewer than CHECK_MAX_PROBLEMS.
+ *
+ * @param ctx The check.
+ * @param kind The CHECK_* kind.
+ * @param cluster Where the problem was found.
+ * @param value The value that goes with the kind.
+ * @param expected The expected value that goes with the kind.
+ * @param path The entry, NULL for a lost chain.
+ */
+static void addProblem(t_checkContext *ctx, uint8_t kind, uint32_t cluster, uint32_t value, uint32_t expected, const char *path);
+
+/**
+ * Name: checkChain
+ * @brief Walk the chain of an entry, marking its clusters and reporting what is wrong with it.
+ *
+ * @param ctx The check.
+ * @param start The start cluster of the entry.
+ * @param path The path of the entry.
+ * @param isDirectory 1 for a directory, whose size is not checked.
+ * @param size The file size in bytes.
+ *
+ * @return 1 if the chain starts on a data cluster no other chain reached, so its content is
+ *         worth reading, 0 otherwise.
+ */
+static uint8_t checkChain(t_checkContext *ctx, uint32_t start, const char *path, uint8_t isDirectory, uint32_t size);
+
+/**
+ * Name: checkEntry
+ * @brief t_walkCallback checking the chain of every entry.
+ *
+ * @param path The path of the entry.
+ * @param entry The directory entry.
+ * @param context The t_checkContext.
+ *
+ * @return WALK_SKIP for a directory whose chain is not its own, 0 once memory ran out, 1 otherwise.
+ */
+static uint8_t checkEntry(const char *path, const t_direcroryEntry *entry, void *context);
+
+/**
+ * Name: sweepRange
+ * @brief Thread body finding the lost clusters of a range of bitmap words. The targets of
+ *        their links are marked in the linked bitmap.
+ *
+ * @param arg The t_checkRange.
+ *
+ * @return NULL.
+ */
+static void *sweepRange(void *arg);
+
+/**
+ * Name: sweepFAT
+ * @brief Find the lost clusters of the whole FAT, one range of bitmap words per thread.
+ *
+ * @param ctx The check.
+ * @param numThreads The number of threads.
+ *
+ * @return 1 if the FAT was swept, 0 if memory ran out.
+ */
+static uint8_t sweepFAT(t_checkContext *ctx, uint32_t numThreads);
+
+/**
+ * Name: reportLostChains
+ * @brief Report each chain of lost clusters once: first those with a head that no lost
+ *        cluster links to, then the loops that are left.
+ *
+ * @param ctx The check.
+ */
+static void reportLostChains(t_checkContext *ctx);
+
+/**
+ * Name: walkLostChain
+ * @brief Report the lost chain starting at a cluster and clear its clusters from the lost bitmap.
+ *
+ * @param ctx The check.
+ * @param head The first cluster of the chain.
+ */
+static void walkLostChain(t_checkContext *ctx, uint32_t head);
+
+/**
+ * Name: countBits
+ * @brief Count the bits set in a bitmap.
+ *
+ * @param words The bitmap.
+ * @param numWords The number of words.
+ *
+ * @return The number of bits set.
+ */
+static uint32_t countBits(const uint64_t *words, uint32_t numWords);
+
+/**
+ * Name: compareProblems
+ * @brief qsort order of problems: by kind, then path, then cluster.
+ *
+ * @param a The first problem.
+ * @param b The second problem.
+ *
+ * @return <0, 0 or >0.
+ */
+static int compareProblems(const void *a, const void *b);
+
+/**
+ * Name: checkVolume
+ * @brief Check the FAT of a volume without writing to it. The chain of every file and
+ *        directory is walked by a pool of walker threads and its clusters are marked in a
+ *        shared atomic bitmap, which finds cross-linked clusters, chains that reach free, bad
+ *        or out of range clusters, and files whose chain does not match their size. Chains
+ *        are only checked for loops when they reach a marked cluster. The FAT is then swept
+ *        in parallel for allocated clusters that no chain reached. The checker never follows
+ *        a link that leaves the data clusters and never walks more clusters than there are,
+ *        so it is safe on any image.
+ *
+ * @param vol: The volume.
+ * @param numThreads: The number of workers, CHECK_THREADS_AUTO for one per CPU.
+ * @param report: Receives the problems and the counts, to be released with releaseCheckReport().
+ *
+ * @return 1 if the whole volume was checked, 0 if a read failed or memory ran out.
+ */
+uint8_t checkVolume(t_volume *vol, uint32_t numThreads, t_checkReport *report);
+
+/**
+ * Name: releaseCheckReport
+ * @brief Free the problems of a report and leave it empty.
+ *
+ * @param report: The report.
+ */
+void releaseCheckReport(t_checkReport *report);
+
+/**
+ * Name: checkKindName
+ * @brief Get the name of a kind of problem.
+ *
+ * @param kind: One of CHECK_*.
+ *
+ * @return The name, e.g. "crossLink", or "unknown".
+ */
+const char *checkKindName(uint8_t kind);
+
+/**
+ * Name: defaultCheckOptions
+ * @brief Fill the command line options shared by fsck and defrag with their defaults: no
+ *        image, the default read-only mount, one worker per CPU and text output.
+ *
+ * @param options: Receives the options.
+ */
+void defaultCheckOptions(t_checkOptions *options);
+
+/**
+ * Name: parseCheckOption
+ * @brief Read one of the command line options shared by fsck and defrag: the image path,
+ *        --threads N, --fat-cache BYTES or --format text|json.
+ *
+ * @param options: The options to change.
+ * @param name: The current argument.
+ * @param value: The argument after it, NULL if it is the last one.
+ *
+ * @return The number of arguments used, 1 or 2; 0 if the argument is unknown, has no value
+ *         or names a second image.
+ */
+uint32_t parseCheckOption(t_checkOptions *options, const char *name, const char *value);
+
+/*******************************************************************************
+* Code
+*******************************************************************************/
+static uint8_t loadTable(t_checkContext *ctx)
+{
+    t_volume *vol = ctx->vol;
+    uint32_t index = 0;
+    uint32_t count = 0;
+    uint32_t chunk = FAT_CACHE_PAGE_ENTRIES * FAT_CACHE_CHUNK_PAGES;
+    uint8_t result = 1;
+
+    if((vol->fatCache.pageEntries == 0) && (vol->fatCache.table != NULL))
+    {
+        ctx->table = vol->fatCache.table;
+    }
+    else if((ctx->ownTable = (uint32_t*)malloc((uint64_t)ctx->numClusters * sizeof(uint32_t))) == NULL)
+    {
+        fprintf(stderr, "The disk is empty.\n");
+        result = 0;
+    }
+    else
+    {
+        /* The FAT cache is bounded, decode the entries once for the check */
+        HAL_Advise(vol->device, vol->bootInfo.rsvdSecCnt, vol->bootInfo.FATsz, HAL_ADVICE_SEQUENTIAL);
+        for(index = 0; (result == 1) && (index < ctx->numClusters); index += count)
+        {
+            count = ctx->numClusters - index;
+            if(count > chunk)
+            {
+                count = chunk;
+            }
+
+            result = fillFATEntries(vol, index, count, &ctx->ownTable[index]);
+        }
+        ctx->table = ctx->ownTable;
+    }
+
+    return result;
+}
+
+static uint32_t nextLink(const t_checkContext *ctx, uint32_t cluster)
+{
+    uint32_t next = CHECK_END_OF_CHAIN;
+
+    if((cluster >= FIRST_CLUSTER) && (cluster < ctx->numClusters) &&
+       (ctx->table[cluster] >= FIRST_CLUSTER) && (ctx->table[cluster] < ctx->numClusters))
+    {
+        next = ctx->table[cluster];
+    }
+
+    return next;
+}
+
+static uint8_t findLoop(const t_checkContext *ctx, uint32_t start, uint32_t *entry, uint32_t *length)
+{
+    uint32_t power = 1;
+    uint32_t lambda = 1;
+    uint32_t mu = 0;
+    uint32_t tortoise = start;
+    uint32_t hare = 0;
+    uint32_t index = 0;
+    uint8_t result = 0;
+
+    /* The hare runs ahead; the tortoise jumps to it every power of two steps */
+    hare = nextLink(ctx, start);
+    while((hare != CHECK_END_OF_CHAIN) && (hare != tortoise))
+    {
+        if(power == lambda)
+        {
+            tortoise = hare;
+            power <<= 1;
+            lambda = 0;
+        }
+        hare = nextLink(ctx, hare);
+        lambda++;
+    }
+
+    if(hare != CHECK_END_OF_CHAIN)
+    {
+        /* lambda is the length of the loop; two walkers lambda apart meet where it starts */
+        tortoise = start;
+        hare = start;
+        for(index = 0; index < lambda; index++)
+        {
+            hare = nextLink(ctx, hare);
+        }
+        while(tortoise != hare)
+        {
+            tortoise = nextLink(ctx, tortoise);
+            hare = nextLink(ctx, hare);
+            mu++;
+        }
+
+        *entry = tortoise;
+        *length = mu + lambda;
+        result = 1;
+    }
+
+    return result;
+}
+
+static uint8_t claimCluster(t_checkContext *ctx, uint32_t cluster)
+{
+    uint64_t bit = 1ULL << (cluster % 64);
+    uint64_t before = 0;
+    uint8_t result = 1;
+
+    before = __atomic_fetch_or(&ctx->claimed[cluster / 64], bit, __ATOMIC_RELAXED);
+    if((before & bit) != 0)
+    {
+        result = 0;
+    }
+
+    return result;
+}
+
+static void addProblem(t_checkContext *ctx, uint8_t kind, uint32_t cluster, uint32_t value, uint32_t expected, const char *path)
+{
+    t_checkReport *report = ctx->report;
+    t_checkProblem *grown = NULL;
+    t_checkProblem *problem = NULL;
+    uint32_t capacity = 0;
+
+    pthread_mutex_lock(&ctx->lock);
+
+    report->counts[kind]++;
+    if(report->count < CHECK_MAX_PROBLEMS)
+    {
+        if(report->count == report->capacity)
+        {
+            capacity = (report->capacity == 0) ? CHECK_PROBLEMS_INIT_SIZE : report->capacity * 2;
+            grown = (t_checkProblem*)realloc(report->problems, capacity * sizeof(t_checkProblem));
+            if(grown != NULL)
+            {
+                report->problems = grown;
+                report->capacity = capacity;
+            }
+        }
+
+        if(report->count < report->capacity)
+        {
+            problem = &report->problems[report->count];
+            problem->kind = kind;
+            problem->cluster = cluster;
+            problem->value = value;
+            problem->expected = expected;
+            problem->path = (path != NULL) ? strdup(path) : NULL;
+            if((path != NULL) && (problem->path == NULL))
+            {
+                problem = NULL;
+            }
+            else
+            {
+                report->count++;
+            }
+        }
+
+        if(problem == NULL)
+        {
+            fprintf(stderr, "The disk is empty.\n");
+            __atomic_store_n(&ctx->failed, 1, __ATOMIC_RELAXED);
+        }
+    }
+
+    pthread_mutex_unlock(&ctx->lock);
+}
+
+static uint8_t checkChain(t_checkContext *ctx, uint32_t start, const char *path, uint8_t isDirectory, uint32_t size)
+{
+    uint32_t cluster = start;
+    uint32_t previous = 0;
+    uint32_t length = 0;
+    uint32_t value = 0;
+    uint32_t expected = 0;
+    uint32_t loopCluster = 0;
+    uint32_t loopLength = 0;
+    uint8_t walking = 1;
+    uint8_t crossed = 0;
+    uint8_t complete = 0;
+    uint8_t result = 1;
+
+    /* An empty file has no chain */
+    if((start == 0) && (isDirectory == 0))
+    {
+        walking = 0;
+        complete = 1;
+        result = 0;
+    }
+
+    while(walking == 1)
+    {
+        if((cluster < FIRST_CLUSTER) || (cluster >= ctx->numClusters))
+        {
+            addProblem(ctx, CHECK_OUT_OF_RANGE, previous, cluster, 0, path);
+            walking = 0;
+            if(length == 0)
+            {
+                result = 0;
+            }
+        }
+        else
+        {
+            if(claimCluster(ctx, cluster) == 0)
+            {
+                /* Once a chain is known to run into another, it has no loop and the shared
+                   clusters are not reported again */
+                if((crossed == 0) && (findLoop(ctx, start, &loopCluster, &loopLength) == 1))
+                {
+                    addProblem(ctx, CHECK_LOOP, loopCluster, loopLength, 0, path);
+                    walking = 0;
+                }
+                else
+                {
+                    __atomic_fetch_or(&ctx->shared[cluster / 64], 1ULL << (cluster % 64), __ATOMIC_RELAXED);
+                    if(crossed == 0)
+                    {
+                        addProblem(ctx, CHECK_CROSS_LINK, cluster, 0, 0, path);
+                        crossed = 1;
+                    }
+                }
+
+                if(length == 0)
+                {
+                    result = 0;
+                }
+            }
+
+            if(walking == 1)
+            {
+                length++;
+                value = ctx->table[cluster];
+                if(value == 0)
+                {
+                    addProblem(ctx, CHECK_FREE_CLUSTER, cluster, 0, 0, path);
+                    walking = 0;
+                }
+                else if(value == ctx->badCluster)
+                {
+                    addProblem(ctx, CHECK_BAD_CLUSTER, cluster, 0, 0, path);
+                    walking = 0;
+                }
+                else if(value >= ctx->lastCluster)
+                {
+                    walking = 0;
+                    complete = 1;
+                }
+                else
+                {
+                    previous = cluster;
+                    cluster = value;
+                }
+            }
+        }
+    }
+
+    /* A broken chain is already reported, its length says nothing about the size */
+    if((isDirectory == 0) && (complete == 1))
+    {
+        expected = (uint32_t)(((uint64_t)size + ctx->clusterBytes - 1) / ctx->clusterBytes);
+        if(length != expected)
+        {
+            addProblem(ctx, CHECK_SIZE_MISMATCH, start, length, expected, path);
+        }
+    }
+
+    return result;
+}
+
+static uint8_t checkEntry(const char *path, const t_direcroryEntry *entry, void *context)
+{
+    t_checkContext *ctx = (t_checkContext*)context;
+    uint8_t result = 1;
+
+    if((entry->attributes & ATTR_DIRECTORY) != 0)
+    {
+        __atomic_add_fetch(&ctx->report->directories, 1, __ATOMIC_RELAXED);
+        if(checkChain(ctx, entry->startCluster, path, 1, 0) == 0)
+        {
+            /* Its content belongs to another entry, or is not there at all */
+            result = WALK_SKIP;
+        }
+    }
+    else
+    {
+        __atomic_add_fetch(&ctx->report->files, 1, __ATOMIC_RELAXED);
+        checkChain(ctx, entry->startCluster, path, 0, entry->fileSize);
+    }
+
+    if(__atomic_load_n(&ctx->failed, __ATOMIC_RELAXED) != 0)
+    {
+        result = 0;
+    }
+
+    return result;
+}
+
+static void *sweepRange(void *arg)
+{
+    t_checkRange *range = (t_checkRange*)arg;
+    t_checkContext *ctx = range->context;
+    uint64_t lost = 0;
+    uint32_t word = 0;
+    uint32_t bit = 0;
+    uint32_t cluster = 0;
+    uint32_t value = 0;
+
+    for(word = range->firstWord; word < range->lastWord; word++)
+    {
+        lost = 0;
+        for(bit = 0; bit < 64; bit++)
+        {
+            cluster = word * 64 + bit;
+            if((cluster >= FIRST_CLUSTER) && (cluster < ctx->numClusters))
+            {
+                value = ctx->table[cluster];
+
+                /* Bad clusters are allocated on purpose and belong to no chain */
+                if((value != 0) && (value != ctx->badCluster) && ((ctx->claimed[word] & (1ULL << bit)) == 0))
+                {
+                    lost |= 1ULL << bit;
+                    if((value >= FIRST_CLUSTER) && (value < ctx->numClusters))
+                    {
+                        __atomic_fetch_or(&ctx->linked[value / 64], 1ULL << (value % 64), __ATOMIC_RELAXED);
+                    }
+                }
+            }
+        }
+
+        ctx->lost[word] = lost;
+        range->lostClusters += (uint32_t)__builtin_popcountll(lost);
+    }
+
+    return NULL;
+}
+
+static uint8_t sweepFAT(t_checkContext *ctx, uint32_t numThreads)
+{
+    t_checkRange *ranges = NULL;
+    pthread_t *threads = NULL;
+    uint8_t *started = NULL;
+    uint32_t perThread = 0;
+    uint32_t index = 0;
+    uint8_t result = 0;
+
+    if(numThreads > ctx->numWords)
+    {
+        numThreads = (ctx->numWords > 0) ? ctx->numWords : 1;
+    }
+
+    ranges = (t_checkRange*)calloc(numThreads, sizeof(t_checkRange));
+    threads = (pthread_t*)calloc(numThreads, sizeof(pthread_t));
+    started = (uint8_t*)calloc(numThreads, sizeof(uint8_t));
+
+    if((ranges == NULL) || (threads == NULL) || (started == NULL))
+    {
+        fprintf(stderr, "The disk is empty.\n");
+    }
+    else
+    {
+        perThread = (ctx->numWords + numThreads - 1) / numThreads;
+        for(index = 0; index < numThreads; index++)
+        {
+            ranges[index].context = ctx;
+            ranges[index].firstWord = (index * perThread < ctx->numWords) ? index * perThread : ctx->numWords;
+            ranges[index].lastWord = (ranges[index].firstWord + perThread < ctx->numWords) ?
+                                     ranges[index].firstWord + perThread : ctx->numWords;
+        }
+
+        /* The calling thread sweeps the first range; a range whose thread cannot be
+           started is swept afterwards */
+        for(index = 1; index < numThreads; index++)
+        {
+            started[index] = (pthread_create(&threads[index], NULL, sweepRange, &ranges[index]) == 0);
+        }
+        sweepRange(&ranges[0]);
+
+        for(index = 1; index < numThreads; index++)
+        {
+            if(started[index] == 1)
+            {
+                pthread_join(threads[index], NULL);
+            }
+            else
+            {
+                sweepRange(&ranges[index]);
+            }
+        }
+
+        for(index = 0; index < numThreads; index++)
+        {
+            ctx->report->lostClusters += ranges[index].lostClusters;
+        }
+        result = 1;
+    }
+
+    free(ranges);
+    free(threads);
+    free(started);
+
+    return result;
+}
+
+static void walkLostChain(t_checkContext *ctx, uint32_t head)
+{
+    uint32_t cluster = head;
+    uint32_t length = 0;
+
+    /* Clearing each cluster ends the walk at a loop or where it joins a chain already reported */
+    while((cluster != CHECK_END_OF_CHAIN) && ((ctx->lost[cluster / 64] & (1ULL << (cluster % 64))) != 0))
+    {
+        ctx->lost[cluster / 64] &= ~(1ULL << (cluster % 64));
+        length++;
+        cluster = nextLink(ctx, cluster);
+    }
+
+    addProblem(ctx, CHECK_LOST_CHAIN, head, length, 0, NULL);
+}
+
+static void reportLostChains(t_checkContext *ctx)
+{
+    uint64_t bits = 0;
+    uint32_t word = 0;
+
+    for(word = 0; word < ctx->numWords; word++)
+    {
+        bits = ctx->lost[word] & ~ctx->linked[word];
+        while(bits != 0)
+        {
+            walkLostChain(ctx, word * 64 + (uint32_t)__builtin_ctzll(bits));
+            bits &= bits - 1;
+        }
+    }
+
+    /* Only loops with no way in are left */
+    for(word = 0; word < ctx->numWords; word++)
+    {
+        while(ctx->lost[word] != 0)
+        {
+            walkLostChain(ctx, word * 64 + (uint32_t)__builtin_ctzll(ctx->lost[word]));
+        }
+    }
+}
+
+static uint32_t countBits(const uint64_t *words, uint32_t numWords)
+{
+    uint32_t count = 0;
+    uint32_t index = 0;
+
+    for(index = 0; index < numWords; index++)
+    {
+        count += (uint32_t)__builtin_popcountll(words[index]);
+    }
+
+    return count;
+}
+
+static int compareProblems(const void *a, const void *b)
+{
+    const t_checkProblem *first = (const t_checkProblem*)a;
+    const t_checkProblem *second = (const t_checkProblem*)b;
+    int result = 0;
+
+    if(first->kind != second->kind)
+    {
+        result = (first->kind < second->kind) ? -1 : 1;
+    }
+    else if((first->path != NULL) && (second->path != NULL) && ((result = strcmp(first->path, second->path)) != 0))
+    {
+        /* result is already set */
+    }
+    else if(first->cluster != second->cluster)
+    {
+        result = (first->cluster < second->cluster) ? -1 : 1;
+    }
+
+    return result;
+}
+
+uint8_t checkVolume(t_volume *vol, uint32_t numThreads, t_checkReport *report)
+{
+    t_checkContext ctx;
+    uint32_t dataClusters = 0;
+    long online = 0;
+    uint8_t result = 0;
+
+    memset(report, 0, sizeof(t_checkReport));
+    memset(&ctx, 0, sizeof(ctx));
+    pthread_mutex_init(&ctx.lock, NULL);
+    ctx.vol = vol;
+    ctx.report = report;
+    ctx.clusterBytes = vol->bootInfo.secPerClus * vol->bootInfo.bytsPerSec;
+
+    if(numThreads == CHECK_THREADS_AUTO)
+    {
+        online = sysconf(_SC_NPROCESSORS_ONLN);
+        numThreads = (online > 0) ? (uint32_t)online : 1;
+    }
+    if(numThreads > WALK_THREADS_MAX)
+    {
+        numThreads = WALK_THREADS_MAX;
+    }
+
+    switch(fatType(vol))
+    {
+    case FAT_12:
+        ctx.lastCluster = LAST_CRUSTER_12;
+        break;
+    case FAT_16:
+        ctx.lastCluster = LAST_CRUSTER_16;
+        break;
+    default:
+        ctx.lastCluster = LAST_CRUSTER_32;
+        break;
+    }
+    /* The value just below the end of chain marks a bad cluster */
+    ctx.badCluster = ctx.lastCluster - 1;
+
+    /* A FAT shorter than the data region leaves the last clusters out */
+    dataClusters = countDataClusters(vol);
+    ctx.numClusters = (dataClusters + FIRST_CLUSTER < vol->fatCache.numEntries) ?
+                      dataClusters + FIRST_CLUSTER : vol->fatCache.numEntries;
+    ctx.numWords = (ctx.numClusters + 63) / 64;
+    report->numClusters = ctx.numClusters;
+
+    ctx.claimed = (uint64_t*)calloc(ctx.numWords + 1, sizeof(uint64_t));
+    ctx.shared = (uint64_t*)calloc(ctx.numWords + 1, sizeof(uint64_t));
+    ctx.lost = (uint64_t*)calloc(ctx.numWords + 1, sizeof(uint64_t));
+    ctx.linked = (uint64_t*)calloc(ctx.numWords + 1, sizeof(uint64_t));
+
+    if((ctx.claimed == NULL) || (ctx.shared == NULL) || (ctx.lost == NULL) || (ctx.linked == NULL))
+    {
+        fprintf(stderr, "The disk is empty.\n");
+    }
+    else if((ctx.numClusters <= FIRST_CLUSTER) || (loadTable(&ctx) == 0))
+    {
+        fprintf(stderr, "Read FAT Region error.\n");
+    }
+    else
+    {
+        /* The FAT32 root directory is a chain of its own that no entry points to */
+        if(fatType(vol) == FAT_32)
+        {
+            report->directories++;
+            checkChain(&ctx, vol->bootInfo.rootClus, "/", 1, 0);
+        }
+
+        if((walkVolume(vol, numThreads, checkEntry, &ctx) == 1) && (ctx.failed == 0) &&
+           (sweepFAT(&ctx, numThreads) == 1))
+        {
+            reportLostChains(&ctx);
+            report->usedClusters = countBits(ctx.claimed, ctx.numWords);
+            report->crossLinkedClusters = countBits(ctx.shared, ctx.numWords);
+
+            /* The walkers report in any order */
+            qsort(report->problems, report->count, sizeof(t_checkProblem), compareProblems);
+            result = (ctx.failed == 0) ? 1 : 0;
+        }
+    }
+
+    free(ctx.ownTable);
+    free(ctx.claimed);
+    free(ctx.shared);
+    free(ctx.lost);
+    free(ctx.linked);
+    pthread_mutex_destroy(&ctx.lock);
+
+    return result;
+}
+
+void releaseCheckReport(t_checkReport *report)
+{
+    uint32_t index = 0;
+
+    for(index = 0; index < report->count; index++)
+    {
+        free(report->problems[index].path);
+    }
+    free(report->problems);
+    memset(report, 0, sizeof(t_checkReport));
+}
+
+const char *checkKindName(uint8_t kind)
+{
+    return (kind < CHECK_NUM_KINDS) ? s_kindNames[kind] : "unknown";
+}
+
+void defaultCheckOptions(t_checkOptions *options)
+{
+    memset(options, 0, sizeof(t_checkOptions));
+    defaultVolumeConfig(&options->volume);
+    options->numThreads = CHECK_THREADS_AUTO;
+    options->format = CHECK_FORMAT_TEXT;
+}
+
+uint32_t parseCheckOption(t_checkOptions *options, const char *name, const char *value)
+{
+    uint32_t used = 0;
+
+    if(name[0] != '-')
+    {
+        if(options->imagePath == NULL)
+        {
+            options->imagePath = name;
+            used = 1;
+        }
+    }
+    else if(value == NULL)
+    {
+        used = 0;
+    }
+    else if(strcmp(name, "--threads") == 0)
+    {
+        options->numThreads = (uint32_t)strtoul(value, NULL, 0);
+        used = 2;
+    }
+    else if(strcmp(name, "--fat-cache") == 0)
+    {
+        options->volume.fatCacheLimit = (uint32_t)strtoul(value, NULL, 0);
+        used = 2;
+    }
+    else if((strcmp(name, "--format") == 0) && (strcmp(value, "text") == 0))
+    {
+        options->format = CHECK_FORMAT_TEXT;
+        used = 2;
+    }
+    else if((strcmp(name, "--format") == 0) && (strcmp(value, "json") == 0))
+    {
+        options->format = CHECK_FORMAT_JSON;
+        used = 2;
+    }
+
+    return used;
+}
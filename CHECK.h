@@ -0,0 +1,158 @@
+#ifndef _CHECK_H_
+#define _CHECK_H_
+
+/*******************************************************************************
+* Include
+*******************************************************************************/
+#include <unistd.h>
+#include "WALK.h"
+#include "SPACE.h"
+
+/*******************************************************************************
+* Define
+*******************************************************************************/
+#define CHECK_THREADS_AUTO      0U       /* One worker per online CPU */
+#define CHECK_MAX_PROBLEMS      1024U    /* Problems kept with their details, the others are only counted */
+#define CHECK_PROBLEMS_INIT_SIZE 16U     /* Initial capacity of the problem list */
+#define CHECK_END_OF_CHAIN      0U       /* Next cluster of a cluster whose entry does not link to a data cluster */
+
+/* Kinds of problems */
+#define CHECK_CROSS_LINK        0U       /* A chain reaches a cluster another chain reached first */
+#define CHECK_LOOP              1U       /* A chain comes back to one of its own clusters */
+#define CHECK_FREE_CLUSTER      2U       /* A chain reaches a cluster whose entry is free */
+#define CHECK_OUT_OF_RANGE      3U       /* A start cluster or a FAT entry points outside the data clusters */
+#define CHECK_BAD_CLUSTER       4U       /* A chain reaches a cluster marked bad */
+#define CHECK_SIZE_MISMATCH     5U       /* The chain of a file does not have the clusters its size needs */
+#define CHECK_LOST_CHAIN        6U       /* Allocated clusters that no entry reaches, one problem per chain */
+#define CHECK_NUM_KINDS         7U
+
+/* Output formats of the tools that check an image */
+#define CHECK_FORMAT_TEXT       0U       /* Lines of text */
+#define CHECK_FORMAT_JSON       1U       /* One JSON object */
+
+typedef struct
+{
+    uint8_t     kind;                    /* CHECK_* */
+    uint32_t    cluster;                 /* Where the problem was found: the shared, repeated, free, bad or
+                                            first cluster; for out of range, the cluster holding the link,
+                                            0 when the link is the start cluster of the entry */
+    uint32_t    value;                   /* Out of range: the link; loop and size mismatch: the clusters of the
+                                            chain; lost chain: its clusters; otherwise 0 */
+    uint32_t    expected;                /* Size mismatch: the clusters the size needs; otherwise 0 */
+    char        *path;                   /* The entry whose chain has the problem, NULL for a lost chain */
+} t_checkProblem;
+
+typedef struct
+{
+    t_checkProblem *problems;            /* The first CHECK_MAX_PROBLEMS problems, sorted by kind and path */
+    uint32_t    count;                   /* Number of problems in the list */
+    uint32_t    capacity;                /* Number of problems the list can hold */
+    uint64_t    counts[CHECK_NUM_KINDS]; /* Problems found of each kind, listed or not */
+    uint32_t    files;                   /* Files checked */
+    uint32_t    directories;             /* Directories checked, the FAT32 root included */
+    uint32_t    numClusters;             /* Entries checked: the data clusters plus the two reserved entries */
+    uint32_t    usedClusters;            /* Clusters reached by a chain */
+    uint32_t    crossLinkedClusters;     /* Clusters reached by more than one chain */
+    uint32_t    lostClusters;            /* Allocated clusters that no chain reaches */
+} t_checkReport;
+
+typedef struct
+{
+    t_volume    *vol;                    /* The volume being checked */
+    const uint32_t *table;               /* Next-cluster value of every entry */
+    uint32_t    *ownTable;               /* The table when the FAT cache is not resident, NULL otherwise */
+    uint32_t    numClusters;             /* Entries checked, valid links are 2 to numClusters - 1 */
+    uint32_t    lastCluster;             /* Smallest end of chain value */
+    uint32_t    badCluster;              /* Bad cluster mark */
+    uint32_t    clusterBytes;            /* Bytes in a cluster */
+    uint32_t    numWords;                /* Words in each bitmap */
+    uint64_t    *claimed;                /* Bit set once a chain reached the cluster */
+    uint64_t    *shared;                 /* Bit set when a second chain reached the cluster */
+    uint64_t    *lost;                   /* Bit set for an allocated cluster no chain reached */
+    uint64_t    *linked;                 /* Bit set for a lost cluster that another lost cluster links to */
+    t_checkReport *report;               /* Receives the problems */
+    uint8_t     failed;                  /* Set when memory ran out */
+    pthread_mutex_t lock;                /* Protects the report */
+} t_checkContext;
+
+typedef struct
+{
+    t_checkContext *context;             /* The check */
+    uint32_t    firstWord;               /* First bitmap word of the range */
+    uint32_t    lastWord;                /* One past the last bitmap word of the range */
+    uint32_t    lostClusters;            /* Lost clusters found in the range */
+} t_checkRange;
+
+typedef struct
+{
+    const char      *imagePath;          /* The image */
+    t_volumeConfig  volume;              /* Mount options */
+    uint32_t        numThreads;          /* Workers of the check, CHECK_THREADS_AUTO for one per CPU */
+    uint8_t         format;              /* CHECK_FORMAT_TEXT or CHECK_FORMAT_JSON */
+} t_checkOptions;
+
+/*******************************************************************************
+* API
+*******************************************************************************/
+
+/**
+ * Name: checkVolume
+ * @brief Check the FAT of a volume without writing to it. The chain of every file and
+ *        directory is walked by a pool of walker threads and its clusters are marked in a
+ *        shared atomic bitmap, which finds cross-linked clusters, chains that reach free, bad
+ *        or out of range clusters, and files whose chain does not match their size. Chains
+ *        are only checked for loops when they reach a marked cluster. The FAT is then swept
+ *        in parallel for allocated clusters that no chain reached. The checker never follows
+ *        a link that leaves the data clusters and never walks more clusters than there are,
+ *        so it is safe on any image.
+ *
+ * @param vol: The volume.
+ * @param numThreads: The number of workers, CHECK_THREADS_AUTO for one per CPU.
+ * @param report: Receives the problems and the counts, to be released with releaseCheckReport().
+ *
+ * @return 1 if the whole volume was checked, 0 if a read failed or memory ran out.
+ */
+uint8_t checkVolume(t_volume *vol, uint32_t numThreads, t_checkReport *report);
+
+/**
+ * Name: releaseCheckReport
+ * @brief Free the problems of a report and leave it empty.
+ *
+ * @param report: The report.
+ */
+void releaseCheckReport(t_checkReport *report);
+
+/**
+ * Name: checkKindName
+ * @brief Get the name of a kind of problem.
+ *
+ * @param kind: One of CHECK_*.
+ *
+ * @return The name, e.g. "crossLink", or "unknown".
+ */
+const char *checkKindName(uint8_t kind);
+
+/**
+ * Name: defaultCheckOptions
+ * @brief Fill the command line options shared by fsck and defrag with their defaults: no
+ *        image, the default read-only mount, one worker per CPU and text output.
+ *
+ * @param options: Receives the options.
+ */
+void defaultCheckOptions(t_checkOptions *options);
+
+/**
+ * Name: parseCheckOption
+ * @brief Read one of the command line options shared by fsck and defrag: the image path,
+ *        --threads N, --fat-cache BYTES or --format text|json.
+ *
+ * @param options: The options to change.
+ * @param name: The current argument.
+ * @param value: The argument after it, NULL if it is the last one.
+ *
+ * @return The number of arguments used, 1 or 2; 0 if the argument is unknown, has no value
+ *         or names a second image.
+ */
+uint32_t parseCheckOption(t_checkOptions *options, const char *name, const char *value);
+
+#endif /* _CHECK_H_ */
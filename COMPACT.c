@@ -0,0 +1,684 @@
+/*******************************************************************************
+* Include
+*******************************************************************************/
+#include "COMPACT.h"
+
+/*******************************************************************************
+* Prototypes
+*******************************************************************************/
+
+/**
+ * Name: appendChain
+ * @brief Append a chain to a list, growing it when full.
+ *
+ * @param list The list.
+ * @param chain The chain.
+ *
+ * @return 1 if the chain was added, 0 if memory ran out.
+ */
+static uint8_t appendChain(t_compactList *list, const t_compactChain *chain);
+
+/**
+ * Name: collectSlot
+ * @brief Slot callback of collectChains: append the chain of every file and directory entry.
+ *
+ * @param slot The raw slot.
+ * @param position The position of the slot.
+ * @param context The t_compactContext of the walk.
+ *
+ * @return 0 at the end of the directory or when memory ran out, 1 otherwise.
+ */
+static uint8_t collectSlot(const uint8_t *slot, const t_slotPosition *position, void *context);
+
+/**
+ * Name: collectChains
+ * @brief List the chain of every entry of the volume and where its entry is, one directory
+ *        after the other, each directory before its entries.
+ *
+ * @param vol The volume.
+ * @param list Receives the chains.
+ *
+ * @return 1 if every directory was read, 0 if a read failed or memory ran out.
+ */
+static uint8_t collectChains(t_volume *vol, t_compactList *list);
+
+/**
+ * Name: countChainExtents
+ * @brief Add up the extents of every chain of a list.
+ *
+ * @param vol The volume.
+ * @param list The chains.
+ * @param fragmented Receives the number of chains with more than one extent.
+ *
+ * @return The number of extents.
+ */
+static uint64_t countChainExtents(t_volume *vol, const t_compactList *list, uint32_t *fragmented);
+
+/**
+ * Name: copyChain
+ * @brief Copy the clusters of a chain, in order, into a run starting at a cluster. Each
+ *        extent is read and written COMPACT_COPY_BYTES at a time.
+ *
+ * @param vol The volume.
+ * @param extents The extents of the chain.
+ * @param numExtents The number of extents.
+ * @param newCluster The first cluster of the run.
+ * @param category The HAL_TRACE_* category of the copy.
+ * @param buff A buffer of COMPACT_COPY_BYTES.
+ *
+ * @return 1 if every cluster was copied, 0 if a read or a write failed.
+ */
+static uint8_t copyChain(t_volume *vol, const t_extent *extents, uint32_t numExtents, uint32_t newCluster,
+                         uint8_t category, uint8_t *buff);
+
+/**
+ * Name: setSlotCluster
+ * @brief Change the start cluster of the entry in a slot, in the write cache.
+ *
+ * @param vol The volume.
+ * @param slot The position of the slot.
+ * @param cluster The new start cluster.
+ * @param name The packed name the slot must hold, NULL for any; a slot holding another name is left alone.
+ *
+ * @return 1 if the slot was changed or holds another name, 0 if the sector could not be read.
+ */
+static uint8_t setSlotCluster(t_volume *vol, const t_slotPosition *slot, uint32_t cluster, const char *name);
+
+/**
+ * Name: remapSlot
+ * @brief Move the position of a slot of a directory to the same place in the copy of its chain.
+ *
+ * @param vol The volume.
+ * @param extents The extents of the old chain.
+ * @param numExtents The number of extents.
+ * @param newCluster The first cluster of the copy.
+ * @param slot The position, changed in place.
+ */
+static void remapSlot(t_volume *vol, const t_extent *extents, uint32_t numExtents, uint32_t newCluster,
+                      t_slotPosition *slot);
+
+/**
+ * Name: moveFiles
+ * @brief Move the fragmented file chains of a list, COMPACT_BATCH_SIZE at a time, in the
+ *        three flushed steps of compactVolume().
+ *
+ * @param vol The volume.
+ * @param list The chains, their start clusters are updated.
+ * @param report Receives the moved and skipped counts.
+ * @param buff A buffer of COMPACT_COPY_BYTES.
+ *
+ * @return 1 if every step was written, 0 otherwise.
+ */
+static uint8_t moveFiles(t_volume *vol, t_compactList *list, t_compactReport *report, uint8_t *buff);
+
+/**
+ * Name: moveDirectory
+ * @brief Move the chain of one directory if it is fragmented. With the entry of the directory,
+ *        its "." entry and the ".." entry of each of its subdirectories are switched, and the
+ *        slots of its entries in the list follow the copy.
+ *
+ * @param vol The volume.
+ * @param list The chains, updated.
+ * @param index The index of the directory in the list.
+ * @param report Receives the moved and skipped counts.
+ * @param buff A buffer of COMPACT_COPY_BYTES.
+ *
+ * @return 1 if every step was written, 0 otherwise.
+ */
+static uint8_t moveDirectory(t_volume *vol, t_compactList *list, uint32_t index, t_compactReport *report, uint8_t *buff);
+
+/**
+ * Name: reportFragmentation
+ * @brief Count the chains of a volume and their extents without changing anything.
+ *        extentsAfter is set to extentsBefore.
+ *
+ * @param vol: The volume.
+ * @param report: Receives the counts.
+ *
+ * @return 1 if every directory was read, 0 if a read failed or memory ran out.
+ */
+uint8_t reportFragmentation(t_volume *vol, t_compactReport *report);
+
+/**
+ * Name: compactVolume
+ * @brief Move every fragmented file chain, and with compactDirs every fragmented directory
+ *        chain, into one free run. The clusters are copied with large sequential requests
+ *        and each step is flushed before the next one starts:
+ *        1. the new chains are written and linked in the FAT, which no entry uses yet;
+ *        2. the directory entries are switched to the new chains;
+ *        3. the old chains are freed.
+ *        The old chain stays valid until its entry is switched, so a crash leaves at worst
+ *        clusters that are allocated but lost. File chains are moved in batches of
+ *        COMPACT_BATCH_SIZE, directories one at a time since "." and the ".." of each
+ *        subdirectory change with them. The FAT32 root directory is never moved. The volume
+ *        must be mounted writable, be free of problems (checkVolume()) and not be used by
+ *        anything else while it is compacted.
+ *
+ * @param vol: The volume, mounted writable.
+ * @param compactDirs: 1 to move directories too.
+ * @param report: Receives the counts, extents before and after included.
+ *
+ * @return 1 if the volume was compacted, even with chains skipped, 0 if a read, a write or a
+ *         flush failed or memory ran out.
+ */
+uint8_t compactVolume(t_volume *vol, uint8_t compactDirs, t_compactReport *report);
+
+/*******************************************************************************
+* Code
+*******************************************************************************/
+
+static uint8_t appendChain(t_compactList *list, const t_compactChain *chain)
+{
+    t_compactChain *grown = NULL;
+    uint32_t capacity = 0;
+    uint8_t result = 1;
+
+    if(list->count == list->capacity)
+    {
+        capacity = (list->capacity == 0) ? COMPACT_INIT_SIZE : (list->capacity * 2);
+        grown = (t_compactChain*)realloc(list->chains, capacity * sizeof(t_compactChain));
+        if(grown == NULL)
+        {
+            fprintf(stderr, "The disk is empty.\n");
+            result = 0;
+        }
+        else
+        {
+            list->chains = grown;
+            list->capacity = capacity;
+        }
+    }
+
+    if(result == 1)
+    {
+        list->chains[list->count] = *chain;
+        list->count++;
+    }
+
+    return result;
+}
+
+static uint8_t collectSlot(const uint8_t *slot, const t_slotPosition *position, void *context)
+{
+    t_compactContext *collect = (t_compactContext*)context;
+    t_direcroryEntry entry;
+    t_compactChain chain;
+    uint8_t attributes = 0;
+    uint8_t result = 1;
+
+    attributes = slot[0x0B];
+
+    if(slot[0] == INVALID_FILE_NAME)
+    {
+        /* Nothing follows the first never used slot */
+        result = 0;
+    }
+    else if((slot[0] == DELETED_FILE_NAME) || (slot[0] == '.') || (attributes == ATTR_LONG_FILE_NAME) ||
+            ((attributes & ATTR_VOLUME_ID) != 0))
+    {
+        /* No chain of its own */
+    }
+    else
+    {
+        parseDirEntry(collect->vol, slot, &entry);
+
+        /* Empty files have no chain */
+        if((entry.startCluster >= FIRST_CLUSTER) && (entry.startCluster - FIRST_CLUSTER < collect->dataClusters))
+        {
+            memset(&chain, 0, sizeof(chain));
+            chain.startCluster = entry.startCluster;
+            chain.dirCluster = collect->dirCluster;
+            chain.slot = *position;
+            chain.depth = collect->depth;
+            chain.isDirectory = ((attributes & ATTR_DIRECTORY) != 0);
+
+            if(appendChain(collect->list, &chain) == 0)
+            {
+                collect->failed = 1;
+                result = 0;
+            }
+        }
+    }
+
+    return result;
+}
+
+static uint8_t collectChains(t_volume *vol, t_compactList *list)
+{
+    t_compactContext collect;
+    t_compactChain root;
+    uint32_t index = 0;
+    uint8_t result = 1;
+
+    memset(&collect, 0, sizeof(collect));
+    collect.vol = vol;
+    collect.list = list;
+    collect.dataClusters = countDataClusters(vol);
+    collect.depth = 1;
+
+    /* The FAT32 root directory has a chain but no entry, the FAT12/16 one has neither */
+    if(fatType(vol) == FAT_32)
+    {
+        memset(&root, 0, sizeof(root));
+        root.startCluster = vol->bootInfo.rootClus;
+        root.isDirectory = 1;
+        result = appendChain(list, &root);
+    }
+    else
+    {
+        result = scanSlots(vol, 0, collectSlot, &collect, NULL);
+    }
+
+    /* Directories are appended behind the ones being read, so one pass reads them all */
+    for(index = 0; (result == 1) && (collect.failed == 0) && (index < list->count); index++)
+    {
+        if((list->chains[index].isDirectory == 1) && (list->chains[index].depth < COMPACT_MAX_DEPTH))
+        {
+            collect.dirCluster = list->chains[index].startCluster;
+            collect.depth = list->chains[index].depth + 1;
+            result = scanSlots(vol, collect.dirCluster, collectSlot, &collect, NULL);
+        }
+    }
+
+    return ((result == 1) && (collect.failed == 0)) ? 1 : 0;
+}
+
+static uint64_t countChainExtents(t_volume *vol, const t_compactList *list, uint32_t *fragmented)
+{
+    uint64_t total = 0;
+    uint32_t index = 0;
+    uint32_t count = 0;
+
+    *fragmented = 0;
+
+    for(index = 0; index < list->count; index++)
+    {
+        count = countExtents(vol, list->chains[index].startCluster);
+        total += count;
+        if(count > 1)
+        {
+            (*fragmented)++;
+        }
+    }
+
+    return total;
+}
+
+static uint8_t copyChain(t_volume *vol, const t_extent *extents, uint32_t numExtents, uint32_t newCluster,
+                         uint8_t category, uint8_t *buff)
+{
+    uint32_t bytsPerSec = vol->bootInfo.bytsPerSec;
+    uint32_t secPerClus = vol->bootInfo.secPerClus;
+    uint32_t source = 0;
+    uint32_t target = 0;
+    uint32_t remain = 0;
+    uint32_t num = 0;
+    uint32_t index = 0;
+    uint8_t saved = 0;
+    uint8_t result = 1;
+
+    saved = HAL_TraceCategory(category);
+    target = ((newCluster - FIRST_CLUSTER) * secPerClus) + vol->local.dataStartSector;
+
+    for(index = 0; (result == 1) && (index < numExtents); index++)
+    {
+        source = ((extents[index].firstCluster - FIRST_CLUSTER) * secPerClus) + vol->local.dataStartSector;
+        remain = extents[index].length * secPerClus;
+
+        while((result == 1) && (remain > 0))
+        {
+            num = (remain < COMPACT_COPY_BYTES / bytsPerSec) ? remain : (COMPACT_COPY_BYTES / bytsPerSec);
+
+            if((HAL_ReadMultiSector(vol->device, source, num, buff) != num * bytsPerSec) ||
+               (HAL_WriteMultiSector(vol->device, target, num, buff) != num * bytsPerSec))
+            {
+                fprintf(stderr, "Cannot copy cluster %u.\n", extents[index].firstCluster);
+                result = 0;
+            }
+
+            source += num;
+            target += num;
+            remain -= num;
+        }
+    }
+
+    HAL_TraceCategory(saved);
+
+    return result;
+}
+
+static uint8_t setSlotCluster(t_volume *vol, const t_slotPosition *slot, uint32_t cluster, const char *name)
+{
+    t_direcroryEntry entry;
+    uint8_t *buff = NULL;
+    uint8_t result = 0;
+
+    buff = getDirtySector(vol, slot->sector, 1);
+
+    if(buff != NULL)
+    {
+        if((name == NULL) || (memcmp(buff + slot->offset, name, SIZE_OF_NAME) == 0))
+        {
+            parseDirEntry(vol, buff + slot->offset, &entry);
+            entry.startCluster = cluster;
+            storeDirEntry(vol, &entry, buff + slot->offset);
+        }
+        result = 1;
+    }
+
+    return result;
+}
+
+static void remapSlot(t_volume *vol, const t_extent *extents, uint32_t numExtents, uint32_t newCluster,
+                      t_slotPosition *slot)
+{
+    uint32_t secPerClus = vol->bootInfo.secPerClus;
+    uint32_t cluster = 0;
+    uint32_t within = 0;
+    uint32_t position = 0;
+    uint32_t index = 0;
+
+    cluster = ((slot->sector - vol->local.dataStartSector) / secPerClus) + FIRST_CLUSTER;
+    within = (slot->sector - vol->local.dataStartSector) % secPerClus;
+
+    for(index = 0; index < numExtents; index++)
+    {
+        if((cluster >= extents[index].firstCluster) && (cluster - extents[index].firstCluster < extents[index].length))
+        {
+            /* The same cluster of the chain, now in the run */
+            cluster = newCluster + position + (cluster - extents[index].firstCluster);
+            slot->sector = ((cluster - FIRST_CLUSTER) * secPerClus) + vol->local.dataStartSector + within;
+            break;
+        }
+        position += extents[index].length;
+    }
+}
+
+static uint8_t moveFiles(t_volume *vol, t_compactList *list, t_compactReport *report, uint8_t *buff)
+{
+    t_compactChain *chain = NULL;
+    t_extent *extents = NULL;
+    uint32_t batch[COMPACT_BATCH_SIZE];
+    uint32_t cursor = 0;
+    uint32_t count = 0;
+    uint32_t index = 0;
+    uint32_t numExtents = 0;
+    uint32_t numClusters = 0;
+    uint8_t result = 1;
+
+    while((result == 1) && (cursor < list->count))
+    {
+        /* 1. Copy a batch of chains into free runs and link the runs */
+        count = 0;
+        for(; (result == 1) && (cursor < list->count) && (count < COMPACT_BATCH_SIZE); cursor++)
+        {
+            chain = &list->chains[cursor];
+            if(chain->isDirectory == 0)
+            {
+                numExtents = buildExtentList(vol, chain->startCluster, &extents);
+                numClusters = 0;
+                for(index = 0; index < numExtents; index++)
+                {
+                    numClusters += extents[index].length;
+                }
+
+                if(numExtents == 0)
+                {
+                    /* Memory ran out; a part of the chain must never replace the whole */
+                    result = 0;
+                }
+                else if(numExtents == 1)
+                {
+                    /* Already contiguous */
+                }
+                else if((chain->newCluster = allocateRun(vol, numClusters)) == 0)
+                {
+                    report->skipped++;
+                }
+                else if(copyChain(vol, extents, numExtents, chain->newCluster, HAL_TRACE_DATA, buff) == 0)
+                {
+                    freeChain(vol, chain->newCluster);
+                    chain->newCluster = 0;
+                    result = 0;
+                }
+                else
+                {
+                    batch[count] = cursor;
+                    count++;
+                    report->clustersMoved += numClusters;
+                }
+
+                free(extents);
+                extents = NULL;
+            }
+        }
+
+        /* A batch that stopped early gives its copies back, no entry points to them yet */
+        for(index = 0; (result == 0) && (index < count); index++)
+        {
+            chain = &list->chains[batch[index]];
+            freeChain(vol, chain->newCluster);
+            chain->newCluster = 0;
+        }
+
+        if((count > 0) && (result == 1))
+        {
+            result = fatFlush(vol);
+
+            /* 2. Switch the entries to the copies */
+            for(index = 0; (result == 1) && (index < count); index++)
+            {
+                chain = &list->chains[batch[index]];
+                result = setSlotCluster(vol, &chain->slot, chain->newCluster, NULL);
+                invalidateDirCache(vol, chain->dirCluster);
+            }
+            if(result == 1)
+            {
+                result = fatFlush(vol);
+            }
+
+            /* 3. Free the old chains */
+            for(index = 0; (result == 1) && (index < count); index++)
+            {
+                chain = &list->chains[batch[index]];
+                freeChain(vol, chain->startCluster);
+                chain->startCluster = chain->newCluster;
+                chain->newCluster = 0;
+                report->moved++;
+            }
+            if(result == 1)
+            {
+                result = fatFlush(vol);
+            }
+        }
+    }
+
+    return result;
+}
+
+static uint8_t moveDirectory(t_volume *vol, t_compactList *list, uint32_t index, t_compactReport *report, uint8_t *buff)
+{
+    t_compactChain *chain = &list->chains[index];
+    t_compactChain *other = NULL;
+    t_extent *extents = NULL;
+    t_slotPosition dots;
+    uint32_t oldCluster = chain->startCluster;
+    uint32_t newCluster = 0;
+    uint32_t numExtents = 0;
+    uint32_t numClusters = 0;
+    uint32_t extent = 0;
+    uint32_t entry = 0;
+    uint8_t result = 1;
+
+    numExtents = buildExtentList(vol, oldCluster, &extents);
+    for(extent = 0; extent < numExtents; extent++)
+    {
+        numClusters += extents[extent].length;
+    }
+
+    if(numExtents == 0)
+    {
+        /* Memory ran out; a part of the chain must never replace the whole */
+        result = 0;
+    }
+    else if(numExtents == 1)
+    {
+        /* Already contiguous */
+    }
+    else if((newCluster = allocateRun(vol, numClusters)) == 0)
+    {
+        report->skipped++;
+    }
+    else if(copyChain(vol, extents, numExtents, newCluster, HAL_TRACE_DIR, buff) == 0)
+    {
+        freeChain(vol, newCluster);
+        result = 0;
+    }
+    else
+    {
+        report->clustersMoved += numClusters;
+
+        /* 1. The copy points to itself */
+        dots.sector = ((newCluster - FIRST_CLUSTER) * vol->bootInfo.secPerClus) + vol->local.dataStartSector;
+        dots.offset = 0;
+        result = setSlotCluster(vol, &dots, newCluster, COMPACT_DOT_NAME);
+        if(result == 1)
+        {
+            result = fatFlush(vol);
+        }
+
+        /* 2. The entry and the ".." of every subdirectory point to the copy */
+        if(result == 1)
+        {
+            result = setSlotCluster(vol, &chain->slot, newCluster, NULL);
+        }
+        for(entry = 0; (result == 1) && (entry < list->count); entry++)
+        {
+            other = &list->chains[entry];
+            if((entry != index) && (other->dirCluster == oldCluster))
+            {
+                remapSlot(vol, extents, numExtents, newCluster, &other->slot);
+                other->dirCluster = newCluster;
+
+                if(other->isDirectory == 1)
+                {
+                    dots.sector = ((other->startCluster - FIRST_CLUSTER) * vol->bootInfo.secPerClus) + vol->local.dataStartSector;
+                    dots.offset = SIZE_ROOT_ENTRY;
+                    result = setSlotCluster(vol, &dots, newCluster, COMPACT_DOTDOT_NAME);
+                }
+            }
+        }
+        invalidateDirCache(vol, chain->dirCluster);
+        invalidateDirCache(vol, oldCluster);
+        if(result == 1)
+        {
+            result = fatFlush(vol);
+        }
+
+        /* 3. Free the old chain */
+        if(result == 1)
+        {
+            freeChain(vol, oldCluster);
+            chain->startCluster = newCluster;
+            report->moved++;
+            result = fatFlush(vol);
+        }
+    }
+
+    free(extents);
+
+    return result;
+}
+
+uint8_t reportFragmentation(t_volume *vol, t_compactReport *report)
+{
+    t_compactList list;
+    uint32_t index = 0;
+    uint8_t result = 0;
+
+    memset(report, 0, sizeof(t_compactReport));
+    memset(&list, 0, sizeof(list));
+
+    result = collectChains(vol, &list);
+
+    for(index = 0; index < list.count; index++)
+    {
+        if(list.chains[index].isDirectory == 1)
+        {
+            report->directories++;
+        }
+        else
+        {
+            report->files++;
+        }
+    }
+    report->extentsBefore = countChainExtents(vol, &list, &report->fragmented);
+    report->extentsAfter = report->extentsBefore;
+
+    free(list.chains);
+
+    return result;
+}
+
+uint8_t compactVolume(t_volume *vol, uint8_t compactDirs, t_compactReport *report)
+{
+    t_compactList list;
+    uint8_t *buff = NULL;
+    uint32_t index = 0;
+    uint32_t fragmented = 0;
+    uint8_t result = 0;
+
+    memset(report, 0, sizeof(t_compactReport));
+    memset(&list, 0, sizeof(list));
+
+    if(vol->device->writable == 0)
+    {
+        fprintf(stderr, "The image is read-only.\n");
+    }
+    /* The copies read the disk, so it must hold every pending change */
+    else if(fatFlush(vol) == 0)
+    {
+        /* Nothing can be moved safely */
+    }
+    else if(collectChains(vol, &list) == 0)
+    {
+        fprintf(stderr, "Cannot read the directories.\n");
+    }
+    else if((buff = (uint8_t*)malloc(COMPACT_COPY_BYTES)) == NULL)
+    {
+        fprintf(stderr, "The disk is empty.\n");
+    }
+    else
+    {
+        for(index = 0; index < list.count; index++)
+        {
+            if(list.chains[index].isDirectory == 1)
+            {
+                report->directories++;
+            }
+            else
+            {
+                report->files++;
+            }
+        }
+        report->extentsBefore = countChainExtents(vol, &list, &report->fragmented);
+
+        result = moveFiles(vol, &list, report, buff);
+
+        /* Parents come first, so the slots of a directory follow the moves of the ones above it */
+        for(index = 0; (compactDirs == 1) && (result == 1) && (index < list.count); index++)
+        {
+            if((list.chains[index].isDirectory == 1) && (list.chains[index].slot.sector != 0))
+            {
+                result = moveDirectory(vol, &list, index, report, buff);
+            }
+        }
+
+        report->extentsAfter = countChainExtents(vol, &list, &fragmented);
+    }
+
+    free(buff);
+    free(list.chains);
+
+    return result;
+}
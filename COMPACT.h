@@ -0,0 +1,98 @@
+#ifndef _COMPACT_H_
+#define _COMPACT_H_
+
+/*******************************************************************************
+* Include
+*******************************************************************************/
+#include "WRITE.h"
+
+/*******************************************************************************
+* Define
+*******************************************************************************/
+#define COMPACT_COPY_BYTES      (4U * 1024U * 1024U)  /* Bytes read and written per request when a chain is copied */
+#define COMPACT_BATCH_SIZE      256U     /* File chains moved between two flushes */
+#define COMPACT_INIT_SIZE       256U     /* Initial capacity of the chain list */
+#define COMPACT_MAX_DEPTH       256U     /* Directories below this depth are not read */
+#define COMPACT_DOT_NAME        ".          "  /* Packed name of the entry of a directory for itself */
+#define COMPACT_DOTDOT_NAME     "..         "  /* Packed name of the entry of a directory for its parent */
+
+typedef struct
+{
+    uint32_t    startCluster;            /* First cluster of the chain */
+    uint32_t    newCluster;              /* First cluster of the copy while the chain is moved, 0 otherwise */
+    uint32_t    dirCluster;              /* Start cluster of the directory holding the entry, 0 for the FAT12/16 root */
+    t_slotPosition slot;                 /* Slot of the entry, sector 0 for the FAT32 root directory */
+    uint32_t    depth;                   /* Directories above the entry */
+    uint8_t     isDirectory;             /* 1 for a directory */
+} t_compactChain;
+
+typedef struct
+{
+    t_compactChain *chains;              /* Every chain of the volume, each directory before its entries */
+    uint32_t    count;                   /* Number of chains */
+    uint32_t    capacity;                /* Number of chains the array can hold */
+} t_compactList;
+
+typedef struct
+{
+    t_volume    *vol;                    /* The volume read */
+    t_compactList *list;                 /* Receives the chains */
+    uint32_t    dirCluster;              /* Start cluster of the directory being read */
+    uint32_t    depth;                   /* Depth of its entries */
+    uint32_t    dataClusters;            /* Data clusters of the volume, start clusters past them are ignored */
+    uint8_t     failed;                  /* Set when memory ran out */
+} t_compactContext;
+
+typedef struct
+{
+    uint32_t    files;                   /* File chains found */
+    uint32_t    directories;             /* Directory chains found, the FAT32 root included */
+    uint32_t    fragmented;              /* Chains with more than one extent before the run */
+    uint32_t    moved;                   /* Chains moved into one extent */
+    uint32_t    skipped;                 /* Fragmented chains that no free run was long enough for */
+    uint64_t    clustersMoved;           /* Clusters copied */
+    uint64_t    extentsBefore;           /* Extents of every chain before the run */
+    uint64_t    extentsAfter;            /* Extents of every chain after the run */
+} t_compactReport;
+
+/*******************************************************************************
+* API
+*******************************************************************************/
+
+/**
+ * Name: reportFragmentation
+ * @brief Count the chains of a volume and their extents without changing anything.
+ *        extentsAfter is set to extentsBefore.
+ *
+ * @param vol: The volume.
+ * @param report: Receives the counts.
+ *
+ * @return 1 if every directory was read, 0 if a read failed or memory ran out.
+ */
+uint8_t reportFragmentation(t_volume *vol, t_compactReport *report);
+
+/**
+ * Name: compactVolume
+ * @brief Move every fragmented file chain, and with compactDirs every fragmented directory
+ *        chain, into one free run. The clusters are copied with large sequential requests
+ *        and each step is flushed before the next one starts:
+ *        1. the new chains are written and linked in the FAT, which no entry uses yet;
+ *        2. the directory entries are switched to the new chains;
+ *        3. the old chains are freed.
+ *        The old chain stays valid until its entry is switched, so a crash leaves at worst
+ *        clusters that are allocated but lost. File chains are moved in batches of
+ *        COMPACT_BATCH_SIZE, directories one at a time since "." and the ".." of each
+ *        subdirectory change with them. The FAT32 root directory is never moved. The volume
+ *        must be mounted writable, be free of problems (checkVolume()) and not be used by
+ *        anything else while it is compacted.
+ *
+ * @param vol: The volume, mounted writable.
+ * @param compactDirs: 1 to move directories too.
+ * @param report: Receives the counts, extents before and after included.
+ *
+ * @return 1 if the volume was compacted, even with chains skipped, 0 if a read, a write or a
+ *         flush failed or memory ran out.
+ */
+uint8_t compactVolume(t_volume *vol, uint8_t compactDirs, t_compactReport *report);
+
+#endif /* _COMPACT_H_ */
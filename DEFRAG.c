@@ -0,0 +1,221 @@
+#include "COMPACT.h"
+#include "CHECK.h"
+
+/*******************************************************************************
+* Define
+*******************************************************************************/
+#define DEFRAG_EXIT_DONE        0        /* The image was compacted or reported */
+#define DEFRAG_EXIT_PROBLEMS    1        /* The image has problems and was left alone */
+#define DEFRAG_EXIT_FAILED      2        /* The image could not be compacted */
+
+typedef struct
+{
+    t_checkOptions  common;              /* The image, mount options, workers of the check and format */
+    uint8_t         reportOnly;          /* 1 to count the extents without changing the image */
+    uint8_t         compactDirs;         /* 1 to move directories too */
+} t_defragOptions;
+
+/*******************************************************************************
+* Prototypes
+*******************************************************************************/
+
+/**
+ * Name: parseOptions
+ * @brief Read the command line.
+ *
+ * @param argc The number of arguments.
+ * @param argv The arguments.
+ * @param options Receives the options.
+ *
+ * @return 1 if the command line is valid, 0 otherwise.
+ */
+uint8_t parseOptions(int argc, char **argv, t_defragOptions *options);
+
+/**
+ * Name: checkImage
+ * @brief Check the volume before it is changed; moving the chains of a damaged volume
+ *        could make things worse.
+ *
+ * @param vol The volume.
+ * @param numThreads The number of workers.
+ *
+ * @return DEFRAG_EXIT_DONE if the volume is clean, DEFRAG_EXIT_PROBLEMS or DEFRAG_EXIT_FAILED otherwise.
+ */
+int checkImage(t_volume *vol, uint32_t numThreads);
+
+/**
+ * Name: printText
+ * @brief Print a report as one summary line.
+ *
+ * @param report The report.
+ */
+void printText(const t_compactReport *report);
+
+/**
+ * Name: printJSON
+ * @brief Print a report as one JSON object.
+ *
+ * @param imagePath The image compacted.
+ * @param compacted 1 if the image was changed.
+ * @param report The report.
+ */
+void printJSON(const char *imagePath, uint8_t compacted, const t_compactReport *report);
+
+/*******************************************************************************
+* Code
+*******************************************************************************/
+int main(int argc, char **argv)
+{
+    t_defragOptions options;
+    t_compactReport report;
+    t_volume *vol = NULL;
+    int status = DEFRAG_EXIT_FAILED;
+
+    memset(&report, 0, sizeof(report));
+
+    if(parseOptions(argc, argv, &options) == 0)
+    {
+        printf("Usage: %s IMAGE [--report] [--dirs] [--threads N] [--fat-cache BYTES] [--format text|json]\n", argv[0]);
+    }
+    else if((vol = initFileFAT(options.common.imagePath, &options.common.volume)) == NULL)
+    {
+        printf("Cannot open the image %s.\n", options.common.imagePath);
+    }
+    else if(options.reportOnly == 1)
+    {
+        if(reportFragmentation(vol, &report) == 0)
+        {
+            printf("Cannot read the image %s.\n", options.common.imagePath);
+        }
+        else
+        {
+            status = DEFRAG_EXIT_DONE;
+        }
+    }
+    else if((status = checkImage(vol, options.common.numThreads)) != DEFRAG_EXIT_DONE)
+    {
+        printf("The image %s was not changed.\n", options.common.imagePath);
+    }
+    else if(compactVolume(vol, options.compactDirs, &report) == 0)
+    {
+        printf("Cannot compact the image %s.\n", options.common.imagePath);
+        status = DEFRAG_EXIT_FAILED;
+    }
+
+    if(status == DEFRAG_EXIT_DONE)
+    {
+        if(options.common.format == CHECK_FORMAT_JSON)
+        {
+            printJSON(options.common.imagePath, (options.reportOnly == 0), &report);
+        }
+        else
+        {
+            printText(&report);
+        }
+    }
+
+    if(vol != NULL)
+    {
+        deinitFileFAT(vol);
+    }
+
+    return status;
+}
+
+uint8_t parseOptions(int argc, char **argv, t_defragOptions *options)
+{
+    const char *name = NULL;
+    uint32_t used = 0;
+    int index = 0;
+    uint8_t result = 1;
+
+    memset(options, 0, sizeof(t_defragOptions));
+    defaultCheckOptions(&options->common);
+    options->common.volume.disk.writable = 1;
+
+    for(index = 1; (result == 1) && (index < argc); index++)
+    {
+        name = argv[index];
+
+        if(strcmp(name, "--report") == 0)
+        {
+            options->reportOnly = 1;
+            options->common.volume.disk.writable = 0;
+        }
+        else if(strcmp(name, "--dirs") == 0)
+        {
+            options->compactDirs = 1;
+        }
+        else if((used = parseCheckOption(&options->common, name, (index + 1 < argc) ? argv[index + 1] : NULL)) == 0)
+        {
+            result = 0;
+        }
+        else
+        {
+            index += (int)used - 1;
+        }
+    }
+
+    if(options->common.imagePath == NULL)
+    {
+        result = 0;
+    }
+
+    return result;
+}
+
+int checkImage(t_volume *vol, uint32_t numThreads)
+{
+    t_checkReport check;
+    uint64_t total = 0;
+    uint32_t index = 0;
+    int status = DEFRAG_EXIT_FAILED;
+
+    memset(&check, 0, sizeof(check));
+
+    if(checkVolume(vol, numThreads, &check) == 0)
+    {
+        printf("Cannot check the image.\n");
+    }
+    else
+    {
+        for(index = 0; index < CHECK_NUM_KINDS; index++)
+        {
+            total += check.counts[index];
+        }
+
+        if(total > 0)
+        {
+            printf("The image has %llu problems, repair it first.\n", (unsigned long long)total);
+            status = DEFRAG_EXIT_PROBLEMS;
+        }
+        else
+        {
+            status = DEFRAG_EXIT_DONE;
+        }
+    }
+
+    releaseCheckReport(&check);
+
+    return status;
+}
+
+void printText(const t_compactReport *report)
+{
+    printf("%u files, %u directories, %u fragmented, %llu extents before, %llu after, %u moved, %u skipped, %llu clusters copied\n",
+           report->files, report->directories, report->fragmented, (unsigned long long)report->extentsBefore,
+           (unsigned long long)report->extentsAfter, report->moved, report->skipped,
+           (unsigned long long)report->clustersMoved);
+}
+
+void printJSON(const char *imagePath, uint8_t compacted, const t_compactReport *report)
+{
+    printf("{\"image\":");
+    statsWriteJSONString(stdout, imagePath);
+    printf(",\"compacted\":%s,\"files\":%u,\"directories\":%u,\"fragmented\":%u,\"extentsBefore\":%llu,"
+           "\"extentsAfter\":%llu,\"moved\":%u,\"skipped\":%u,\"clustersMoved\":%llu}\n",
+           (compacted == 1) ? "true" : "false", report->files, report->directories, report->fragmented,
+           (unsigned long long)report->extentsBefore, (unsigned long long)report->extentsAfter,
+           report->moved, report->skipped, (unsigned long long)report->clustersMoved);
+}
+
@@ -0,0 +1,615 @@
+/*******************************************************************************
+* Include
+*******************************************************************************/
+#include "EXTRACT.h"
+
+/*******************************************************************************
+* Prototypes
+*******************************************************************************/
+
+/**
+ * Name: appendJob
+ * @brief Add a job at the end of a job list, growing the array if it is full.
+ *
+ * @param list The job list.
+ * @param hostPath The host path of the entry, owned by the list on success.
+ * @param entry The directory entry.
+ *
+ * @return 1 if the job was added, 0 if memory ran out.
+ */
+static uint8_t appendJob(t_extractList *list, char *hostPath, const t_direcroryEntry *entry);
+
+/**
+ * Name: freeJobs
+ * @brief Free the host paths and the array of a job list.
+ *
+ * @param list The job list.
+ */
+static void freeJobs(t_extractList *list);
+
+/**
+ * Name: collectEntry
+ * @brief Walk callback sorting the entries of the tree into directories and files.
+ *
+ * @param path The path of the entry below the extracted directory.
+ * @param entry The directory entry.
+ * @param context The t_extractTree being filled.
+ *
+ * @return 1 to continue the walk, 0 if memory ran out.
+ */
+static uint8_t collectEntry(const char *path, const t_direcroryEntry *entry, void *context);
+
+/**
+ * Name: compareDirs
+ * @brief qsort order of directories: a parent sorts before everything below it.
+ *
+ * @param a The first job.
+ * @param b The second job.
+ *
+ * @return <0, 0 or >0 like strcmp on the host paths.
+ */
+static int compareDirs(const void *a, const void *b);
+
+/**
+ * Name: compareFiles
+ * @brief qsort order of files: by first cluster, so the image is read front to back.
+ *
+ * @param a The first job.
+ * @param b The second job.
+ *
+ * @return <0, 0 or >0.
+ */
+static int compareFiles(const void *a, const void *b);
+
+/**
+ * Name: entryTimes
+ * @brief Convert the write date and time of an entry to host access and modification times.
+ *        FAT stores local time with a two second resolution.
+ *
+ * @param entry The directory entry.
+ * @param times Receives the access and modification times, UTIME_OMIT if the entry has no date.
+ */
+static void entryTimes(const t_direcroryEntry *entry, struct timespec times[2]);
+
+/**
+ * Name: writeAll
+ * @brief Write a whole buffer, going on after short writes and interrupted calls.
+ *
+ * @param fd The host file.
+ * @param buff The bytes to write.
+ * @param size The number of bytes.
+ *
+ * @return 1 if every byte was written, 0 otherwise.
+ */
+static uint8_t writeAll(int fd, const uint8_t *buff, uint32_t size);
+
+/**
+ * Name: copyExtents
+ * @brief Copy the leading contiguous runs of a file from the image to the host file
+ *        inside the kernel, stopping at the first run the kernel does not copy in full.
+ *
+ * @param run The extraction.
+ * @param job The file to copy.
+ * @param fd The host file, positioned at its start.
+ *
+ * @return The number of bytes copied, the position of fd is moved past them.
+ */
+static uint32_t copyExtents(t_extractRun *run, const t_extractJob *job, int fd);
+
+/**
+ * Name: extractFile
+ * @brief Copy one file of the volume to the host and restore its write time.
+ *
+ * @param run The extraction.
+ * @param job The file to copy.
+ * @param buff The copy buffer of the writer.
+ *
+ * @return 1 if the file was copied, 0 otherwise.
+ */
+static uint8_t extractFile(t_extractRun *run, const t_extractJob *job, uint8_t *buff);
+
+/**
+ * Name: writerMain
+ * @brief Take the next file of the run until every file has been written.
+ *
+ * @param arg The run.
+ *
+ * @return NULL.
+ */
+static void *writerMain(void *arg);
+
+/**
+ * Name: extractTree
+ * @brief Copy a file or a directory tree of a volume to a directory of the host.
+ *        The tree is listed with walkTree, the directories are created parents first,
+ *        then several writers copy the files in the order of their first cluster so
+ *        the image is read from the front to the back. Contiguous runs of clusters are
+ *        copied from the image to the file inside the kernel (HAL_CopyToFile); the rest
+ *        goes through an aligned buffer per writer. The write date and time of every entry is
+ *        restored. An entry that fails is counted and the others are still extracted.
+ *
+ * @param vol: The volume.
+ * @param path: The path on the volume, "/" for the whole volume.
+ * @param hostDir: The host directory, created if needed. A directory is extracted
+ *                 into it, a file is written in it under its own name.
+ * @param config: Extraction options, NULL for the defaults.
+ * @param stats: Receives the counters, may be NULL.
+ *
+ * @return 1 if every entry was extracted, 0 otherwise.
+ */
+uint8_t extractTree(t_volume *vol, const char *path, const char *hostDir,
+                    const t_extractConfig *config, t_extractStats *stats);
+
+/*******************************************************************************
+* Code
+*******************************************************************************/
+static uint8_t appendJob(t_extractList *list, char *hostPath, const t_direcroryEntry *entry)
+{
+    t_extractJob *grown = NULL;
+    uint32_t capacity = 0;
+    uint8_t result = 1;
+
+    if(list->count == list->capacity)
+    {
+        capacity = (list->capacity == 0) ? EXTRACT_JOBS_INIT_SIZE : list->capacity * 2;
+        grown = (t_extractJob*)realloc(list->jobs, capacity * sizeof(t_extractJob));
+        if(grown == NULL)
+        {
+            fprintf(stderr, "The disk is empty.\n");
+            result = 0;
+        }
+        else
+        {
+            list->jobs = grown;
+            list->capacity = capacity;
+        }
+    }
+
+    if(result == 1)
+    {
+        list->jobs[list->count].hostPath = hostPath;
+        list->jobs[list->count].entry = *entry;
+        list->count++;
+    }
+
+    return result;
+}
+
+static void freeJobs(t_extractList *list)
+{
+    uint32_t index = 0;
+
+    for(index = 0; index < list->count; index++)
+    {
+        free(list->jobs[index].hostPath);
+    }
+
+    free(list->jobs);
+    list->jobs = NULL;
+    list->count = 0;
+    list->capacity = 0;
+}
+
+static uint8_t collectEntry(const char *path, const t_direcroryEntry *entry, void *context)
+{
+    t_extractTree *tree = NULL;
+    char *hostPath = NULL;
+    size_t length = 0;
+    uint8_t result = 0;
+
+    tree = (t_extractTree*)context;
+    length = strlen(tree->hostDir) + strlen(path) + 1;
+    hostPath = (char*)malloc(length);
+
+    if(hostPath == NULL)
+    {
+        fprintf(stderr, "The disk is empty.\n");
+    }
+    else
+    {
+        snprintf(hostPath, length, "%s%s", tree->hostDir, path);
+
+        pthread_mutex_lock(&tree->lock);
+        if((entry->attributes & ATTR_DIRECTORY) != 0)
+        {
+            result = appendJob(&tree->dirs, hostPath, entry);
+        }
+        else
+        {
+            result = appendJob(&tree->files, hostPath, entry);
+        }
+        pthread_mutex_unlock(&tree->lock);
+
+        if(result == 0)
+        {
+            free(hostPath);
+            tree->failed = 1;
+        }
+    }
+
+    return result;
+}
+
+static int compareDirs(const void *a, const void *b)
+{
+    return strcmp(((const t_extractJob*)a)->hostPath, ((const t_extractJob*)b)->hostPath);
+}
+
+static int compareFiles(const void *a, const void *b)
+{
+    uint32_t first = ((const t_extractJob*)a)->entry.startCluster;
+    uint32_t second = ((const t_extractJob*)b)->entry.startCluster;
+
+    return (first > second) - (first < second);
+}
+
+static void entryTimes(const t_direcroryEntry *entry, struct timespec times[2])
+{
+    struct tm local;
+    time_t seconds = 0;
+
+    memset(&local, 0, sizeof(local));
+
+    if(entry->writeDate == 0)
+    {
+        times[0].tv_sec = 0;
+        times[0].tv_nsec = UTIME_OMIT;
+    }
+    else
+    {
+        local.tm_year = (int)((entry->writeDate >> SHIFT_9_BIT) + SET_YEAR) - 1900;
+        local.tm_mon = (int)((entry->writeDate >> SHIFT_5_BIT) & MASK_MONTH) - 1;
+        local.tm_mday = (int)(entry->writeDate & MASK_DAY);
+        local.tm_hour = (int)(entry->writeTime >> SHIFT_11_BIT);
+        local.tm_min = (int)((entry->writeTime >> SHIFT_5_BIT) & MASK_MINUTE);
+        local.tm_sec = (int)((entry->writeTime & MASK_SECOND) << SHIFT_1_BIT);
+        local.tm_isdst = -1;
+        seconds = mktime(&local);
+
+        times[0].tv_sec = seconds;
+        times[0].tv_nsec = (seconds == (time_t)-1) ? UTIME_OMIT : 0;
+    }
+
+    times[1] = times[0];
+}
+
+static uint8_t writeAll(int fd, const uint8_t *buff, uint32_t size)
+{
+    ssize_t length = 0;
+    uint32_t written = 0;
+    uint8_t result = 1;
+
+    while((result == 1) && (written < size))
+    {
+        length = write(fd, buff + written, size - written);
+        if(length > 0)
+        {
+            written += (uint32_t)length;
+        }
+        else if((length < 0) && (errno == EINTR))
+        {
+            /* Interrupted before anything was written, try again */
+        }
+        else
+        {
+            result = 0;
+        }
+    }
+
+    return result;
+}
+
+static uint32_t copyExtents(t_extractRun *run, const t_extractJob *job, int fd)
+{
+    t_volume *vol = run->vol;
+    t_extent *extents = NULL;
+    uint32_t numExtents = 0;
+    uint32_t clusterBytes = 0;
+    uint32_t sector = 0;
+    uint32_t copied = 0;
+    uint32_t length = 0;
+    uint32_t index = 0;
+    uint32_t done = 0;
+    uint64_t runBytes = 0;
+    uint8_t category = 0;
+
+    clusterBytes = (uint32_t)vol->bootInfo.bytsPerSec * vol->bootInfo.secPerClus;
+    numExtents = buildExtentList(vol, job->entry.startCluster, &extents);
+
+    for(index = 0; (index < numExtents) && (copied < job->entry.fileSize); index++)
+    {
+        /* A run is one byte range of the image, the last one stops at the file size */
+        runBytes = (uint64_t)extents[index].length * clusterBytes;
+        length = ((uint64_t)(job->entry.fileSize - copied) < runBytes) ? (job->entry.fileSize - copied) : (uint32_t)runBytes;
+        sector = ((extents[index].firstCluster - FIRST_CLUSTER) * vol->bootInfo.secPerClus) + vol->local.dataStartSector;
+
+        HAL_Advise(vol->device, sector, (length + vol->bootInfo.bytsPerSec - 1) / vol->bootInfo.bytsPerSec, HAL_ADVICE_SEQUENTIAL);
+        category = HAL_TraceCategory(HAL_TRACE_DATA);
+        done = HAL_CopyToFile(vol->device, sector, length, fd);
+        HAL_TraceCategory(category);
+        if(done != length)
+        {
+            /* The fd position is unknown after a partial copy; put it back at the run */
+            lseek(fd, (off_t)copied, SEEK_SET);
+            break;
+        }
+
+        copied += length;
+    }
+
+    free(extents);
+
+    return copied;
+}
+
+static uint8_t extractFile(t_extractRun *run, const t_extractJob *job, uint8_t *buff)
+{
+    t_fatFile *file = NULL;
+    struct timespec times[2];
+    uint32_t copied = 0;
+    uint32_t length = 0;
+    uint8_t result = 0;
+    int fd = -1;
+
+    fd = open(job->hostPath, O_WRONLY | O_CREAT | O_TRUNC, EXTRACT_FILE_MODE);
+    file = fatOpen(run->vol, job->entry.startCluster, job->entry.fileSize);
+
+    if((fd >= 0) && (file != NULL))
+    {
+        if(run->copyMode == EXTRACT_COPY_KERNEL)
+        {
+            /* The kernel places the blocks, or shares them with the image on filesystems with reflinks */
+            copied = copyExtents(run, job, fd);
+            __atomic_add_fetch(&run->stats->kernelBytes, copied, __ATOMIC_RELAXED);
+        }
+        else if(job->entry.fileSize > 0)
+        {
+            /* Reserve the whole file up front so the host can place it in one piece */
+            (void)posix_fallocate(fd, 0, (off_t)job->entry.fileSize);
+        }
+
+        /* Whatever the kernel did not copy goes through the buffer */
+        result = 1;
+        if((copied > 0) && (copied < job->entry.fileSize) && (fatSeek(file, copied) == 0))
+        {
+            result = 0;
+        }
+        while((result == 1) && (copied < job->entry.fileSize))
+        {
+            length = fatRead(file, buff, run->bufferBytes);
+            if((length == 0) || (writeAll(fd, buff, length) == 0))
+            {
+                result = 0;
+            }
+            else
+            {
+                copied += length;
+            }
+        }
+
+        __atomic_add_fetch(&run->stats->bytes, copied, __ATOMIC_RELAXED);
+
+        if(result == 1)
+        {
+            entryTimes(&job->entry, times);
+            futimens(fd, times);
+        }
+    }
+
+    if(file != NULL)
+    {
+        fatClose(file);
+    }
+    if(fd >= 0)
+    {
+        close(fd);
+    }
+
+    return result;
+}
+
+static void *writerMain(void *arg)
+{
+    t_extractRun *run = NULL;
+    uint8_t *buff = NULL;
+    uint32_t index = 0;
+
+    run = (t_extractRun*)arg;
+
+    if(posix_memalign((void**)&buff, EXTRACT_BUFFER_ALIGN, run->bufferBytes) != 0)
+    {
+        fprintf(stderr, "The disk is empty.\n");
+    }
+    else
+    {
+        /* Files are handed out in cluster order, the writers move through the image together */
+        while((index = __atomic_fetch_add(&run->next, 1, __ATOMIC_RELAXED)) < run->files->count)
+        {
+            if(extractFile(run, &run->files->jobs[index], buff) == 1)
+            {
+                __atomic_add_fetch(&run->stats->files, 1, __ATOMIC_RELAXED);
+            }
+            else
+            {
+                __atomic_add_fetch(&run->stats->errors, 1, __ATOMIC_RELAXED);
+            }
+        }
+
+        free(buff);
+    }
+
+    return NULL;
+}
+
+uint8_t extractTree(t_volume *vol, const char *path, const char *hostDir,
+                    const t_extractConfig *config, t_extractStats *stats)
+{
+    t_extractTree tree;
+    t_extractRun run;
+    t_extractStats counters = {0, 0, 0, 0, 0};
+    t_direcroryEntry entry;
+    struct timespec times[2];
+    pthread_t *threads = NULL;
+    uint8_t *started = NULL;
+    char name[NAME_MAX_LENGTH];
+    char *hostPath = NULL;
+    size_t length = 0;
+    uint32_t numThreads = EXTRACT_THREADS_AUTO;
+    uint32_t index = 0;
+    long online = 0;
+    uint8_t listed = 1;
+    uint8_t result = 0;
+
+    memset(&tree, 0, sizeof(tree));
+    memset(&run, 0, sizeof(run));
+    tree.hostDir = hostDir;
+    pthread_mutex_init(&tree.lock, NULL);
+
+    run.vol = vol;
+    run.files = &tree.files;
+    run.bufferBytes = EXTRACT_BUFFER_DEFAULT;
+    run.copyMode = EXTRACT_COPY_KERNEL;
+    run.stats = &counters;
+    if(config != NULL)
+    {
+        numThreads = config->numThreads;
+        run.copyMode = config->copyMode;
+        if(config->bufferBytes != 0)
+        {
+            run.bufferBytes = config->bufferBytes;
+        }
+    }
+
+    if(fatLookup(vol, path, &entry) == 0)
+    {
+        fprintf(stderr, "%s is not on the disk.\n", path);
+    }
+    else if((mkdir(hostDir, EXTRACT_DIR_MODE) != 0) && (errno != EEXIST))
+    {
+        fprintf(stderr, "Cannot create %s.\n", hostDir);
+    }
+    else if((entry.attributes & ATTR_DIRECTORY) != 0)
+    {
+        /* List the whole tree first, the files are written in disk order afterwards. A tree
+           listed in part is still extracted, the missing directories count as an error */
+        listed = walkTree(vol, entry.startCluster, "", WALK_THREADS_AUTO, collectEntry, &tree);
+        result = 1;
+    }
+    else
+    {
+        fatFormatName(&entry, name);
+        length = strlen(hostDir) + strlen(name) + 2;
+        hostPath = (char*)malloc(length);
+        if(hostPath == NULL)
+        {
+            fprintf(stderr, "The disk is empty.\n");
+        }
+        else
+        {
+            snprintf(hostPath, length, "%s%c%s", hostDir, PATH_SEPARATOR, name);
+            result = appendJob(&tree.files, hostPath, &entry);
+            if(result == 0)
+            {
+                free(hostPath);
+            }
+        }
+    }
+
+    if((result == 1) && (tree.failed == 0))
+    {
+        if(listed == 0)
+        {
+            fprintf(stderr, "Not every directory below %s could be read.\n", path);
+            counters.errors++;
+        }
+
+        /* Parents sort before their children, so every directory is created inside an existing one */
+        qsort(tree.dirs.jobs, tree.dirs.count, sizeof(t_extractJob), compareDirs);
+        for(index = 0; index < tree.dirs.count; index++)
+        {
+            if((mkdir(tree.dirs.jobs[index].hostPath, EXTRACT_DIR_MODE) == 0) || (errno == EEXIST))
+            {
+                counters.directories++;
+            }
+            else
+            {
+                counters.errors++;
+            }
+        }
+
+        qsort(tree.files.jobs, tree.files.count, sizeof(t_extractJob), compareFiles);
+
+        if(numThreads == EXTRACT_THREADS_AUTO)
+        {
+            online = sysconf(_SC_NPROCESSORS_ONLN);
+            numThreads = (online > 0) ? (uint32_t)online : 1;
+        }
+        if(numThreads > EXTRACT_THREADS_MAX)
+        {
+            numThreads = EXTRACT_THREADS_MAX;
+        }
+        if(numThreads > tree.files.count)
+        {
+            numThreads = (tree.files.count > 0) ? tree.files.count : 1;
+        }
+
+        threads = (pthread_t*)calloc(numThreads, sizeof(pthread_t));
+        started = (uint8_t*)calloc(numThreads, sizeof(uint8_t));
+        if((threads == NULL) || (started == NULL))
+        {
+            fprintf(stderr, "The disk is empty.\n");
+            numThreads = 1;
+        }
+
+        /* Load the time zone once, before the writers convert the FAT times */
+        tzset();
+
+        /* The calling thread is the first writer */
+        for(index = 1; index < numThreads; index++)
+        {
+            started[index] = (pthread_create(&threads[index], NULL, writerMain, &run) == 0);
+        }
+
+        writerMain(&run);
+
+        for(index = 1; index < numThreads; index++)
+        {
+            if(started[index] == 1)
+            {
+                pthread_join(threads[index], NULL);
+            }
+        }
+
+        /* A writer that could not get its buffer leaves files behind */
+        if(run.next < tree.files.count)
+        {
+            counters.errors += tree.files.count - run.next;
+        }
+
+        /* Writing the files touched the directories; restore the deepest ones first */
+        for(index = tree.dirs.count; index > 0; index--)
+        {
+            entryTimes(&tree.dirs.jobs[index - 1].entry, times);
+            utimensat(AT_FDCWD, tree.dirs.jobs[index - 1].hostPath, times, 0);
+        }
+
+        result = (counters.errors == 0) ? 1 : 0;
+    }
+    else
+    {
+        result = 0;
+    }
+
+    if(stats != NULL)
+    {
+        *stats = counters;
+    }
+
+    freeJobs(&tree.dirs);
+    freeJobs(&tree.files);
+    pthread_mutex_destroy(&tree.lock);
+    free(threads);
+    free(started);
+
+    return result;
+}
@@ -0,0 +1,99 @@
+#ifndef _EXTRACT_H_
+#define _EXTRACT_H_
+
+/*******************************************************************************
+* Include
+*******************************************************************************/
+#include <time.h>
+#include "WALK.h"
+
+/*******************************************************************************
+* Define
+*******************************************************************************/
+#define EXTRACT_THREADS_AUTO    0U       /* One writer per online CPU */
+#define EXTRACT_THREADS_MAX     64U      /* Largest number of files written at once */
+#define EXTRACT_BUFFER_DEFAULT  (1024U * 1024U)  /* Bytes read and written per call */
+#define EXTRACT_BUFFER_ALIGN    4096U    /* Alignment of the copy buffers */
+#define EXTRACT_JOBS_INIT_SIZE  64U      /* Initial capacity of a job list */
+#define EXTRACT_DIR_MODE        0755     /* Mode of the created directories */
+#define EXTRACT_FILE_MODE       0644     /* Mode of the created files */
+
+#define EXTRACT_COPY_KERNEL     0U       /* Copy contiguous extents inside the kernel, the buffer is a fallback */
+#define EXTRACT_COPY_BUFFERED   1U       /* Read every file into the buffer and write it out */
+
+typedef struct
+{
+    uint32_t    numThreads;              /* Files written at once, EXTRACT_THREADS_AUTO for one per CPU */
+    uint32_t    bufferBytes;             /* Size of the copy buffer of each writer, 0 for EXTRACT_BUFFER_DEFAULT */
+    uint8_t     copyMode;                /* EXTRACT_COPY_KERNEL or EXTRACT_COPY_BUFFERED */
+} t_extractConfig;
+
+typedef struct
+{
+    uint32_t    files;                   /* Files written completely */
+    uint32_t    directories;             /* Directories created */
+    uint64_t    bytes;                   /* Bytes written to the files */
+    uint64_t    kernelBytes;             /* Part of bytes copied by the kernel without the buffer */
+    uint32_t    errors;                  /* Entries that could not be extracted */
+} t_extractStats;
+
+typedef struct
+{
+    char             *hostPath;          /* Where the entry is written on the host */
+    t_direcroryEntry entry;              /* The directory entry on the volume */
+} t_extractJob;
+
+typedef struct
+{
+    t_extractJob *jobs;                  /* Jobs in the order they were found */
+    uint32_t    count;                   /* Number of jobs */
+    uint32_t    capacity;                /* Number of jobs the array can hold */
+} t_extractList;
+
+typedef struct
+{
+    const char      *hostDir;            /* The directory the tree is extracted to */
+    t_extractList   dirs;                /* Directories to create */
+    t_extractList   files;               /* Files to write */
+    uint8_t         failed;              /* Set when memory ran out while collecting */
+    pthread_mutex_t lock;                /* Protects the lists during the walk */
+} t_extractTree;
+
+typedef struct
+{
+    t_volume        *vol;                /* The volume the files are read from */
+    const t_extractList *files;          /* Files sorted by start cluster */
+    uint32_t        next;                /* Index of the next file to write */
+    uint32_t        bufferBytes;         /* Size of the copy buffer of each writer */
+    uint8_t         copyMode;            /* EXTRACT_COPY_KERNEL or EXTRACT_COPY_BUFFERED */
+    t_extractStats  *stats;              /* Counters updated by the writers */
+} t_extractRun;
+
+/*******************************************************************************
+* API
+*******************************************************************************/
+
+/**
+ * Name: extractTree
+ * @brief Copy a file or a directory tree of a volume to a directory of the host.
+ *        The tree is listed with walkTree, the directories are created parents first,
+ *        then several writers copy the files in the order of their first cluster so
+ *        the image is read from the front to the back. Contiguous runs of clusters are
+ *        copied from the image to the file inside the kernel (HAL_CopyToFile); the rest
+ *        goes through an aligned buffer per writer. The write date and time of every entry is
+ *        restored. An entry that fails is counted and the others are still extracted.
+ *
+ * @param vol: The volume.
+ * @param path: The path on the volume, "/" for the whole volume.
+ * @param hostDir: The host directory, created if needed. A directory is extracted
+ *                 into it, a file is written in it under its own name.
+ * @param config: Extraction options, NULL for the defaults.
+ * @param stats: Receives the counters, may be NULL.
+ *
+ * @return 1 if every entry was extracted, 0 otherwise.
+ */
+uint8_t extractTree(t_volume *vol, const char *path, const char *hostDir,
+                    const t_extractConfig *config, t_extractStats *stats);
+
+#endif /* _EXTRACT_H_ */
+
@@ -9,511 +9,3294 @@
 /*******************************************************************************
 * Variables
 *******************************************************************************/
-static t_bootSector s_bootInfo;
-static t_location s_local;
+static const t_volumeConfig s_defaultConfig = {{HAL_BACKEND_PREAD, DISK_CACHE_DEFAULT, HAL_CACHE_BLOCK_SIZE, HAL_QUEUE_DEFAULT, 0},
+                                               FAT_CACHE_UNLIMITED, DIR_CACHE_DEFAULT};
 
 /*******************************************************************************
 * Prototypes
 *******************************************************************************/
 
 /**
- * Name: deleteList
- * @brief Free the memory used by a linked list.
+ * Name: reserveDirList
+ * @brief Make sure a directory list can hold more entries without growing again.
  *
- * @param head Pointer to the head pointer of the linked list.
+ * @param list The directory list.
+ * @param more The number of entries that may be appended.
  *
- * @return void.
+ * @return 1 if the list has room, 0 if memory ran out.
  */
-static void deleteList(p_EntryList *head);
+static uint8_t reserveDirList(t_dirList *list, uint32_t more);
 
 /**
  * Name: nextCluster
  * @brief Retrieves the value of the next cluster in the File Allocation Table (FAT) for a given cluster.
  *
+ * @param vol The volume.
  * @param cluster The cluster number for which to find the next cluster.
  *
  * @return The value of the next cluster in the FAT for the given cluster.
  */
-static uint32_t nextCluster(uint32_t cluster);
+static uint32_t nextCluster(t_volume *vol, uint32_t cluster);
 
 /**
- * Name: createNewNodeAsDirEntry
- * @brief Creates a new node representing a directory entry and copies the information from the buffer.
+ * Name: getSectors
+ * @brief Get the content of sectors from index to num, straight from the mapped image
+ *        when possible, otherwise read into a newly allocated buffer.
  *
- * @param buff Pointer to a buffer containing the data of a directory entry to be copied.
+ * @param vol The volume.
+ * @param index Position of the first sector.
+ * @param num Number of sectors.
+ * @param copy Receives the allocated buffer to free() after use, NULL when nothing was allocated.
  *
- * @return Pointer to the newly created node representing the directory entry.
- *         If memory allocation fails, NULL is returned.
+ * @return Pointer to the sector content, NULL if the read failed.
  */
-static p_EntryList createNewNodeAsDirEntry(const uint8_t *buff);
+static const uint8_t *getSectors(t_volume *vol, uint32_t index, uint32_t num, uint8_t **copy);
+
+/**
+ * Name: lastClusterMark
+ * @brief Get the smallest end-of-chain value for the FAT type of the mounted volume.
+ *
+ * @param vol The volume.
+ *
+ * @return LAST_CRUSTER_12, LAST_CRUSTER_16 or LAST_CRUSTER_32.
+ */
+static uint32_t lastClusterMark(t_volume *vol);
+
+/**
+ * Name: chainLoops
+ * @brief Brent's loop check, called after each hop of a chain walk. The cluster reached after
+ *        each power of two hops is saved; a looping chain comes back to it within two turns.
+ *
+ * @param cluster The cluster just reached.
+ * @param hops The hops made so far, at least 1.
+ * @param mark The saved cluster, the start cluster before the first hop.
+ *
+ * @return 1 if the chain loops, 0 otherwise.
+ */
+static uint8_t chainLoops(uint32_t cluster, uint32_t hops, uint32_t *mark);
+
+/**
+ * Name: decodeFATEntries
+ * @brief Decode a range of raw FAT entries into next-cluster values.
+ *
+ * @param vol The volume.
+ * @param raw Raw FAT bytes, raw[0] is the byte at offset 'rawOffset' in the FAT.
+ * @param rawOffset The FAT byte offset of raw[0].
+ * @param first The first entry to decode.
+ * @param count The number of entries to decode.
+ * @param out Array receiving 'count' decoded values.
+ */
+static void decodeFATEntries(t_volume *vol, const uint8_t *raw, uint32_t rawOffset, uint32_t first, uint32_t count, uint32_t *out);
+
+/**
+ * Name: initFATCache
+ * @brief Size the FAT cache for the mounted volume and, without a memory limit, decode the whole FAT.
+ *
+ * @param vol The volume.
+ * @param limitBytes Memory limit of the decoded table, FAT_CACHE_UNLIMITED for no limit.
+ */
+static void initFATCache(t_volume *vol, uint32_t limitBytes);
+
+/**
+ * Name: loadFATPage
+ * @brief Get a decoded page of the FAT in bounded mode, reading it from the disk if it is not resident.
+ *
+ * @param vol The volume.
+ * @param page The page number.
+ *
+ * @return Pointer to the FAT_CACHE_PAGE_ENTRIES decoded values of the page, NULL if the read failed.
+ */
+static uint32_t *loadFATPage(t_volume *vol, uint32_t page);
+
+/**
+ * Name: readByteRange
+ * @brief Read a byte range that starts at an offset from a sector. Whole sectors are read
+ *        straight into the buffer, partial first and last sectors through a bounce buffer.
+ *
+ * @param vol The volume.
+ * @param sector The sector the offset is counted from.
+ * @param byteOffset Offset of the first byte from the start of the sector.
+ * @param size Number of bytes to read.
+ * @param buff Buffer receiving the data.
+ * @param bounce One sector buffer.
+ *
+ * @return Number of bytes read.
+ */
+static uint32_t readByteRange(t_volume *vol, uint32_t sector, uint32_t byteOffset, uint32_t size, uint8_t *buff, uint8_t *bounce);
+
+/**
+ * Name: buildFileIndex
+ * @brief Build the extent list of an open file and the chain index where each extent starts.
+ *
+ * @param file The file handle.
+ *
+ * @return 1 if the index is available, 0 if memory ran out.
+ */
+static uint8_t buildFileIndex(t_fatFile *file);
+
+/**
+ * Name: locateCluster
+ * @brief Find the cluster at a chain index with a binary search over the extent index of a file.
+ *
+ * @param file The file handle, with its index built.
+ * @param index The chain index.
+ * @param cluster Receives the cluster number.
+ * @param runClusters Receives the number of contiguous clusters from this one to the end of its extent.
+ *
+ * @return 1 if found, 0 if the chain is shorter than 'index' + 1 clusters.
+ */
+static uint8_t locateCluster(t_fatFile *file, uint32_t index, uint32_t *cluster, uint32_t *runClusters);
+
+/**
+ * Name: appendDirEntries
+ * @brief Append the valid entries of a buffer of raw directory entries to a list.
+ *
+ * @param vol The volume.
+ * @param list The directory list.
+ * @param buff The raw directory entries.
+ * @param size The number of bytes in the buffer.
+ *
+ * @return 1 if the entries were appended, 0 if memory ran out.
+ */
+static uint8_t appendDirEntries(t_volume *vol, t_dirList *list, const uint8_t *buff, uint32_t size);
+
+/**
+ * Name: readExtents
+ * @brief Read the clusters of a list of extents one after the other into a buffer.
+ *        All reads are handed to HAL_ReadBatch at once, extents longer than
+ *        EXTENT_READ_CHUNK are split so they also keep several reads in flight.
+ *
+ * @param vol The volume.
+ * @param extents The extents to read.
+ * @param numExtents The number of extents.
+ * @param buff The buffer, large enough for every cluster of the extents.
+ *
+ * @return 1 if every cluster was read, 0 otherwise.
+ */
+static uint8_t readExtents(t_volume *vol, const t_extent *extents, uint32_t numExtents, uint8_t *buff);
+
+/**
+ * Name: rootCluster
+ * @brief Get the start cluster that stands for the root directory.
+ *
+ * @param vol The volume.
+ *
+ * @return rootClus for FAT32, 0 for FAT12/16 whose root directory has its own region.
+ */
+static uint32_t rootCluster(t_volume *vol);
+
+/**
+ * Name: hashName
+ * @brief Hash a packed 8.3 name (FNV-1a).
+ *
+ * @param name The SIZE_OF_NAME bytes of the name.
+ *
+ * @return The hash value.
+ */
+static uint32_t hashName(const uint8_t *name);
+
+/**
+ * Name: buildNameIndex
+ * @brief Build the open addressing name index of a directory node from its entries.
+ *
+ * @param node The directory node.
+ *
+ * @return 1 if the index was built, 0 if memory ran out.
+ */
+static uint8_t buildNameIndex(t_dirNode *node);
+
+/**
+ * Name: findName
+ * @brief Find an entry of a directory node by its packed 8.3 name.
+ *
+ * @param node The directory node.
+ * @param packed The SIZE_OF_NAME bytes of the name.
+ *
+ * @return The index of the entry in the node list, DIR_INDEX_EMPTY if there is none.
+ */
+static uint32_t findName(const t_dirNode *node, const uint8_t *packed);
+
+/**
+ * Name: hashCluster
+ * @brief Get the bucket of a directory in the directory cache.
+ *
+ * @param cache The directory cache.
+ * @param cluster The start cluster of the directory.
+ *
+ * @return The bucket index.
+ */
+static uint32_t hashCluster(const t_dirCache *cache, uint32_t cluster);
+
+/**
+ * Name: growDirCache
+ * @brief Double the number of buckets of the directory cache, or create it.
+ *
+ * @param vol The volume.
+ *
+ * @return 1 if the cache was grown, 0 if memory ran out.
+ */
+static uint8_t growDirCache(t_volume *vol);
+
+/**
+ * Name: linkDirNode
+ * @brief Insert a directory node at the most recently used end of the LRU list.
+ *
+ * @param cache The directory cache.
+ * @param node The directory node.
+ */
+static void linkDirNode(t_dirCache *cache, t_dirNode *node);
+
+/**
+ * Name: unlinkDirNode
+ * @brief Remove a directory node from the LRU list.
+ *
+ * @param cache The directory cache.
+ * @param node The directory node.
+ */
+static void unlinkDirNode(t_dirCache *cache, t_dirNode *node);
+
+/**
+ * Name: evictDirNode
+ * @brief Drop a directory node from the cache and free it.
+ *
+ * @param cache The directory cache.
+ * @param node The directory node.
+ */
+static void evictDirNode(t_dirCache *cache, t_dirNode *node);
+
+/**
+ * Name: findDirNode
+ * @brief Find the node of a directory in the directory cache. The cache lock is held.
+ *
+ * @param cache The directory cache.
+ * @param cluster The start cluster of the directory.
+ *
+ * @return The directory node, NULL if the directory is not cached.
+ */
+static t_dirNode *findDirNode(const t_dirCache *cache, uint32_t cluster);
+
+/**
+ * Name: readDirNode
+ * @brief Read and index a directory for the cache. The cache lock is held by the caller
+ *        and released while the disk is read, so other lookups do not wait for it.
+ *
+ * @param vol The volume.
+ * @param cluster The start cluster of the directory.
+ *
+ * @return The new node, not yet in the cache. NULL if the directory could not be read or memory
+ *         ran out; a directory read in part is never cached.
+ */
+static t_dirNode *readDirNode(t_volume *vol, uint32_t cluster);
+
+/**
+ * Name: getDirNode
+ * @brief Get the indexed directory starting at a cluster from the directory cache.
+ *        On a miss the directory is read and indexed without the cache lock, then the
+ *        least recently used directories are evicted until it fits in the budget. Two
+ *        threads missing the same directory at once may both read it; the first node
+ *        inserted is kept.
+ *
+ * @param vol The volume.
+ * @param cluster The start cluster of the directory, as returned by rootCluster for the root.
+ *
+ * @return The directory node, valid while the cache lock is held. NULL if the directory could
+ *         not be read or memory ran out.
+ *         Nodes obtained before the call may have been evicted, since the lock is released
+ *         during a miss.
+ */
+static t_dirNode *getDirNode(t_volume *vol, uint32_t cluster);
+
+/**
+ * Name: freeDirCache
+ * @brief Free every directory node of a volume and the cache itself.
+ *
+ * @param vol The volume.
+ */
+static void freeDirCache(t_volume *vol);
+
+/**
+ * Name: storeLittleEndian
+ * @brief Store a value in little endian byte order.
+ *
+ * @param buff The destination.
+ * @param value The value.
+ * @param size The number of bytes, 2 or 4.
+ */
+static void storeLittleEndian(uint8_t *buff, uint32_t value, uint32_t size);
+
+/**
+ * Name: hashSector
+ * @brief Get the slot of a sector in the index of the write cache.
+ *
+ * @param cache The write cache.
+ * @param sector The sector.
+ *
+ * @return The first slot to probe.
+ */
+static uint32_t hashSector(const t_writeCache *cache, uint32_t sector);
+
+/**
+ * Name: findDirtySector
+ * @brief Look a sector up in the write cache.
+ *
+ * @param cache The write cache.
+ * @param sector The sector.
+ *
+ * @return The position of the sector in the array, DIR_INDEX_EMPTY if it is not there.
+ */
+static uint32_t findDirtySector(const t_writeCache *cache, uint32_t sector);
+
+/**
+ * Name: growWriteCache
+ * @brief Make room for one more sector in the array and the index of the write cache.
+ *
+ * @param cache The write cache.
+ *
+ * @return 1 if there is room, 0 if memory ran out.
+ */
+static uint8_t growWriteCache(t_writeCache *cache);
+
+/**
+ * Name: applyDirtySectors
+ * @brief Copy the pending writes of a range of sectors over the bytes read from the disk.
+ *
+ * @param vol The volume.
+ * @param index The first sector of the range.
+ * @param num The number of sectors.
+ * @param buff The sectors read from the disk, NULL to only count the pending sectors.
+ *
+ * @return The number of sectors of the range with a pending write.
+ */
+static uint32_t applyDirtySectors(t_volume *vol, uint32_t index, uint32_t num, uint8_t *buff);
+
+/**
+ * Name: dropDirtySectors
+ * @brief Forget the pending writes of a range of sectors, e.g. the clusters of a freed chain
+ *        whose old directory slots must not land on data written there later.
+ *
+ * @param vol The volume.
+ * @param index The first sector of the range.
+ * @param num The number of sectors.
+ */
+static void dropDirtySectors(t_volume *vol, uint32_t index, uint32_t num);
+
+/**
+ * Name: compareDirtySectors
+ * @brief qsort comparator ordering pending sectors by sector number.
+ *
+ * @param left The first t_dirtySector pointer.
+ * @param right The second t_dirtySector pointer.
+ *
+ * @return Negative, zero or positive like strcmp.
+ */
+static int compareDirtySectors(const void *left, const void *right);
+
+/**
+ * Name: writeDirtyRuns
+ * @brief Write sorted pending sectors, one request per run of neighbouring sectors.
+ *
+ * @param vol The volume.
+ * @param order The pending sectors, sorted.
+ * @param first The first sector of order to write.
+ * @param last One past the last sector of order to write.
+ * @param shift Added to every sector number, to write a FAT sector to another table.
+ * @param bytes Incremented by the bytes written.
+ *
+ * @return 1 if every sector was written, 0 otherwise.
+ */
+static uint8_t writeDirtyRuns(t_volume *vol, t_dirtySector **order, uint32_t first, uint32_t last, uint32_t shift, uint64_t *bytes);
+
+/**
+ * Name: updateFSInfo
+ * @brief Put the free cluster count and the next free hint of the allocator in the FSInfo
+ *        sector of a FAT32 volume, or mark them unknown when the allocator has not counted.
+ *
+ * @param vol The volume.
+ */
+static void updateFSInfo(t_volume *vol);
+
+/**
+ * Name: releaseWriteCache
+ * @brief Free the pending sectors and the allocator bitmap of a volume.
+ *
+ * @param vol The volume.
+ */
+static void releaseWriteCache(t_volume *vol);
+
+/**
+ * Name: unpackScalar
+ * @brief Unpack FAT12 entries one at a time with the odd/even nibble logic.
+ *
+ * @param raw The FAT bytes holding entry 'first', raw[0] is the byte at offset first * 1.5.
+ * @param first The first entry to unpack.
+ * @param count The number of entries to unpack.
+ * @param out Array receiving 'count' entries.
+ */
+static void unpackScalar(const uint8_t *raw, uint32_t first, uint32_t count, uint32_t *out);
+
+#if defined(FAT_HAVE_X86)
+/**
+ * Name: unpackSSSE3
+ * @brief Unpack FAT12 entries 8 at a time while the rest of the entries cover a whole 16 byte load.
+ *
+ * @param raw The FAT bytes of an even entry.
+ * @param count The number of entries that may be unpacked.
+ * @param out Array receiving the entries.
+ *
+ * @return The number of entries unpacked, a multiple of 8.
+ */
+static uint32_t unpackSSSE3(const uint8_t *raw, uint32_t count, uint32_t *out);
+
+/**
+ * Name: unpackAVX2
+ * @brief Unpack FAT12 entries 16 at a time while the rest of the entries cover two overlapping
+ *        16 byte loads.
+ *
+ * @param raw The FAT bytes of an even entry.
+ * @param count The number of entries that may be unpacked.
+ * @param out Array receiving the entries.
+ *
+ * @return The number of entries unpacked, a multiple of 16.
+ */
+static uint32_t unpackAVX2(const uint8_t *raw, uint32_t count, uint32_t *out);
+#endif
+
+/**
+ * Name: pickFAT12Kernel
+ * @brief Resolve the FAT12 kernel asked for against what the CPU supports.
+ *
+ * @param kernel The FAT12_KERNEL_* asked for.
+ *
+ * @return The FAT12_KERNEL_* to use, never FAT12_KERNEL_AUTO.
+ */
+static uint8_t pickFAT12Kernel(uint8_t kernel);
 
 /**
  * Name: fatType
  * @brief Determine the FAT type based on the total number of clusters.
  *
+ * @param vol: The volume.
+ *
  * @return The FAT type: FAT_12, FAT_16, or FAT_32.
  */
-uint8_t fatType();
+uint8_t fatType(t_volume *vol);
+
+/**
+ * Name: unpackFAT12
+ * @brief Expand packed 12-bit FAT entries into one uint32_t per entry. The SIMD kernels
+ *        shuffle 12 raw bytes into 8 entries at a time and never read past the last entry.
+ *
+ * @param raw: The FAT bytes holding entry 'first', raw[0] is the byte at offset first * 1.5.
+ * @param first: The first entry to unpack.
+ * @param count: The number of entries to unpack.
+ * @param kernel: FAT12_KERNEL_AUTO, or a kernel to force; one the CPU lacks falls back to scalar.
+ * @param out: Array receiving 'count' entries.
+ *
+ * @return The FAT12_KERNEL_* that unpacked the entries, never FAT12_KERNEL_AUTO.
+ */
+uint8_t unpackFAT12(const uint8_t *raw, uint32_t first, uint32_t count, uint8_t kernel, uint32_t *out);
+
+/**
+ * Name: fillFATEntries
+ * @brief Read the FAT sectors covering a range of entries of the first FAT table and decode
+ *        them into next-cluster values, without going through the FAT cache.
+ *
+ * @param vol: The volume.
+ * @param first: The first entry to decode.
+ * @param count: The number of entries to decode, first + count at most fatCache.numEntries.
+ * @param out: Array receiving 'count' decoded values.
+ *
+ * @return 1 if the entries were decoded, 0 if the read failed.
+ */
+uint8_t fillFATEntries(t_volume *vol, uint32_t first, uint32_t count, uint32_t *out);
+
+/**
+ * Name: getFATEntry
+ * @brief Get the next-cluster value of a FAT entry, pending writes included.
+ *
+ * @param vol: The volume.
+ * @param cluster: The cluster.
+ *
+ * @return The value of the entry, an end of chain mark for a cluster outside the FAT.
+ */
+uint32_t getFATEntry(t_volume *vol, uint32_t cluster);
+
+/**
+ * Name: setFATEntry
+ * @brief Change a FAT entry in the write cache of the volume. The decoded FAT is updated at
+ *        once; the raw entry is patched into a cached copy of its sector, and fatFlush() writes
+ *        the sector to every FAT table. Freeing a cluster drops the pending writes of its sectors.
+ *        Writes must not run while other threads use the volume.
+ *
+ * @param vol: The volume, mounted writable.
+ * @param cluster: The cluster, 2 or more and inside the FAT.
+ * @param value: The new value, FREE_CLUSTER, a cluster or an end of chain mark.
+ *
+ * @return 1 if the entry was changed, 0 if the cluster is invalid, the volume is read-only or memory ran out.
+ */
+uint8_t setFATEntry(t_volume *vol, uint32_t cluster, uint32_t value);
+
+/**
+ * Name: getDirtySector
+ * @brief Get the cached copy of a metadata sector to change it. The sector is written at the
+ *        next fatFlush(); until then every read of the volume sees the cached copy.
+ *
+ * @param vol: The volume, mounted writable.
+ * @param sector: The sector.
+ * @param load: 1 to start from the bytes on the disk, 0 to start from zeros.
+ *
+ * @return The bytes of the sector, NULL if the volume is read-only, the read failed or memory ran out.
+ */
+uint8_t *getDirtySector(t_volume *vol, uint32_t sector, uint8_t load);
+
+/**
+ * Name: fatReadSectors
+ * @brief Read sectors as the volume sees them, with the pending writes applied.
+ *
+ * @param vol: The volume.
+ * @param index: The first sector.
+ * @param num: The number of sectors.
+ * @param buff: Receives the sectors.
+ *
+ * @return 1 if every sector was read, 0 otherwise.
+ */
+uint8_t fatReadSectors(t_volume *vol, uint32_t index, uint32_t num, uint8_t *buff);
+
+/**
+ * Name: fatFlush
+ * @brief Write every pending metadata sector with as few requests as possible: the sectors
+ *        are sorted, neighbours are written together, and each changed FAT sector is written
+ *        to all numFATs tables in the same pass. The FAT32 FSInfo sector is updated when the
+ *        FAT changed. Returns once the writes are on the disk.
+ *
+ * @param vol: The volume.
+ *
+ * @return 1 if nothing is left to write, 0 if a write failed; the sectors stay pending.
+ */
+uint8_t fatFlush(t_volume *vol);
+
+/**
+ * Name: invalidateDirCache
+ * @brief Drop a directory from the directory cache after its slots were changed.
+ *
+ * @param vol: The volume.
+ * @param cluster: The start cluster of the directory, as loadDirEntry() or fatLookup() use it.
+ */
+void invalidateDirCache(t_volume *vol, uint32_t cluster);
+
+/**
+ * Name: parseDirEntry
+ * @brief Read a raw 32 byte directory slot into an entry.
+ *
+ * @param vol: The volume.
+ * @param buff: The slot.
+ * @param entry: Receives the entry.
+ */
+void parseDirEntry(t_volume *vol, const uint8_t *buff, t_direcroryEntry *entry);
+
+/**
+ * Name: storeDirEntry
+ * @brief Write an entry into a raw 32 byte directory slot. Bytes the entry does not hold,
+ *        such as the creation time, are left as they are.
+ *
+ * @param vol: The volume.
+ * @param entry: The entry.
+ * @param buff: The slot.
+ */
+void storeDirEntry(t_volume *vol, const t_direcroryEntry *entry, uint8_t *buff);
+
+/**
+ * Name: fatPackName
+ * @brief Turn a name such as "file.txt" into its packed 8.3 form "FILE    TXT".
+ *
+ * @param name: The name, not terminated.
+ * @param length: The number of characters of the name.
+ * @param packed: Receives SIZE_OF_NAME bytes.
+ *
+ * @return 1 if the name fits an 8.3 name, 0 otherwise.
+ */
+uint8_t fatPackName(const char *name, uint32_t length, uint8_t *packed);
+
+/**
+ * Name: defaultVolumeConfig
+ * @brief Fill mount options with the defaults initFileFAT() uses for a NULL config, so a
+ *        caller can change only the settings it needs. The volume is mounted read-only.
+ *
+ * @param config: Receives the options.
+ */
+void defaultVolumeConfig(t_volumeConfig *config);
 
 /**
  * Name: initFileFAT
- * @brief Initializes the file system and reads the boot sector information from a disk file.
+ * @brief Open a disk file, read the boot sector information and mount it as a volume.
+ *        Each volume owns its disk handle and caches, so several images can be open at
+ *        once and different volumes can be used from different threads.
  *
  * @param filePath: The path to the disk file.
- * @param fp: A pointer to the opened file.
+ * @param config: Mount options, NULL for the defaults (pread backend with a DISK_CACHE_DEFAULT
+ *                block cache, HAL_QUEUE_DEFAULT reads in flight, whole FAT decoded,
+ *                DIR_CACHE_DEFAULT directory cache).
+ *
+ * @return t_volume*: The mounted volume. If failed, returns NULL.
+ */
+t_volume* initFileFAT(const char *filePath, const t_volumeConfig *config);
+
+/**
+ * Name: deinitFileFAT
+ * @brief Flush the pending writes of a volume, close its disk file and release everything it owns.
  *
- * @return t_bootSector: The boot sector information read from the disk file.
+ * @param vol: The volume, may be NULL.
  */
-t_bootSector initFileFAT(const char *filePath, FILE *fp);
+void deinitFileFAT(t_volume *vol);
 
 /**
  * Name: localEachRegion
  * @brief Calculate the starting sectors and the number of sectors by regions in the file system.
  *
+ * @param vol: The volume.
+ *
  * @return A `t_location` structure containing information about regions.
  */
-t_location localEachRegion(void);
+t_location localEachRegion(t_volume *vol);
 
 /**
  * Name: readDirEntry
  * @brief Read directory entries from the specified start entry in the file system
- *        and create linked list nodes for valid entries.
+ *        and append the valid entries to the list.
  *
- * @param head: A pointer to the head of the linked list.
+ * @param vol: The volume.
+ * @param list: The directory list to append to.
  * @param startEntry: The start entry to read directory entries from.
+ *
+ * @return 1 if the sectors were read and their entries appended, 0 if a read failed or memory ran out.
  */
-void readDirEntry(p_EntryList *head, uint32_t startEntry);
+uint8_t readDirEntry(t_volume *vol, t_dirList *list, uint32_t startEntry);
 
 /**
  * Name: loadDirEntry
  * @brief Load directory entries from the specified start cluster in the file system
- *        and update the linked list with the new entries.
+ *        and replace the content of the list with the new entries.
+ *        Directories are served from the directory cache of the volume, only the
+ *        first visit of a directory (or a visit after it was evicted) reads the disk.
  *
- * @param head: A pointer to the head of the linked list.
+ * @param vol: The volume.
+ * @param list: The directory list, its memory is reused.
  * @param startCluster: The start cluster to read directory entries from.
+ *
+ * @return 1 if the whole directory was loaded, 0 if a read failed or memory ran out; the list
+ *         then holds the entries that could be read.
+ */
+uint8_t loadDirEntry(t_volume *vol, t_dirList *list, uint32_t startCluster);
+
+/**
+ * Name: freeDirList
+ * @brief Free the memory used by a directory list and leave it empty.
+ *
+ * @param list: The directory list.
+ */
+void freeDirList(t_dirList *list);
+
+/**
+ * Name: readDirChain
+ * @brief Read every directory entry of the cluster chain of a directory straight from the disk,
+ *        without going through the directory cache. Several threads can read directories of
+ *        the same volume at once.
+ *
+ * @param vol: The volume.
+ * @param list: The directory list, emptied before the entries are appended.
+ * @param startCluster: The start cluster of the directory, 0 for the root directory.
+ *
+ * @return 1 if every cluster of the chain was read, 0 if a read failed or memory ran out; the
+ *         list then holds the entries that could be read.
+ */
+uint8_t readDirChain(t_volume *vol, t_dirList *list, uint32_t startCluster);
+
+/**
+ * Name: fatFormatName
+ * @brief Turn the packed 8.3 name of an entry into "NAME.EXT", without the padding spaces.
+ *
+ * @param entry: The directory entry.
+ * @param name: Receives the name, at least NAME_MAX_LENGTH bytes.
+ */
+void fatFormatName(const t_direcroryEntry *entry, char *name);
+
+/**
+ * Name: fatLookup
+ * @brief Resolve a path such as "/DIR1/SUBDIR/FILE.TXT" to its directory entry.
+ *        Names are compared as packed 8.3 names, so the case of the path does not matter.
+ *        Every directory on the way is loaded once and indexed by name, further lookups
+ *        in the same directory cost one hash probe and no disk access.
+ *
+ * @param vol: The volume.
+ * @param path: The path, components separated by '/'. "/" is the root directory.
+ * @param entry: Receives the directory entry of the last component.
+ *
+ * @return 1 if the path was found, 0 otherwise.
  */
-void loadDirEntry(p_EntryList *head, uint32_t startCluster);
+uint8_t fatLookup(t_volume *vol, const char *path, t_direcroryEntry *entry);
 
 /**
  * Name: loadFile
  * @brief Load the contents of a file starting from the specified start cluster in the file system
- *        and store the data in the provided buffer.
+ *        and store the data in the provided buffer. Every extent of the chain is queued at once,
+ *        so with a queue depth the next extents are read while earlier ones complete.
  *
+ * @param vol: The volume.
  * @param buff: A pointer to the buffer where the file data will be stored.
  * @param startCluster: The start cluster of the file.
  */
-void loadFile(uint8_t *buff, uint32_t startCluster);
+void loadFile(t_volume *vol, uint8_t *buff, uint32_t startCluster);
+
+/**
+ * Name: buildExtentList
+ * @brief Turn the cluster chain starting at a cluster into a list of contiguous extents.
+ *
+ * @param vol: The volume.
+ * @param startCluster: The start cluster of the chain.
+ * @param extents: Receives a malloc'd array of extents, to be released with free(). NULL if the chain
+ *                 is empty or memory ran out.
+ *
+ * @return The number of extents in the chain, 0 if it is empty or memory ran out; a chain is never
+ *         returned in part.
+ */
+uint32_t buildExtentList(t_volume *vol, uint32_t startCluster, t_extent **extents);
+
+/**
+ * Name: countExtents
+ * @brief Count the contiguous extents of the cluster chain starting at a cluster.
+ *        A file stored contiguously has one extent, a higher count means more fragmentation.
+ *
+ * @param vol: The volume.
+ * @param startCluster: The start cluster of the chain.
+ *
+ * @return The number of extents in the chain.
+ */
+uint32_t countExtents(t_volume *vol, uint32_t startCluster);
+
+/**
+ * Name: fatOpen
+ * @brief Open a file of a volume for streaming reads. Only one cluster position is kept,
+ *        so the memory used does not depend on the file size.
+ *
+ * @param vol: The volume.
+ * @param startCluster: The start cluster of the file.
+ * @param size: The file size in bytes.
+ *
+ * @return t_fatFile*: The file handle positioned at offset 0. If failed, returns NULL.
+ */
+t_fatFile* fatOpen(t_volume *vol, uint32_t startCluster, uint32_t size);
+
+/**
+ * Name: fatRead
+ * @brief Read bytes from the current position of a file and advance the position.
+ *        Contiguous clusters are read with one request; sequential reads continue
+ *        from the current cluster instead of walking the chain from the start.
+ *
+ * @param file: The file handle.
+ * @param buff: The buffer receiving the data.
+ * @param size: The number of bytes to read.
+ *
+ * @return The number of bytes read, less than 'size' at the end of the file.
+ */
+uint32_t fatRead(t_fatFile *file, uint8_t *buff, uint32_t size);
+
+/**
+ * Name: fatSeek
+ * @brief Move the position of a file. The first seek builds the extent list of the file,
+ *        after which any offset is found with a binary search instead of a chain walk.
+ *
+ * @param file: The file handle.
+ * @param offset: The new position in bytes from the start of the file.
+ *
+ * @return 1 if the position was changed, 0 if the offset is past the end of the file.
+ */
+uint8_t fatSeek(t_fatFile *file, uint32_t offset);
+
+/**
+ * Name: fatClose
+ * @brief Close a file handle.
+ *
+ * @param file: The file handle, may be NULL.
+ */
+void fatClose(t_fatFile *file);
 
 /*******************************************************************************
 * Code
 *******************************************************************************/
-static void deleteList(p_EntryList *head)
+static uint8_t reserveDirList(t_dirList *list, uint32_t more)
+{
+    t_direcroryEntry *grown = NULL;
+    uint32_t capacity = 0;
+    uint8_t result = 1;
+
+    if(list->count + more > list->capacity)
+    {
+        /* Grow geometrically so appending N entries costs O(N) */
+        capacity = list->capacity * 2;
+        if(capacity < list->count + more)
+        {
+            capacity = list->count + more;
+        }
+
+        grown = (t_direcroryEntry*)realloc(list->entries, capacity * sizeof(t_direcroryEntry));
+        if(grown == NULL)
+        {
+            fprintf(stderr, "The disk is empty.\n");
+            result = 0;
+        }
+        else
+        {
+            list->entries = grown;
+            list->capacity = capacity;
+        }
+    }
+
+    return result;
+}
+
+void freeDirList(t_dirList *list)
+{
+    free(list->entries);
+    list->entries = NULL;
+    list->count = 0;
+    list->capacity = 0;
+}
+
+static const uint8_t *getSectors(t_volume *vol, uint32_t index, uint32_t num, uint8_t **copy)
+{
+    const uint8_t *sector = NULL;
+
+    *copy = NULL;
+
+    /* Zero-copy access through the mapping */
+    sector = HAL_MapSectors(vol->device, index, num);
+
+    /* Sectors with pending writes need a private copy */
+    if((sector != NULL) && (applyDirtySectors(vol, index, num, NULL) > 0))
+    {
+        *copy = (uint8_t*)malloc(vol->bootInfo.bytsPerSec * num * sizeof(uint8_t));
+
+        if(*copy == NULL)
+        {
+            fprintf(stderr, "The disk is empty.\n");
+        }
+        else
+        {
+            memcpy(*copy, sector, vol->bootInfo.bytsPerSec * num);
+            applyDirtySectors(vol, index, num, *copy);
+        }
+        sector = *copy;
+    }
+    else if(sector == NULL)
+    {
+        /* Allocate some memory */
+        *copy = (uint8_t*)malloc(vol->bootInfo.bytsPerSec * num * sizeof(uint8_t));
+
+        if(*copy == NULL)
+        {
+            fprintf(stderr, "The disk is empty.\n");
+        }
+        else if(HAL_ReadMultiSector(vol->device, index, num, *copy) != vol->bootInfo.bytsPerSec * num)
+        {
+            free(*copy);
+            *copy = NULL;
+        }
+        else
+        {
+            applyDirtySectors(vol, index, num, *copy);
+            sector = *copy;
+        }
+    }
+
+    return sector;
+}
+
+void defaultVolumeConfig(t_volumeConfig *config)
+{
+    *config = s_defaultConfig;
+}
+
+t_volume* initFileFAT(const char *filePath, const t_volumeConfig *config)
+{
+    t_volume *vol = NULL;
+    const uint8_t *buff = NULL;
+    uint8_t *copy = NULL;
+    uint32_t totalSec = 0;
+    uint32_t fatSize = 0;
+    uint8_t thisFatType = 0;
+
+    if(config == NULL)
+    {
+        config = &s_defaultConfig;
+    }
+
+    /* Allocate some memory */
+    vol = (t_volume*)calloc(1, sizeof(t_volume));
+
+    if(vol == NULL)
+    {
+        fprintf(stderr, "The disk is empty.\n");
+    }
+    else if((vol->device = HAL_Init(filePath, &config->disk)) == NULL)
+    {
+        free(vol);
+        vol = NULL;
+    }
+    else
+    {
+        pthread_mutex_init(&vol->fatCache.lock, NULL);
+        pthread_mutex_init(&vol->dirCache.lock, NULL);
+
+        /* The boot sector is read with the default sector size */
+        vol->bootInfo.bytsPerSec = BYTE_PER_SECTOR;
+
+        /* Read the boot sector from the disk */
+        buff = getSectors(vol, 0, 1, &copy);
+
+        if(buff == NULL)
+        {
+            fprintf(stderr, "Read boot region error.\n");
+            deinitFileFAT(vol);
+            vol = NULL;
+        }
+    }
+
+    if(buff != NULL)
+    {
+        /* Store the information of the boot sector */
+        vol->bootInfo.bytsPerSec = LITTLE_ENDIAN(buff[0x0B], buff[0x0C]); /* Bytes per sector */
+        vol->bootInfo.secPerClus = buff[0x0D];                            /* Sectors per cluster */
+        vol->bootInfo.rsvdSecCnt = LITTLE_ENDIAN(buff[0x0E], buff[0x0F]); /* Reserved sector count */
+        vol->bootInfo.numFATs = buff[0x10];                               /* Number of FATs */
+        vol->bootInfo.rootEntCnt = LITTLE_ENDIAN(buff[0x11], buff[0x12]); /* Root directory entry count */
+        fatSize = LITTLE_ENDIAN(buff[0x16], buff[0x17]);                  /* FAT size in sectors */
+        totalSec = LITTLE_ENDIAN(buff[0x13], buff[0x14]);                 /* Total number of sectors in the file system */
+
+        /* If totalSec or fatSize is 0, read extended fields to get the actual values */
+        if(totalSec == 0)
+        {
+            totalSec = (uint32_t)(buff[0x23] << SHIFT_24_BIT)
+                        | (uint32_t)(buff[0x22] << SHIFT_16_BIT)
+                        | (uint32_t)(buff[0x21] << SHIFT_8_BIT)
+                        | buff[0x20];
+        }
+
+        if(fatSize == 0)
+        {
+            fatSize = (uint32_t)(buff[0x27] << SHIFT_24_BIT)
+                    | (uint32_t)(buff[0x26] << SHIFT_16_BIT)
+                    | (uint32_t)(buff[0x25] << SHIFT_8_BIT)
+                    | buff[0x24];
+        }
+
+        vol->bootInfo.FATsz = fatSize;
+        vol->bootInfo.totalSector = totalSec;
+    }
+
+    /* A sector or cluster size of zero is not a FAT boot sector */
+    if((buff != NULL) && ((vol->bootInfo.bytsPerSec == 0) || (vol->bootInfo.secPerClus == 0)))
+    {
+        fprintf(stderr, "Invalid boot sector.\n");
+        free(copy);
+        deinitFileFAT(vol);
+        vol = NULL;
+        buff = NULL;
+    }
+
+    if(buff != NULL)
+    {
+        /* Check the FAT type and set the root cluster for FAT_32 */
+        thisFatType = fatType(vol);
+        if(thisFatType == FAT_32)
+        {
+            vol->bootInfo.rootClus = (uint32_t)(buff[0x2F] << SHIFT_24_BIT)
+                                   | (uint32_t)(buff[0x2E] << SHIFT_16_BIT)
+                                   | (uint32_t)(buff[0x2D] << SHIFT_8_BIT)
+                                   | buff[0x2C];
+            vol->bootInfo.fsInfo = LITTLE_ENDIAN(buff[0x30], buff[0x31]);
+        }
+
+        free(copy);
+
+        /* Update the number of byte in a sector */
+        HAL_Update(vol->device, vol->bootInfo.bytsPerSec);
+
+        /* Locate each region and decode the FAT once for the whole mount */
+        localEachRegion(vol);
+        initFATCache(vol, config->fatCacheLimit);
+        vol->dirCache.limitBytes = config->dirCacheLimit;
+    }
+
+    return vol;
+}
+
+void deinitFileFAT(t_volume *vol)
+{
+    if(vol != NULL)
+    {
+        if(vol->writeCache.count > 0)
+        {
+            fatFlush(vol);
+        }
+        releaseWriteCache(vol);
+
+        free(vol->fatCache.table);
+        free(vol->fatCache.slotPage);
+        freeDirCache(vol);
+        pthread_mutex_destroy(&vol->fatCache.lock);
+        pthread_mutex_destroy(&vol->dirCache.lock);
+
+        HAL_Deinit(vol->device);
+        free(vol);
+    }
+}
+
+uint8_t fatType(t_volume *vol)
+{
+    uint8_t fatType = 0;
+    uint32_t totalClusters = 0;
+
+    /* The total number of clusters */
+    totalClusters = vol->bootInfo.totalSector/vol->bootInfo.secPerClus;
+
+    /* Check the total number of clusters to determine the FAT type */
+    if (totalClusters < FAT12_CLUST_COUNT)
+    {
+        fatType = FAT_12;
+    }
+    else
+    {
+        if(totalClusters < FAT16_CLUST_COUNT)
+        {
+            fatType = FAT_16;
+        }
+        else
+        {
+            fatType = FAT_32;
+        }
+
+    }
+
+    return fatType;
+}
+
+static void unpackScalar(const uint8_t *raw, uint32_t first, uint32_t count, uint32_t *out)
+{
+    uint32_t index = 0;
+    uint32_t cluster = 0;
+    uint32_t offset = 0;
+    uint32_t base = first + (first >> 1);
+
+    for(index = 0; index < count; index++)
+    {
+        cluster = first + index;
+        /* Multiply the cluster by 1.5 to get the FAT position */
+        offset = cluster + (cluster >> 1) - base;
+        /* If the cluster that index is odd */
+        if (cluster & 1)
+        {
+            out[index] = (raw[offset] >> SHIFT_4_BIT) | ((uint32_t)raw[offset + 1] << SHIFT_4_BIT);
+        }
+        /* If the cluster that index is even */
+        else
+        {
+            out[index] = (raw[offset]) | ((uint32_t)(raw[offset + 1] & 0x0F) << SHIFT_8_BIT);
+        }
+    }
+}
+
+#if defined(FAT_HAVE_X86)
+__attribute__((target("ssse3")))
+static uint32_t unpackSSSE3(const uint8_t *raw, uint32_t count, uint32_t *out)
+{
+    /* 16-bit lane 2k holds bytes 3k and 3k+1 (entry 2k in its low 12 bits),
+       lane 2k+1 holds bytes 3k+1 and 3k+2 (entry 2k+1 in its high 12 bits) */
+    const __m128i order = _mm_setr_epi8(0, 1, 1, 2, 3, 4, 4, 5, 6, 7, 7, 8, 9, 10, 10, 11);
+    const __m128i evenMask = _mm_set1_epi32(0x00000FFF);
+    const __m128i oddMask = _mm_set1_epi32((int)0xFFFF0000U);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i lanes;
+    __m128i entries;
+    uint32_t done = 0;
+
+    /* n entries from an even one span (3n + 1) / 2 bytes, a step loads 16 of them */
+    while((count - done) * 3 + 1 >= 32)
+    {
+        lanes = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(raw + done + (done >> 1))), order);
+        entries = _mm_or_si128(_mm_and_si128(lanes, evenMask),
+                               _mm_and_si128(_mm_srli_epi16(lanes, SHIFT_4_BIT), oddMask));
+
+        _mm_storeu_si128((__m128i*)(out + done), _mm_unpacklo_epi16(entries, zero));
+        _mm_storeu_si128((__m128i*)(out + done + 4), _mm_unpackhi_epi16(entries, zero));
+        done += 8;
+    }
+
+    return done;
+}
+
+__attribute__((target("avx2")))
+static uint32_t unpackAVX2(const uint8_t *raw, uint32_t count, uint32_t *out)
 {
-    p_EntryList current = NULL;
-    p_EntryList next = NULL;
+    /* The same order as unpackSSSE3, applied to each 128-bit half */
+    const __m256i order = _mm256_setr_epi8(0, 1, 1, 2, 3, 4, 4, 5, 6, 7, 7, 8, 9, 10, 10, 11,
+                                           0, 1, 1, 2, 3, 4, 4, 5, 6, 7, 7, 8, 9, 10, 10, 11);
+    const __m256i evenMask = _mm256_set1_epi32(0x00000FFF);
+    const __m256i oddMask = _mm256_set1_epi32((int)0xFFFF0000U);
+    const uint8_t *step = NULL;
+    __m256i lanes;
+    __m256i entries;
+    uint32_t done = 0;
+
+    /* The second half is loaded from 12 bytes in, so a step reads 28 bytes */
+    while((count - done) * 3 + 1 >= 56)
+    {
+        step = raw + done + (done >> 1);
+        lanes = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)step)),
+                                        _mm_loadu_si128((const __m128i*)(step + 12)), 1);
+        lanes = _mm256_shuffle_epi8(lanes, order);
+        entries = _mm256_or_si256(_mm256_and_si256(lanes, evenMask),
+                                  _mm256_and_si256(_mm256_srli_epi16(lanes, SHIFT_4_BIT), oddMask));
+
+        _mm256_storeu_si256((__m256i*)(out + done), _mm256_cvtepu16_epi32(_mm256_castsi256_si128(entries)));
+        _mm256_storeu_si256((__m256i*)(out + done + 8), _mm256_cvtepu16_epi32(_mm256_extracti128_si256(entries, 1)));
+        done += 16;
+    }
+
+    return done;
+}
+#endif
+
+static uint8_t pickFAT12Kernel(uint8_t kernel)
+{
+    uint8_t result = FAT12_KERNEL_SCALAR;
+
+#if defined(FAT_HAVE_X86)
+    if(((kernel == FAT12_KERNEL_AUTO) || (kernel == FAT12_KERNEL_AVX2)) && __builtin_cpu_supports("avx2"))
+    {
+        result = FAT12_KERNEL_AVX2;
+    }
+    else if(((kernel == FAT12_KERNEL_AUTO) || (kernel == FAT12_KERNEL_SSSE3)) && __builtin_cpu_supports("ssse3"))
+    {
+        result = FAT12_KERNEL_SSSE3;
+    }
+#else
+    (void)kernel;
+#endif
+
+    return result;
+}
+
+uint8_t unpackFAT12(const uint8_t *raw, uint32_t first, uint32_t count, uint8_t kernel, uint32_t *out)
+{
+    uint32_t skip = 0;
+    uint32_t done = 0;
+    uint8_t used = 0;
+
+    used = pickFAT12Kernel(kernel);
+
+    /* The kernels start on an even entry, the one after an odd entry begins 2 bytes further */
+    skip = ((first & 1) && (count > 0)) ? 1 : 0;
+    unpackScalar(raw, first, skip, out);
+    done = skip;
+
+#if defined(FAT_HAVE_X86)
+    if(used == FAT12_KERNEL_AVX2)
+    {
+        done += unpackAVX2(raw + skip * 2, count - skip, out + skip);
+    }
+    else if(used == FAT12_KERNEL_SSSE3)
+    {
+        done += unpackSSSE3(raw + skip * 2, count - skip, out + skip);
+    }
+#endif
+
+    /* The entries left over by the kernel */
+    unpackScalar(raw + (first + done) + ((first + done) >> 1) - (first + (first >> 1)),
+                 first + done, count - done, out + done);
+
+    return used;
+}
+
+t_location localEachRegion(t_volume *vol)
+{
+    /* FAT Region */
+    vol->local.FATStartSector = vol->bootInfo.rsvdSecCnt;
+    vol->local.sectorInFAT = vol->bootInfo.FATsz * vol->bootInfo.numFATs;
+    /* Root Directory Region */
+    vol->local.rootDirStartSector = vol->local.FATStartSector + vol->local.sectorInFAT;
+    vol->local.sectorInRootDir = ((SIZE_ROOT_ENTRY * vol->bootInfo.rootEntCnt) +
+                               (vol->bootInfo.bytsPerSec -1)) / vol->bootInfo.bytsPerSec;
+    /* Data Region */
+    vol->local.dataStartSector = vol->local.rootDirStartSector + vol->local.sectorInRootDir;
+
+    return vol->local;
+}
+
+static uint32_t lastClusterMark(t_volume *vol)
+{
+    uint32_t thisLastCluster = 0;
+
+    switch(fatType(vol))
+    {
+    case FAT_12:
+        thisLastCluster = LAST_CRUSTER_12;
+        break;
+    case FAT_16:
+        thisLastCluster = LAST_CRUSTER_16;
+        break;
+    case FAT_32:
+        thisLastCluster = LAST_CRUSTER_32;
+        break;
+    default:
+        break;
+    }
+
+    return thisLastCluster;
+}
+
+static uint8_t chainLoops(uint32_t cluster, uint32_t hops, uint32_t *mark)
+{
+    uint8_t result = 0;
+
+    if(cluster == *mark)
+    {
+        result = 1;
+    }
+    else if((hops & (hops - 1)) == 0)
+    {
+        *mark = cluster;
+    }
+
+    return result;
+}
+
+static void decodeFATEntries(t_volume *vol, const uint8_t *raw, uint32_t rawOffset, uint32_t first, uint32_t count, uint32_t *out)
+{
+    uint64_t start = 0;
+    uint32_t index = 0;
+    uint32_t cluster = 0;
+    uint32_t thisFATOffset = 0;
+    uint8_t thisFatType = 0;
+
+    start = STATS_START();
+    thisFatType = fatType(vol);
+
+    if(thisFatType == FAT_12)
+    {
+        /* Multiply the cluster by 1.5 to get the FAT position */
+        unpackFAT12(raw + (first + (first >> 1) - rawOffset), first, count, FAT12_KERNEL_AUTO, out);
+    }
+    else
+    {
+        for(index = 0; index < count; index++)
+        {
+            cluster = first + index;
+
+            switch(thisFatType)
+            {
+            case FAT_16:
+                /* Multiply the cluster by 2 to get the FAT position */
+                thisFATOffset = cluster * 2 - rawOffset;
+
+                out[index] = (uint32_t)(raw[thisFATOffset]) | ((uint32_t)raw[thisFATOffset + 1] << SHIFT_8_BIT);
+                break;
+            case FAT_32:
+                /* Multiply the cluster by 4 to get the FAT position */
+                thisFATOffset = cluster * 4 - rawOffset;
+
+                out[index] = (uint32_t)(raw[thisFATOffset])
+                           | ((uint32_t)raw[thisFATOffset + 1] << SHIFT_8_BIT)
+                           | ((uint32_t)raw[thisFATOffset + 2] << SHIFT_16_BIT)
+                           | ((uint32_t)(raw[thisFATOffset + 3] & 0x0F) << SHIFT_24_BIT);
+                break;
+            default:
+                out[index] = 0;
+                break;
+            }
+        }
+    }
+
+    STATS_RECORD(STATS_OP_FAT_DECODE, start, (uint64_t)count * sizeof(uint32_t));
+}
+
+uint8_t fillFATEntries(t_volume *vol, uint32_t first, uint32_t count, uint32_t *out)
+{
+    const uint8_t *raw = NULL;
+    uint8_t *copy = NULL;
+    uint32_t byteStart = 0;
+    uint32_t byteEnd = 0;
+    uint32_t firstSector = 0;
+    uint32_t numSector = 0;
+    uint32_t last = 0;
+    uint8_t result = 0;
+    uint8_t category = 0;
+
+    last = first + count - 1;
+
+    /* Byte range of the FAT holding the entries */
+    switch(fatType(vol))
+    {
+    case FAT_12:
+        byteStart = first + (first >> 1);
+        byteEnd = last + (last >> 1) + 2;
+        break;
+    case FAT_16:
+        byteStart = first * 2;
+        byteEnd = (last + 1) * 2;
+        break;
+    case FAT_32:
+        byteStart = first * 4;
+        byteEnd = (last + 1) * 4;
+        break;
+    default:
+        break;
+    }
+
+    firstSector = byteStart / vol->bootInfo.bytsPerSec;
+    numSector = ((byteEnd + vol->bootInfo.bytsPerSec - 1) / vol->bootInfo.bytsPerSec) - firstSector;
+
+    category = HAL_TraceCategory(HAL_TRACE_FAT);
+    raw = getSectors(vol, vol->bootInfo.rsvdSecCnt + firstSector, numSector, &copy);
+    HAL_TraceCategory(category);
+
+    if(raw == NULL)
+    {
+        fprintf(stderr, "Read FAT Region error.\n");
+    }
+    else
+    {
+        decodeFATEntries(vol, raw, firstSector * vol->bootInfo.bytsPerSec, first, count, out);
+        free(copy);
+        result = 1;
+    }
+
+    return result;
+}
+
+static void initFATCache(t_volume *vol, uint32_t limitBytes)
+{
+    uint32_t fatBytes = 0;
+    uint32_t index = 0;
+    uint32_t count = 0;
+    uint32_t chunk = 0;
+
+    /* The number of entries one FAT table can hold */
+    fatBytes = vol->bootInfo.FATsz * vol->bootInfo.bytsPerSec;
+    switch(fatType(vol))
+    {
+    case FAT_12:
+        vol->fatCache.numEntries = (uint32_t)(((uint64_t)fatBytes * 2) / 3);
+        break;
+    case FAT_16:
+        vol->fatCache.numEntries = fatBytes / 2;
+        break;
+    case FAT_32:
+        vol->fatCache.numEntries = fatBytes / 4;
+        break;
+    default:
+        vol->fatCache.numEntries = 0;
+        break;
+    }
+
+    if((limitBytes == FAT_CACHE_UNLIMITED) ||
+       ((uint64_t)vol->fatCache.numEntries * sizeof(uint32_t) <= limitBytes))
+    {
+        /* The whole FAT is resident: decode it now, a few pages per disk read */
+        HAL_Advise(vol->device, vol->bootInfo.rsvdSecCnt, vol->bootInfo.FATsz, HAL_ADVICE_SEQUENTIAL);
+        vol->fatCache.table = (uint32_t*)malloc(vol->fatCache.numEntries * sizeof(uint32_t));
+        if(vol->fatCache.table == NULL)
+        {
+            fprintf(stderr, "The disk is empty.\n");
+            vol->fatCache.numEntries = 0;
+        }
+        else
+        {
+            chunk = FAT_CACHE_PAGE_ENTRIES * FAT_CACHE_CHUNK_PAGES;
+            for(index = 0; index < vol->fatCache.numEntries; index += count)
+            {
+                count = vol->fatCache.numEntries - index;
+                if(count > chunk)
+                {
+                    count = chunk;
+                }
+
+                if(fillFATEntries(vol, index, count, &vol->fatCache.table[index]) == 0)
+                {
+                    /* Entries that could not be read end the chain */
+                    memset(&vol->fatCache.table[index], 0xFF, count * sizeof(uint32_t));
+                }
+            }
+        }
+    }
+    else
+    {
+        /* Bounded mode: pages are decoded on first use into a fixed number of slots */
+        HAL_Advise(vol->device, vol->bootInfo.rsvdSecCnt, vol->bootInfo.FATsz, HAL_ADVICE_RANDOM);
+        vol->fatCache.pageEntries = FAT_CACHE_PAGE_ENTRIES;
+        vol->fatCache.numSlots = limitBytes / (FAT_CACHE_PAGE_ENTRIES * sizeof(uint32_t));
+        if(vol->fatCache.numSlots == 0)
+        {
+            vol->fatCache.numSlots = 1;
+        }
+
+        vol->fatCache.table = (uint32_t*)malloc(vol->fatCache.numSlots * FAT_CACHE_PAGE_ENTRIES * sizeof(uint32_t));
+        vol->fatCache.slotPage = (uint32_t*)malloc(vol->fatCache.numSlots * sizeof(uint32_t));
+        if((vol->fatCache.table == NULL) || (vol->fatCache.slotPage == NULL))
+        {
+            fprintf(stderr, "The disk is empty.\n");
+            free(vol->fatCache.table);
+            free(vol->fatCache.slotPage);
+            vol->fatCache.table = NULL;
+            vol->fatCache.slotPage = NULL;
+            vol->fatCache.numEntries = 0;
+        }
+        else
+        {
+            memset(vol->fatCache.slotPage, 0xFF, vol->fatCache.numSlots * sizeof(uint32_t));
+        }
+    }
+}
+
+static uint32_t *loadFATPage(t_volume *vol, uint32_t page)
+{
+    uint32_t slot = 0;
+    uint32_t first = 0;
+    uint32_t count = 0;
+    uint32_t *entries = NULL;
+
+    /* Each page has exactly one slot it can live in */
+    slot = page % vol->fatCache.numSlots;
+    entries = &vol->fatCache.table[slot * FAT_CACHE_PAGE_ENTRIES];
+
+    if(vol->fatCache.slotPage[slot] != page)
+    {
+        first = page * FAT_CACHE_PAGE_ENTRIES;
+        count = vol->fatCache.numEntries - first;
+        if(count > FAT_CACHE_PAGE_ENTRIES)
+        {
+            count = FAT_CACHE_PAGE_ENTRIES;
+        }
+
+        vol->fatCache.slotPage[slot] = FAT_CACHE_NO_PAGE;
+        if(fillFATEntries(vol, first, count, entries) == 0)
+        {
+            entries = NULL;
+        }
+        else
+        {
+            vol->fatCache.slotPage[slot] = page;
+        }
+    }
+
+    return entries;
+}
+
+static uint32_t nextCluster(t_volume *vol, uint32_t cluster)
+{
+    uint64_t start = 0;
+    uint32_t thisEntryVal = 0;
+    uint32_t *entries = NULL;
+
+    start = STATS_START();
+
+    /* A cluster outside the FAT ends the chain */
+    if(cluster >= vol->fatCache.numEntries)
+    {
+        thisEntryVal = lastClusterMark(vol);
+    }
+    /* The whole FAT is resident */
+    else if(vol->fatCache.pageEntries == 0)
+    {
+        thisEntryVal = vol->fatCache.table[cluster];
+    }
+    else
+    {
+        /* Another thread may replace the page in the slot */
+        pthread_mutex_lock(&vol->fatCache.lock);
+        entries = loadFATPage(vol, cluster / vol->fatCache.pageEntries);
+        if(entries == NULL)
+        {
+            thisEntryVal = lastClusterMark(vol);
+        }
+        else
+        {
+            thisEntryVal = entries[cluster % vol->fatCache.pageEntries];
+        }
+        pthread_mutex_unlock(&vol->fatCache.lock);
+    }
+
+    STATS_RECORD(STATS_OP_FAT_LOOKUP, start, 0);
+
+    return thisEntryVal;
+}
+
+uint32_t getFATEntry(t_volume *vol, uint32_t cluster)
+{
+    return nextCluster(vol, cluster);
+}
+
+uint8_t setFATEntry(t_volume *vol, uint32_t cluster, uint32_t value)
+{
+    t_writeCache *cache = &vol->writeCache;
+    uint8_t *first = NULL;
+    uint8_t *second = NULL;
+    uint32_t bytsPerSec = vol->bootInfo.bytsPerSec;
+    uint32_t offset = 0;
+    uint32_t old = 0;
+    uint32_t page = 0;
+    uint32_t slot = 0;
+    uint8_t thisFatType = 0;
+    uint8_t result = 0;
+
+    thisFatType = fatType(vol);
+
+    /* Byte offset of the entry in the FAT */
+    switch(thisFatType)
+    {
+    case FAT_12:
+        offset = cluster + (cluster >> 1);
+        value &= END_CRUSTER_12;
+        break;
+    case FAT_16:
+        offset = cluster * 2;
+        value &= END_CRUSTER_16;
+        break;
+    case FAT_32:
+        offset = cluster * 4;
+        value &= MASK_CLUSTER_32;
+        break;
+    default:
+        break;
+    }
+
+    if((cluster < FIRST_CLUSTER) || (cluster >= vol->fatCache.numEntries))
+    {
+        fprintf(stderr, "Invalid cluster %u.\n", cluster);
+    }
+    /* A FAT12 entry can straddle two sectors, both are taken before either is changed */
+    else if(((first = getDirtySector(vol, vol->local.FATStartSector + (offset / bytsPerSec), 1)) == NULL) ||
+            ((thisFatType == FAT_12) && ((offset + 1) % bytsPerSec == 0) &&
+             ((second = getDirtySector(vol, vol->local.FATStartSector + (offset / bytsPerSec) + 1, 1)) == NULL)))
+    {
+        /* Nothing was changed */
+    }
+    else
+    {
+        old = nextCluster(vol, cluster);
+        offset %= bytsPerSec;
+
+        /* The second byte of a FAT12 entry is the next byte, or the first byte of the next sector */
+        if(second == NULL)
+        {
+            second = first + offset + 1;
+        }
+
+        switch(thisFatType)
+        {
+        case FAT_12:
+            /* Odd entries hold the high 12 bits of their 3 bytes, even entries the low 12 bits */
+            if((cluster & 1U) != 0)
+            {
+                first[offset] = (uint8_t)((first[offset] & 0x0FU) | ((value << SHIFT_4_BIT) & 0xF0U));
+                *second = (uint8_t)(value >> SHIFT_4_BIT);
+            }
+            else
+            {
+                first[offset] = (uint8_t)value;
+                *second = (uint8_t)((*second & 0xF0U) | ((value >> SHIFT_8_BIT) & 0x0FU));
+            }
+            break;
+        case FAT_16:
+            storeLittleEndian(first + offset, value, 2);
+            break;
+        case FAT_32:
+            /* The top 4 bits are reserved and kept */
+            storeLittleEndian(first + offset, value | (((uint32_t)first[offset + 3] & 0xF0U) << SHIFT_24_BIT), 4);
+            break;
+        default:
+            break;
+        }
+
+        /* Keep the decoded FAT in step */
+        if(vol->fatCache.pageEntries == 0)
+        {
+            vol->fatCache.table[cluster] = value;
+        }
+        else
+        {
+            /* Only a resident page is changed, the others are decoded from the cached sectors */
+            page = cluster / vol->fatCache.pageEntries;
+            slot = page % vol->fatCache.numSlots;
+            pthread_mutex_lock(&vol->fatCache.lock);
+            if(vol->fatCache.slotPage[slot] == page)
+            {
+                vol->fatCache.table[(slot * vol->fatCache.pageEntries) + (cluster % vol->fatCache.pageEntries)] = value;
+            }
+            pthread_mutex_unlock(&vol->fatCache.lock);
+        }
+
+        /* Keep the allocator bitmap in step */
+        if((cache->freeMap != NULL) && (cluster < cache->numClusters) && ((old == FREE_CLUSTER) != (value == FREE_CLUSTER)))
+        {
+            cache->freeMap[cluster / FREE_MAP_GROUP] ^= 1ULL << (cluster % FREE_MAP_GROUP);
+            if(value == FREE_CLUSTER)
+            {
+                cache->freeClusters++;
+            }
+            else
+            {
+                cache->freeClusters--;
+            }
+        }
+
+        /* A freed cluster may be reused for data, its old directory slots must not be written over it */
+        if((old != FREE_CLUSTER) && (value == FREE_CLUSTER))
+        {
+            dropDirtySectors(vol, ((cluster - FIRST_CLUSTER) * vol->bootInfo.secPerClus) + vol->local.dataStartSector,
+                             vol->bootInfo.secPerClus);
+        }
+
+        cache->fatChanged = 1;
+        result = 1;
+    }
+
+    return result;
+}
+
+static void storeLittleEndian(uint8_t *buff, uint32_t value, uint32_t size)
+{
+    uint32_t index = 0;
+
+    for(index = 0; index < size; index++)
+    {
+        buff[index] = (uint8_t)(value >> (index * SHIFT_8_BIT));
+    }
+}
+
+static uint32_t hashSector(const t_writeCache *cache, uint32_t sector)
+{
+    /* Fibonacci hashing spreads neighbouring sectors over the slots */
+    return (uint32_t)(((uint64_t)sector * 0x9E3779B97F4A7C15ULL) >> 32) & (cache->indexSize - 1);
+}
+
+static uint32_t findDirtySector(const t_writeCache *cache, uint32_t sector)
+{
+    uint32_t slot = 0;
+    uint32_t position = DIR_INDEX_EMPTY;
+
+    if(cache->count > 0)
+    {
+        slot = hashSector(cache, sector);
+        while((cache->index[slot] != DIR_INDEX_EMPTY) && (cache->sectors[cache->index[slot]].sector != sector))
+        {
+            slot = (slot + 1) & (cache->indexSize - 1);
+        }
+        position = cache->index[slot];
+    }
+
+    return position;
+}
+
+static uint8_t growWriteCache(t_writeCache *cache)
+{
+    t_dirtySector *sectors = NULL;
+    uint32_t *index = NULL;
+    uint32_t capacity = 0;
+    uint32_t size = 0;
+    uint32_t position = 0;
+    uint32_t slot = 0;
+    uint8_t result = 1;
+
+    if(cache->count == cache->capacity)
+    {
+        capacity = (cache->capacity == 0) ? WRITE_CACHE_INIT_SIZE : (cache->capacity * 2);
+        sectors = (t_dirtySector*)realloc(cache->sectors, capacity * sizeof(t_dirtySector));
+        if(sectors == NULL)
+        {
+            fprintf(stderr, "The disk is empty.\n");
+            result = 0;
+        }
+        else
+        {
+            cache->sectors = sectors;
+            cache->capacity = capacity;
+        }
+    }
+
+    /* Keep the index at most half full so probe sequences stay short */
+    if((result == 1) && ((cache->count + 1) * 2 > cache->indexSize))
+    {
+        size = (cache->indexSize == 0) ? (WRITE_CACHE_INIT_SIZE * 2) : (cache->indexSize * 2);
+        index = (uint32_t*)malloc(size * sizeof(uint32_t));
+        if(index == NULL)
+        {
+            fprintf(stderr, "The disk is empty.\n");
+            result = 0;
+        }
+        else
+        {
+            free(cache->index);
+            cache->index = index;
+            cache->indexSize = size;
+            memset(cache->index, 0xFF, size * sizeof(uint32_t));
+
+            for(position = 0; position < cache->count; position++)
+            {
+                slot = hashSector(cache, cache->sectors[position].sector);
+                while(cache->index[slot] != DIR_INDEX_EMPTY)
+                {
+                    slot = (slot + 1) & (size - 1);
+                }
+                cache->index[slot] = position;
+            }
+        }
+    }
+
+    return result;
+}
+
+uint8_t *getDirtySector(t_volume *vol, uint32_t sector, uint8_t load)
+{
+    t_writeCache *cache = &vol->writeCache;
+    uint8_t *data = NULL;
+    uint32_t position = 0;
+    uint32_t slot = 0;
+
+    position = findDirtySector(cache, sector);
+
+    if(vol->device->writable == 0)
+    {
+        fprintf(stderr, "The image is read-only.\n");
+    }
+    else if((position != DIR_INDEX_EMPTY) && (cache->sectors[position].data != NULL))
+    {
+        data = cache->sectors[position].data;
+    }
+    else if((position == DIR_INDEX_EMPTY) && (growWriteCache(cache) == 0))
+    {
+        /* No room for one more sector */
+    }
+    else if((data = (uint8_t*)malloc(vol->bootInfo.bytsPerSec)) == NULL)
+    {
+        fprintf(stderr, "The disk is empty.\n");
+    }
+    else if((load == 1) && (HAL_ReadSector(vol->device, sector, data) != vol->bootInfo.bytsPerSec))
+    {
+        fprintf(stderr, "Read sector %u error.\n", sector);
+        free(data);
+        data = NULL;
+    }
+    else
+    {
+        if(load == 0)
+        {
+            memset(data, 0, vol->bootInfo.bytsPerSec);
+        }
+
+        /* A dropped sector gets its place back */
+        if(position == DIR_INDEX_EMPTY)
+        {
+            position = cache->count;
+            cache->sectors[position].sector = sector;
+            cache->count++;
+
+            slot = hashSector(cache, sector);
+            while(cache->index[slot] != DIR_INDEX_EMPTY)
+            {
+                slot = (slot + 1) & (cache->indexSize - 1);
+            }
+            cache->index[slot] = position;
+        }
+        cache->sectors[position].data = data;
+    }
+
+    return data;
+}
+
+static uint32_t applyDirtySectors(t_volume *vol, uint32_t index, uint32_t num, uint8_t *buff)
+{
+    const t_writeCache *cache = &vol->writeCache;
+    uint32_t found = 0;
+    uint32_t position = 0;
+    uint32_t sector = 0;
+
+    /* Probe each sector of a short range, walk the pending sectors for a long one */
+    if((cache->count > 0) && (num <= cache->count))
+    {
+        for(sector = index; sector < index + num; sector++)
+        {
+            position = findDirtySector(cache, sector);
+            if((position != DIR_INDEX_EMPTY) && (cache->sectors[position].data != NULL))
+            {
+                if(buff != NULL)
+                {
+                    memcpy(buff + ((size_t)(sector - index) * vol->bootInfo.bytsPerSec), cache->sectors[position].data, vol->bootInfo.bytsPerSec);
+                }
+                found++;
+            }
+        }
+    }
+    else
+    {
+        for(position = 0; position < cache->count; position++)
+        {
+            sector = cache->sectors[position].sector;
+            if((cache->sectors[position].data != NULL) && (sector >= index) && (sector - index < num))
+            {
+                if(buff != NULL)
+                {
+                    memcpy(buff + ((size_t)(sector - index) * vol->bootInfo.bytsPerSec), cache->sectors[position].data, vol->bootInfo.bytsPerSec);
+                }
+                found++;
+            }
+        }
+    }
+
+    return found;
+}
+
+static void dropDirtySectors(t_volume *vol, uint32_t index, uint32_t num)
+{
+    t_writeCache *cache = &vol->writeCache;
+    uint32_t position = 0;
+    uint32_t sector = 0;
+
+    for(sector = index; (cache->count > 0) && (sector < index + num); sector++)
+    {
+        position = findDirtySector(cache, sector);
+        if(position != DIR_INDEX_EMPTY)
+        {
+            /* The slot stays in the index, the sector is simply not written */
+            free(cache->sectors[position].data);
+            cache->sectors[position].data = NULL;
+        }
+    }
+}
+
+static int compareDirtySectors(const void *left, const void *right)
+{
+    const t_dirtySector *first = *(const t_dirtySector *const *)left;
+    const t_dirtySector *second = *(const t_dirtySector *const *)right;
+
+    return (first->sector > second->sector) - (first->sector < second->sector);
+}
+
+static uint8_t writeDirtyRuns(t_volume *vol, t_dirtySector **order, uint32_t first, uint32_t last, uint32_t shift, uint64_t *bytes)
+{
+    struct iovec iov[WRITE_FLUSH_MAX_RUN];
+    uint32_t bytsPerSec = vol->bootInfo.bytsPerSec;
+    uint32_t index = first;
+    uint32_t run = 0;
+    uint32_t written = 0;
+    uint8_t result = 1;
+
+    while((result == 1) && (index < last))
+    {
+        /* Gather the sectors that follow each other on the disk */
+        run = 0;
+        do
+        {
+            iov[run].iov_base = order[index + run]->data;
+            iov[run].iov_len = bytsPerSec;
+            run++;
+        } while((index + run < last) && (run < WRITE_FLUSH_MAX_RUN) &&
+                (order[index + run]->sector == order[index]->sector + run));
+
+        written = HAL_WriteVector(vol->device, order[index]->sector + shift, iov, (int)run);
+        *bytes += written;
+        if(written != run * bytsPerSec)
+        {
+            result = 0;
+        }
+
+        index += run;
+    }
+
+    return result;
+}
+
+static void updateFSInfo(t_volume *vol)
+{
+    const t_writeCache *cache = &vol->writeCache;
+    uint8_t *buff = NULL;
+    uint32_t lead = 0;
+    uint32_t struc = 0;
+
+    if((fatType(vol) == FAT_32) && (vol->bootInfo.fsInfo != 0) &&
+       ((buff = getDirtySector(vol, vol->bootInfo.fsInfo, 1)) != NULL))
+    {
+        lead = LITTLE_ENDIAN(buff[0], buff[1]) | (LITTLE_ENDIAN(buff[2], buff[3]) << SHIFT_16_BIT);
+        struc = LITTLE_ENDIAN(buff[FSINFO_STRUC_OFFSET], buff[FSINFO_STRUC_OFFSET + 1])
+              | (LITTLE_ENDIAN(buff[FSINFO_STRUC_OFFSET + 2], buff[FSINFO_STRUC_OFFSET + 3]) << SHIFT_16_BIT);
+
+        /* A sector without its signatures is not an FSInfo sector, it is written back as it was */
+        if((lead == FSINFO_LEAD_SIG) && (struc == FSINFO_STRUC_SIG))
+        {
+            storeLittleEndian(buff + FSINFO_FREE_COUNT, (cache->freeMap != NULL) ? cache->freeClusters : FSINFO_UNKNOWN, 4);
+            storeLittleEndian(buff + FSINFO_NEXT_FREE, (cache->freeMap != NULL) ? cache->nextFree : FSINFO_UNKNOWN, 4);
+        }
+    }
+}
+
+uint8_t fatReadSectors(t_volume *vol, uint32_t index, uint32_t num, uint8_t *buff)
+{
+    uint8_t result = 0;
+
+    if(HAL_ReadMultiSector(vol->device, index, num, buff) == num * vol->bootInfo.bytsPerSec)
+    {
+        applyDirtySectors(vol, index, num, buff);
+        result = 1;
+    }
+
+    return result;
+}
+
+uint8_t fatFlush(t_volume *vol)
+{
+    t_writeCache *cache = &vol->writeCache;
+    t_dirtySector **order = NULL;
+    uint64_t start = 0;
+    uint64_t bytes = 0;
+    uint32_t numLive = 0;
+    uint32_t fatBegin = 0;
+    uint32_t fatEnd = 0;
+    uint32_t index = 0;
+    uint8_t category = 0;
+    uint8_t result = 1;
+
+    start = STATS_START();
+
+    if(cache->fatChanged == 1)
+    {
+        updateFSInfo(vol);
+    }
+
+    if(cache->count > 0)
+    {
+        order = (t_dirtySector**)malloc(cache->count * sizeof(t_dirtySector*));
+        if(order == NULL)
+        {
+            fprintf(stderr, "The disk is empty.\n");
+            result = 0;
+        }
+        else
+        {
+            for(index = 0; index < cache->count; index++)
+            {
+                if(cache->sectors[index].data != NULL)
+                {
+                    order[numLive++] = &cache->sectors[index];
+                }
+            }
+
+            /* Sorted sectors turn into a few long sequential writes */
+            qsort(order, numLive, sizeof(t_dirtySector*), compareDirtySectors);
+
+            while((fatBegin < numLive) && (order[fatBegin]->sector < vol->local.FATStartSector))
+            {
+                fatBegin++;
+            }
+            fatEnd = fatBegin;
+            while((fatEnd < numLive) && (order[fatEnd]->sector < vol->local.FATStartSector + vol->bootInfo.FATsz))
+            {
+                fatEnd++;
+            }
+
+            /* The reserved sectors, every FAT table, then the directories, in disk order */
+            category = HAL_TraceCategory(HAL_TRACE_OTHER);
+            result = writeDirtyRuns(vol, order, 0, fatBegin, 0, &bytes);
+            HAL_TraceCategory(HAL_TRACE_FAT);
+            for(index = 0; (result == 1) && (index < vol->bootInfo.numFATs); index++)
+            {
+                result = writeDirtyRuns(vol, order, fatBegin, fatEnd, index * vol->bootInfo.FATsz, &bytes);
+            }
+            HAL_TraceCategory(HAL_TRACE_DIR);
+            if(result == 1)
+            {
+                result = writeDirtyRuns(vol, order, fatEnd, numLive, 0, &bytes);
+            }
+            HAL_TraceCategory(category);
+
+            if((result == 1) && (HAL_Sync(vol->device) == 0))
+            {
+                fprintf(stderr, "Failed to sync the image.\n");
+                result = 0;
+            }
+
+            free(order);
+        }
+    }
+
+    /* Everything is on the disk, the cache starts empty */
+    if((result == 1) && (cache->count > 0))
+    {
+        for(index = 0; index < cache->count; index++)
+        {
+            free(cache->sectors[index].data);
+        }
+        cache->count = 0;
+        memset(cache->index, 0xFF, cache->indexSize * sizeof(uint32_t));
+    }
+
+    if(result == 1)
+    {
+        cache->fatChanged = 0;
+    }
+
+    STATS_RECORD(STATS_OP_FLUSH, start, bytes);
+
+    return result;
+}
+
+static void releaseWriteCache(t_volume *vol)
+{
+    uint32_t index = 0;
+
+    for(index = 0; index < vol->writeCache.count; index++)
+    {
+        free(vol->writeCache.sectors[index].data);
+    }
+
+    free(vol->writeCache.sectors);
+    free(vol->writeCache.index);
+    free(vol->writeCache.freeMap);
+    memset(&vol->writeCache, 0, sizeof(t_writeCache));
+}
+
+void parseDirEntry(t_volume *vol, const uint8_t *buff, t_direcroryEntry *entry)
+{
+    /* Store the information of the current directory entry */
+    memcpy(entry->fileName, buff, SIZE_OF_NAME);
+    entry->attributes = buff[0x0B];
+    entry->writeTime = LITTLE_ENDIAN(buff[0x16], buff[0x17]);
+    entry->writeDate = LITTLE_ENDIAN(buff[0x18], buff[0x19]);
+    entry->startCluster = LITTLE_ENDIAN(buff[0x1A], buff[0x1B]);
+    /* FAT32 keeps the high word of the first cluster at 0x14 */
+    if(fatType(vol) == FAT_32)
+    {
+        entry->startCluster |= LITTLE_ENDIAN(buff[0x14], buff[0x15]) << SHIFT_16_BIT;
+    }
+    entry->fileSize = (uint32_t)(buff[0x1F] << SHIFT_24_BIT)
+                    | (uint32_t)(buff[0x1E] << SHIFT_16_BIT)
+                    | (uint32_t)(buff[0x1D] << SHIFT_8_BIT)
+                    | buff[0x1C];
+}
+
+void storeDirEntry(t_volume *vol, const t_direcroryEntry *entry, uint8_t *buff)
+{
+    memcpy(buff, entry->fileName, SIZE_OF_NAME);
+    buff[0x0B] = entry->attributes;
+    storeLittleEndian(&buff[0x16], entry->writeTime, 2);
+    storeLittleEndian(&buff[0x18], entry->writeDate, 2);
+    storeLittleEndian(&buff[0x1A], entry->startCluster & 0xFFFFU, 2);
+    /* FAT32 keeps the high word of the first cluster at 0x14 */
+    if(fatType(vol) == FAT_32)
+    {
+        storeLittleEndian(&buff[0x14], entry->startCluster >> SHIFT_16_BIT, 2);
+    }
+    storeLittleEndian(&buff[0x1C], entry->fileSize, 4);
+}
+
+static uint8_t appendDirEntries(t_volume *vol, t_dirList *list, const uint8_t *buff, uint32_t size)
+{
+    uint64_t start = 0;
+    uint32_t index = 0;
+    uint8_t attributes = 0;
+    uint8_t result = 0;
+
+    start = STATS_START();
+
+    /* Make room for every slot of the buffer at once */
+    if(reserveDirList(list, size / SIZE_ROOT_ENTRY) == 1)
+    {
+        result = 1;
+        while(index < size)
+        {
+            attributes = buff[index + 0x0B];
+
+            /* Append the entry if this is a file or a directory, whatever its hidden,
+               system, read-only or archive bits; long name slots and the volume
+               label both have the volume bit set */
+            if(((attributes & ATTR_VOLUME_ID) == 0) &&
+                buff[index] != INVALID_FILE_NAME &&
+                buff[index] != DELETED_FILE_NAME)
+            {
+                parseDirEntry(vol, &buff[index], &list->entries[list->count]);
+                list->count++;
+            }
+
+            /* Point to next entry address */
+            index += SIZE_ROOT_ENTRY;
+        }
+    }
+
+    STATS_RECORD(STATS_OP_DIR_PARSE, start, size);
+
+    return result;
+}
+
+uint8_t readDirEntry(t_volume *vol, t_dirList *list, uint32_t startEntry)
+{
+    const uint8_t *buff = NULL;
+    uint8_t *copy = NULL;
+    uint32_t num = 0;
+    uint8_t thisFatType = 0;
+    uint8_t category = 0;
+    uint8_t result = 0;
+
+    thisFatType = fatType(vol);
+    switch(thisFatType)
+    {
+    case FAT_12:
+    case FAT_16:
+        if(startEntry == vol->local.rootDirStartSector)
+        {
+            num = vol->local.sectorInRootDir;
+        }
+        else
+        {
+            num = vol->bootInfo.secPerClus;
+        }
+        break;
+    case FAT_32:
+        num = vol->bootInfo.secPerClus;
+        break;
+    default:
+        break;
+    }
+
+    /* Read the number of sector to the address of the entry */
+    category = HAL_TraceCategory(HAL_TRACE_DIR);
+    buff = getSectors(vol, startEntry, num, &copy);
+    HAL_TraceCategory(category);
+
+    if(buff == NULL)
+    {
+        fprintf(stderr, "Read Directory Entry error.\n");
+    }
+    else
+    {
+        result = appendDirEntries(vol, list, buff, num * vol->bootInfo.bytsPerSec);
+        free(copy);
+    }
+
+    return result;
+}
+
+uint8_t loadDirEntry(t_volume *vol, t_dirList *list, uint32_t startCluster)
+{
+    t_dirNode *node = NULL;
+    uint64_t start = 0;
+    uint8_t result = 1;
+
+    start = STATS_START();
+
+    /* ".." of a first level directory holds cluster 0 even on FAT32 */
+    if(startCluster == 0)
+    {
+        startCluster = rootCluster(vol);
+    }
+
+    pthread_mutex_lock(&vol->dirCache.lock);
+    node = getDirNode(vol, startCluster);
+
+    if(node != NULL)
+    {
+        list->count = 0;
+        if((node->list.count > 0) && (reserveDirList(list, node->list.count) == 1))
+        {
+            memcpy(list->entries, node->list.entries, node->list.count * sizeof(t_direcroryEntry));
+            list->count = node->list.count;
+        }
+        else if(node->list.count > 0)
+        {
+            result = 0;
+        }
+    }
+    pthread_mutex_unlock(&vol->dirCache.lock);
+
+    if(node == NULL)
+    {
+        /* Out of memory for the cache or a read failed, read the directory straight into the list */
+        result = readDirChain(vol, list, startCluster);
+    }
+
+    STATS_RECORD(STATS_OP_DIR_LOAD, start, (uint64_t)list->count * sizeof(t_direcroryEntry));
+
+    return result;
+}
+
+static uint32_t rootCluster(t_volume *vol)
+{
+    uint32_t cluster = 0;
+
+    if(fatType(vol) == FAT_32)
+    {
+        cluster = vol->bootInfo.rootClus;
+    }
+
+    return cluster;
+}
+
+uint8_t fatPackName(const char *name, uint32_t length, uint8_t *packed)
+{
+    uint32_t index = 0;
+    uint32_t pos = 0;
+    uint32_t limit = NAME_BASE_LENGTH;
+    uint8_t result = 1;
+
+    memset(packed, ' ', SIZE_OF_NAME);
+
+    /* "." and ".." are stored as they are */
+    if(((length == 1) || (length == 2)) && (memcmp(name, "..", length) == 0))
+    {
+        memcpy(packed, name, length);
+    }
+    else if(length == 0)
+    {
+        result = 0;
+    }
+    else
+    {
+        for(index = 0; (index < length) && (result == 1); index++)
+        {
+            /* The first dot after the base starts the extension */
+            if((name[index] == '.') && (limit == NAME_BASE_LENGTH) && (pos > 0))
+            {
+                pos = NAME_BASE_LENGTH;
+                limit = SIZE_OF_NAME;
+            }
+            /* A name that is too long or has another dot cannot be an 8.3 name */
+            else if((name[index] == '.') || (pos >= limit))
+            {
+                result = 0;
+            }
+            else
+            {
+                packed[pos] = (uint8_t)toupper((unsigned char)name[index]);
+                pos++;
+            }
+        }
+    }
+
+    return result;
+}
+
+static uint32_t hashName(const uint8_t *name)
+{
+    uint32_t hash = 2166136261U;
+    uint32_t index = 0;
+
+    for(index = 0; index < SIZE_OF_NAME; index++)
+    {
+        hash ^= name[index];
+        hash *= 16777619U;
+    }
+
+    return hash;
+}
+
+static uint8_t buildNameIndex(t_dirNode *node)
+{
+    uint32_t size = 1;
+    uint32_t index = 0;
+    uint32_t slot = 0;
+    uint8_t result = 0;
+
+    /* Keep the table at most half full so probe sequences stay short */
+    while(size < node->list.count * 2)
+    {
+        size <<= 1;
+    }
+
+    node->nameIndex = (uint32_t*)malloc(size * sizeof(uint32_t));
+    if(node->nameIndex == NULL)
+    {
+        fprintf(stderr, "The disk is empty.\n");
+    }
+    else
+    {
+        memset(node->nameIndex, 0xFF, size * sizeof(uint32_t));
+        node->indexSize = size;
+
+        for(index = 0; index < node->list.count; index++)
+        {
+            slot = hashName(node->list.entries[index].fileName) & (size - 1);
+            while((node->nameIndex[slot] != DIR_INDEX_EMPTY) &&
+                  (memcmp(node->list.entries[node->nameIndex[slot]].fileName,
+                          node->list.entries[index].fileName, SIZE_OF_NAME) != 0))
+            {
+                slot = (slot + 1) & (size - 1);
+            }
+
+            /* On a duplicated name the first entry wins, as in a linear scan */
+            if(node->nameIndex[slot] == DIR_INDEX_EMPTY)
+            {
+                node->nameIndex[slot] = index;
+            }
+        }
+
+        result = 1;
+    }
+
+    return result;
+}
+
+static uint32_t findName(const t_dirNode *node, const uint8_t *packed)
+{
+    uint32_t slot = 0;
+
+    slot = hashName(packed) & (node->indexSize - 1);
+    while((node->nameIndex[slot] != DIR_INDEX_EMPTY) &&
+          (memcmp(node->list.entries[node->nameIndex[slot]].fileName, packed, SIZE_OF_NAME) != 0))
+    {
+        slot = (slot + 1) & (node->indexSize - 1);
+    }
+
+    return node->nameIndex[slot];
+}
+
+static uint32_t hashCluster(const t_dirCache *cache, uint32_t cluster)
+{
+    /* Fibonacci hashing spreads neighbouring clusters over the buckets */
+    return (uint32_t)(((uint64_t)cluster * 0x9E3779B97F4A7C15ULL) >> 32) & (cache->numBuckets - 1);
+}
+
+static uint8_t growDirCache(t_volume *vol)
+{
+    t_dirCache grown = {0};
+    t_dirNode *node = NULL;
+    t_dirNode *next = NULL;
+    uint32_t index = 0;
+    uint32_t bucket = 0;
+    uint8_t result = 0;
+
+    grown = vol->dirCache;
+    grown.numBuckets = (vol->dirCache.numBuckets == 0) ? DIR_CACHE_INIT_BUCKETS : (vol->dirCache.numBuckets * 2);
+    grown.buckets = (t_dirNode**)calloc(grown.numBuckets, sizeof(t_dirNode*));
+
+    if(grown.buckets == NULL)
+    {
+        fprintf(stderr, "The disk is empty.\n");
+    }
+    else
+    {
+        /* Move every node to its bucket in the new table */
+        for(index = 0; index < vol->dirCache.numBuckets; index++)
+        {
+            node = vol->dirCache.buckets[index];
+            while(node != NULL)
+            {
+                next = node->hashNext;
+                bucket = hashCluster(&grown, node->cluster);
+                node->hashNext = grown.buckets[bucket];
+                grown.buckets[bucket] = node;
+                node = next;
+            }
+        }
+
+        /* Only the table changes hands; the lock is held, and waiters may change its state */
+        free(vol->dirCache.buckets);
+        vol->dirCache.buckets = grown.buckets;
+        vol->dirCache.numBuckets = grown.numBuckets;
+        result = 1;
+    }
+
+    return result;
+}
+
+static void linkDirNode(t_dirCache *cache, t_dirNode *node)
+{
+    node->prev = NULL;
+    node->next = cache->mru;
+
+    if(cache->mru != NULL)
+    {
+        cache->mru->prev = node;
+    }
+    else
+    {
+        cache->lru = node;
+    }
+
+    cache->mru = node;
+}
+
+static void unlinkDirNode(t_dirCache *cache, t_dirNode *node)
+{
+    if(node->prev != NULL)
+    {
+        node->prev->next = node->next;
+    }
+    else
+    {
+        cache->mru = node->next;
+    }
+
+    if(node->next != NULL)
+    {
+        node->next->prev = node->prev;
+    }
+    else
+    {
+        cache->lru = node->prev;
+    }
+
+    node->prev = NULL;
+    node->next = NULL;
+}
+
+static void evictDirNode(t_dirCache *cache, t_dirNode *node)
+{
+    t_dirNode **link = NULL;
+
+    /* Unchain the node from its bucket */
+    link = &cache->buckets[hashCluster(cache, node->cluster)];
+    while(*link != node)
+    {
+        link = &(*link)->hashNext;
+    }
+    *link = node->hashNext;
+
+    unlinkDirNode(cache, node);
+    cache->usedBytes -= node->bytes;
+    cache->numNodes--;
+
+    freeDirList(&node->list);
+    free(node->nameIndex);
+    free(node);
+}
+
+void invalidateDirCache(t_volume *vol, uint32_t cluster)
+{
+    t_dirNode *node = NULL;
+
+    pthread_mutex_lock(&vol->dirCache.lock);
+    node = findDirNode(&vol->dirCache, cluster);
+    if(node != NULL)
+    {
+        evictDirNode(&vol->dirCache, node);
+    }
+    pthread_mutex_unlock(&vol->dirCache.lock);
+}
+
+uint8_t readDirChain(t_volume *vol, t_dirList *list, uint32_t startCluster)
+{
+    t_extent *extents = NULL;
+    uint8_t *buff = NULL;
+    uint32_t numExtents = 0;
+    uint32_t numClusters = 0;
+    uint32_t startEntry = 0;
+    uint32_t index = 0;
+    uint32_t temp = 0;
+    uint32_t hops = 0;
+    uint32_t loopMark = 0;
+    uint8_t thisFatType = 0;
+    uint32_t thisLastCluster = 0;
+    uint64_t start = 0;
+    uint8_t category = 0;
+    uint8_t result = 1;
+
+    start = STATS_START();
+    temp = startCluster;
+    thisFatType = fatType(vol);
+
+    /* Empty the list, its memory is kept for the new entries */
+    list->count = 0;
+
+    /* The root directory of FAT32 is a cluster chain starting at rootClus */
+    if((thisFatType == FAT_32) && (temp == 0))
+    {
+        temp = vol->bootInfo.rootClus;
+    }
+
+    /* Determine the value of the last cluster based on the FAT type */
+    thisLastCluster = lastClusterMark(vol);
+
+    /* With a read queue, read the whole chain at once instead of one cluster at a time;
+       pending writes are applied by the cluster at a time path */
+    if((temp != 0) && (vol->device->ring != NULL) && (vol->writeCache.count == 0))
+    {
+        numExtents = buildExtentList(vol, temp, &extents);
+        for(index = 0; index < numExtents; index++)
+        {
+            numClusters += extents[index].length;
+        }
+
+        /* Without a list, memory ran out: the chain is read a cluster at a time */
+        if(numExtents > 0)
+        {
+            buff = (uint8_t*)malloc((uint64_t)numClusters * vol->bootInfo.secPerClus * vol->bootInfo.bytsPerSec);
+        }
+        if(buff != NULL)
+        {
+            category = HAL_TraceCategory(HAL_TRACE_DIR);
+            if(readExtents(vol, extents, numExtents, buff) == 1)
+            {
+                result = appendDirEntries(vol, list, buff, numClusters * vol->bootInfo.secPerClus * vol->bootInfo.bytsPerSec);
+            }
+            else
+            {
+                fprintf(stderr, "Read Directory Entry error.\n");
+                result = 0;
+            }
+            HAL_TraceCategory(category);
+
+            /* The chain has been read */
+            temp = thisLastCluster;
+            free(buff);
+        }
+
+        free(extents);
+    }
+
+    /* A chain cannot be longer than the FAT */
+    loopMark = temp;
+    while ((temp < thisLastCluster) && (hops <= vol->fatCache.numEntries))
+    {
+        if(temp == 0)
+        {
+            startEntry = vol->local.rootDirStartSector;
+            temp = thisLastCluster;
+        }
+        else
+        {
+            startEntry = ((temp - FIRST_CLUSTER)* vol->bootInfo.secPerClus) + vol->local.dataStartSector;
+            temp = nextCluster(vol, temp); /* next cluster */
+        }
+
+        /* Read content in directory, the other clusters are still read after a failure */
+        if(readDirEntry(vol, list, startEntry) == 0)
+        {
+            result = 0;
+        }
+        hops++;
+
+        if(chainLoops(temp, hops, &loopMark) == 1)
+        {
+            temp = thisLastCluster;
+        }
+    }
+
+    STATS_RECORD(STATS_OP_DIR_READ, start, (uint64_t)list->count * sizeof(t_direcroryEntry));
+
+    return result;
+}
+
+static t_dirNode *findDirNode(const t_dirCache *cache, uint32_t cluster)
+{
+    t_dirNode *node = NULL;
+
+    if(cache->numBuckets > 0)
+    {
+        node = cache->buckets[hashCluster(cache, cluster)];
+        while((node != NULL) && (node->cluster != cluster))
+        {
+            node = node->hashNext;
+        }
+    }
+
+    return node;
+}
+
+static t_dirNode *readDirNode(t_volume *vol, uint32_t cluster)
+{
+    t_dirNode *node = NULL;
+    t_direcroryEntry *fitted = NULL;
+    uint8_t ok = 0;
+
+    pthread_mutex_unlock(&vol->dirCache.lock);
+
+    node = (t_dirNode*)calloc(1, sizeof(t_dirNode));
+    if(node == NULL)
+    {
+        fprintf(stderr, "The disk is empty.\n");
+    }
+    else
+    {
+        node->cluster = cluster;
+        ok = readDirChain(vol, &node->list, cluster);
+
+        /* The list was sized for every slot of the chain, keep only the valid entries */
+        if(node->list.count == 0)
+        {
+            freeDirList(&node->list);
+        }
+        else if(node->list.count < node->list.capacity)
+        {
+            fitted = (t_direcroryEntry*)realloc(node->list.entries, node->list.count * sizeof(t_direcroryEntry));
+            if(fitted != NULL)
+            {
+                node->list.entries = fitted;
+                node->list.capacity = node->list.count;
+            }
+        }
+
+        /* A directory read in part would hide its other entries until it is evicted */
+        if((ok == 0) || (buildNameIndex(node) == 0))
+        {
+            freeDirList(&node->list);
+            free(node);
+            node = NULL;
+        }
+        else
+        {
+            node->bytes = sizeof(t_dirNode)
+                        + (node->list.capacity * sizeof(t_direcroryEntry))
+                        + (node->indexSize * sizeof(uint32_t));
+        }
+    }
+
+    pthread_mutex_lock(&vol->dirCache.lock);
+
+    return node;
+}
+
+static t_dirNode *getDirNode(t_volume *vol, uint32_t cluster)
+{
+    t_dirCache *cache = NULL;
+    t_dirNode *node = NULL;
+    t_dirNode *cached = NULL;
+    uint32_t bucket = 0;
+
+    cache = &vol->dirCache;
+    node = findDirNode(cache, cluster);
+
+    if(node != NULL)
+    {
+        /* Hit: the directory becomes the most recently used */
+        cache->hits++;
+        STATS_COUNT(STATS_DIR_CACHE_HITS, 1);
+        unlinkDirNode(cache, node);
+        linkDirNode(cache, node);
+    }
+    else
+    {
+        /* Miss: read the directory and index it, the lock is released meanwhile */
+        cache->misses++;
+        STATS_COUNT(STATS_DIR_CACHE_MISSES, 1);
+        node = readDirNode(vol, cluster);
+        cached = findDirNode(cache, cluster);
+
+        if(node == NULL)
+        {
+            /* Memory ran out */
+        }
+        else if(cached != NULL)
+        {
+            /* Another thread read the same directory first, its node is kept */
+            freeDirList(&node->list);
+            free(node->nameIndex);
+            free(node);
+            node = cached;
+            unlinkDirNode(cache, node);
+            linkDirNode(cache, node);
+        }
+        else if((cache->numNodes >= cache->numBuckets) && (growDirCache(vol) == 0) &&
+                (cache->numBuckets == 0))
+        {
+            /* No table to keep the node in */
+            freeDirList(&node->list);
+            free(node->nameIndex);
+            free(node);
+            node = NULL;
+        }
+        else
+        {
+            /* Make room under the budget, the new directory is always kept */
+            while((cache->lru != NULL) && (cache->usedBytes + node->bytes > cache->limitBytes))
+            {
+                evictDirNode(cache, cache->lru);
+                cache->evictions++;
+            }
+
+            bucket = hashCluster(cache, cluster);
+            node->hashNext = cache->buckets[bucket];
+            cache->buckets[bucket] = node;
+            linkDirNode(cache, node);
+            cache->usedBytes += node->bytes;
+            cache->numNodes++;
+        }
+    }
+
+    return node;
+}
+
+static void freeDirCache(t_volume *vol)
+{
+    /* Every node is on the LRU list */
+    while(vol->dirCache.lru != NULL)
+    {
+        evictDirNode(&vol->dirCache, vol->dirCache.lru);
+    }
+
+    free(vol->dirCache.buckets);
+    vol->dirCache.buckets = NULL;
+    vol->dirCache.numBuckets = 0;
+}
+
+uint8_t fatLookup(t_volume *vol, const char *path, t_direcroryEntry *entry)
+{
+    t_dirNode *node = NULL;
+    uint8_t packed[SIZE_OF_NAME];
+    const char *name = NULL;
+    uint32_t length = 0;
+    uint32_t index = 0;
+    uint8_t found = 1;
+
+    /* The walk starts from the root directory */
+    memset(entry, 0, sizeof(t_direcroryEntry));
+    memset(entry->fileName, ' ', SIZE_OF_NAME);
+    entry->attributes = ATTR_DIRECTORY;
+    entry->startCluster = rootCluster(vol);
+
+    name = path;
+    pthread_mutex_lock(&vol->dirCache.lock);
+    while((found == 1) && (*name != '\0'))
+    {
+        /* Skip the separators before the next component */
+        while(*name == PATH_SEPARATOR)
+        {
+            name++;
+        }
+
+        length = 0;
+        while((name[length] != '\0') && (name[length] != PATH_SEPARATOR))
+        {
+            length++;
+        }
+
+        if(length > 0)
+        {
+            /* Only a directory can have a component after it */
+            if((entry->attributes & ATTR_DIRECTORY) == 0)
+            {
+                found = 0;
+            }
+            else if(fatPackName(name, length, packed) == 0)
+            {
+                found = 0;
+            }
+            else if((node = getDirNode(vol, entry->startCluster)) == NULL)
+            {
+                found = 0;
+            }
+            else if((index = findName(node, packed)) == DIR_INDEX_EMPTY)
+            {
+                found = 0;
+            }
+            else
+            {
+                *entry = node->list.entries[index];
 
-    current = *head;
+                /* ".." of a first level directory points to cluster 0 */
+                if(((entry->attributes & ATTR_DIRECTORY) != 0) && (entry->startCluster == 0))
+                {
+                    entry->startCluster = rootCluster(vol);
+                }
+            }
 
-    /* Free the allocated memory until null pointer is encountered */
-    while(current != NULL)
-    {
-        next = current->next;
-        free(current);
-        current = next; /* Move to the next node in the list */
+            name += length;
+        }
     }
+    pthread_mutex_unlock(&vol->dirCache.lock);
 
-    *head = NULL;
+    return found;
 }
 
-t_bootSector initFileFAT(const char *filePath, FILE *fp)
+void fatFormatName(const t_direcroryEntry *entry, char *name)
 {
-    uint8_t *buff = NULL;
-    uint32_t totalSec = 0;
-    uint32_t fatSize = 0;
-    uint8_t thisFatType = 0;
-
-    fp = HAL_Init(filePath);
-
-    /* Allocate some memory */
-    buff = (uint8_t*)malloc(BYTE_PER_SECTOR * sizeof(uint8_t));
+    uint32_t index = 0;
+    uint32_t length = 0;
 
-    if(buff == NULL)
-    {
-        printf("The disk is empty.\n");
-    }
-    /* Read the boot sector from the disk */
-    else if(HAL_ReadSector(0, buff) != BYTE_PER_SECTOR)
+    /* Base name without the padding */
+    for(index = 0; (index < NAME_BASE_LENGTH) && (entry->fileName[index] != ' '); index++)
     {
-        printf("Read boot region error.\n");
+        name[length++] = (char)entry->fileName[index];
     }
-    else
-    {
-        /* Store the information of the boot sector */
-        s_bootInfo.bytsPerSec = LITTLE_ENDIAN(buff[0x0B], buff[0x0C]); /* Bytes per sector */
-        s_bootInfo.secPerClus = buff[0x0D];                            /* Sectors per cluster */
-        s_bootInfo.rsvdSecCnt = LITTLE_ENDIAN(buff[0x0E], buff[0x0F]); /* Reserved sector count */
-        s_bootInfo.numFATs = buff[0x10];                               /* Number of FATs */
-        s_bootInfo.rootEntCnt = LITTLE_ENDIAN(buff[0x11], buff[0x12]); /* Root directory entry count */
-        fatSize = LITTLE_ENDIAN(buff[0x16], buff[0x17]);               /* FAT size in sectors */
-        totalSec = LITTLE_ENDIAN(buff[0x13], buff[0x14]);              /* Total number of sectors in the file system */
 
-        /* If totalSec or fatSize is 0, read extended fields to get the actual values */
-        if(totalSec == 0)
+    /* Extension, if there is one */
+    if(entry->fileName[NAME_BASE_LENGTH] != ' ')
+    {
+        name[length++] = '.';
+        for(index = NAME_BASE_LENGTH; (index < SIZE_OF_NAME) && (entry->fileName[index] != ' '); index++)
         {
-            totalSec = (uint32_t)(buff[0x23] << SHIFT_24_BIT)
-                        | (uint32_t)(buff[0x22] << SHIFT_16_BIT)
-                        | (uint32_t)(buff[0x21] << SHIFT_8_BIT)
-                        | buff[0x20];
+            name[length++] = (char)entry->fileName[index];
         }
+    }
 
-        if(fatSize == 0)
-        {
-            fatSize = (uint32_t)(buff[0x27] << SHIFT_24_BIT)
-                    | (uint32_t)(buff[0x26] << SHIFT_16_BIT)
-                    | (uint32_t)(buff[0x25] << SHIFT_8_BIT)
-                    | buff[0x24];
-        }
+    name[length] = '\0';
+}
 
-        s_bootInfo.FATsz = fatSize;
-        s_bootInfo.totalSector = totalSec;
+uint32_t buildExtentList(t_volume *vol, uint32_t startCluster, t_extent **extents)
+{
+    t_extent *list = NULL;
+    t_extent *grown = NULL;
+    uint32_t capacity = 0;
+    uint32_t count = 0;
+    uint32_t temp = 0;
+    uint32_t hops = 0;
+    uint32_t loopMark = 0;
+    uint32_t thisLastCluster = 0;
 
-        /* Check the FAT type and set the root cluster for FAT_32 */
-        thisFatType = fatType();
-        if(thisFatType == FAT_32)
+    temp = startCluster;
+    loopMark = startCluster;
+    thisLastCluster = lastClusterMark(vol);
+
+    /* A chain cannot be longer than the FAT */
+    while ((temp >= FIRST_CLUSTER) && (temp < thisLastCluster) && (hops < vol->fatCache.numEntries))
+    {
+        /* Extend the current extent if this cluster follows it on the disk */
+        if((count > 0) && (list[count - 1].firstCluster + list[count - 1].length == temp))
         {
-            s_bootInfo.rootClus = (uint32_t)(buff[0x2F] << SHIFT_24_BIT)
-                                | (uint32_t)(buff[0x2E] << SHIFT_16_BIT)
-                                | (uint32_t)(buff[0x2D] << SHIFT_8_BIT)
-                                | buff[0x2C];
+            list[count - 1].length++;
         }
+        else
+        {
+            if(count == capacity)
+            {
+                capacity = (capacity == 0) ? EXTENT_LIST_INIT_SIZE : (capacity * 2);
+                grown = (t_extent*)realloc(list, capacity * sizeof(t_extent));
+                if(grown == NULL)
+                {
+                    fprintf(stderr, "The disk is empty.\n");
+                    free(list);
+                    list = NULL;
+                    count = 0;
+                    break;
+                }
+                list = grown;
+            }
 
-        free(buff);
+            list[count].firstCluster = temp;
+            list[count].length = 1;
+            count++;
+        }
 
-        /* Update the number of byte in a sector */
-        HAL_Update(s_bootInfo.bytsPerSec);
+        hops++;
+        temp = nextCluster(vol, temp); /* Next cluster */
+        if(chainLoops(temp, hops, &loopMark) == 1)
+        {
+            temp = thisLastCluster;
+        }
     }
 
-    return s_bootInfo;
+    *extents = list;
+
+    return count;
 }
 
-uint8_t fatType()
+uint32_t countExtents(t_volume *vol, uint32_t startCluster)
 {
-    uint8_t fatType = 0;
-    uint32_t totalClusters = 0;
+    uint32_t count = 0;
+    uint32_t temp = 0;
+    uint32_t prev = 0;
+    uint32_t hops = 0;
+    uint32_t loopMark = 0;
+    uint32_t thisLastCluster = 0;
 
-    /* The total number of clusters */
-    totalClusters = s_bootInfo.totalSector/s_bootInfo.secPerClus;
+    temp = startCluster;
+    loopMark = startCluster;
+    thisLastCluster = lastClusterMark(vol);
 
-    /* Check the total number of clusters to determine the FAT type */
-    if (totalClusters < FAT12_CLUST_COUNT)
+    while ((temp >= FIRST_CLUSTER) && (temp < thisLastCluster) && (hops < vol->fatCache.numEntries))
     {
-        fatType = FAT_12;
-    }
-    else
-    {
-        if(totalClusters < FAT16_CLUST_COUNT)
+        /* A new extent starts whenever the chain jumps */
+        if((count == 0) || (temp != prev + 1))
         {
-            fatType = FAT_16;
+            count++;
         }
-        else
+
+        prev = temp;
+        hops++;
+        temp = nextCluster(vol, temp); /* Next cluster */
+        if(chainLoops(temp, hops, &loopMark) == 1)
         {
-            fatType = FAT_32;
+            temp = thisLastCluster;
         }
-
     }
 
-    return fatType;
-}
-
-t_location localEachRegion(void)
-{
-    /* FAT Region */
-    s_local.FATStartSector = s_bootInfo.rsvdSecCnt;
-    s_local.sectorInFAT = s_bootInfo.FATsz * s_bootInfo.numFATs;
-    /* Root Directory Region */
-    s_local.rootDirStartSector = s_local.FATStartSector + s_local.sectorInFAT;
-    s_local.sectorInRootDir = ((SIZE_ROOT_ENTRY * s_bootInfo.rootEntCnt) +
-                               (s_bootInfo.bytsPerSec -1)) / s_bootInfo.bytsPerSec;
-    /* Data Region */
-    s_local.dataStartSector = s_local.rootDirStartSector + s_local.sectorInRootDir;
-
-    return s_local;
+    return count;
 }
 
-static uint32_t nextCluster(uint32_t cluster)
+static uint8_t readExtents(t_volume *vol, const t_extent *extents, uint32_t numExtents, uint8_t *buff)
 {
-    uint8_t *fatSector = NULL;
-    uint16_t thisFATOffset = 0;
-    uint32_t thisEntryVal = 0;
-    uint8_t thisFatType = 0;
-    thisFatType = fatType();
+    t_halRequest *requests = NULL;
+    uint32_t numRequests = 0;
+    uint32_t chunkSectors = 0;
+    uint32_t index = 0;
+    uint32_t position = 0;
+    uint32_t remain = 0;
+    uint64_t offset = 0;
+    uint8_t result = 0;
 
-    /* Allocate some memory */
-    fatSector = (uint8_t*)malloc(s_bootInfo.FATsz * s_bootInfo.bytsPerSec * sizeof(uint8_t));
+    chunkSectors = EXTENT_READ_CHUNK / vol->bootInfo.bytsPerSec;
+    if(chunkSectors == 0)
+    {
+        chunkSectors = 1;
+    }
 
-    if(fatSector == NULL)
+    for(index = 0; index < numExtents; index++)
     {
-        printf("The disk is empty.\n");
+        remain = extents[index].length * vol->bootInfo.secPerClus;
+        numRequests += (remain + chunkSectors - 1) / chunkSectors;
     }
-    else if(HAL_ReadMultiSector(s_bootInfo.rsvdSecCnt, s_bootInfo.FATsz, fatSector) != s_bootInfo.FATsz * s_bootInfo.bytsPerSec)
+
+    requests = (t_halRequest*)malloc((numRequests > 0 ? numRequests : 1) * sizeof(t_halRequest));
+
+    if(requests == NULL)
     {
-        printf("Read FAT Region error.\n");
-        free(fatSector);
+        fprintf(stderr, "The disk is empty.\n");
     }
     else
     {
-        switch(thisFatType)
+        numRequests = 0;
+        for(index = 0; index < numExtents; index++)
         {
-        case FAT_12:
-            /* Multiply the cluster by 1.5 to get the FAT position */
-            thisFATOffset = cluster + (cluster >> 1);
-            /* If the cluster that index is odd */
-            if (cluster & 1)
-            {
-                thisEntryVal = (fatSector[thisFATOffset] >> SHIFT_4_BIT)
-                            | ((uint32_t)fatSector[thisFATOffset + 1] << SHIFT_4_BIT);
-            }
-            /* If the cluster that index is even */
-            else
+            position = ((extents[index].firstCluster - FIRST_CLUSTER) * vol->bootInfo.secPerClus) + vol->local.dataStartSector; /* Position of sector need to read */
+            remain = extents[index].length * vol->bootInfo.secPerClus;
+            HAL_Advise(vol->device, position, remain, HAL_ADVICE_SEQUENTIAL);
+
+            /* Cut the extent into chunks that can be in flight together */
+            while(remain > 0)
             {
-                thisEntryVal = (fatSector[thisFATOffset])
-                            | ((uint32_t)(fatSector[thisFATOffset + 1] & 0x0F) << SHIFT_8_BIT);
+                requests[numRequests].index = position;
+                requests[numRequests].num = (remain < chunkSectors) ? remain : chunkSectors;
+                requests[numRequests].buff = buff + offset;
+
+                position += requests[numRequests].num;
+                remain -= requests[numRequests].num;
+                offset += (uint64_t)requests[numRequests].num * vol->bootInfo.bytsPerSec;
+                numRequests++;
             }
+        }
 
-            break;
-        case FAT_16:
-            /* Multiply the cluster by 2 to get the FAT position */
-            thisFATOffset = cluster * 2;
+        result = HAL_ReadBatch(vol->device, requests, numRequests);
+        free(requests);
+    }
 
-            thisEntryVal = (uint32_t)(fatSector[thisFATOffset]) | ((uint32_t)fatSector[thisFATOffset + 1] << SHIFT_8_BIT);
+    return result;
+}
 
-            break;
-        case FAT_32:
-            /* Multiply the cluster by 4 to get the FAT position */
-            thisFATOffset = cluster * 4;
+void loadFile(t_volume *vol, uint8_t *buff, uint32_t startCluster)
+{
+    t_extent *extents = NULL;
+    uint64_t start = 0;
+    uint64_t bytes = 0;
+    uint32_t numExtents = 0;
+    uint32_t index = 0;
+    uint8_t category = 0;
 
-            thisEntryVal = (uint32_t)(fatSector[thisFATOffset])
-                        | ((uint32_t)fatSector[thisFATOffset + 1] << SHIFT_8_BIT)
-                        | ((uint32_t)fatSector[thisFATOffset + 2] << SHIFT_16_BIT)
-                        | ((uint32_t)(fatSector[thisFATOffset + 3] & 0x0F) << SHIFT_24_BIT);
+    start = STATS_START();
+    numExtents = buildExtentList(vol, startCluster, &extents);
 
-            break;
-        default:
-            break;
+    /* Queue every contiguous run of clusters at once */
+    category = HAL_TraceCategory(HAL_TRACE_DATA);
+    readExtents(vol, extents, numExtents, buff);
+    HAL_TraceCategory(category);
+
+    for(index = 0; (start != 0) && (index < numExtents); index++)
+    {
+        bytes += (uint64_t)extents[index].length * vol->bootInfo.secPerClus * vol->bootInfo.bytsPerSec;
+    }
+    STATS_RECORD(STATS_OP_FILE_READ, start, bytes);
+
+    free(extents);
+}
+
+static uint32_t readByteRange(t_volume *vol, uint32_t sector, uint32_t byteOffset, uint32_t size, uint8_t *buff, uint8_t *bounce)
+{
+    uint32_t bytsPerSec = vol->bootInfo.bytsPerSec;
+    uint32_t byteRead = 0;
+    uint32_t offset = 0;
+    uint32_t length = 0;
+    uint32_t numSector = 0;
+    uint8_t failed = 0;
+
+    sector += byteOffset / bytsPerSec;
+    offset = byteOffset % bytsPerSec;
+
+    /* Head: a partial first sector goes through the bounce buffer */
+    if((size > 0) && ((offset != 0) || (size < bytsPerSec)))
+    {
+        length = bytsPerSec - offset;
+        if(length > size)
+        {
+            length = size;
+        }
+
+        if(HAL_ReadSector(vol->device, sector, bounce) == bytsPerSec)
+        {
+            memcpy(buff, bounce + offset, length);
+            byteRead = length;
+        }
+        else
+        {
+            failed = 1;
         }
 
-        free(fatSector);
-        
+        sector++;
     }
 
-    return thisEntryVal;
+    /* Body: whole sectors are read straight into the caller buffer */
+    numSector = (size - byteRead) / bytsPerSec;
+    if((failed == 0) && (numSector > 0))
+    {
+        length = HAL_ReadMultiSector(vol->device, sector, numSector, buff + byteRead);
+        byteRead += length;
+        sector += numSector;
+        failed = (length != numSector * bytsPerSec);
+    }
+
+    /* Tail: a partial last sector goes through the bounce buffer */
+    if((failed == 0) && (byteRead < size))
+    {
+        if(HAL_ReadSector(vol->device, sector, bounce) == bytsPerSec)
+        {
+            memcpy(buff + byteRead, bounce, size - byteRead);
+            byteRead = size;
+        }
+    }
+
+    return byteRead;
 }
 
-static p_EntryList createNewNodeAsDirEntry(const uint8_t *buff)
+t_fatFile* fatOpen(t_volume *vol, uint32_t startCluster, uint32_t size)
 {
-    uint16_t index = 0;
-    p_EntryList newNode = NULL;
+    t_fatFile *file = NULL;
 
     /* Allocate some memory */
-    newNode = (p_EntryList) malloc(sizeof(t_entryList));
+    file = (t_fatFile*)malloc(sizeof(t_fatFile) + vol->bootInfo.bytsPerSec);
 
-    if(newNode == NULL)
+    if(file == NULL)
     {
-        printf("The disk is empty.\n");
+        fprintf(stderr, "The disk is empty.\n");
     }
     else
     {
-        /* Store the information of the current directory entry */
-        memcpy(newNode->entry.fileName, buff, SIZE_OF_NAME);
-        newNode->entry.attributes = buff[0x0B];
-        newNode->entry.writeTime = LITTLE_ENDIAN(buff[0x16], buff[0x17]);
-        newNode->entry.writeDate = LITTLE_ENDIAN(buff[0x18], buff[0x19]);
-        newNode->entry.startCluster = LITTLE_ENDIAN(buff[0x1A], buff[0x1B]);
-        newNode->entry.fileSize = (uint32_t)(buff[0x1F] << SHIFT_24_BIT)
-                                | (uint32_t)(buff[0x1E] << SHIFT_16_BIT)
-                                | (uint32_t)(buff[0x1D] << SHIFT_8_BIT)
-                                | buff[0x1C];
-
-        newNode->next = NULL;
+        file->vol = vol;
+        file->startCluster = startCluster;
+        file->fileSize = size;
+        file->position = 0;
+        file->curCluster = startCluster;
+        file->curClusterIndex = 0;
+        file->clusterBytes = (uint32_t)vol->bootInfo.bytsPerSec * vol->bootInfo.secPerClus;
+        file->bounce = (uint8_t*)(file + 1);
+        file->extents = NULL;
+        file->extentIndex = NULL;
+        file->numExtents = 0;
     }
 
-    return newNode;
+    return file;
 }
 
-void readDirEntry(p_EntryList *head, uint32_t startEntry)
+uint32_t fatRead(t_fatFile *file, uint8_t *buff, uint32_t size)
 {
-    p_EntryList newNode = NULL;
-    p_EntryList temp = NULL;
-    uint8_t *buff = NULL;
+    t_volume *vol = file->vol;
+    uint32_t thisLastCluster = 0;
+    uint32_t byteRead = 0;
+    uint32_t length = 0;
+    uint32_t offset = 0;
+    uint32_t runClusters = 0;
+    uint32_t runEnd = 0;
+    uint32_t temp = 0;
     uint32_t index = 0;
-    uint32_t num = 0;
-    uint8_t thisFatType = 0;
+    uint32_t sector = 0;
+    uint64_t start = 0;
+    uint8_t category = 0;
 
-    thisFatType = fatType();
-    switch(thisFatType)
+    start = STATS_START();
+    thisLastCluster = lastClusterMark(vol);
+
+    /* Never read past the end of the file */
+    if(size > file->fileSize - file->position)
     {
-    case FAT_12:
-    case FAT_16:
-        if(startEntry == s_local.rootDirStartSector)
+        size = file->fileSize - file->position;
+    }
+
+    while(byteRead < size)
+    {
+        index = file->position / file->clusterBytes;
+        offset = file->position % file->clusterBytes;
+
+        if(file->extents != NULL)
         {
-            num = s_local.sectorInRootDir;
+            /* With an index the cluster and its run come from the extent list */
+            if(locateCluster(file, index, &file->curCluster, &runClusters) == 0)
+            {
+                break;
+            }
+
+            file->curClusterIndex = index;
+            runEnd = file->curCluster + runClusters - 1;
         }
         else
         {
-            num = s_bootInfo.secPerClus;
+            /* Catch up with the cluster holding the position */
+            while((file->curClusterIndex < index) && (file->curCluster >= FIRST_CLUSTER) && (file->curCluster < thisLastCluster))
+            {
+                file->curCluster = nextCluster(vol, file->curCluster);
+                file->curClusterIndex++;
+            }
+
+            if((file->curCluster < FIRST_CLUSTER) || (file->curCluster >= thisLastCluster))
+            {
+                /* The chain is shorter than the file size */
+                break;
+            }
+
+            /* Extend the run while the next cluster follows on the disk */
+            runClusters = 1;
+            runEnd = file->curCluster;
+            while(((uint64_t)runClusters * file->clusterBytes - offset < size - byteRead) &&
+                  ((temp = nextCluster(vol, runEnd)) == runEnd + 1))
+            {
+                runEnd = temp;
+                runClusters++;
+            }
+        }
+
+        length = size - byteRead;
+        if((uint64_t)runClusters * file->clusterBytes - offset < length)
+        {
+            length = runClusters * file->clusterBytes - offset;
+        }
+
+        sector = ((file->curCluster - FIRST_CLUSTER) * vol->bootInfo.secPerClus) + vol->local.dataStartSector;
+        category = HAL_TraceCategory(HAL_TRACE_DATA);
+        length = readByteRange(vol, sector, offset, length, buff + byteRead, file->bounce);
+        HAL_TraceCategory(category);
+        if(length == 0)
+        {
+            break;
+        }
+
+        byteRead += length;
+        file->position += length;
+
+        /* The run is contiguous, so the cluster of the new position is known without the FAT */
+        index = file->position / file->clusterBytes;
+        if(index < file->curClusterIndex + runClusters)
+        {
+            file->curCluster += index - file->curClusterIndex;
+            file->curClusterIndex = index;
+        }
+        else
+        {
+            file->curCluster = runEnd;
+            file->curClusterIndex += runClusters - 1;
         }
-        break;
-    case FAT_32:
-        num = s_bootInfo.secPerClus;
-        break;
-    default:
-        break;
     }
 
-    /* Allocate some memory to store */
-    buff = (uint8_t*)malloc(s_bootInfo.bytsPerSec * num * sizeof(uint8_t));
+    STATS_RECORD(STATS_OP_FILE_READ, start, byteRead);
 
-    if(buff == NULL)
+    return byteRead;
+}
+
+static uint8_t buildFileIndex(t_fatFile *file)
+{
+    uint32_t index = 0;
+    uint32_t count = 0;
+    uint8_t result = 0;
+
+    file->numExtents = buildExtentList(file->vol, file->startCluster, &file->extents);
+
+    if(file->numExtents == 0)
     {
-        printf("The disk is empty.\n");
+        /* An empty chain still gets an index so it is not rebuilt on every seek */
+        file->extents = (t_extent*)malloc(sizeof(t_extent));
     }
-    /* Read the number of sector to the address of the entry and save to buff array */
-    else if(HAL_ReadMultiSector(startEntry, num, buff) != s_bootInfo.bytsPerSec * num)
+
+    file->extentIndex = (uint32_t*)malloc((file->numExtents + 1) * sizeof(uint32_t));
+
+    if((file->extents == NULL) || (file->extentIndex == NULL))
     {
-        printf("Read Directory Entry error.\n");
-        free(buff);
+        fprintf(stderr, "The disk is empty.\n");
+        free(file->extents);
+        free(file->extentIndex);
+        file->extents = NULL;
+        file->extentIndex = NULL;
+        file->numExtents = 0;
     }
     else
     {
-        while(index < (num * s_bootInfo.bytsPerSec))
+        /* Prefix sum of the extent lengths, with the chain length as the last element */
+        for(index = 0; index < file->numExtents; index++)
         {
-            /* Define a node with the information of the directory entry  */
-            newNode = createNewNodeAsDirEntry(&buff[index]);
+            file->extentIndex[index] = count;
+            count += file->extents[index].length;
+        }
+        file->extentIndex[file->numExtents] = count;
+        result = 1;
+    }
 
-            /* Create a new node if this is a file or a directory */
-            if((newNode->entry.attributes == ATTR_DIRECTORY ||
-                newNode->entry.attributes == ATTR_FILE ||
-                newNode->entry.attributes == ATTR_READ_ONLY ||
-                newNode->entry.attributes == ATTR_ARCHIVE) &&
-                newNode->entry.fileName[0] != INVALID_FILE_NAME &&
-                newNode->entry.fileName[0] != DELETED_FILE_NAME)
-            {
-                if(*head == NULL)
-                {
-                    *head = newNode;
-                }
-                else
-                {
-                    temp = *head;
-                    while(temp->next != NULL)
-                    {
-                        temp = temp->next;
-                    }
+    return result;
+}
 
-                    temp->next = newNode;
-                }
+static uint8_t locateCluster(t_fatFile *file, uint32_t index, uint32_t *cluster, uint32_t *runClusters)
+{
+    uint32_t low = 0;
+    uint32_t high = 0;
+    uint32_t middle = 0;
+    uint8_t result = 0;
+
+    if(index < file->extentIndex[file->numExtents])
+    {
+        /* Find the last extent starting at or before the index */
+        low = 0;
+        high = file->numExtents - 1;
+        while(low < high)
+        {
+            middle = low + ((high - low + 1) / 2);
+            if(file->extentIndex[middle] <= index)
+            {
+                low = middle;
             }
-            /* Otherwise, free the node */
             else
             {
-                free(newNode);
+                high = middle - 1;
             }
-
-            /* Point to next entry address */
-            index += SIZE_ROOT_ENTRY;
         }
 
-        free(buff);
+        *cluster = file->extents[low].firstCluster + (index - file->extentIndex[low]);
+        *runClusters = file->extentIndex[low + 1] - index;
+        result = 1;
     }
+
+    return result;
 }
 
-void loadDirEntry(p_EntryList *head, uint32_t startCluster)
+uint8_t fatSeek(t_fatFile *file, uint32_t offset)
 {
-    uint8_t *buff = NULL;
-    uint32_t startEntry = 0;
-    uint32_t temp = 0;
-    uint8_t thisFatType = 0;
-    uint32_t thisLastCluster = 0;
+    uint8_t result = 0;
 
-    temp = startCluster;
-    thisFatType = fatType();
-
-    /* Delete all link list */
-    deleteList(head);
-
-    /* Determine the value of the last cluster based on the FAT type */
-    switch(thisFatType)
+    if(offset <= file->fileSize)
     {
-    case FAT_12:
-        thisLastCluster = LAST_CRUSTER_12;
-        break;
-    case FAT_16:
-        thisLastCluster = LAST_CRUSTER_16;
-        break;
-    case FAT_32:
-        if(temp == 0)
+        if(file->extents == NULL)
         {
-            temp = s_bootInfo.rootClus;
+            buildFileIndex(file);
         }
-        thisLastCluster = LAST_CRUSTER_32;
-        break;
-    default:
-        break;
-    }
 
-    while (temp < thisLastCluster)
-    {
-        if(temp == 0)
-        {
-            startEntry = s_local.rootDirStartSector;
-            temp = thisLastCluster;
-        }
-        else
+        /* Without an index, seeking backwards restarts the chain walk */
+        if((file->extents == NULL) && (offset / file->clusterBytes < file->curClusterIndex))
         {
-            startEntry = ((temp - FIRST_CLUSTER)* s_bootInfo.secPerClus) + s_local.dataStartSector;
-            temp = nextCluster(temp); /* next cluster */
+            file->curCluster = file->startCluster;
+            file->curClusterIndex = 0;
         }
 
-        /* Read content in directory */
-        readDirEntry(head, startEntry);
+        file->position = offset;
+        result = 1;
     }
+
+    return result;
 }
 
-void loadFile(uint8_t *buff, uint32_t startCluster)
+void fatClose(t_fatFile *file)
 {
-    uint16_t count = 0;
-    uint16_t position = 0;
-    uint32_t temp = 0;
-    uint8_t thisFatType = 0;
-    uint32_t thisLastCluster = 0;
-
-    temp = startCluster;
-    thisFatType = fatType();
-
-    /* Determine the value of the last cluster based on the FAT type */
-    switch(thisFatType)
-    {
-    case FAT_12:
-        thisLastCluster = LAST_CRUSTER_12;
-        break;
-    case FAT_16:
-        thisLastCluster = LAST_CRUSTER_16;
-        break;
-    case FAT_32:
-        thisLastCluster = LAST_CRUSTER_32;
-        break;
-    default:
-        break;
-    }
-
-    /* Read the file content from each cluster and store it in the buffer
-       Stop when the end of the file (last cluster) is reached */
-    while (temp < thisLastCluster)
+    if(file != NULL)
     {
-        position = ((temp - FIRST_CLUSTER) * s_bootInfo.secPerClus) + s_local.dataStartSector; /* Position of sector need to read */
-        HAL_ReadMultiSector(position, s_bootInfo.secPerClus , buff + (s_bootInfo.bytsPerSec * s_bootInfo.secPerClus * count));
-        count++;
-        temp = nextCluster(temp); /* Next cluster */
+        free(file->extents);
+        free(file->extentIndex);
+        free(file);
     }
 }
-
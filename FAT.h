@@ -8,6 +8,12 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+#include "HAL.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FAT_HAVE_X86            1U       /* SIMD kernels are built, picked at run time */
+#endif
 
 /*******************************************************************************
 * Define
@@ -53,6 +59,47 @@
 #define LAST_CRUSTER_12      0XFF8U
 #define LAST_CRUSTER_16      0xFFF8U
 #define LAST_CRUSTER_32      0xFFFFFF8U
+#define MASK_CLUSTER_32      0x0FFFFFFFU
+#define END_CRUSTER_12       0xFFFU       /* End of chain value written to a FAT12 entry */
+#define END_CRUSTER_16       0xFFFFU      /* End of chain value written to a FAT16 entry */
+#define END_CRUSTER_32       0x0FFFFFFFU  /* End of chain value written to a FAT32 entry */
+#define FREE_CLUSTER         0x00U        /* Entry value of a free cluster */
+
+#define FSINFO_LEAD_SIG      0x41615252U
+#define FSINFO_STRUC_SIG     0x61417272U
+#define FSINFO_TRAIL_SIG     0xAA550000U
+#define FSINFO_STRUC_OFFSET  484U         /* Offset of the second signature in the FSInfo sector */
+#define FSINFO_FREE_COUNT    488U         /* Offset of the free cluster count in the FSInfo sector */
+#define FSINFO_NEXT_FREE     492U         /* Offset of the next free cluster hint in the FSInfo sector */
+#define FSINFO_TRAIL_OFFSET  508U         /* Offset of the trailing signature in the FSInfo sector */
+#define FSINFO_UNKNOWN       0xFFFFFFFFU  /* Free count or hint not maintained */
+
+#define FAT12_KERNEL_AUTO       0U       /* The fastest FAT12 unpacking kernel the CPU supports */
+#define FAT12_KERNEL_SCALAR     1U       /* One entry at a time, any CPU */
+#define FAT12_KERNEL_SSSE3      2U       /* 8 entries from 12 bytes per shuffle */
+#define FAT12_KERNEL_AVX2       3U       /* 16 entries from 24 bytes per shuffle */
+
+#define FAT_CACHE_UNLIMITED     0U       /* Decode the whole FAT at mount time */
+#define FAT_CACHE_PAGE_ENTRIES  1024U    /* FAT entries decoded per page in bounded mode */
+#define FAT_CACHE_CHUNK_PAGES   64U      /* Pages decoded per disk read when filling the whole FAT */
+#define FAT_CACHE_NO_PAGE       0xFFFFFFFFU
+
+#define DISK_CACHE_DEFAULT      (1024U * 1024U)  /* Block cache of a volume mounted with the default config */
+
+#define EXTENT_LIST_INIT_SIZE   8U       /* Initial capacity of an extent list */
+#define EXTENT_READ_CHUNK       (1024U * 1024U)  /* Longer extents are split into reads of this many bytes */
+
+#define DIR_CACHE_INIT_BUCKETS  64U      /* Initial number of buckets of the directory cache of a volume */
+#define DIR_CACHE_DEFAULT       (1024U * 1024U)  /* Directory cache of a volume mounted with the default config */
+#define DIR_INDEX_EMPTY         0xFFFFFFFFU
+#define PATH_SEPARATOR          '/'
+#define NAME_BASE_LENGTH        8U       /* Characters in the base of an 8.3 name */
+#define NAME_EXT_LENGTH         3U       /* Characters in the extension of an 8.3 name */
+#define NAME_MAX_LENGTH         13U      /* "NAME.EXT" with its terminating NUL */
+
+#define WRITE_CACHE_INIT_SIZE   64U      /* Initial capacity of the dirty sector table of a volume */
+#define WRITE_FLUSH_MAX_RUN     256U     /* Most sectors written by one request of a flush */
+#define FREE_MAP_GROUP          64U      /* Clusters per word of the allocator bitmap, the layout of SPACE_GROUP */
 
 typedef struct
 {
@@ -61,11 +108,12 @@ typedef struct
     uint16_t    rsvdSecCnt;              /* Number of Sector in Reserved Sector Region. */
     uint8_t     numFATs;                 /* Number of FAT table in FAT Region. */
     uint16_t    rootEntCnt;              /* Max directory entries in root directory. */
-    uint16_t    FATsz;                   /* Number of sector in FAT table. */
+    uint32_t    FATsz;                   /* Number of sector in FAT table. */
     uint32_t    totalSector;             /* The total number of sector */
 
     /* Only FAT32 */
-    uint16_t    rootClus;                /* The location of the first sector in the directory region */
+    uint32_t    rootClus;                /* The location of the first sector in the directory region */
+    uint16_t    fsInfo;                  /* Sector of the FSInfo structure, 0 if there is none */
 } t_bootSector;
 
 typedef struct
@@ -78,83 +126,469 @@ typedef struct
     uint32_t    fileSize;                /* File size in bytes */
 } t_direcroryEntry;
 
-typedef struct entry
+typedef struct
 {
-    t_direcroryEntry entry;
-    struct entry *next;
-} t_entryList;
-
-typedef t_entryList* p_EntryList;
+    t_direcroryEntry *entries;           /* Entries in directory order */
+    uint32_t    count;                   /* Number of entries */
+    uint32_t    capacity;                /* Number of entries the array can hold */
+} t_dirList;
 
 typedef struct
 {
-    uint16_t FATStartSector;
-    uint16_t sectorInFAT;
-    uint16_t rootDirStartSector;
-    uint16_t sectorInRootDir;
-    uint16_t dataStartSector;
+    uint32_t FATStartSector;
+    uint32_t sectorInFAT;
+    uint32_t rootDirStartSector;
+    uint32_t sectorInRootDir;
+    uint32_t dataStartSector;
 } t_location;
 
+typedef struct
+{
+    uint32_t    firstCluster;            /* First cluster of a contiguous run */
+    uint32_t    length;                  /* Number of clusters in the run */
+} t_extent;
+
+typedef struct
+{
+    uint32_t    *table;                  /* Decoded next-cluster values */
+    uint32_t    numEntries;              /* Number of entries in one FAT table */
+    uint32_t    pageEntries;             /* Entries per page, 0 when the whole FAT is resident */
+    uint32_t    numSlots;                /* Number of page slots in bounded mode */
+    uint32_t    *slotPage;               /* Page number held by each slot, FAT_CACHE_NO_PAGE if empty */
+    pthread_mutex_t lock;                /* Protects the page slots in bounded mode */
+} t_fatCache;
+
+typedef struct s_dirNode
+{
+    uint32_t    cluster;                 /* Start cluster of the directory, key of the node */
+    t_dirList   list;                    /* Entries of the directory */
+    uint32_t    *nameIndex;              /* Entry indexes hashed on the 8.3 name, DIR_INDEX_EMPTY if free */
+    uint32_t    indexSize;               /* Number of slots in nameIndex, a power of two */
+    uint32_t    bytes;                   /* Memory charged to the cache for this directory */
+    struct s_dirNode *hashNext;          /* Next node in the same bucket of the directory cache */
+    struct s_dirNode *prev;              /* More recently used node */
+    struct s_dirNode *next;              /* Less recently used node */
+} t_dirNode;
+
+typedef struct
+{
+    t_dirNode   **buckets;               /* Directories hashed on their start cluster */
+    uint32_t    numBuckets;              /* Number of buckets, a power of two */
+    uint32_t    numNodes;                /* Number of directories in the cache */
+    uint32_t    limitBytes;              /* Memory budget of the cache */
+    uint32_t    usedBytes;               /* Memory charged to the cached directories */
+    t_dirNode   *mru;                    /* Most recently used directory */
+    t_dirNode   *lru;                    /* Least recently used directory, evicted first */
+    uint64_t    hits;                    /* Directories served from memory */
+    uint64_t    misses;                  /* Directories read from the disk */
+    uint64_t    evictions;               /* Directories dropped to stay under the budget */
+    pthread_mutex_t lock;                /* Protects the nodes and the counters */
+} t_dirCache;
+
+typedef struct
+{
+    uint32_t    sector;                  /* Sector of the volume, for the FAT a sector of the first table */
+    uint8_t     *data;                   /* Bytes to write at the next flush, NULL once the sector was dropped */
+} t_dirtySector;
+
+typedef struct
+{
+    t_dirtySector *sectors;              /* Metadata sectors changed since the last flush, in the order they were first changed */
+    uint32_t    count;                   /* Number of sectors in the array */
+    uint32_t    capacity;                /* Number of sectors the array can hold */
+    uint32_t    *index;                  /* Array positions hashed on the sector, DIR_INDEX_EMPTY if free */
+    uint32_t    indexSize;               /* Number of slots in index, a power of two */
+    uint64_t    *freeMap;                /* Bit n set when cluster n is free, NULL until the allocator needs it */
+    uint32_t    numClusters;             /* Bits in freeMap */
+    uint32_t    freeClusters;            /* Free data clusters, kept up to date while freeMap is set */
+    uint32_t    nextFree;                /* Cluster the next allocation looks at first */
+    uint8_t     fatChanged;              /* Set when a FAT entry changed since the last flush */
+} t_writeCache;
+
+typedef struct
+{
+    t_halConfig disk;                    /* HAL backend and block cache settings, disk.writable to mount read-write */
+    uint32_t    fatCacheLimit;           /* Memory limit of the decoded FAT, FAT_CACHE_UNLIMITED for no limit */
+    uint32_t    dirCacheLimit;           /* Memory budget of the directory cache, the last directory used is always kept */
+} t_volumeConfig;
+
+typedef struct
+{
+    t_halDevice     *device;             /* The disk the volume is read from */
+    t_bootSector    bootInfo;            /* Boot sector information */
+    t_location      local;               /* Location of each region */
+    t_fatCache      fatCache;            /* Decoded FAT */
+    t_dirCache      dirCache;            /* Parsed and indexed directories, in LRU order */
+    t_writeCache    writeCache;          /* FAT and directory sectors waiting for fatFlush() */
+} t_volume;
+
+typedef struct
+{
+    t_volume    *vol;                    /* The volume the file belongs to */
+    uint32_t    startCluster;            /* First cluster of the file */
+    uint32_t    fileSize;                /* File size in bytes */
+    uint32_t    position;                /* Byte offset of the next read */
+    uint32_t    curCluster;              /* A cluster of the chain at or before the position */
+    uint32_t    curClusterIndex;         /* Index of curCluster in the chain */
+    uint32_t    clusterBytes;            /* Number of bytes in a cluster */
+    uint8_t     *bounce;                 /* One sector buffer for reads that do not start or end on a sector */
+    t_extent    *extents;                /* Extent list of the chain, built on the first seek */
+    uint32_t    *extentIndex;            /* Chain index of the first cluster of each extent */
+    uint32_t    numExtents;              /* Number of extents in the list */
+} t_fatFile;
+
 /*******************************************************************************
 * API
 *******************************************************************************/
 
+/**
+ * Name: defaultVolumeConfig
+ * @brief Fill mount options with the defaults initFileFAT() uses for a NULL config, so a
+ *        caller can change only the settings it needs. The volume is mounted read-only.
+ *
+ * @param config: Receives the options.
+ */
+void defaultVolumeConfig(t_volumeConfig *config);
+
 /**
  * Name: initFileFAT
- * @brief Initializes the file system and reads the boot sector information from a disk file.
+ * @brief Open a disk file, read the boot sector information and mount it as a volume.
+ *        Each volume owns its disk handle and caches, so several images can be open at
+ *        once and different volumes can be used from different threads.
  *
  * @param filePath: The path to the disk file.
- * @param fp: A pointer to the opened file.
+ * @param config: Mount options, NULL for the defaults (pread backend with a DISK_CACHE_DEFAULT
+ *                block cache, HAL_QUEUE_DEFAULT reads in flight, whole FAT decoded,
+ *                DIR_CACHE_DEFAULT directory cache).
+ *
+ * @return t_volume*: The mounted volume. If failed, returns NULL.
+ */
+t_volume* initFileFAT(const char *filePath, const t_volumeConfig *config);
+
+/**
+ * Name: deinitFileFAT
+ * @brief Flush the pending writes of a volume, close its disk file and release everything it owns.
  *
- * @return t_bootSector: The boot sector information read from the disk file.
+ * @param vol: The volume, may be NULL.
  */
-t_bootSector initFileFAT(const char *filePath, FILE *fp);
+void deinitFileFAT(t_volume *vol);
 
 /**
  * Name: localEachRegion
  * @brief Calculate the starting sectors and the number of sectors by regions in the file system.
  *
+ * @param vol: The volume.
+ *
  * @return A `t_location` structure containing information about regions.
  */
-t_location localEachRegion(void);
+t_location localEachRegion(t_volume *vol);
 
 /**
  * Name: readDirEntry
  * @brief Read directory entries from the specified start entry in the file system
- *        and create linked list nodes for valid entries.
+ *        and append the valid entries to the list.
  *
- * @param head: A pointer to the head of the linked list.
+ * @param vol: The volume.
+ * @param list: The directory list to append to.
  * @param startEntry: The start entry to read directory entries from.
+ *
+ * @return 1 if the sectors were read and their entries appended, 0 if a read failed or memory ran out.
  */
-void readDirEntry(p_EntryList *head, uint32_t startEntry);
+uint8_t readDirEntry(t_volume *vol, t_dirList *list, uint32_t startEntry);
 
 /**
  * Name: loadDirEntry
  * @brief Load directory entries from the specified start cluster in the file system
- *        and update the linked list with the new entries.
+ *        and replace the content of the list with the new entries.
+ *        Directories are served from the directory cache of the volume, only the
+ *        first visit of a directory (or a visit after it was evicted) reads the disk.
  *
- * @param head: A pointer to the head of the linked list.
+ * @param vol: The volume.
+ * @param list: The directory list, its memory is reused.
  * @param startCluster: The start cluster to read directory entries from.
+ *
+ * @return 1 if the whole directory was loaded, 0 if a read failed or memory ran out; the list
+ *         then holds the entries that could be read.
+ */
+uint8_t loadDirEntry(t_volume *vol, t_dirList *list, uint32_t startCluster);
+
+/**
+ * Name: freeDirList
+ * @brief Free the memory used by a directory list and leave it empty.
+ *
+ * @param list: The directory list.
+ */
+void freeDirList(t_dirList *list);
+
+/**
+ * Name: readDirChain
+ * @brief Read every directory entry of the cluster chain of a directory straight from the disk,
+ *        without going through the directory cache. Several threads can read directories of
+ *        the same volume at once.
+ *
+ * @param vol: The volume.
+ * @param list: The directory list, emptied before the entries are appended.
+ * @param startCluster: The start cluster of the directory, 0 for the root directory.
+ *
+ * @return 1 if every cluster of the chain was read, 0 if a read failed or memory ran out; the
+ *         list then holds the entries that could be read.
  */
-void loadDirEntry(p_EntryList *head, uint32_t startCluster);
+uint8_t readDirChain(t_volume *vol, t_dirList *list, uint32_t startCluster);
+
+/**
+ * Name: fatFormatName
+ * @brief Turn the packed 8.3 name of an entry into "NAME.EXT", without the padding spaces.
+ *
+ * @param entry: The directory entry.
+ * @param name: Receives the name, at least NAME_MAX_LENGTH bytes.
+ */
+void fatFormatName(const t_direcroryEntry *entry, char *name);
+
+/**
+ * Name: fatLookup
+ * @brief Resolve a path such as "/DIR1/SUBDIR/FILE.TXT" to its directory entry.
+ *        Names are compared as packed 8.3 names, so the case of the path does not matter.
+ *        Every directory on the way is loaded once and indexed by name, further lookups
+ *        in the same directory cost one hash probe and no disk access.
+ *
+ * @param vol: The volume.
+ * @param path: The path, components separated by '/'. "/" is the root directory.
+ * @param entry: Receives the directory entry of the last component.
+ *
+ * @return 1 if the path was found, 0 otherwise.
+ */
+uint8_t fatLookup(t_volume *vol, const char *path, t_direcroryEntry *entry);
 
 /**
  * Name: loadFile
  * @brief Load the contents of a file starting from the specified start cluster in the file system
- *        and store the data in the provided buffer.
+ *        and store the data in the provided buffer. Every extent of the chain is queued at once,
+ *        so with a queue depth the next extents are read while earlier ones complete.
  *
+ * @param vol: The volume.
  * @param buff: A pointer to the buffer where the file data will be stored.
  * @param startCluster: The start cluster of the file.
  */
-void loadFile(uint8_t *buff, uint32_t startCluster);
+void loadFile(t_volume *vol, uint8_t *buff, uint32_t startCluster);
+
+/**
+ * Name: buildExtentList
+ * @brief Turn the cluster chain starting at a cluster into a list of contiguous extents.
+ *
+ * @param vol: The volume.
+ * @param startCluster: The start cluster of the chain.
+ * @param extents: Receives a malloc'd array of extents, to be released with free(). NULL if the chain
+ *                 is empty or memory ran out.
+ *
+ * @return The number of extents in the chain, 0 if it is empty or memory ran out; a chain is never
+ *         returned in part.
+ */
+uint32_t buildExtentList(t_volume *vol, uint32_t startCluster, t_extent **extents);
+
+/**
+ * Name: countExtents
+ * @brief Count the contiguous extents of the cluster chain starting at a cluster.
+ *        A file stored contiguously has one extent, a higher count means more fragmentation.
+ *
+ * @param vol: The volume.
+ * @param startCluster: The start cluster of the chain.
+ *
+ * @return The number of extents in the chain.
+ */
+uint32_t countExtents(t_volume *vol, uint32_t startCluster);
+
+/**
+ * Name: fatOpen
+ * @brief Open a file of a volume for streaming reads. Only one cluster position is kept,
+ *        so the memory used does not depend on the file size.
+ *
+ * @param vol: The volume.
+ * @param startCluster: The start cluster of the file.
+ * @param size: The file size in bytes.
+ *
+ * @return t_fatFile*: The file handle positioned at offset 0. If failed, returns NULL.
+ */
+t_fatFile* fatOpen(t_volume *vol, uint32_t startCluster, uint32_t size);
+
+/**
+ * Name: fatRead
+ * @brief Read bytes from the current position of a file and advance the position.
+ *        Contiguous clusters are read with one request; sequential reads continue
+ *        from the current cluster instead of walking the chain from the start.
+ *
+ * @param file: The file handle.
+ * @param buff: The buffer receiving the data.
+ * @param size: The number of bytes to read.
+ *
+ * @return The number of bytes read, less than 'size' at the end of the file.
+ */
+uint32_t fatRead(t_fatFile *file, uint8_t *buff, uint32_t size);
+
+/**
+ * Name: fatSeek
+ * @brief Move the position of a file. The first seek builds the extent list of the file,
+ *        after which any offset is found with a binary search instead of a chain walk.
+ *
+ * @param file: The file handle.
+ * @param offset: The new position in bytes from the start of the file.
+ *
+ * @return 1 if the position was changed, 0 if the offset is past the end of the file.
+ */
+uint8_t fatSeek(t_fatFile *file, uint32_t offset);
+
+/**
+ * Name: fatClose
+ * @brief Close a file handle.
+ *
+ * @param file: The file handle, may be NULL.
+ */
+void fatClose(t_fatFile *file);
 
 /**
  * Name: fatType
  * @brief Determine the FAT type based on the total number of clusters.
  *
+ * @param vol: The volume.
+ *
  * @return The FAT type: FAT_12, FAT_16, or FAT_32.
  */
-uint8_t fatType();
+uint8_t fatType(t_volume *vol);
+
+/**
+ * Name: unpackFAT12
+ * @brief Expand packed 12-bit FAT entries into one uint32_t per entry. The SIMD kernels
+ *        shuffle 12 raw bytes into 8 entries at a time and never read past the last entry.
+ *
+ * @param raw: The FAT bytes holding entry 'first', raw[0] is the byte at offset first * 1.5.
+ * @param first: The first entry to unpack.
+ * @param count: The number of entries to unpack.
+ * @param kernel: FAT12_KERNEL_AUTO, or a kernel to force; one the CPU lacks falls back to scalar.
+ * @param out: Array receiving 'count' entries.
+ *
+ * @return The FAT12_KERNEL_* that unpacked the entries, never FAT12_KERNEL_AUTO.
+ */
+uint8_t unpackFAT12(const uint8_t *raw, uint32_t first, uint32_t count, uint8_t kernel, uint32_t *out);
+
+/**
+ * Name: fillFATEntries
+ * @brief Read the FAT sectors covering a range of entries of the first FAT table and decode
+ *        them into next-cluster values, without going through the FAT cache.
+ *
+ * @param vol: The volume.
+ * @param first: The first entry to decode.
+ * @param count: The number of entries to decode, first + count at most fatCache.numEntries.
+ * @param out: Array receiving 'count' decoded values.
+ *
+ * @return 1 if the entries were decoded, 0 if the read failed.
+ */
+uint8_t fillFATEntries(t_volume *vol, uint32_t first, uint32_t count, uint32_t *out);
+
+/**
+ * Name: getFATEntry
+ * @brief Get the next-cluster value of a FAT entry, pending writes included.
+ *
+ * @param vol: The volume.
+ * @param cluster: The cluster.
+ *
+ * @return The value of the entry, an end of chain mark for a cluster outside the FAT.
+ */
+uint32_t getFATEntry(t_volume *vol, uint32_t cluster);
+
+/**
+ * Name: setFATEntry
+ * @brief Change a FAT entry in the write cache of the volume. The decoded FAT is updated at
+ *        once; the raw entry is patched into a cached copy of its sector, and fatFlush() writes
+ *        the sector to every FAT table. Freeing a cluster drops the pending writes of its sectors.
+ *        Writes must not run while other threads use the volume.
+ *
+ * @param vol: The volume, mounted writable.
+ * @param cluster: The cluster, 2 or more and inside the FAT.
+ * @param value: The new value, FREE_CLUSTER, a cluster or an end of chain mark.
+ *
+ * @return 1 if the entry was changed, 0 if the cluster is invalid, the volume is read-only or memory ran out.
+ */
+uint8_t setFATEntry(t_volume *vol, uint32_t cluster, uint32_t value);
+
+/**
+ * Name: getDirtySector
+ * @brief Get the cached copy of a metadata sector to change it. The sector is written at the
+ *        next fatFlush(); until then every read of the volume sees the cached copy.
+ *
+ * @param vol: The volume, mounted writable.
+ * @param sector: The sector.
+ * @param load: 1 to start from the bytes on the disk, 0 to start from zeros.
+ *
+ * @return The bytes of the sector, NULL if the volume is read-only, the read failed or memory ran out.
+ */
+uint8_t *getDirtySector(t_volume *vol, uint32_t sector, uint8_t load);
+
+/**
+ * Name: fatReadSectors
+ * @brief Read sectors as the volume sees them, with the pending writes applied.
+ *
+ * @param vol: The volume.
+ * @param index: The first sector.
+ * @param num: The number of sectors.
+ * @param buff: Receives the sectors.
+ *
+ * @return 1 if every sector was read, 0 otherwise.
+ */
+uint8_t fatReadSectors(t_volume *vol, uint32_t index, uint32_t num, uint8_t *buff);
+
+/**
+ * Name: fatFlush
+ * @brief Write every pending metadata sector with as few requests as possible: the sectors
+ *        are sorted, neighbours are written together, and each changed FAT sector is written
+ *        to all numFATs tables in the same pass. The FAT32 FSInfo sector is updated when the
+ *        FAT changed. Returns once the writes are on the disk.
+ *
+ * @param vol: The volume.
+ *
+ * @return 1 if nothing is left to write, 0 if a write failed; the sectors stay pending.
+ */
+uint8_t fatFlush(t_volume *vol);
+
+/**
+ * Name: invalidateDirCache
+ * @brief Drop a directory from the directory cache after its slots were changed.
+ *
+ * @param vol: The volume.
+ * @param cluster: The start cluster of the directory, as loadDirEntry() or fatLookup() use it.
+ */
+void invalidateDirCache(t_volume *vol, uint32_t cluster);
+
+/**
+ * Name: parseDirEntry
+ * @brief Read a raw 32 byte directory slot into an entry.
+ *
+ * @param vol: The volume.
+ * @param buff: The slot.
+ * @param entry: Receives the entry.
+ */
+void parseDirEntry(t_volume *vol, const uint8_t *buff, t_direcroryEntry *entry);
+
+/**
+ * Name: storeDirEntry
+ * @brief Write an entry into a raw 32 byte directory slot. Bytes the entry does not hold,
+ *        such as the creation time, are left as they are.
+ *
+ * @param vol: The volume.
+ * @param entry: The entry.
+ * @param buff: The slot.
+ */
+void storeDirEntry(t_volume *vol, const t_direcroryEntry *entry, uint8_t *buff);
+
+/**
+ * Name: fatPackName
+ * @brief Turn a name such as "file.txt" into its packed 8.3 form "FILE    TXT".
+ *
+ * @param name: The name, not terminated.
+ * @param length: The number of characters of the name.
+ * @param packed: Receives SIZE_OF_NAME bytes.
+ *
+ * @return 1 if the name fits an 8.3 name, 0 otherwise.
+ */
+uint8_t fatPackName(const char *name, uint32_t length, uint8_t *packed);
 
 #endif /* _FAT_H_ */
 
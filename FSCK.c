@@ -0,0 +1,225 @@
+#include "CHECK.h"
+
+/*******************************************************************************
+* Define
+*******************************************************************************/
+#define FSCK_EXIT_CLEAN         0        /* No problem found */
+#define FSCK_EXIT_PROBLEMS      1        /* The image has problems */
+#define FSCK_EXIT_FAILED        2        /* The image could not be checked */
+
+/*******************************************************************************
+* Prototypes
+*******************************************************************************/
+
+/**
+ * Name: parseOptions
+ * @brief Read the command line.
+ *
+ * @param argc The number of arguments.
+ * @param argv The arguments.
+ * @param options Receives the options.
+ *
+ * @return 1 if the command line is valid, 0 otherwise.
+ */
+uint8_t parseOptions(int argc, char **argv, t_checkOptions *options);
+
+/**
+ * Name: printText
+ * @brief Print the problems of a report one per line, then a summary line.
+ *
+ * @param report The report.
+ */
+void printText(const t_checkReport *report);
+
+/**
+ * Name: printJSON
+ * @brief Print a report as one JSON object.
+ *
+ * @param imagePath The image checked.
+ * @param report The report.
+ */
+void printJSON(const char *imagePath, const t_checkReport *report);
+
+/**
+ * Name: countProblems
+ * @brief Add up the problems of every kind.
+ *
+ * @param report The report.
+ *
+ * @return The number of problems, listed or not.
+ */
+uint64_t countProblems(const t_checkReport *report);
+
+/*******************************************************************************
+* Code
+*******************************************************************************/
+int main(int argc, char **argv)
+{
+    t_checkOptions options;
+    t_checkReport report;
+    t_volume *vol = NULL;
+    int status = FSCK_EXIT_FAILED;
+
+    memset(&report, 0, sizeof(report));
+
+    if(parseOptions(argc, argv, &options) == 0)
+    {
+        printf("Usage: %s IMAGE [--threads N] [--fat-cache BYTES] [--format text|json]\n", argv[0]);
+    }
+    else if((vol = initFileFAT(options.imagePath, &options.volume)) == NULL)
+    {
+        printf("Cannot open the image %s.\n", options.imagePath);
+    }
+    else if(checkVolume(vol, options.numThreads, &report) == 0)
+    {
+        printf("Cannot check the image %s.\n", options.imagePath);
+    }
+    else
+    {
+        if(options.format == CHECK_FORMAT_JSON)
+        {
+            printJSON(options.imagePath, &report);
+        }
+        else
+        {
+            printText(&report);
+        }
+
+        status = (countProblems(&report) == 0) ? FSCK_EXIT_CLEAN : FSCK_EXIT_PROBLEMS;
+    }
+
+    releaseCheckReport(&report);
+    if(vol != NULL)
+    {
+        deinitFileFAT(vol);
+    }
+
+    return status;
+}
+
+uint8_t parseOptions(int argc, char **argv, t_checkOptions *options)
+{
+    uint32_t used = 0;
+    int index = 0;
+    uint8_t result = 1;
+
+    defaultCheckOptions(options);
+
+    for(index = 1; (result == 1) && (index < argc); index++)
+    {
+        used = parseCheckOption(options, argv[index], (index + 1 < argc) ? argv[index + 1] : NULL);
+        if(used == 0)
+        {
+            result = 0;
+        }
+        else
+        {
+            index += (int)used - 1;
+        }
+    }
+
+    if(options->imagePath == NULL)
+    {
+        result = 0;
+    }
+
+    return result;
+}
+
+void printText(const t_checkReport *report)
+{
+    const t_checkProblem *problem = NULL;
+    uint64_t total = 0;
+    uint32_t index = 0;
+
+    for(index = 0; index < report->count; index++)
+    {
+        problem = &report->problems[index];
+        switch(problem->kind)
+        {
+        case CHECK_CROSS_LINK:
+            printf("%s: cluster %u is cross-linked\n", problem->path, problem->cluster);
+            break;
+        case CHECK_LOOP:
+            printf("%s: chain loops back to cluster %u after %u clusters\n", problem->path, problem->cluster, problem->value);
+            break;
+        case CHECK_FREE_CLUSTER:
+            printf("%s: chain reaches free cluster %u\n", problem->path, problem->cluster);
+            break;
+        case CHECK_OUT_OF_RANGE:
+            printf("%s: link from cluster %u to %u is outside the volume\n", problem->path, problem->cluster, problem->value);
+            break;
+        case CHECK_BAD_CLUSTER:
+            printf("%s: chain reaches bad cluster %u\n", problem->path, problem->cluster);
+            break;
+        case CHECK_SIZE_MISMATCH:
+            printf("%s: chain has %u clusters, the size needs %u\n", problem->path, problem->value, problem->expected);
+            break;
+        case CHECK_LOST_CHAIN:
+            printf("lost chain of %u clusters at cluster %u\n", problem->value, problem->cluster);
+            break;
+        default:
+            break;
+        }
+    }
+
+    total = countProblems(report);
+    if(total > report->count)
+    {
+        printf("%llu more problems not listed\n", (unsigned long long)(total - report->count));
+    }
+
+    printf("%u files, %u directories, %u of %u clusters used, %u lost, %u cross-linked, %llu problems\n",
+           report->files, report->directories, report->usedClusters, report->numClusters - FIRST_CLUSTER,
+           report->lostClusters, report->crossLinkedClusters, (unsigned long long)total);
+}
+
+void printJSON(const char *imagePath, const t_checkReport *report)
+{
+    const t_checkProblem *problem = NULL;
+    uint32_t index = 0;
+
+    printf("{\"image\":");
+    statsWriteJSONString(stdout, imagePath);
+    printf(",\"clean\":%s,\"files\":%u,\"directories\":%u,\"clusters\":%u,\"usedClusters\":%u,"
+           "\"lostClusters\":%u,\"crossLinkedClusters\":%u,\"counts\":{",
+           (countProblems(report) == 0) ? "true" : "false", report->files, report->directories,
+           report->numClusters - FIRST_CLUSTER, report->usedClusters, report->lostClusters,
+           report->crossLinkedClusters);
+
+    for(index = 0; index < CHECK_NUM_KINDS; index++)
+    {
+        printf("%s\"%s\":%llu", (index > 0) ? "," : "", checkKindName((uint8_t)index),
+               (unsigned long long)report->counts[index]);
+    }
+
+    printf("},\"problems\":[");
+    for(index = 0; index < report->count; index++)
+    {
+        problem = &report->problems[index];
+        printf("%s{\"kind\":\"%s\",\"path\":", (index > 0) ? "," : "", checkKindName(problem->kind));
+        if(problem->path != NULL)
+        {
+            statsWriteJSONString(stdout, problem->path);
+        }
+        else
+        {
+            printf("null");
+        }
+        printf(",\"cluster\":%u,\"value\":%u,\"expected\":%u}", problem->cluster, problem->value, problem->expected);
+    }
+    printf("]}\n");
+}
+
+uint64_t countProblems(const t_checkReport *report)
+{
+    uint64_t total = 0;
+    uint32_t index = 0;
+
+    for(index = 0; index < CHECK_NUM_KINDS; index++)
+    {
+        total += report->counts[index];
+    }
+
+    return total;
+}
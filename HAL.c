@@ -3,8 +3,12 @@
 /*******************************************************************************
 * Variables
 *******************************************************************************/
-static FILE *fp = NULL;
-static uint32_t sizeSector = BYTE_PER_SECTOR;
+
+/* Category recorded with the accesses of this thread */
+static __thread uint8_t s_traceCategory = HAL_TRACE_OTHER;
+
+/* Devices traced through HAL_TRACE_ENV so far, numbers the trace files */
+static uint32_t s_tracedDevices = 0;
 
 /*******************************************************************************
 * Prototypes
@@ -12,107 +16,2082 @@ static uint32_t sizeSector = BYTE_PER_SECTOR;
 
 /**
  * Name: HAL_Init
- * @brief Initializes the file system by opening a file in binary read mode.
+ * @brief Open a disk image for reading and return the device handle used by every read.
+ *        With HAL_BACKEND_MMAP the file is also mapped read-only; if the mapping
+ *        fails the pread backend is used instead.
+ *        Reads never share a file position, so one device can be read from many threads.
+ *        With a cacheBytes cap the pread backend keeps recently read blocks in an LRU cache;
+ *        the mmap backend has the page cache behind it and ignores the cap.
+ *        A queueDepth sets up an io_uring for HAL_ReadBatch; if the kernel does not
+ *        allow it, batches fall back to one read at a time.
+ *
+ *        With writable set the image is opened read-write; the mapping stays read-only and
+ *        sees the writes through the page cache.
  *
  * @param filePath: The path to the file to be opened.
- * @return FILE*: A pointer to the opened file. If failed, returns NULL.
+ * @param config: The backend and cache settings, NULL for pread without a cache.
+ * @return t_halDevice*: The device handle. If failed, returns NULL.
+ */
+t_halDevice* HAL_Init(const char * fileFath, const t_halConfig *config);
+
+/**
+ * Name: HAL_Deinit
+ * @brief Unmap and close a device opened by HAL_Init.
+ *
+ * @param dev The device handle, may be NULL
  */
-FILE* HAL_Init(const char * fileFath);
+void HAL_Deinit(t_halDevice *dev);
 
 /**
  * Name: HAL_Update
  * @brief Update the number of bytes in a sector
  *
+ * @param dev The device handle
  * @param bytsPerSec the number of bytes in a sector
  */
-void HAL_Update(uint32_t bytsPerSec);
+void HAL_Update(t_halDevice *dev, uint32_t bytsPerSec);
 
 /**
  * Name: HAL_ReadSector
  * @brief  Read sector position index
  *
+ * @param dev The device handle
  * @param index Position sector to read
  * @param buff Array contain this sector
  *
  * @return Byte read in this sector
  */
-uint32_t HAL_ReadSector(uint32_t index, uint8_t *buff);
+uint32_t HAL_ReadSector(t_halDevice *dev, uint32_t index, uint8_t *buff);
 
 /**
  * Name: HAL_ReadMultiSector
  * @brief Read sector from index to num
  *
+ * @param dev The device handle
+ * @param index Position sector to read
+ * @param num Number sector read
+ * @param buff Array contain this sector
+ *
+ * @return byteRead Byte read in 'num' sector
+ */
+uint32_t HAL_ReadMultiSector(t_halDevice *dev, uint32_t index, uint32_t num, uint8_t *buff);
+
+/**
+ * Name: HAL_ReadVector
+ * @brief Read consecutive sectors starting at index into several buffers with one request.
+ *        Each buffer is filled in turn, like readv.
+ *
+ * @param dev The device handle
+ * @param index Position sector to read
+ * @param iov Array of buffers to fill
+ * @param iovcnt Number of buffers
+ *
+ * @return byteRead Byte read into all buffers
+ */
+uint32_t HAL_ReadVector(t_halDevice *dev, uint32_t index, const struct iovec *iov, int iovcnt);
+
+/**
+ * Name: HAL_ReadBatch
+ * @brief Read a list of independent sector ranges. With a queue depth set, up to that many
+ *        reads are submitted to io_uring at once and the next ones are queued as earlier
+ *        ones complete, so the latency of the disk is paid once per queue instead of once
+ *        per range. Without a ring (queue disabled, io_uring not available, mmap backend) or
+ *        while another thread is using it, the ranges are read in turn with HAL_ReadMultiSector.
+ *        Batched reads do not go through the block cache.
+ *
+ * @param dev The device handle
+ * @param requests The ranges to read
+ * @param count Number of ranges
+ *
+ * @return 1 if every range was read completely, 0 otherwise
+ */
+uint8_t HAL_ReadBatch(t_halDevice *dev, const t_halRequest *requests, uint32_t count);
+
+/**
+ * Name: HAL_WriteMultiSector
+ * @brief Write sectors from index to num. Blocks of the cache holding these sectors are
+ *        updated in place, so later reads see the new bytes.
+ *
+ * @param dev The device handle
+ * @param index Position sector to write
+ * @param num Number sector to write
+ * @param buff The bytes of the sectors
+ *
+ * @return Byte written, less than 'num' sectors if the device is read-only or a write failed
+ */
+uint32_t HAL_WriteMultiSector(t_halDevice *dev, uint32_t index, uint32_t num, const uint8_t *buff);
+
+/**
+ * Name: HAL_WriteVector
+ * @brief Write several buffers to consecutive bytes starting at sector index with one
+ *        request, like writev. Used to write a run of sectors kept in separate buffers.
+ *
+ * @param dev The device handle
+ * @param index Position sector to write
+ * @param iov Array of buffers to write
+ * @param iovcnt Number of buffers
+ *
+ * @return Byte written from all buffers
+ */
+uint32_t HAL_WriteVector(t_halDevice *dev, uint32_t index, const struct iovec *iov, int iovcnt);
+
+/**
+ * Name: HAL_Sync
+ * @brief Wait until every write of the device has reached the disk.
+ *
+ * @param dev The device handle
+ *
+ * @return 1 if the data is on the disk, 0 if the device is read-only or the sync failed
+ */
+uint8_t HAL_Sync(t_halDevice *dev);
+
+/**
+ * Name: HAL_GetCacheStats
+ * @brief Get the hit, miss and eviction counters of the block cache.
+ *
+ * @param dev The device handle
+ * @param stats Receives the counters, all zero when the device has no cache
+ */
+void HAL_GetCacheStats(t_halDevice *dev, t_halCacheStats *stats);
+
+/**
+ * Name: HAL_MapSectors
+ * @brief Get a pointer straight into the mapped image for sectors from index to num.
+ *        The pointer stays valid until HAL_Deinit().
+ *
+ * @param dev The device handle
+ * @param index Position sector to map
+ * @param num Number sector to map
+ *
+ * @return Pointer to the first byte of the sector, NULL if the backend is not
+ *         HAL_BACKEND_MMAP or the sectors are outside the image
+ */
+const uint8_t* HAL_MapSectors(t_halDevice *dev, uint32_t index, uint32_t num);
+
+/**
+ * Name: HAL_Advise
+ * @brief Tell the kernel how sectors from index to num are going to be accessed.
+ *
+ * @param dev The device handle
+ * @param index Position of the first sector
+ * @param num Number sector
+ * @param advice One of HAL_ADVICE_NORMAL, HAL_ADVICE_SEQUENTIAL, HAL_ADVICE_RANDOM or HAL_ADVICE_WILLNEED
+ */
+void HAL_Advise(t_halDevice *dev, uint32_t index, uint32_t num, uint8_t advice);
+
+/**
+ * Name: HAL_CopyToFile
+ * @brief Copy bytes of the image starting at a sector to a file, without passing them
+ *        through a user buffer. copy_file_range is tried first, so filesystems that
+ *        support it can share the blocks instead of copying them; sendfile is used when
+ *        the kernel refuses it. With HAL_BACKEND_MMAP the bytes are written straight
+ *        from the mapping. The bytes land at the current position of fd.
+ *
+ * @param dev The device handle
+ * @param index Position of the first sector
+ * @param size Number of bytes to copy, the last sector may be copied in part
+ * @param fd The file to write to, opened for writing
+ *
+ * @return The number of bytes copied; less than size if the image ends or the copy
+ *         failed, the caller copies the rest itself
+ */
+uint32_t HAL_CopyToFile(t_halDevice *dev, uint32_t index, uint32_t size, int fd);
+
+/**
+ * Name: HAL_TraceStart
+ * @brief Start recording every sector access of the device to a binary trace file: a
+ *        t_halTraceHeader followed by one t_halTraceRecord per call, in native byte order.
+ *        HAL_Init starts a trace by itself when HAL_TRACE_ENV is set: the first device of the
+ *        process writes to that file, the next ones to the file name followed by ".1", ".2"
+ *        and so on. Must not be called while other threads read from the device.
+ *
+ * @param dev The device handle
+ * @param path The trace file, replaced if it exists
+ *
+ * @return 1 if the trace started, 0 if the device is already traced or the file cannot be written
+ */
+uint8_t HAL_TraceStart(t_halDevice *dev, const char *path);
+
+/**
+ * Name: HAL_TraceStop
+ * @brief Write the records still in memory and close the trace. HAL_Deinit calls it.
+ *        Must not be called while other threads read from the device.
+ *
+ * @param dev The device handle
+ *
+ * @return 1 if every record was written, 0 if a write failed or the device is not traced
+ */
+uint8_t HAL_TraceStop(t_halDevice *dev);
+
+/**
+ * Name: HAL_TraceCategory
+ * @brief Set the category recorded with the accesses the calling thread makes from now on.
+ *
+ * @param category One of HAL_TRACE_OTHER, HAL_TRACE_FAT, HAL_TRACE_DIR or HAL_TRACE_DATA
+ *
+ * @return The previous category, to restore it afterwards
+ */
+uint8_t HAL_TraceCategory(uint8_t category);
+
+/**
+ * Name: copyFromMap
+ * @brief Copy bytes from the mapped image, stopping at the end of the image like pread.
+ *
+ * @param dev The device handle
+ * @param position Byte offset in the image
+ * @param size Number of bytes to copy
+ * @param buff Destination buffer
+ *
+ * @return Number of bytes copied
+ */
+static uint32_t copyFromMap(t_halDevice *dev, uint64_t position, uint32_t size, uint8_t *buff);
+
+/**
+ * Name: noteAccess
+ * @brief Count a seek when a read does not start where the previous read of the device ended.
+ *        Does nothing while the stats are disabled.
+ *
+ * @param dev The device handle
+ * @param position Byte offset of the read
+ * @param size Number of bytes read
+ */
+static void noteAccess(t_halDevice *dev, uint64_t position, uint64_t size);
+
+/**
+ * Name: readAt
+ * @brief Read bytes at an offset with pread, retrying only if the call is interrupted
+ *        or returns less than asked before the end of the image.
+ *
+ * @param dev The device handle
+ * @param position Byte offset in the image
+ * @param size Number of bytes to read
+ * @param buff Destination buffer
+ *
+ * @return Number of bytes read
+ */
+static uint32_t readAt(t_halDevice *dev, uint64_t position, uint32_t size, uint8_t *buff);
+
+/**
+ * Name: writeAt
+ * @brief Write bytes at an offset with pwrite, retrying interrupted and short writes.
+ *
+ * @param dev The device handle
+ * @param position Byte offset in the image
+ * @param size Number of bytes to write
+ * @param buff Source buffer
+ *
+ * @return Number of bytes written
+ */
+static uint32_t writeAt(t_halDevice *dev, uint64_t position, uint32_t size, const uint8_t *buff);
+
+/**
+ * Name: patchCache
+ * @brief Copy written bytes into the blocks of the cache that hold them. Blocks that are
+ *        not cached are left alone, the next read takes them from the disk.
+ *
+ * @param dev The device handle
+ * @param position Byte offset of the write
+ * @param size Number of bytes written
+ * @param buff The bytes written
+ */
+static void patchCache(t_halDevice *dev, uint64_t position, uint32_t size, const uint8_t *buff);
+
+/**
+ * Name: createCache
+ * @brief Allocate a block cache holding as many blocks as fit in a memory cap.
+ *
+ * @param cacheBytes Memory cap of the cached blocks
+ * @param blockBytes Bytes per block
+ *
+ * @return The cache, NULL if the cap is smaller than one block or memory ran out
+ */
+static t_halCache* createCache(uint32_t cacheBytes, uint32_t blockBytes);
+
+/**
+ * Name: destroyCache
+ * @brief Release a block cache.
+ *
+ * @param cache The cache, may be NULL
+ */
+static void destroyCache(t_halCache *cache);
+
+/**
+ * Name: hashBlock
+ * @brief Get the hash bucket of a block number.
+ *
+ * @param cache The cache
+ * @param block The block number
+ *
+ * @return The bucket index
+ */
+static uint32_t hashBlock(t_halCache *cache, uint64_t block);
+
+/**
+ * Name: findSlot
+ * @brief Find the slot holding a block.
+ *
+ * @param cache The cache
+ * @param block The block number
+ *
+ * @return The slot index, HAL_CACHE_NO_SLOT if the block is not cached
+ */
+static uint32_t findSlot(t_halCache *cache, uint64_t block);
+
+/**
+ * Name: unlinkSlot
+ * @brief Remove a slot from the LRU list.
+ *
+ * @param cache The cache
+ * @param slot The slot index
+ */
+static void unlinkSlot(t_halCache *cache, uint32_t slot);
+
+/**
+ * Name: touchSlot
+ * @brief Make a slot the most recently used one.
+ *
+ * @param cache The cache
+ * @param slot The slot index
+ */
+static void touchSlot(t_halCache *cache, uint32_t slot);
+
+/**
+ * Name: unhashSlot
+ * @brief Remove a slot from its hash chain so its block is no longer found.
+ *
+ * @param cache The cache
+ * @param slot The slot index
+ */
+static void unhashSlot(t_halCache *cache, uint32_t slot);
+
+/**
+ * Name: claimSlot
+ * @brief Get a slot for a block, taking an unused slot or evicting the least recently used one
+ *        that is not filling. The slot is marked as filling.
+ *
+ * @param cache The cache
+ * @param block The block number the slot will hold
+ *
+ * @return The slot index, now the most recently used one; HAL_CACHE_NO_SLOT if every slot is filling
+ */
+static uint32_t claimSlot(t_halCache *cache, uint64_t block);
+
+/**
+ * Name: copyFromSlot
+ * @brief Copy the part of a cached block that falls inside a requested byte range.
+ *
+ * @param cache The cache
+ * @param slot The slot index
+ * @param position Byte offset of the requested range in the image
+ * @param size Number of bytes requested
+ * @param buff Destination buffer of the whole request
+ *
+ * @return Number of bytes copied
+ */
+static uint32_t copyFromSlot(t_halCache *cache, uint32_t slot, uint64_t position, uint32_t size, uint8_t *buff);
+
+/**
+ * Name: readCached
+ * @brief Read bytes through the block cache. Consecutive missing blocks are claimed as filling
+ *        and filled with one preadv that runs without the cache lock; readers of a filling
+ *        block wait for it. A block no slot is free for is read without the cache.
+ *
+ * @param dev The device handle
+ * @param position Byte offset in the image
+ * @param size Number of bytes to read
+ * @param buff Destination buffer
+ *
+ * @return Number of bytes read
+ */
+static uint32_t readCached(t_halDevice *dev, uint64_t position, uint32_t size, uint8_t *buff);
+
+/**
+ * Name: createRing
+ * @brief Set up an io_uring and map its rings.
+ *
+ * @param depth Number of submission entries
+ *
+ * @return The ring, NULL if io_uring or its read opcode is not available or memory ran out
+ */
+static t_halRing* createRing(uint32_t depth);
+
+/**
+ * Name: ringSupportsRead
+ * @brief Ask the kernel whether an io_uring takes IORING_OP_READ. Kernels before 5.6 set up a
+ *        ring but fail every such read with -EINVAL, and have no probe either.
+ *
+ * @param fd The io_uring file descriptor
+ *
+ * @return 1 if the opcode is supported, 0 otherwise
+ */
+static uint8_t ringSupportsRead(int fd);
+
+/**
+ * Name: destroyRing
+ * @brief Unmap and close an io_uring.
+ *
+ * @param ring The ring, may be NULL
+ */
+static void destroyRing(t_halRing *ring);
+
+/**
+ * Name: queueRead
+ * @brief Put one read on the submission ring, to be submitted by the next io_uring_enter.
+ *
+ * @param dev The device handle
+ * @param position Byte offset in the image
+ * @param size Number of bytes to read
+ * @param buff Destination buffer
+ * @param tag Value returned with the completion
+ */
+static void queueRead(t_halDevice *dev, uint64_t position, uint32_t size, uint8_t *buff, uint64_t tag);
+
+/**
+ * Name: readBatchRing
+ * @brief Read a batch of ranges through the io_uring of a device. The ring lock is held.
+ *
+ * @param dev The device handle
+ * @param requests The ranges to read
+ * @param count Number of ranges
+ *
+ * @return 1 if every range was read completely, 0 otherwise
+ */
+static uint8_t readBatchRing(t_halDevice *dev, const t_halRequest *requests, uint32_t count);
+
+/**
+ * Name: readSectors
+ * @brief Body of HAL_ReadMultiSector without the trace, so a batch read one range at a
+ *        time is recorded once.
+ *
+ * @param dev The device handle
  * @param index Position sector to read
  * @param num Number sector read
  * @param buff Array contain this sector
  *
  * @return byteRead Byte read in 'num' sector
  */
-uint32_t HAL_ReadMultiSector(uint32_t index, uint32_t num, uint8_t *buff);
+static uint32_t readSectors(t_halDevice *dev, uint32_t index, uint32_t num, uint8_t *buff);
+
+/**
+ * Name: writeAll
+ * @brief Write a buffer completely, retrying interrupted and short writes.
+ *
+ * @param fd The file
+ * @param buff The bytes to write
+ * @param size Number of bytes
+ *
+ * @return 1 if every byte was written, 0 otherwise
+ */
+static uint8_t writeAll(int fd, const void *buff, uint64_t size);
+
+/**
+ * Name: flushTrace
+ * @brief Write the records waiting in memory to the trace file. The trace lock is held.
+ *
+ * @param trace The trace
+ */
+static void flushTrace(t_halTrace *trace);
+
+/**
+ * Name: appendRecord
+ * @brief Add one record stamped with the current time and category. The trace lock is held.
+ *
+ * @param trace The trace
+ * @param op One of HAL_TRACE_READ to HAL_TRACE_WRITE
+ * @param index First sector accessed
+ * @param num Sectors accessed, or bytes for the ops noted
+ */
+static void appendRecord(t_halTrace *trace, uint8_t op, uint32_t index, uint32_t num);
+
+/**
+ * Name: traceAccess
+ * @brief Record one access if the device is traced.
+ *
+ * @param dev The device handle
+ * @param op One of HAL_TRACE_READ to HAL_TRACE_WRITE
+ * @param index First sector accessed
+ * @param num Sectors accessed, or bytes for the ops noted
+ */
+static void traceAccess(t_halDevice *dev, uint8_t op, uint32_t index, uint32_t num);
+
+/**
+ * Name: traceBatch
+ * @brief Record the ranges of a batch next to each other if the device is traced.
+ *
+ * @param dev The device handle
+ * @param requests The ranges of the batch
+ * @param count Number of ranges
+ */
+static void traceBatch(t_halDevice *dev, const t_halRequest *requests, uint32_t count);
 
 /*******************************************************************************
 * Code
 *******************************************************************************/
 
-FILE* HAL_Init(const char *fileFath)
+t_halDevice* HAL_Init(const char *fileFath, const t_halConfig *config)
 {
-    /* Open file to read */
-    fp = fopen(fileFath, "rb");
-    if (fp == NULL )
+    t_halDevice *dev = NULL;
+    const char *tracePath = NULL;
+    char numberedPath[HAL_TRACE_PATH_MAX];
+    struct stat info;
+    uint32_t traceNumber = 0;
+    uint8_t backend = HAL_BACKEND_PREAD;
+    uint32_t blockBytes = HAL_CACHE_BLOCK_SIZE;
+
+    if(config != NULL)
+    {
+        backend = config->backend;
+        if(config->blockBytes != 0)
+        {
+            blockBytes = config->blockBytes;
+        }
+    }
+
+    /* FAT_STATS in the environment turns the counters on for the whole process */
+    statsInitFromEnv();
+
+    /* Allocate some memory */
+    dev = (t_halDevice*)calloc(1, sizeof(t_halDevice));
+
+    if(dev == NULL)
+    {
+        fprintf(stderr, "The disk is empty.\n");
+    }
+    /* Open file to read, and to write when asked */
+    else if((dev->fd = open(fileFath, ((config != NULL) && (config->writable == 1)) ? O_RDWR : O_RDONLY)) < 0)
     {
-        printf("Failed to open the file.\n");
+        fprintf(stderr, "Failed to open the file.\n");
+        free(dev);
+        dev = NULL;
+    }
+    else
+    {
+        dev->sizeSector = BYTE_PER_SECTOR;
+        dev->backend = HAL_BACKEND_PREAD;
+        dev->writable = ((config != NULL) && (config->writable == 1)) ? 1 : 0;
+
+        if(backend == HAL_BACKEND_MMAP)
+        {
+            if((fstat(dev->fd, &info) != 0) || (info.st_size == 0))
+            {
+                fprintf(stderr, "Failed to map the file, using pread.\n");
+            }
+            else
+            {
+                dev->map = (uint8_t*)mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, dev->fd, 0);
+                if(dev->map == MAP_FAILED)
+                {
+                    fprintf(stderr, "Failed to map the file, using pread.\n");
+                    dev->map = NULL;
+                }
+                else
+                {
+                    dev->mapSize = info.st_size;
+                    dev->backend = HAL_BACKEND_MMAP;
+                }
+            }
+        }
+
+        /* Only the pread backend has a block cache */
+        if((dev->backend == HAL_BACKEND_PREAD) && (config != NULL) && (config->cacheBytes != HAL_CACHE_DISABLED))
+        {
+            dev->cache = createCache(config->cacheBytes, blockBytes);
+        }
+
+        /* Batched reads are queued to io_uring, the mapping is read with memcpy anyway */
+        if((dev->backend == HAL_BACKEND_PREAD) && (config != NULL) && (config->queueDepth != HAL_QUEUE_DISABLED))
+        {
+            dev->ring = createRing((config->queueDepth < HAL_QUEUE_MAX) ? config->queueDepth : HAL_QUEUE_MAX);
+        }
+
+        /* FAT_TRACE in the environment records the accesses of the device. A trace is replayed
+           against one image, so every further device of the process gets its own file */
+        tracePath = getenv(HAL_TRACE_ENV);
+        if((tracePath != NULL) && (tracePath[0] != '\0'))
+        {
+            traceNumber = __atomic_fetch_add(&s_tracedDevices, 1, __ATOMIC_RELAXED);
+            if(traceNumber == 0)
+            {
+                HAL_TraceStart(dev, tracePath);
+            }
+            else if(snprintf(numberedPath, sizeof(numberedPath), "%s.%u", tracePath, traceNumber) >= (int)sizeof(numberedPath))
+            {
+                fprintf(stderr, "Failed to create the trace %s.%u.\n", tracePath, traceNumber);
+            }
+            else
+            {
+                HAL_TraceStart(dev, numberedPath);
+            }
+        }
     }
 
-    return fp;
+    return dev;
 }
 
-void HAL_Update(uint32_t bytsPerSec)
+void HAL_Deinit(t_halDevice *dev)
 {
-    sizeSector = bytsPerSec;
+    if(dev != NULL)
+    {
+        if(dev->map != NULL)
+        {
+            munmap(dev->map, dev->mapSize);
+        }
+
+        HAL_TraceStop(dev);
+        destroyCache(dev->cache);
+        destroyRing(dev->ring);
+        close(dev->fd);
+        free(dev);
+    }
 }
 
-uint32_t HAL_ReadSector(uint32_t index, uint8_t *buff)
+void HAL_Update(t_halDevice *dev, uint32_t bytsPerSec)
 {
-    uint64_t positionPointer = 0;
-    uint32_t byteRead = 0;
+    dev->sizeSector = bytsPerSec;
+    traceAccess(dev, HAL_TRACE_SECTOR_SIZE, 0, bytsPerSec);
+}
 
-    positionPointer = index * sizeSector;
+static uint32_t copyFromMap(t_halDevice *dev, uint64_t position, uint32_t size, uint8_t *buff)
+{
+    uint32_t byteRead = 0;
 
-    if(buff == NULL)
+    if(position < dev->mapSize)
     {
-        printf("The disk is empty!");
+        byteRead = size;
+        if(position + size > dev->mapSize)
+        {
+            byteRead = dev->mapSize - position;
+        }
+
+        memcpy(buff, dev->map + position, byteRead);
     }
-    else if (fseek(fp, positionPointer, SEEK_SET) != 0x00)
+
+    return byteRead;
+}
+
+static void noteAccess(t_halDevice *dev, uint64_t position, uint64_t size)
+{
+    if(STATS_ENABLED())
     {
-        printf("Error moving the file pointer.\n");
+        if(__atomic_exchange_n(&dev->lastEnd, position + size, __ATOMIC_RELAXED) != position)
+        {
+            statsCount(STATS_SEEKS, 1);
+        }
     }
-    else
+}
+
+static uint32_t readAt(t_halDevice *dev, uint64_t position, uint32_t size, uint8_t *buff)
+{
+    uint32_t byteRead = 0;
+    ssize_t result = 0;
+
+    while(byteRead < size)
     {
-        byteRead = fread(buff, sizeof(uint8_t), sizeSector, fp);
+        result = pread(dev->fd, buff + byteRead, size - byteRead, (off_t)(position + byteRead));
+        STATS_COUNT(STATS_SYSCALLS, 1);
+        if(result > 0)
+        {
+            byteRead += (uint32_t)result;
+        }
+        else if((result < 0) && (errno == EINTR))
+        {
+            continue;
+        }
+        else
+        {
+            /* End of the image or a read error */
+            if(result < 0)
+            {
+                fprintf(stderr, "Error reading the file.\n");
+            }
+            break;
+        }
     }
 
     return byteRead;
 }
 
-uint32_t HAL_ReadMultiSector(uint32_t index, uint32_t num, uint8_t *buff)
+static uint32_t writeAt(t_halDevice *dev, uint64_t position, uint32_t size, const uint8_t *buff)
 {
-    uint32_t positionPointer = 0;
-    uint32_t byteRead = 0;
+    uint32_t byteWrite = 0;
+    ssize_t result = 0;
 
-    positionPointer = index * sizeSector;
+    while(byteWrite < size)
+    {
+        result = pwrite(dev->fd, buff + byteWrite, size - byteWrite, (off_t)(position + byteWrite));
+        if(result > 0)
+        {
+            byteWrite += (uint32_t)result;
+        }
+        else if((result < 0) && (errno == EINTR))
+        {
+            continue;
+        }
+        else
+        {
+            fprintf(stderr, "Error writing the file.\n");
+            break;
+        }
+    }
 
-    if(buff == NULL)
+    return byteWrite;
+}
+
+static void patchCache(t_halDevice *dev, uint64_t position, uint32_t size, const uint8_t *buff)
+{
+    t_halCache *cache = dev->cache;
+    uint64_t block = 0;
+    uint64_t lastBlock = 0;
+    uint64_t blockStart = 0;
+    uint64_t from = 0;
+    uint64_t to = 0;
+    uint32_t slot = 0;
+
+    if((cache != NULL) && (size > 0))
+    {
+        block = position / cache->blockBytes;
+        lastBlock = (position + size - 1) / cache->blockBytes;
+
+        pthread_mutex_lock(&cache->lock);
+        for(; block <= lastBlock; block++)
+        {
+            slot = findSlot(cache, block);
+            if((slot != HAL_CACHE_NO_SLOT) && (cache->slots[slot].filling == 1))
+            {
+                /* The read in flight may return the old bytes; the block is dropped when it ends */
+                cache->slots[slot].stale = 1;
+            }
+            else if(slot != HAL_CACHE_NO_SLOT)
+            {
+                blockStart = block * cache->blockBytes;
+                from = (position > blockStart) ? position : blockStart;
+                to = blockStart + cache->blockBytes;
+                if(to > position + size)
+                {
+                    to = position + size;
+                }
+
+                memcpy(cache->data + ((size_t)slot * cache->blockBytes) + (from - blockStart), buff + (from - position), to - from);
+
+                /* A write past the end of the image makes the block longer */
+                if(to - blockStart > cache->slots[slot].length)
+                {
+                    cache->slots[slot].length = (uint32_t)(to - blockStart);
+                }
+            }
+        }
+        pthread_mutex_unlock(&cache->lock);
+    }
+}
+
+static t_halCache* createCache(uint32_t cacheBytes, uint32_t blockBytes)
+{
+    t_halCache *cache = NULL;
+    uint32_t numSlots = 0;
+    uint32_t index = 0;
+
+    numSlots = cacheBytes / blockBytes;
+
+    if(numSlots > 0)
     {
-        printf("The disk is empty!");
+        /* Allocate some memory */
+        cache = (t_halCache*)calloc(1, sizeof(t_halCache));
     }
-    else if(fseek(fp, positionPointer, SEEK_SET) != 0x00)
+
+    if(cache != NULL)
     {
-        printf("Error moving the file pointer.\n");
+        cache->numSlots = numSlots;
+        cache->blockBytes = blockBytes;
+        cache->mru = HAL_CACHE_NO_SLOT;
+        cache->lru = HAL_CACHE_NO_SLOT;
+
+        /* At least one bucket per slot keeps the chains short */
+        cache->numBuckets = 1;
+        while(cache->numBuckets < numSlots)
+        {
+            cache->numBuckets <<= 1;
+        }
+
+        cache->data = (uint8_t*)malloc((size_t)numSlots * blockBytes);
+        cache->slots = (t_halCacheSlot*)malloc(numSlots * sizeof(t_halCacheSlot));
+        cache->buckets = (uint32_t*)malloc(cache->numBuckets * sizeof(uint32_t));
+
+        if((cache->data == NULL) || (cache->slots == NULL) || (cache->buckets == NULL))
+        {
+            fprintf(stderr, "Not enough memory for the block cache.\n");
+            free(cache->data);
+            free(cache->slots);
+            free(cache->buckets);
+            free(cache);
+            cache = NULL;
+        }
+        else
+        {
+            for(index = 0; index < cache->numBuckets; index++)
+            {
+                cache->buckets[index] = HAL_CACHE_NO_SLOT;
+            }
+
+            cache->stats.numSlots = numSlots;
+            cache->stats.blockBytes = blockBytes;
+            pthread_mutex_init(&cache->lock, NULL);
+            pthread_cond_init(&cache->filled, NULL);
+        }
     }
-    else
+
+    return cache;
+}
+
+static void destroyCache(t_halCache *cache)
+{
+    if(cache != NULL)
     {
-        byteRead = fread(buff, sizeof(uint8_t), sizeSector * num, fp);
+        pthread_cond_destroy(&cache->filled);
+        pthread_mutex_destroy(&cache->lock);
+        free(cache->data);
+        free(cache->slots);
+        free(cache->buckets);
+        free(cache);
     }
+}
 
-    return byteRead;
+static uint32_t hashBlock(t_halCache *cache, uint64_t block)
+{
+    /* Fibonacci hashing spreads neighbouring blocks over the buckets */
+    return (uint32_t)((block * 0x9E3779B97F4A7C15ULL) >> 32) & (cache->numBuckets - 1);
+}
+
+static uint32_t findSlot(t_halCache *cache, uint64_t block)
+{
+    uint32_t slot = HAL_CACHE_NO_SLOT;
+
+    slot = cache->buckets[hashBlock(cache, block)];
+    while((slot != HAL_CACHE_NO_SLOT) && (cache->slots[slot].block != block))
+    {
+        slot = cache->slots[slot].hashNext;
+    }
+
+    return slot;
+}
+
+static void unlinkSlot(t_halCache *cache, uint32_t slot)
+{
+    t_halCacheSlot *node = &cache->slots[slot];
+
+    if(node->prev != HAL_CACHE_NO_SLOT)
+    {
+        cache->slots[node->prev].next = node->next;
+    }
+    else
+    {
+        cache->mru = node->next;
+    }
+
+    if(node->next != HAL_CACHE_NO_SLOT)
+    {
+        cache->slots[node->next].prev = node->prev;
+    }
+    else
+    {
+        cache->lru = node->prev;
+    }
+}
+
+static void touchSlot(t_halCache *cache, uint32_t slot)
+{
+    if(cache->mru != slot)
+    {
+        unlinkSlot(cache, slot);
+
+        /* Insert at the front of the list */
+        cache->slots[slot].prev = HAL_CACHE_NO_SLOT;
+        cache->slots[slot].next = cache->mru;
+        if(cache->mru != HAL_CACHE_NO_SLOT)
+        {
+            cache->slots[cache->mru].prev = slot;
+        }
+        else
+        {
+            cache->lru = slot;
+        }
+        cache->mru = slot;
+    }
+}
+
+static void unhashSlot(t_halCache *cache, uint32_t slot)
+{
+    uint32_t *link = NULL;
+
+    link = &cache->buckets[hashBlock(cache, cache->slots[slot].block)];
+    while((*link != HAL_CACHE_NO_SLOT) && (*link != slot))
+    {
+        link = &cache->slots[*link].hashNext;
+    }
+
+    if(*link == slot)
+    {
+        *link = cache->slots[slot].hashNext;
+    }
+}
+
+static uint32_t claimSlot(t_halCache *cache, uint64_t block)
+{
+    uint32_t slot = HAL_CACHE_NO_SLOT;
+    uint32_t bucket = 0;
+
+    if(cache->usedSlots < cache->numSlots)
+    {
+        /* Take a slot that was never used */
+        slot = cache->usedSlots;
+        cache->usedSlots++;
+
+        cache->slots[slot].prev = HAL_CACHE_NO_SLOT;
+        cache->slots[slot].next = cache->mru;
+        if(cache->mru != HAL_CACHE_NO_SLOT)
+        {
+            cache->slots[cache->mru].prev = slot;
+        }
+        else
+        {
+            cache->lru = slot;
+        }
+        cache->mru = slot;
+    }
+    else
+    {
+        /* Evict the least recently used block; blocks being filled are still in use */
+        slot = cache->lru;
+        while((slot != HAL_CACHE_NO_SLOT) && (cache->slots[slot].filling == 1))
+        {
+            slot = cache->slots[slot].prev;
+        }
+
+        if(slot != HAL_CACHE_NO_SLOT)
+        {
+            if(cache->slots[slot].block != UINT64_MAX)
+            {
+                unhashSlot(cache, slot);
+                cache->stats.evictions++;
+            }
+            touchSlot(cache, slot);
+        }
+    }
+
+    if(slot != HAL_CACHE_NO_SLOT)
+    {
+        bucket = hashBlock(cache, block);
+        cache->slots[slot].block = block;
+        cache->slots[slot].length = 0;
+        cache->slots[slot].filling = 1;
+        cache->slots[slot].stale = 0;
+        cache->slots[slot].hashNext = cache->buckets[bucket];
+        cache->buckets[bucket] = slot;
+    }
+
+    return slot;
+}
+
+static uint32_t copyFromSlot(t_halCache *cache, uint32_t slot, uint64_t position, uint32_t size, uint8_t *buff)
+{
+    uint64_t blockStart = 0;
+    uint64_t from = 0;
+    uint64_t to = 0;
+    uint32_t byteCopy = 0;
+
+    blockStart = cache->slots[slot].block * cache->blockBytes;
+
+    /* Intersect the request with the valid bytes of the block */
+    from = (position > blockStart) ? position : blockStart;
+    to = blockStart + cache->slots[slot].length;
+    if(to > position + size)
+    {
+        to = position + size;
+    }
+
+    if(to > from)
+    {
+        byteCopy = (uint32_t)(to - from);
+        memcpy(buff + (from - position), cache->data + ((size_t)slot * cache->blockBytes) + (from - blockStart), byteCopy);
+    }
+
+    return byteCopy;
+}
+
+static uint32_t readCached(t_halDevice *dev, uint64_t position, uint32_t size, uint8_t *buff)
+{
+    t_halCache *cache = dev->cache;
+    struct iovec iov[HAL_CACHE_MAX_RUN];
+    uint32_t runSlot[HAL_CACHE_MAX_RUN];
+    uint64_t block = 0;
+    uint64_t lastBlock = 0;
+    uint64_t remain = 0;
+    uint64_t from = 0;
+    uint64_t to = 0;
+    uint32_t slot = 0;
+    uint32_t run = 0;
+    uint32_t maxRun = 0;
+    uint32_t index = 0;
+    uint32_t byteRead = 0;
+    ssize_t result = 0;
+    uint8_t endOfImage = 0;
+
+    block = position / cache->blockBytes;
+    lastBlock = (position + size - 1) / cache->blockBytes;
+
+    /* A run never claims more slots than the cache has */
+    maxRun = (cache->numSlots < HAL_CACHE_MAX_RUN) ? cache->numSlots : HAL_CACHE_MAX_RUN;
+
+    pthread_mutex_lock(&cache->lock);
+
+    while((block <= lastBlock) && (endOfImage == 0))
+    {
+        slot = findSlot(cache, block);
+
+        if((slot != HAL_CACHE_NO_SLOT) && (cache->slots[slot].filling == 1))
+        {
+            /* Another thread is reading the block; look it up again once it is done */
+            pthread_cond_wait(&cache->filled, &cache->lock);
+        }
+        else if(slot != HAL_CACHE_NO_SLOT)
+        {
+            touchSlot(cache, slot);
+            cache->stats.hits++;
+            STATS_COUNT(STATS_CACHE_HITS, 1);
+            byteRead += copyFromSlot(cache, slot, position, size, buff);
+            endOfImage = (cache->slots[slot].length < cache->blockBytes);
+            block++;
+        }
+        else
+        {
+            /* Claim slots for the run of missing blocks */
+            run = 0;
+            while((block + run <= lastBlock) && (run < maxRun) &&
+                  ((run == 0) || (findSlot(cache, block + run) == HAL_CACHE_NO_SLOT)) &&
+                  ((runSlot[run] = claimSlot(cache, block + run)) != HAL_CACHE_NO_SLOT))
+            {
+                iov[run].iov_base = cache->data + ((size_t)runSlot[run] * cache->blockBytes);
+                iov[run].iov_len = cache->blockBytes;
+                run++;
+            }
+            cache->stats.misses += run;
+            cache->stats.bypasses += (run == 0);
+            STATS_COUNT(STATS_CACHE_MISSES, run);
+
+            /* Fill them with one read, other blocks stay usable meanwhile */
+            pthread_mutex_unlock(&cache->lock);
+
+            if(run > 0)
+            {
+                do
+                {
+                    result = preadv(dev->fd, iov, run, (off_t)(block * cache->blockBytes));
+                    STATS_COUNT(STATS_SYSCALLS, 1);
+                } while((result < 0) && (errno == EINTR));
+            }
+            else
+            {
+                /* Every slot is filling: read the part of this block the request needs */
+                from = (position > block * cache->blockBytes) ? position : block * cache->blockBytes;
+                to = (block + 1) * cache->blockBytes;
+                if(to > position + size)
+                {
+                    to = position + size;
+                }
+
+                do
+                {
+                    result = pread(dev->fd, buff + (from - position), to - from, (off_t)from);
+                    STATS_COUNT(STATS_SYSCALLS, 1);
+                } while((result < 0) && (errno == EINTR));
+            }
+
+            if(result < 0)
+            {
+                fprintf(stderr, "Error reading the file.\n");
+                result = 0;
+            }
+
+            pthread_mutex_lock(&cache->lock);
+
+            if(run == 0)
+            {
+                byteRead += (uint32_t)result;
+                endOfImage = ((uint64_t)result < to - from);
+                block++;
+            }
+
+            remain = (uint64_t)result;
+            for(index = 0; index < run; index++)
+            {
+                slot = runSlot[index];
+                cache->slots[slot].length = (remain > cache->blockBytes) ? cache->blockBytes : (uint32_t)remain;
+                cache->slots[slot].filling = 0;
+                remain -= cache->slots[slot].length;
+
+                if(cache->slots[slot].length > 0)
+                {
+                    byteRead += copyFromSlot(cache, slot, position, size, buff);
+                }
+
+                if(cache->slots[slot].length < cache->blockBytes)
+                {
+                    endOfImage = 1;
+                }
+
+                if((cache->slots[slot].length == 0) || (cache->slots[slot].stale == 1))
+                {
+                    /* Nothing to keep past the end of the image, after an error or a write */
+                    unhashSlot(cache, slot);
+                    cache->slots[slot].block = UINT64_MAX;
+                }
+            }
+
+            if(run > 0)
+            {
+                pthread_cond_broadcast(&cache->filled);
+            }
+
+            block += run;
+        }
+    }
+
+    pthread_mutex_unlock(&cache->lock);
+
+    return byteRead;
+}
+
+static t_halRing* createRing(uint32_t depth)
+{
+    t_halRing *ring = NULL;
+#ifdef HAL_HAVE_IO_URING
+    struct io_uring_params params;
+    void *area = NULL;
+    uint8_t ok = 0;
+
+    ring = (t_halRing*)calloc(1, sizeof(t_halRing));
+    memset(&params, 0, sizeof(params));
+
+    if(ring == NULL)
+    {
+        fprintf(stderr, "The disk is empty.\n");
+    }
+    /* Not every kernel or sandbox allows io_uring, the caller falls back to pread */
+    else if((ring->fd = (int)syscall(__NR_io_uring_setup, depth, &params)) < 0)
+    {
+        free(ring);
+        ring = NULL;
+    }
+    else
+    {
+        ring->depth = params.sq_entries;
+        ring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+        ring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+        ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+
+        /* Newer kernels map both rings with one call */
+        if(params.features & IORING_FEAT_SINGLE_MMAP)
+        {
+            if(ring->cqRingSize > ring->sqRingSize)
+            {
+                ring->sqRingSize = ring->cqRingSize;
+            }
+            ring->cqRingSize = ring->sqRingSize;
+        }
+
+        area = mmap(NULL, ring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+        if(area != MAP_FAILED)
+        {
+            ring->sqRing = (uint8_t*)area;
+            if(params.features & IORING_FEAT_SINGLE_MMAP)
+            {
+                ring->cqRing = ring->sqRing;
+            }
+            else
+            {
+                area = mmap(NULL, ring->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+                ring->cqRing = (area != MAP_FAILED) ? (uint8_t*)area : NULL;
+            }
+        }
+
+        if(ring->cqRing != NULL)
+        {
+            area = mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+            if(area != MAP_FAILED)
+            {
+                ring->sqes = (uint8_t*)area;
+                ok = 1;
+            }
+        }
+
+        if((ok == 0) || (ringSupportsRead(ring->fd) == 0))
+        {
+            destroyRing(ring);
+            ring = NULL;
+        }
+        else
+        {
+            ring->sqHead = (uint32_t*)(ring->sqRing + params.sq_off.head);
+            ring->sqTail = (uint32_t*)(ring->sqRing + params.sq_off.tail);
+            ring->sqMask = (uint32_t*)(ring->sqRing + params.sq_off.ring_mask);
+            ring->sqArray = (uint32_t*)(ring->sqRing + params.sq_off.array);
+            ring->cqHead = (uint32_t*)(ring->cqRing + params.cq_off.head);
+            ring->cqTail = (uint32_t*)(ring->cqRing + params.cq_off.tail);
+            ring->cqMask = (uint32_t*)(ring->cqRing + params.cq_off.ring_mask);
+            ring->cqes = ring->cqRing + params.cq_off.cqes;
+            pthread_mutex_init(&ring->lock, NULL);
+        }
+    }
+#else
+    (void)depth;
+#endif
+
+    return ring;
+}
+
+static uint8_t ringSupportsRead(int fd)
+{
+    uint8_t supported = 0;
+#ifdef HAL_HAVE_IO_URING
+    struct io_uring_probe *probe = NULL;
+    uint32_t numOps = 256;
+
+    probe = (struct io_uring_probe*)calloc(1, sizeof(struct io_uring_probe) + numOps * sizeof(struct io_uring_probe_op));
+
+    if(probe == NULL)
+    {
+        fprintf(stderr, "The disk is empty.\n");
+    }
+    else
+    {
+        if((syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, numOps) >= 0) &&
+           (probe->last_op >= IORING_OP_READ) && ((probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED) != 0))
+        {
+            supported = 1;
+        }
+        free(probe);
+    }
+#else
+    (void)fd;
+#endif
+
+    return supported;
+}
+
+static void destroyRing(t_halRing *ring)
+{
+    if(ring != NULL)
+    {
+        if(ring->sqes != NULL)
+        {
+            munmap(ring->sqes, ring->sqesSize);
+            pthread_mutex_destroy(&ring->lock);
+        }
+        if((ring->cqRing != NULL) && (ring->cqRing != ring->sqRing))
+        {
+            munmap(ring->cqRing, ring->cqRingSize);
+        }
+        if(ring->sqRing != NULL)
+        {
+            munmap(ring->sqRing, ring->sqRingSize);
+        }
+
+        close(ring->fd);
+        free(ring);
+    }
+}
+
+static void queueRead(t_halDevice *dev, uint64_t position, uint32_t size, uint8_t *buff, uint64_t tag)
+{
+#ifdef HAL_HAVE_IO_URING
+    t_halRing *ring = NULL;
+    struct io_uring_sqe *sqe = NULL;
+    uint32_t tail = 0;
+    uint32_t slot = 0;
+
+    ring = dev->ring;
+    tail = *ring->sqTail;
+    slot = tail & *ring->sqMask;
+
+    sqe = &((struct io_uring_sqe*)ring->sqes)[slot];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = dev->fd;
+    sqe->off = position;
+    sqe->addr = (uint64_t)(uintptr_t)buff;
+    sqe->len = size;
+    sqe->user_data = tag;
+
+    ring->sqArray[slot] = slot;
+
+    /* The entry must be visible before the kernel sees the new tail */
+    __atomic_store_n(ring->sqTail, tail + 1, __ATOMIC_RELEASE);
+#else
+    (void)dev;
+    (void)position;
+    (void)size;
+    (void)buff;
+    (void)tag;
+#endif
+}
+
+static uint8_t readBatchRing(t_halDevice *dev, const t_halRequest *requests, uint32_t count)
+{
+    uint8_t result = 0;
+#ifdef HAL_HAVE_IO_URING
+    t_halRing *ring = NULL;
+    struct io_uring_cqe *cqe = NULL;
+    uint32_t *progress = NULL;
+    uint32_t *retry = NULL;
+    uint32_t retryCount = 0;
+    uint32_t next = 0;
+    uint32_t inFlight = 0;
+    uint32_t pending = 0;
+    uint32_t unsubmitted = 0;
+    uint32_t head = 0;
+    uint32_t tail = 0;
+    uint32_t req = 0;
+    uint32_t size = 0;
+    int ret = 0;
+    int error = 0;
+    uint8_t broken = 0;
+
+    ring = dev->ring;
+    result = 1;
+
+    /* Bytes already read of each range, and ranges to resubmit after a short read */
+    progress = (uint32_t*)calloc((uint64_t)count * 2, sizeof(uint32_t));
+
+    if(progress == NULL)
+    {
+        fprintf(stderr, "The disk is empty.\n");
+        result = 0;
+    }
+    else
+    {
+        retry = progress + count;
+
+        while((broken == 0) && ((inFlight > 0) || ((result == 1) && ((next < count) || (retryCount > 0)))))
+        {
+            /* Keep the queue full: short reads first, then new ranges */
+            while((result == 1) && (inFlight < ring->depth) && ((retryCount > 0) || (next < count)))
+            {
+                req = (retryCount > 0) ? retry[--retryCount] : next++;
+                size = requests[req].num * dev->sizeSector;
+                queueRead(dev, (uint64_t)requests[req].index * dev->sizeSector + progress[req],
+                          size - progress[req], requests[req].buff + progress[req], req);
+                inFlight++;
+            }
+
+            /* Submit what the kernel has not taken yet and wait for one completion */
+            pending = *ring->sqTail - __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+            ret = (int)syscall(__NR_io_uring_enter, ring->fd, pending, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+            error = (ret < 0) ? errno : 0;
+            STATS_COUNT(STATS_SYSCALLS, 1);
+            if((ret < 0) && (error != EINTR) && (error != EAGAIN) && (error != EBUSY))
+            {
+                if((result == 1) && (error != EINVAL))
+                {
+                    fprintf(stderr, "Error reading the file.\n");
+                }
+                result = 0;
+
+                /* Take back the reads the kernel has not taken, they never started. The ones it
+                   took still write into the buffers of the caller, so they are waited for */
+                unsubmitted = *ring->sqTail - __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+                if(unsubmitted > 0)
+                {
+                    __atomic_store_n(ring->sqTail, *ring->sqTail - unsubmitted, __ATOMIC_RELEASE);
+                    inFlight -= unsubmitted;
+                }
+                else if(pending == 0)
+                {
+                    /* Even waiting fails: late completions must never be taken for the next batch */
+                    ring->broken = 1;
+                    broken = 1;
+                }
+
+                if(error == EINVAL)
+                {
+                    /* The kernel does not take these submissions, the batch is read again without it */
+                    ring->broken = 1;
+                }
+            }
+
+            head = *ring->cqHead;
+            tail = __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE);
+            while(head != tail)
+            {
+                cqe = &((struct io_uring_cqe*)ring->cqes)[head & *ring->cqMask];
+                req = (uint32_t)cqe->user_data;
+                size = requests[req].num * dev->sizeSector;
+                inFlight--;
+
+                if(cqe->res > 0)
+                {
+                    progress[req] += (uint32_t)cqe->res;
+                    if(progress[req] < size)
+                    {
+                        retry[retryCount++] = req;
+                    }
+                }
+                else if((cqe->res == -EINTR) || (cqe->res == -EAGAIN))
+                {
+                    retry[retryCount++] = req;
+                }
+                else if(cqe->res == -EINVAL)
+                {
+                    /* The kernel does not know the opcode or its flags, the batch is read again without the ring */
+                    ring->broken = 1;
+                    result = 0;
+                }
+                else
+                {
+                    /* End of the image or a read error */
+                    if(cqe->res < 0)
+                    {
+                        fprintf(stderr, "Error reading the file.\n");
+                    }
+                    result = 0;
+                }
+
+                head++;
+            }
+            __atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE);
+        }
+
+        free(progress);
+    }
+
+    if(dev->cache != NULL)
+    {
+        pthread_mutex_lock(&dev->cache->lock);
+        dev->cache->stats.bypasses += count;
+        pthread_mutex_unlock(&dev->cache->lock);
+    }
+#else
+    (void)dev;
+    (void)requests;
+    (void)count;
+#endif
+
+    return result;
+}
+
+uint8_t HAL_ReadBatch(t_halDevice *dev, const t_halRequest *requests, uint32_t count)
+{
+    uint64_t start = 0;
+    uint64_t bytes = 0;
+    uint32_t index = 0;
+    uint8_t viaRing = 0;
+    uint8_t result = 1;
+
+    start = STATS_START();
+
+    traceBatch(dev, requests, count);
+
+    if((dev->ring != NULL) && (count > 1) && (pthread_mutex_trylock(&dev->ring->lock) == 0))
+    {
+        if(dev->ring->broken == 0)
+        {
+            for(index = 0; (start != 0) && (index < count); index++)
+            {
+                noteAccess(dev, (uint64_t)requests[index].index * dev->sizeSector, (uint64_t)requests[index].num * dev->sizeSector);
+            }
+
+            result = readBatchRing(dev, requests, count);
+
+            /* A ring found unusable during the batch leaves it to the reads below */
+            viaRing = (dev->ring->broken == 0);
+        }
+        pthread_mutex_unlock(&dev->ring->lock);
+    }
+
+    if(viaRing == 0)
+    {
+        /* One range at a time, another batch keeps the ring busy, it is broken or there is none */
+        result = 1;
+        for(index = 0; index < count; index++)
+        {
+            if(readSectors(dev, requests[index].index, requests[index].num, requests[index].buff)
+               != requests[index].num * dev->sizeSector)
+            {
+                result = 0;
+            }
+        }
+    }
+
+    for(index = 0; (start != 0) && (index < count); index++)
+    {
+        bytes += (uint64_t)requests[index].num * dev->sizeSector;
+    }
+    STATS_RECORD(STATS_OP_READ_BATCH, start, bytes);
+
+    return result;
+}
+
+void HAL_GetCacheStats(t_halDevice *dev, t_halCacheStats *stats)
+{
+    memset(stats, 0, sizeof(t_halCacheStats));
+
+    if(dev->cache != NULL)
+    {
+        pthread_mutex_lock(&dev->cache->lock);
+        *stats = dev->cache->stats;
+        stats->usedSlots = dev->cache->usedSlots;
+        pthread_mutex_unlock(&dev->cache->lock);
+    }
+}
+
+uint32_t HAL_ReadSector(t_halDevice *dev, uint32_t index, uint8_t *buff)
+{
+    return HAL_ReadMultiSector(dev, index, 1, buff);
+}
+
+uint32_t HAL_ReadMultiSector(t_halDevice *dev, uint32_t index, uint32_t num, uint8_t *buff)
+{
+    traceAccess(dev, HAL_TRACE_READ, index, num);
+
+    return readSectors(dev, index, num, buff);
+}
+
+static uint32_t readSectors(t_halDevice *dev, uint32_t index, uint32_t num, uint8_t *buff)
+{
+    uint64_t positionPointer = 0;
+    uint64_t start = 0;
+    uint32_t byteRead = 0;
+
+    start = STATS_START();
+    positionPointer = (uint64_t)index * dev->sizeSector;
+    noteAccess(dev, positionPointer, (uint64_t)dev->sizeSector * num);
+
+    if(buff == NULL)
+    {
+        fprintf(stderr, "The disk is empty.\n");
+    }
+    else if(dev->map != NULL)
+    {
+        byteRead = copyFromMap(dev, positionPointer, dev->sizeSector * num, buff);
+    }
+    else if((dev->cache != NULL) && (num > 0) &&
+            ((positionPointer + (uint64_t)dev->sizeSector * num - 1) / dev->cache->blockBytes
+             - positionPointer / dev->cache->blockBytes < HAL_CACHE_BYPASS_BLOCKS))
+    {
+        byteRead = readCached(dev, positionPointer, dev->sizeSector * num, buff);
+    }
+    else
+    {
+        /* Large reads such as file data go straight to the disk */
+        if(dev->cache != NULL)
+        {
+            pthread_mutex_lock(&dev->cache->lock);
+            dev->cache->stats.bypasses++;
+            pthread_mutex_unlock(&dev->cache->lock);
+        }
+
+        byteRead = readAt(dev, positionPointer, dev->sizeSector * num, buff);
+    }
+
+    STATS_RECORD(STATS_OP_READ, start, byteRead);
+
+    return byteRead;
+}
+
+uint32_t HAL_ReadVector(t_halDevice *dev, uint32_t index, const struct iovec *iov, int iovcnt)
+{
+    uint64_t positionPointer = 0;
+    uint64_t start = 0;
+    uint32_t byteRead = 0;
+    ssize_t result = 0;
+    int count = 0;
+
+    start = STATS_START();
+    positionPointer = (uint64_t)index * dev->sizeSector;
+
+    if(dev->trace != NULL)
+    {
+        for(count = 0; count < iovcnt; count++)
+        {
+            byteRead += (uint32_t)iov[count].iov_len;
+        }
+        traceAccess(dev, HAL_TRACE_VECTOR, index, byteRead);
+        byteRead = 0;
+    }
+
+    if(dev->map != NULL)
+    {
+        for(count = 0; count < iovcnt; count++)
+        {
+            result = copyFromMap(dev, positionPointer + byteRead, iov[count].iov_len, (uint8_t*)iov[count].iov_base);
+            byteRead += (uint32_t)result;
+            if(result < (ssize_t)iov[count].iov_len)
+            {
+                break;
+            }
+        }
+    }
+    else
+    {
+        do
+        {
+            result = preadv(dev->fd, iov, iovcnt, (off_t)positionPointer);
+            STATS_COUNT(STATS_SYSCALLS, 1);
+        } while((result < 0) && (errno == EINTR));
+
+        if(result < 0)
+        {
+            fprintf(stderr, "Error reading the file.\n");
+        }
+        else
+        {
+            byteRead = (uint32_t)result;
+        }
+    }
+
+    noteAccess(dev, positionPointer, byteRead);
+    STATS_RECORD(STATS_OP_READ_VECTOR, start, byteRead);
+
+    return byteRead;
+}
+
+uint32_t HAL_WriteMultiSector(t_halDevice *dev, uint32_t index, uint32_t num, const uint8_t *buff)
+{
+    struct iovec iov;
+
+    iov.iov_base = (void*)buff;
+    iov.iov_len = (size_t)num * dev->sizeSector;
+
+    return HAL_WriteVector(dev, index, &iov, 1);
+}
+
+uint32_t HAL_WriteVector(t_halDevice *dev, uint32_t index, const struct iovec *iov, int iovcnt)
+{
+    uint64_t positionPointer = 0;
+    uint64_t start = 0;
+    uint64_t offset = 0;
+    uint32_t size = 0;
+    uint32_t byteWrite = 0;
+    uint32_t length = 0;
+    ssize_t result = 0;
+    int count = 0;
+
+    start = STATS_START();
+    positionPointer = (uint64_t)index * dev->sizeSector;
+
+    for(count = 0; count < iovcnt; count++)
+    {
+        size += (uint32_t)iov[count].iov_len;
+    }
+    traceAccess(dev, HAL_TRACE_WRITE, index, size);
+
+    if(dev->writable == 0)
+    {
+        fprintf(stderr, "The image is read-only.\n");
+    }
+    else
+    {
+        do
+        {
+            result = pwritev(dev->fd, iov, iovcnt, (off_t)positionPointer);
+        } while((result < 0) && (errno == EINTR));
+
+        byteWrite = (result > 0) ? (uint32_t)result : 0;
+
+        /* Finish a short write one buffer at a time, and keep the cache in step */
+        for(count = 0; count < iovcnt; count++)
+        {
+            length = (uint32_t)iov[count].iov_len;
+            if(offset + length > byteWrite)
+            {
+                if(offset >= byteWrite)
+                {
+                    byteWrite += writeAt(dev, positionPointer + offset, length, (const uint8_t*)iov[count].iov_base);
+                }
+                else
+                {
+                    byteWrite += writeAt(dev, positionPointer + byteWrite, (uint32_t)(offset + length - byteWrite),
+                                         (const uint8_t*)iov[count].iov_base + (byteWrite - offset));
+                }
+            }
+
+            if(offset + length > byteWrite)
+            {
+                /* The write failed, what follows was not written */
+                break;
+            }
+
+            patchCache(dev, positionPointer + offset, length, (const uint8_t*)iov[count].iov_base);
+            offset += length;
+        }
+    }
+
+    STATS_RECORD(STATS_OP_WRITE, start, byteWrite);
+
+    return byteWrite;
+}
+
+uint8_t HAL_Sync(t_halDevice *dev)
+{
+    uint8_t result = 0;
+
+    if((dev->writable == 1) && (fdatasync(dev->fd) == 0))
+    {
+        result = 1;
+    }
+
+    return result;
+}
+
+const uint8_t* HAL_MapSectors(t_halDevice *dev, uint32_t index, uint32_t num)
+{
+    const uint8_t *sector = NULL;
+    uint64_t positionPointer = 0;
+
+    positionPointer = (uint64_t)index * dev->sizeSector;
+
+    if((dev->map != NULL) && (positionPointer + (uint64_t)num * dev->sizeSector <= dev->mapSize))
+    {
+        sector = dev->map + positionPointer;
+        traceAccess(dev, HAL_TRACE_MAP, index, num);
+    }
+
+    return sector;
+}
+
+void HAL_Advise(t_halDevice *dev, uint32_t index, uint32_t num, uint8_t advice)
+{
+    uint64_t start = 0;
+    uint64_t end = 0;
+    uint64_t pageSize = 0;
+    int mapAdvice = MADV_NORMAL;
+    int fileAdvice = POSIX_FADV_NORMAL;
+
+    switch(advice)
+    {
+    case HAL_ADVICE_SEQUENTIAL:
+        mapAdvice = MADV_SEQUENTIAL;
+        fileAdvice = POSIX_FADV_SEQUENTIAL;
+        break;
+    case HAL_ADVICE_RANDOM:
+        mapAdvice = MADV_RANDOM;
+        fileAdvice = POSIX_FADV_RANDOM;
+        break;
+    case HAL_ADVICE_WILLNEED:
+        mapAdvice = MADV_WILLNEED;
+        fileAdvice = POSIX_FADV_WILLNEED;
+        break;
+    default:
+        break;
+    }
+
+    start = (uint64_t)index * dev->sizeSector;
+    end = start + (uint64_t)num * dev->sizeSector;
+
+    if(dev->map != NULL)
+    {
+        /* madvise needs a page aligned start */
+        pageSize = (uint64_t)sysconf(_SC_PAGESIZE);
+        start -= start % pageSize;
+        if(end > dev->mapSize)
+        {
+            end = dev->mapSize;
+        }
+
+        if(start < end)
+        {
+            madvise(dev->map + start, end - start, mapAdvice);
+        }
+    }
+    else
+    {
+        posix_fadvise(dev->fd, start, end - start, fileAdvice);
+    }
+}
+
+uint32_t HAL_CopyToFile(t_halDevice *dev, uint32_t index, uint32_t size, int fd)
+{
+    uint64_t position = 0;
+    int64_t inOffset = 0;
+    off_t fileOffset = 0;
+    uint32_t copied = 0;
+    uint32_t length = 0;
+    ssize_t result = 0;
+    uint8_t method = HAL_COPY_RANGE;
+
+    position = (uint64_t)index * dev->sizeSector;
+    traceAccess(dev, HAL_TRACE_COPY, index, size);
+
+    if(dev->map != NULL)
+    {
+        /* The mapping is already kernel memory, write() copies from it once */
+        if(position < dev->mapSize)
+        {
+            if((uint64_t)size > dev->mapSize - position)
+            {
+                size = (uint32_t)(dev->mapSize - position);
+            }
+
+            while(copied < size)
+            {
+                result = write(fd, dev->map + position + copied, size - copied);
+                if(result > 0)
+                {
+                    copied += (uint32_t)result;
+                }
+                else if((result < 0) && (errno == EINTR))
+                {
+                    /* Interrupted before anything was written, try again */
+                }
+                else
+                {
+                    break;
+                }
+            }
+        }
+    }
+    else
+    {
+        method = __atomic_load_n(&dev->copyMethod, __ATOMIC_RELAXED);
+
+        while((copied < size) && (method != HAL_COPY_NONE))
+        {
+            length = ((size - copied) < HAL_COPY_CHUNK) ? (size - copied) : HAL_COPY_CHUNK;
+
+            if(method == HAL_COPY_RANGE)
+            {
+#if defined(HAL_HAVE_COPY_RANGE)
+                inOffset = (int64_t)(position + copied);
+                result = syscall(__NR_copy_file_range, dev->fd, &inOffset, fd, NULL, (size_t)length, 0U);
+                STATS_COUNT(STATS_SYSCALLS, 1);
+#else
+                result = -1;
+                errno = ENOSYS;
+#endif
+            }
+            else
+            {
+#if defined(__linux__)
+                fileOffset = (off_t)(position + copied);
+                result = sendfile(fd, dev->fd, &fileOffset, (size_t)length);
+                STATS_COUNT(STATS_SYSCALLS, 1);
+#else
+                result = -1;
+                errno = ENOSYS;
+#endif
+            }
+
+            if(result > 0)
+            {
+                copied += (uint32_t)result;
+            }
+            else if(result == 0)
+            {
+                /* End of the image */
+                break;
+            }
+            else if(errno == EINTR)
+            {
+                /* Interrupted before anything was copied, try again */
+            }
+            else if((errno == ENOSYS) || (errno == EXDEV) || (errno == EINVAL) ||
+                    (errno == EOPNOTSUPP) || (errno == EBADF))
+            {
+                /* The kernel refuses the call for this image, skip it for the next copies */
+                method++;
+                __atomic_store_n(&dev->copyMethod, method, __ATOMIC_RELAXED);
+            }
+            else
+            {
+                break;
+            }
+        }
+    }
+
+    return copied;
+}
+
+uint8_t HAL_TraceStart(t_halDevice *dev, const char *path)
+{
+    t_halTrace *trace = NULL;
+    t_halTraceHeader header;
+    struct timespec now;
+    uint8_t result = 0;
+
+    if(dev->trace != NULL)
+    {
+        fprintf(stderr, "The device is already traced.\n");
+    }
+    /* Allocate some memory */
+    else if((trace = (t_halTrace*)calloc(1, sizeof(t_halTrace))) == NULL)
+    {
+        fprintf(stderr, "The disk is empty.\n");
+    }
+    else if((trace->records = (t_halTraceRecord*)malloc(HAL_TRACE_BUFFER * sizeof(t_halTraceRecord))) == NULL)
+    {
+        fprintf(stderr, "The disk is empty.\n");
+        free(trace);
+    }
+    else if((trace->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+    {
+        fprintf(stderr, "Failed to create the trace %s.\n", path);
+        free(trace->records);
+        free(trace);
+    }
+    else
+    {
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, HAL_TRACE_MAGIC, sizeof(header.magic));
+        header.version = HAL_TRACE_VERSION;
+        header.sizeSector = dev->sizeSector;
+        clock_gettime(CLOCK_REALTIME, &now);
+        header.startTime = (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+
+        if(writeAll(trace->fd, &header, sizeof(header)) == 0)
+        {
+            fprintf(stderr, "Failed to write the trace %s.\n", path);
+            close(trace->fd);
+            free(trace->records);
+            free(trace);
+        }
+        else
+        {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            trace->startNs = (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+            pthread_mutex_init(&trace->lock, NULL);
+            dev->trace = trace;
+            result = 1;
+        }
+    }
+
+    return result;
+}
+
+uint8_t HAL_TraceStop(t_halDevice *dev)
+{
+    t_halTrace *trace = NULL;
+    uint8_t result = 0;
+
+    trace = dev->trace;
+
+    if(trace != NULL)
+    {
+        dev->trace = NULL;
+
+        flushTrace(trace);
+        result = (trace->failed == 0) ? 1 : 0;
+
+        close(trace->fd);
+        pthread_mutex_destroy(&trace->lock);
+        free(trace->records);
+        free(trace);
+    }
+
+    return result;
+}
+
+uint8_t HAL_TraceCategory(uint8_t category)
+{
+    uint8_t previous = 0;
+
+    previous = s_traceCategory;
+    s_traceCategory = category;
+
+    return previous;
+}
+
+static uint8_t writeAll(int fd, const void *buff, uint64_t size)
+{
+    uint64_t written = 0;
+    ssize_t result = 0;
+
+    while(written < size)
+    {
+        result = write(fd, (const uint8_t*)buff + written, size - written);
+        if(result > 0)
+        {
+            written += (uint64_t)result;
+        }
+        else if((result < 0) && (errno == EINTR))
+        {
+            continue;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    return (written == size) ? 1 : 0;
+}
+
+static void flushTrace(t_halTrace *trace)
+{
+    if((trace->failed == 0) && (trace->count > 0))
+    {
+        if(writeAll(trace->fd, trace->records, (uint64_t)trace->count * sizeof(t_halTraceRecord)) == 0)
+        {
+            /* Stop here rather than leave a hole in the trace */
+            fprintf(stderr, "Failed to write the trace.\n");
+            trace->failed = 1;
+        }
+    }
+
+    trace->count = 0;
+}
+
+static void appendRecord(t_halTrace *trace, uint8_t op, uint32_t index, uint32_t num)
+{
+    t_halTraceRecord *record = NULL;
+    struct timespec now;
+    uint64_t ns = 0;
+
+    if(trace->failed == 0)
+    {
+        if(trace->count == HAL_TRACE_BUFFER)
+        {
+            flushTrace(trace);
+        }
+
+        /* Read under the lock so the records are in time order */
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        ns = (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec - trace->startNs;
+
+        record = &trace->records[trace->count];
+        record->index = index;
+        record->num = num;
+        record->stamp = HAL_TRACE_STAMP(ns, op, s_traceCategory);
+        trace->count++;
+    }
+}
+
+static void traceAccess(t_halDevice *dev, uint8_t op, uint32_t index, uint32_t num)
+{
+    t_halTrace *trace = NULL;
+
+    trace = dev->trace;
+
+    if(trace != NULL)
+    {
+        pthread_mutex_lock(&trace->lock);
+        appendRecord(trace, op, index, num);
+        pthread_mutex_unlock(&trace->lock);
+    }
+}
+
+static void traceBatch(t_halDevice *dev, const t_halRequest *requests, uint32_t count)
+{
+    t_halTrace *trace = NULL;
+    uint32_t index = 0;
+
+    trace = dev->trace;
+
+    if((trace != NULL) && (count > 0))
+    {
+        pthread_mutex_lock(&trace->lock);
+        for(index = 0; index < count; index++)
+        {
+            appendRecord(trace, (index == 0) ? HAL_TRACE_BATCH : HAL_TRACE_BATCH_NEXT,
+                         requests[index].index, requests[index].num);
+        }
+        pthread_mutex_unlock(&trace->lock);
+    }
 }
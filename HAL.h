@@ -7,6 +7,29 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <pthread.h>
+#include "STATS.h"
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <sys/sendfile.h>
+#include <linux/io_uring.h>
+#endif
+
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter) && defined(__NR_io_uring_register)
+#define HAL_HAVE_IO_URING        1U      /* Batched reads can use io_uring */
+#endif
+
+#if defined(__NR_copy_file_range)
+#define HAL_HAVE_COPY_RANGE      1U      /* Image bytes can be copied to a file inside the kernel */
+#endif
 
 /*******************************************************************************
 * Define
@@ -14,49 +37,395 @@
 
 #define BYTE_PER_SECTOR 512U
 
+#define HAL_BACKEND_PREAD        0U      /* Read sectors with pread/preadv on the raw descriptor */
+#define HAL_BACKEND_MMAP         1U      /* Map the image read-only and serve sectors from the mapping */
+
+#define HAL_ADVICE_NORMAL        0U      /* No particular access pattern */
+#define HAL_ADVICE_SEQUENTIAL    1U      /* Sectors will be read in order (file data) */
+#define HAL_ADVICE_RANDOM        2U      /* Sectors will be read in random order (FAT lookups) */
+#define HAL_ADVICE_WILLNEED      3U      /* Sectors will be read soon */
+
+#define HAL_CACHE_DISABLED       0U      /* No block cache */
+#define HAL_CACHE_BLOCK_SIZE     4096U   /* Default bytes per cache slot */
+#define HAL_CACHE_MAX_RUN        32U     /* Most missing blocks filled by one read */
+#define HAL_CACHE_BYPASS_BLOCKS  16U     /* Reads spanning more blocks than this skip the cache */
+#define HAL_CACHE_NO_SLOT        0xFFFFFFFFU
+
+#define HAL_QUEUE_DISABLED       0U      /* HAL_ReadBatch reads one range at a time */
+#define HAL_QUEUE_DEFAULT        32U     /* Reads in flight for a volume mounted with the default config */
+#define HAL_QUEUE_MAX            4096U   /* Largest queue depth accepted */
+
+#define HAL_COPY_RANGE           0U      /* HAL_CopyToFile uses copy_file_range */
+#define HAL_COPY_SENDFILE        1U      /* copy_file_range was refused, HAL_CopyToFile uses sendfile */
+#define HAL_COPY_NONE            2U      /* Neither call works for this image, nothing is copied */
+#define HAL_COPY_CHUNK           (1024U * 1024U * 1024U)  /* Most bytes asked from the kernel per call */
+
+#define HAL_TRACE_ENV            "FAT_TRACE"  /* Set to a file name to trace every device opened by the process */
+#define HAL_TRACE_PATH_MAX       4096U   /* Longest trace file name, the device number included */
+#define HAL_TRACE_MAGIC          "FATTRACE"   /* First bytes of a trace file */
+#define HAL_TRACE_VERSION        1U      /* Format of the trace file, also tells the byte order apart */
+#define HAL_TRACE_BUFFER         4096U   /* Records kept in memory between two writes of the trace */
+
+/* Caller categories, set per thread with HAL_TraceCategory() */
+#define HAL_TRACE_OTHER          0U      /* Boot sector and untagged reads */
+#define HAL_TRACE_FAT            1U      /* FAT sectors */
+#define HAL_TRACE_DIR            2U      /* Directory sectors */
+#define HAL_TRACE_DATA           3U      /* File contents */
+#define HAL_TRACE_CATEGORIES     4U
+
+/* Calls recorded; num is the sector count of the call unless noted */
+#define HAL_TRACE_READ           0U      /* HAL_ReadSector / HAL_ReadMultiSector */
+#define HAL_TRACE_VECTOR         1U      /* HAL_ReadVector, num is the bytes of all buffers */
+#define HAL_TRACE_BATCH          2U      /* First range of a HAL_ReadBatch */
+#define HAL_TRACE_BATCH_NEXT     3U      /* Next ranges of the same batch, they follow the first */
+#define HAL_TRACE_MAP            4U      /* HAL_MapSectors that returned a pointer */
+#define HAL_TRACE_COPY           5U      /* HAL_CopyToFile, num is the bytes */
+#define HAL_TRACE_SECTOR_SIZE    6U      /* HAL_Update, num is the new bytes per sector */
+#define HAL_TRACE_WRITE          7U      /* HAL_WriteMultiSector / HAL_WriteVector, num is the bytes */
+
+/* A record stamp packs the ns since the start of the trace above the op and the category */
+#define HAL_TRACE_STAMP(ns, op, category)  (((uint64_t)(ns) << 8) | ((uint64_t)(op) << 4) | (uint64_t)(category))
+#define HAL_TRACE_NS(stamp)                ((stamp) >> 8)
+#define HAL_TRACE_OP(stamp)                ((uint8_t)(((stamp) >> 4) & 0x0FU))
+#define HAL_TRACE_CATEGORY(stamp)          ((uint8_t)((stamp) & 0x0FU))
+
+typedef struct
+{
+    uint8_t     backend;                 /* HAL_BACKEND_PREAD or HAL_BACKEND_MMAP */
+    uint32_t    cacheBytes;              /* Memory cap of the block cache, HAL_CACHE_DISABLED for none */
+    uint32_t    blockBytes;              /* Bytes per cache slot, 0 for HAL_CACHE_BLOCK_SIZE */
+    uint32_t    queueDepth;              /* Reads HAL_ReadBatch keeps in flight, HAL_QUEUE_DISABLED for none */
+    uint8_t     writable;                /* 1 to open the image for writing too, the HAL_Write calls fail otherwise */
+} t_halConfig;
+
+typedef struct
+{
+    uint64_t    hits;                    /* Blocks served from the cache */
+    uint64_t    misses;                  /* Blocks read from the disk into the cache */
+    uint64_t    evictions;               /* Blocks dropped to make room */
+    uint64_t    bypasses;                /* Large reads that went straight to the disk */
+    uint32_t    numSlots;                /* Number of slots */
+    uint32_t    usedSlots;               /* Number of slots holding a block */
+    uint32_t    blockBytes;              /* Bytes per slot */
+} t_halCacheStats;
+
+typedef struct
+{
+    uint64_t    block;                   /* Block number held by the slot */
+    uint32_t    length;                  /* Valid bytes, less than a block at the end of the image */
+    uint32_t    prev;                    /* Next more recently used slot */
+    uint32_t    next;                    /* Next less recently used slot */
+    uint32_t    hashNext;                /* Next slot in the same hash bucket */
+    uint8_t     filling;                 /* 1 while a read into the slot runs without the lock */
+    uint8_t     stale;                   /* 1 if a write touched the block while it was filling */
+} t_halCacheSlot;
+
+typedef struct
+{
+    uint8_t         *data;               /* numSlots blocks of blockBytes */
+    t_halCacheSlot  *slots;              /* Slot descriptors */
+    uint32_t        *buckets;            /* Hash buckets, first slot of each chain */
+    uint32_t        numSlots;            /* Number of slots */
+    uint32_t        numBuckets;          /* Number of hash buckets, a power of two */
+    uint32_t        blockBytes;          /* Bytes per slot */
+    uint32_t        usedSlots;           /* Number of slots holding a block */
+    uint32_t        mru;                 /* Most recently used slot */
+    uint32_t        lru;                 /* Least recently used slot, the next to be evicted */
+    t_halCacheStats stats;               /* Hit, miss and eviction counters */
+    pthread_mutex_t lock;                /* Protects the slots and the counters, not held during reads */
+    pthread_cond_t  filled;              /* Signalled when slots stop filling */
+} t_halCache;
+
+typedef struct
+{
+    uint32_t    index;                   /* First sector to read */
+    uint32_t    num;                     /* Number of sectors */
+    uint8_t     *buff;                   /* Destination buffer */
+} t_halRequest;
+
+typedef struct
+{
+    int             fd;                  /* io_uring file descriptor */
+    uint32_t        depth;               /* Most reads in flight */
+    uint8_t         *sqRing;             /* Mapped submission ring */
+    uint64_t        sqRingSize;          /* Size of the submission ring mapping */
+    uint8_t         *cqRing;             /* Mapped completion ring, sqRing when the kernel maps both at once */
+    uint64_t        cqRingSize;          /* Size of the completion ring mapping */
+    uint8_t         *sqes;               /* Mapped submission queue entries */
+    uint64_t        sqesSize;            /* Size of the entries mapping */
+    uint32_t        *sqHead;             /* Submission ring head, advanced by the kernel */
+    uint32_t        *sqTail;             /* Submission ring tail, advanced by us */
+    uint32_t        *sqMask;             /* Submission ring index mask */
+    uint32_t        *sqArray;            /* Submission ring slots, indexes into sqes */
+    uint32_t        *cqHead;             /* Completion ring head, advanced by us */
+    uint32_t        *cqTail;             /* Completion ring tail, advanced by the kernel */
+    uint32_t        *cqMask;             /* Completion ring index mask */
+    uint8_t         *cqes;               /* Completion queue entries */
+    uint8_t         broken;              /* Set when completions could no longer be waited for, the ring is not used again */
+    pthread_mutex_t lock;                /* One batch uses the ring at a time */
+} t_halRing;
+
+typedef struct
+{
+    char        magic[8];                /* HAL_TRACE_MAGIC, not terminated */
+    uint32_t    version;                 /* HAL_TRACE_VERSION */
+    uint32_t    sizeSector;              /* Bytes per sector when the trace started */
+    uint64_t    startTime;               /* Wall clock time of the start in ns since the epoch */
+} t_halTraceHeader;
+
+typedef struct
+{
+    uint32_t    index;                   /* First sector accessed */
+    uint32_t    num;                     /* Sectors accessed, or bytes for the ops noted */
+    uint64_t    stamp;                   /* HAL_TRACE_STAMP of the access */
+} t_halTraceRecord;
+
+typedef struct
+{
+    int                 fd;              /* The trace file */
+    uint64_t            startNs;         /* Monotonic time of the start */
+    t_halTraceRecord    *records;        /* HAL_TRACE_BUFFER records not yet written */
+    uint32_t            count;           /* Number of records waiting */
+    uint8_t             failed;          /* Set when a write failed, nothing more is recorded */
+    pthread_mutex_t     lock;            /* Keeps the records in time order across threads */
+} t_halTrace;
+
+typedef struct
+{
+    int         fd;                      /* Raw file descriptor of the image */
+    uint32_t    sizeSector;              /* Number of bytes in a sector */
+    uint8_t     backend;                 /* Backend in use: HAL_BACKEND_PREAD or HAL_BACKEND_MMAP */
+    uint8_t     writable;                /* 1 if the image was opened for writing */
+    uint8_t     *map;                    /* Read-only mapping of the image, NULL without HAL_BACKEND_MMAP */
+    uint64_t    mapSize;                 /* Size of the mapping in bytes */
+    t_halCache  *cache;                  /* Block cache, NULL when disabled */
+    t_halRing   *ring;                   /* io_uring used by HAL_ReadBatch, NULL for one read at a time */
+    uint8_t     copyMethod;              /* Kernel copy HAL_CopyToFile tries first, HAL_COPY_RANGE to start with */
+    uint64_t    lastEnd;                 /* Byte after the last read, to count seeks while the stats are enabled */
+    t_halTrace  *trace;                  /* Access trace being recorded, NULL when not tracing */
+} t_halDevice;
+
 /*******************************************************************************
 * API
 *******************************************************************************/
 
 /**
  * Name: HAL_Init
- * @brief Initializes the file system by opening a file in binary read mode.
+ * @brief Open a disk image for reading and return the device handle used by every read.
+ *        With HAL_BACKEND_MMAP the file is also mapped read-only; if the mapping
+ *        fails the pread backend is used instead.
+ *        Reads never share a file position, so one device can be read from many threads.
+ *        With a cacheBytes cap the pread backend keeps recently read blocks in an LRU cache;
+ *        the mmap backend has the page cache behind it and ignores the cap.
+ *        A queueDepth sets up an io_uring for HAL_ReadBatch; if the kernel does not
+ *        allow it, batches fall back to one read at a time.
+ *
+ *        With writable set the image is opened read-write; the mapping stays read-only and
+ *        sees the writes through the page cache.
  *
  * @param filePath: The path to the file to be opened.
- * @return FILE*: A pointer to the opened file. If failed, returns NULL.
+ * @param config: The backend and cache settings, NULL for pread without a cache.
+ * @return t_halDevice*: The device handle. If failed, returns NULL.
  */
-FILE* HAL_Init(const char * fileFath);
+t_halDevice* HAL_Init(const char * fileFath, const t_halConfig *config);
+
+/**
+ * Name: HAL_Deinit
+ * @brief Unmap and close a device opened by HAL_Init.
+ *
+ * @param dev The device handle, may be NULL
+ */
+void HAL_Deinit(t_halDevice *dev);
 
 /**
  * Name: HAL_Update
  * @brief Update the number of bytes in a sector
  *
+ * @param dev The device handle
  * @param bytsPerSec the number of bytes in a sector
  */
-void HAL_Update(uint32_t bytsPerSec);
+void HAL_Update(t_halDevice *dev, uint32_t bytsPerSec);
 
 /**
  * Name: HAL_ReadSector
  * @brief  Read sector position index
  *
+ * @param dev The device handle
  * @param index Position sector to read
  * @param buff Array contain this sector
  *
  * @return Byte read in this sector
  */
-uint32_t HAL_ReadSector(uint32_t index, uint8_t *buff);
+uint32_t HAL_ReadSector(t_halDevice *dev, uint32_t index, uint8_t *buff);
 
 /**
  * Name: HAL_ReadMultiSector
  * @brief Read sector from index to num
  *
+ * @param dev The device handle
  * @param index Position sector to read
  * @param num Number sector read
  * @param buff Array contain this sector
  *
  * @return byteRead Byte read in 'num' sector
  */
-uint32_t HAL_ReadMultiSector(uint32_t index, uint32_t num, uint8_t *buff);
+uint32_t HAL_ReadMultiSector(t_halDevice *dev, uint32_t index, uint32_t num, uint8_t *buff);
 
-#endif /* _FAT_H_ */
+/**
+ * Name: HAL_ReadVector
+ * @brief Read consecutive sectors starting at index into several buffers with one request.
+ *        Each buffer is filled in turn, like readv.
+ *
+ * @param dev The device handle
+ * @param index Position sector to read
+ * @param iov Array of buffers to fill
+ * @param iovcnt Number of buffers
+ *
+ * @return byteRead Byte read into all buffers
+ */
+uint32_t HAL_ReadVector(t_halDevice *dev, uint32_t index, const struct iovec *iov, int iovcnt);
+
+/**
+ * Name: HAL_ReadBatch
+ * @brief Read a list of independent sector ranges. With a queue depth set, up to that many
+ *        reads are submitted to io_uring at once and the next ones are queued as earlier
+ *        ones complete, so the latency of the disk is paid once per queue instead of once
+ *        per range. Without a ring (queue disabled, io_uring not available, mmap backend) or
+ *        while another thread is using it, the ranges are read in turn with HAL_ReadMultiSector.
+ *        Batched reads do not go through the block cache.
+ *
+ * @param dev The device handle
+ * @param requests The ranges to read
+ * @param count Number of ranges
+ *
+ * @return 1 if every range was read completely, 0 otherwise
+ */
+uint8_t HAL_ReadBatch(t_halDevice *dev, const t_halRequest *requests, uint32_t count);
+
+/**
+ * Name: HAL_WriteMultiSector
+ * @brief Write sectors from index to num. Blocks of the cache holding these sectors are
+ *        updated in place, so later reads see the new bytes.
+ *
+ * @param dev The device handle
+ * @param index Position sector to write
+ * @param num Number sector to write
+ * @param buff The bytes of the sectors
+ *
+ * @return Byte written, less than 'num' sectors if the device is read-only or a write failed
+ */
+uint32_t HAL_WriteMultiSector(t_halDevice *dev, uint32_t index, uint32_t num, const uint8_t *buff);
+
+/**
+ * Name: HAL_WriteVector
+ * @brief Write several buffers to consecutive bytes starting at sector index with one
+ *        request, like writev. Used to write a run of sectors kept in separate buffers.
+ *
+ * @param dev The device handle
+ * @param index Position sector to write
+ * @param iov Array of buffers to write
+ * @param iovcnt Number of buffers
+ *
+ * @return Byte written from all buffers
+ */
+uint32_t HAL_WriteVector(t_halDevice *dev, uint32_t index, const struct iovec *iov, int iovcnt);
+
+/**
+ * Name: HAL_Sync
+ * @brief Wait until every write of the device has reached the disk.
+ *
+ * @param dev The device handle
+ *
+ * @return 1 if the data is on the disk, 0 if the device is read-only or the sync failed
+ */
+uint8_t HAL_Sync(t_halDevice *dev);
+
+/**
+ * Name: HAL_GetCacheStats
+ * @brief Get the hit, miss and eviction counters of the block cache.
+ *
+ * @param dev The device handle
+ * @param stats Receives the counters, all zero when the device has no cache
+ */
+void HAL_GetCacheStats(t_halDevice *dev, t_halCacheStats *stats);
+
+/**
+ * Name: HAL_MapSectors
+ * @brief Get a pointer straight into the mapped image for sectors from index to num.
+ *        The pointer stays valid until HAL_Deinit().
+ *
+ * @param dev The device handle
+ * @param index Position sector to map
+ * @param num Number sector to map
+ *
+ * @return Pointer to the first byte of the sector, NULL if the backend is not
+ *         HAL_BACKEND_MMAP or the sectors are outside the image
+ */
+const uint8_t* HAL_MapSectors(t_halDevice *dev, uint32_t index, uint32_t num);
+
+/**
+ * Name: HAL_Advise
+ * @brief Tell the kernel how sectors from index to num are going to be accessed.
+ *
+ * @param dev The device handle
+ * @param index Position of the first sector
+ * @param num Number sector
+ * @param advice One of HAL_ADVICE_NORMAL, HAL_ADVICE_SEQUENTIAL, HAL_ADVICE_RANDOM or HAL_ADVICE_WILLNEED
+ */
+void HAL_Advise(t_halDevice *dev, uint32_t index, uint32_t num, uint8_t advice);
 
+/**
+ * Name: HAL_CopyToFile
+ * @brief Copy bytes of the image starting at a sector to a file, without passing them
+ *        through a user buffer. copy_file_range is tried first, so filesystems that
+ *        support it can share the blocks instead of copying them; sendfile is used when
+ *        the kernel refuses it. With HAL_BACKEND_MMAP the bytes are written straight
+ *        from the mapping. The bytes land at the current position of fd.
+ *
+ * @param dev The device handle
+ * @param index Position of the first sector
+ * @param size Number of bytes to copy, the last sector may be copied in part
+ * @param fd The file to write to, opened for writing
+ *
+ * @return The number of bytes copied; less than size if the image ends or the copy
+ *         failed, the caller copies the rest itself
+ */
+uint32_t HAL_CopyToFile(t_halDevice *dev, uint32_t index, uint32_t size, int fd);
+
+/**
+ * Name: HAL_TraceStart
+ * @brief Start recording every sector access of the device to a binary trace file: a
+ *        t_halTraceHeader followed by one t_halTraceRecord per call, in native byte order.
+ *        HAL_Init starts a trace by itself when HAL_TRACE_ENV is set: the first device of the
+ *        process writes to that file, the next ones to the file name followed by ".1", ".2"
+ *        and so on. Must not be called while other threads read from the device.
+ *
+ * @param dev The device handle
+ * @param path The trace file, replaced if it exists
+ *
+ * @return 1 if the trace started, 0 if the device is already traced or the file cannot be written
+ */
+uint8_t HAL_TraceStart(t_halDevice *dev, const char *path);
+
+/**
+ * Name: HAL_TraceStop
+ * @brief Write the records still in memory and close the trace. HAL_Deinit calls it.
+ *        Must not be called while other threads read from the device.
+ *
+ * @param dev The device handle
+ *
+ * @return 1 if every record was written, 0 if a write failed or the device is not traced
+ */
+uint8_t HAL_TraceStop(t_halDevice *dev);
+
+/**
+ * Name: HAL_TraceCategory
+ * @brief Set the category recorded with the accesses the calling thread makes from now on.
+ *
+ * @param category One of HAL_TRACE_OTHER, HAL_TRACE_FAT, HAL_TRACE_DIR or HAL_TRACE_DATA
+ *
+ * @return The previous category, to restore it afterwards
+ */
+uint8_t HAL_TraceCategory(uint8_t category);
+
+#endif /* _FAT_H_ */
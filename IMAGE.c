@@ -0,0 +1,636 @@
+/*******************************************************************************
+* Include
+*******************************************************************************/
+#include "IMAGE.h"
+
+/*******************************************************************************
+* Prototypes
+*******************************************************************************/
+
+/**
+ * Name: nextRandom
+ * @brief Advance the xorshift generator of the builder.
+ *
+ * @param builder The builder.
+ *
+ * @return The next pseudo-random value.
+ */
+static uint32_t nextRandom(t_imageBuilder *builder);
+
+/**
+ * Name: pickFileSize
+ * @brief Draw the size of the next file from the distribution of the config.
+ *
+ * @param builder The builder.
+ *
+ * @return The size in bytes, between minFileSize and maxFileSize.
+ */
+static uint32_t pickFileSize(t_imageBuilder *builder);
+
+/**
+ * Name: putLittle
+ * @brief Store a little-endian value.
+ *
+ * @param buff Where the value is stored.
+ * @param value The value.
+ * @param bytes The number of bytes to store.
+ */
+static void putLittle(uint8_t *buff, uint32_t value, uint32_t bytes);
+
+/**
+ * Name: putEntry
+ * @brief Fill a 32 byte directory entry.
+ *
+ * @param buff The entry.
+ * @param name The 11 character padded 8.3 name.
+ * @param attributes The attributes of the entry.
+ * @param cluster The first cluster, 0 for none.
+ * @param size The file size in bytes.
+ */
+static void putEntry(uint8_t *buff, const char *name, uint8_t attributes, uint32_t cluster, uint32_t size);
+
+/**
+ * Name: writeAt
+ * @brief Write a whole buffer at a byte offset of the image. Nothing is written while measuring.
+ *
+ * @param builder The builder.
+ * @param offset The byte offset in the image.
+ * @param buff The bytes to write.
+ * @param size The number of bytes.
+ */
+static void writeAt(t_imageBuilder *builder, uint64_t offset, const uint8_t *buff, uint32_t size);
+
+/**
+ * Name: allocChain
+ * @brief Hand out the clusters of a new chain from the cursor. With fragmentation, some
+ *        links jump over a few clusters that stay free.
+ *
+ * @param builder The builder.
+ * @param numClusters The length of the chain.
+ *
+ * @return The first cluster of the chain, 0 for an empty chain.
+ */
+static uint32_t allocChain(t_imageBuilder *builder, uint32_t numClusters);
+
+/**
+ * Name: writeChain
+ * @brief Write bytes along a cluster chain, one write per contiguous run.
+ *
+ * @param builder The builder.
+ * @param first The first cluster of the chain.
+ * @param buff The bytes to write, NULL to generate file contents from fileSeed.
+ * @param size The number of bytes.
+ * @param fileSeed The seed of the generated contents.
+ */
+static void writeChain(t_imageBuilder *builder, uint32_t first, const uint8_t *buff, uint32_t size, uint32_t fileSeed);
+
+/**
+ * Name: writeDirectory
+ * @brief Lay out a directory, its files and its subdirectories, depth first.
+ *
+ * @param builder The builder.
+ * @param level The depth of the directory, 0 for the root.
+ * @param parentCluster The first cluster of the parent, 0 for the root.
+ *
+ * @return The first cluster of the directory, 0 for the FAT12/16 root directory.
+ */
+static uint32_t writeDirectory(t_imageBuilder *builder, uint32_t level, uint32_t parentCluster);
+
+/**
+ * Name: writeTables
+ * @brief Encode the FAT and write every copy of it.
+ *
+ * @param builder The builder.
+ * @param rsvdSecCnt The number of reserved sectors.
+ * @param fatSize The number of sectors of one FAT.
+ */
+static void writeTables(t_imageBuilder *builder, uint32_t rsvdSecCnt, uint32_t fatSize);
+
+/**
+ * Name: makeImage
+ * @brief Create a FAT image with a synthetic tree: every directory holds filesPerDir files
+ *        and, above the last level, fanOut subdirectories. The same config and seed always
+ *        give the same image. The volume is sized to the tree, and never smaller than the
+ *        cluster count that selects the FAT type.
+ *
+ * @param path: The image file, replaced if it exists.
+ * @param config: The layout of the image.
+ * @param stats: Receives the counters of the image, may be NULL.
+ *
+ * @return 1 if the image was written, 0 if the tree does not fit the FAT type or a write failed.
+ */
+uint8_t makeImage(const char *path, const t_imageConfig *config, t_imageStats *stats);
+
+/*******************************************************************************
+* Code
+*******************************************************************************/
+static uint32_t nextRandom(t_imageBuilder *builder)
+{
+    builder->rng ^= builder->rng << 13;
+    builder->rng ^= builder->rng >> 17;
+    builder->rng ^= builder->rng << 5;
+
+    return builder->rng;
+}
+
+static uint32_t pickFileSize(t_imageBuilder *builder)
+{
+    const t_imageConfig *config = builder->config;
+    uint64_t low = 0;
+    uint64_t high = 0;
+    uint32_t minBits = 0;
+    uint32_t maxBits = 0;
+    uint32_t bits = 0;
+    uint32_t size = 0;
+
+    if(config->sizeDistribution == IMAGE_SIZE_LOG)
+    {
+        /* Pick the power of two first, then a size inside it */
+        while(((uint64_t)1 << (minBits + 1)) <= (uint64_t)config->minFileSize + 1)
+        {
+            minBits++;
+        }
+        while(((uint64_t)1 << (maxBits + 1)) <= (uint64_t)config->maxFileSize + 1)
+        {
+            maxBits++;
+        }
+
+        bits = minBits + (nextRandom(builder) % (maxBits - minBits + 1));
+        low = ((uint64_t)1 << bits) - 1;
+        high = ((uint64_t)1 << (bits + 1)) - 2;
+        low = (low < config->minFileSize) ? config->minFileSize : low;
+        high = (high > config->maxFileSize) ? config->maxFileSize : high;
+    }
+    else
+    {
+        low = config->minFileSize;
+        high = config->maxFileSize;
+    }
+
+    size = (uint32_t)(low + (nextRandom(builder) % (high - low + 1)));
+
+    return size;
+}
+
+static void putLittle(uint8_t *buff, uint32_t value, uint32_t bytes)
+{
+    uint32_t index = 0;
+
+    for(index = 0; index < bytes; index++)
+    {
+        buff[index] = (uint8_t)(value >> (index * SHIFT_8_BIT));
+    }
+}
+
+static void putEntry(uint8_t *buff, const char *name, uint8_t attributes, uint32_t cluster, uint32_t size)
+{
+    memset(buff, 0, SIZE_ROOT_ENTRY);
+    memcpy(buff, name, SIZE_OF_NAME);
+    buff[0x0B] = attributes;
+    putLittle(&buff[0x14], cluster >> SHIFT_16_BIT, 2);
+    putLittle(&buff[0x16], IMAGE_TIME, 2);
+    putLittle(&buff[0x18], IMAGE_DATE, 2);
+    putLittle(&buff[0x1A], cluster & 0xFFFFU, 2);
+    putLittle(&buff[0x1C], size, 4);
+}
+
+static void writeAt(t_imageBuilder *builder, uint64_t offset, const uint8_t *buff, uint32_t size)
+{
+    ssize_t length = 0;
+    uint32_t written = 0;
+
+    while((builder->fd >= 0) && (builder->failed == 0) && (written < size))
+    {
+        length = pwrite(builder->fd, buff + written, size - written, (off_t)(offset + written));
+        if(length > 0)
+        {
+            written += (uint32_t)length;
+        }
+        else if((length < 0) && (errno == EINTR))
+        {
+            /* Interrupted before anything was written, try again */
+        }
+        else
+        {
+            fprintf(stderr, "Error writing the image.\n");
+            builder->failed = 1;
+        }
+    }
+}
+
+static uint32_t allocChain(t_imageBuilder *builder, uint32_t numClusters)
+{
+    uint32_t first = 0;
+    uint32_t previous = 0;
+    uint32_t index = 0;
+    uint32_t endMark = 0;
+
+    endMark = (builder->config->fatType == FAT_12) ? 0xFFFU :
+              (builder->config->fatType == FAT_16) ? 0xFFFFU : MASK_CLUSTER_32;
+
+    for(index = 0; index < numClusters; index++)
+    {
+        /* A fragmented link leaves a few clusters free behind it */
+        if((index > 0) && (nextRandom(builder) % 100U < builder->config->fragmentation))
+        {
+            builder->cursor += 1 + (nextRandom(builder) % IMAGE_MAX_GAP);
+        }
+
+        if(builder->fat != NULL)
+        {
+            if(builder->cursor >= builder->dataClusters + FIRST_CLUSTER)
+            {
+                builder->failed = 1;
+                break;
+            }
+
+            builder->fat[builder->cursor] = endMark;
+            if(previous != 0)
+            {
+                builder->fat[previous] = builder->cursor;
+            }
+        }
+
+        if(first == 0)
+        {
+            first = builder->cursor;
+        }
+        previous = builder->cursor;
+        builder->cursor++;
+        builder->stats.usedClusters++;
+    }
+
+    return first;
+}
+
+static void writeChain(t_imageBuilder *builder, uint32_t first, const uint8_t *buff, uint32_t size, uint32_t fileSeed)
+{
+    uint32_t cluster = first;
+    uint32_t runStart = 0;
+    uint32_t runClusters = 0;
+    uint32_t runBytes = 0;
+    uint32_t written = 0;
+    uint32_t piece = 0;
+    uint32_t done = 0;
+    uint32_t word = 0;
+    uint32_t index = 0;
+    uint64_t offset = 0;
+
+    word = (fileSeed != 0) ? fileSeed : 1;
+
+    while((builder->fat != NULL) && (builder->failed == 0) && (written < size) &&
+          (cluster >= FIRST_CLUSTER) && (cluster < builder->dataClusters + FIRST_CLUSTER))
+    {
+        /* Follow the chain as long as it stays contiguous */
+        runStart = cluster;
+        runClusters = 1;
+        while(((uint64_t)runClusters * builder->clusterBytes < size - written) && (builder->fat[cluster] == cluster + 1))
+        {
+            cluster++;
+            runClusters++;
+        }
+
+        runBytes = size - written;
+        if((uint64_t)runClusters * builder->clusterBytes < runBytes)
+        {
+            runBytes = runClusters * builder->clusterBytes;
+        }
+        offset = ((uint64_t)builder->dataStartSector + (uint64_t)(runStart - FIRST_CLUSTER) * builder->config->secPerClus) * BYTE_PER_SECTOR;
+
+        if(buff != NULL)
+        {
+            writeAt(builder, offset, buff + written, runBytes);
+        }
+        else
+        {
+            /* Generated contents, the same for the same seed */
+            for(done = 0; done < runBytes; done += piece)
+            {
+                piece = ((runBytes - done) < IMAGE_WRITE_CHUNK) ? (runBytes - done) : IMAGE_WRITE_CHUNK;
+                for(index = 0; index < piece; index += 4)
+                {
+                    word ^= word << 13;
+                    word ^= word >> 17;
+                    word ^= word << 5;
+                    putLittle(&builder->buff[index], word, 4);
+                }
+                writeAt(builder, offset + done, builder->buff, piece);
+            }
+        }
+
+        written += runBytes;
+        cluster = builder->fat[cluster];
+    }
+}
+
+static uint32_t writeDirectory(t_imageBuilder *builder, uint32_t level, uint32_t parentCluster)
+{
+    const t_imageConfig *config = builder->config;
+    uint8_t *entries = NULL;
+    char name[SIZE_OF_NAME + 2];
+    uint32_t numEntries = 0;
+    uint32_t numDirs = 0;
+    uint32_t self = 0;
+    uint32_t cluster = 0;
+    uint32_t size = 0;
+    uint32_t count = 0;
+    uint32_t index = 0;
+    uint8_t fixedRoot = 0;
+
+    fixedRoot = ((level == 0) && (config->fatType != FAT_32)) ? 1 : 0;
+    numDirs = (level < config->depth) ? config->fanOut : 0;
+    numEntries = ((level > 0) ? 2 : 0) + config->filesPerDir + numDirs;
+    entries = (uint8_t*)calloc((numEntries > 0) ? numEntries : 1, SIZE_ROOT_ENTRY);
+
+    if(entries == NULL)
+    {
+        fprintf(stderr, "The disk is empty.\n");
+        builder->failed = 1;
+    }
+    else
+    {
+        /* The directory comes before everything it holds */
+        if(fixedRoot == 0)
+        {
+            self = allocChain(builder, (numEntries * SIZE_ROOT_ENTRY + builder->clusterBytes - 1) / builder->clusterBytes +
+                                       ((numEntries == 0) ? 1 : 0));
+        }
+
+        if(level > 0)
+        {
+            putEntry(&entries[count++ * SIZE_ROOT_ENTRY], ".          ", ATTR_DIRECTORY, self, 0);
+            putEntry(&entries[count++ * SIZE_ROOT_ENTRY], "..         ", ATTR_DIRECTORY, parentCluster, 0);
+        }
+
+        for(index = 0; (index < config->filesPerDir) && (builder->failed == 0); index++)
+        {
+            size = pickFileSize(builder);
+            cluster = allocChain(builder, (uint32_t)(((uint64_t)size + builder->clusterBytes - 1) / builder->clusterBytes));
+            writeChain(builder, cluster, NULL, size, config->seed ^ (builder->nextName * 0x9E3779B9U));
+
+            snprintf(name, sizeof(name), "F%07uDAT", builder->nextName++ % IMAGE_MAX_NAMES);
+            putEntry(&entries[count++ * SIZE_ROOT_ENTRY], name, ATTR_ARCHIVE, cluster, size);
+            builder->stats.files++;
+            builder->stats.bytes += size;
+        }
+
+        for(index = 0; (index < numDirs) && (builder->failed == 0); index++)
+        {
+            /* ".." of a first level directory is cluster 0, whatever the FAT type */
+            snprintf(name, sizeof(name), "D%07u   ", builder->nextName++ % IMAGE_MAX_NAMES);
+            cluster = writeDirectory(builder, level + 1, (level == 0) ? 0 : self);
+            putEntry(&entries[count++ * SIZE_ROOT_ENTRY], name, ATTR_DIRECTORY, cluster, 0);
+            builder->stats.directories++;
+        }
+
+        if(fixedRoot == 1)
+        {
+            writeAt(builder, (uint64_t)builder->rootDirStartSector * BYTE_PER_SECTOR, entries, count * SIZE_ROOT_ENTRY);
+        }
+        else
+        {
+            writeChain(builder, self, entries, count * SIZE_ROOT_ENTRY, 0);
+        }
+
+        free(entries);
+    }
+
+    return self;
+}
+
+static void writeTables(t_imageBuilder *builder, uint32_t rsvdSecCnt, uint32_t fatSize)
+{
+    uint8_t *table = NULL;
+    uint32_t numEntries = 0;
+    uint32_t index = 0;
+    uint32_t offset = 0;
+    uint32_t value = 0;
+
+    table = (uint8_t*)calloc(fatSize, BYTE_PER_SECTOR);
+    numEntries = builder->dataClusters + FIRST_CLUSTER;
+
+    if(table == NULL)
+    {
+        fprintf(stderr, "The disk is empty.\n");
+        builder->failed = 1;
+    }
+    else
+    {
+        for(index = 0; index < numEntries; index++)
+        {
+            value = builder->fat[index];
+            switch(builder->config->fatType)
+            {
+            case FAT_12:
+                /* Two entries share three bytes */
+                offset = index + (index >> SHIFT_1_BIT);
+                if((index & 1U) == 0)
+                {
+                    table[offset] = (uint8_t)value;
+                    table[offset + 1] = (uint8_t)((table[offset + 1] & 0xF0U) | ((value >> SHIFT_8_BIT) & 0x0FU));
+                }
+                else
+                {
+                    table[offset] = (uint8_t)((table[offset] & 0x0FU) | ((value & 0x0FU) << SHIFT_4_BIT));
+                    table[offset + 1] = (uint8_t)(value >> SHIFT_4_BIT);
+                }
+                break;
+            case FAT_16:
+                putLittle(&table[index * 2], value, 2);
+                break;
+            default:
+                putLittle(&table[index * 4], value, 4);
+                break;
+            }
+        }
+
+        for(index = 0; index < IMAGE_NUM_FATS; index++)
+        {
+            writeAt(builder, ((uint64_t)rsvdSecCnt + (uint64_t)index * fatSize) * BYTE_PER_SECTOR, table, fatSize * BYTE_PER_SECTOR);
+        }
+
+        free(table);
+    }
+}
+
+uint8_t makeImage(const char *path, const t_imageConfig *config, t_imageStats *stats)
+{
+    t_imageBuilder builder;
+    uint8_t boot[BYTE_PER_SECTOR];
+    uint8_t info[BYTE_PER_SECTOR];
+    uint64_t totalSectors = 0;
+    uint64_t fatBytes = 0;
+    uint32_t rsvdSecCnt = 0;
+    uint32_t rootEntCnt = 0;
+    uint32_t rootSectors = 0;
+    uint32_t fatSize = 0;
+    uint32_t needed = 0;
+    uint32_t minClusters = 0;
+    uint32_t numClusters = 0;
+    uint32_t freeClusters = 0;
+    uint32_t rootClus = 0;
+    uint32_t index = 0;
+    uint8_t result = 0;
+
+    memset(&builder, 0, sizeof(builder));
+    builder.fd = -1;
+    builder.config = config;
+    builder.clusterBytes = (uint32_t)config->secPerClus * BYTE_PER_SECTOR;
+
+    if(((config->fatType != FAT_12) && (config->fatType != FAT_16) && (config->fatType != FAT_32)) ||
+       (config->secPerClus == 0) || ((config->secPerClus & (config->secPerClus - 1)) != 0) ||
+       (config->minFileSize > config->maxFileSize) || (config->fragmentation > 100))
+    {
+        fprintf(stderr, "Invalid image config.\n");
+    }
+    else
+    {
+        /* Measure the tree with the same random sequence the real layout uses */
+        builder.rng = (config->seed != 0) ? config->seed : 1;
+        builder.cursor = FIRST_CLUSTER;
+        writeDirectory(&builder, 0, 0);
+        needed = builder.cursor - FIRST_CLUSTER;
+
+        /* Leave some free space, and enough clusters for the FAT type */
+        minClusters = (config->fatType == FAT_16) ? FAT12_CLUST_COUNT :
+                      (config->fatType == FAT_32) ? FAT16_CLUST_COUNT : 1;
+        numClusters = needed + (needed / 16) + 16 + config->spareClusters;
+        numClusters = (numClusters < minClusters) ? minClusters : numClusters;
+
+        rsvdSecCnt = (config->fatType == FAT_32) ? IMAGE_RSVD_32 : IMAGE_RSVD_12_16;
+        if(config->fatType != FAT_32)
+        {
+            rootEntCnt = config->filesPerDir + ((config->depth > 0) ? config->fanOut : 0);
+            rootEntCnt = (rootEntCnt < IMAGE_ROOT_ENTRIES) ? IMAGE_ROOT_ENTRIES : rootEntCnt;
+            rootEntCnt = (rootEntCnt + 15U) & ~15U;
+            rootSectors = (rootEntCnt * SIZE_ROOT_ENTRY) / BYTE_PER_SECTOR;
+        }
+
+        fatBytes = (config->fatType == FAT_12) ? (((uint64_t)numClusters + FIRST_CLUSTER) * 3 + 1) / 2 :
+                   ((uint64_t)numClusters + FIRST_CLUSTER) * (config->fatType / 8U);
+        fatSize = (uint32_t)((fatBytes + BYTE_PER_SECTOR - 1) / BYTE_PER_SECTOR);
+        totalSectors = (uint64_t)rsvdSecCnt + (uint64_t)IMAGE_NUM_FATS * fatSize + rootSectors +
+                       (uint64_t)numClusters * config->secPerClus;
+
+        /* fatType() picks the type from totalSector / secPerClus, check it picks this one */
+        if((rootEntCnt > 0xFFFFU) || (totalSectors > 0xFFFFFFFFU) ||
+           ((config->fatType == FAT_12) && (totalSectors / config->secPerClus >= FAT12_CLUST_COUNT)) ||
+           ((config->fatType == FAT_16) && (totalSectors / config->secPerClus >= FAT16_CLUST_COUNT)) ||
+           ((config->fatType == FAT_32) && (numClusters > MASK_CLUSTER_32 - 16U)))
+        {
+            fprintf(stderr, "The tree does not fit in a FAT%u volume.\n", config->fatType);
+        }
+        else
+        {
+            builder.fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+            builder.fat = (uint32_t*)calloc((uint64_t)numClusters + FIRST_CLUSTER, sizeof(uint32_t));
+            builder.buff = (uint8_t*)malloc(IMAGE_WRITE_CHUNK);
+
+            if(builder.fd < 0)
+            {
+                fprintf(stderr, "Cannot create %s.\n", path);
+            }
+            else if((builder.fat == NULL) || (builder.buff == NULL))
+            {
+                fprintf(stderr, "The disk is empty.\n");
+            }
+            else if(ftruncate(builder.fd, (off_t)(totalSectors * BYTE_PER_SECTOR)) != 0)
+            {
+                fprintf(stderr, "Error writing the image.\n");
+            }
+            else
+            {
+                /* Lay out the tree for real */
+                builder.dataClusters = numClusters;
+                builder.rootDirStartSector = rsvdSecCnt + IMAGE_NUM_FATS * fatSize;
+                builder.dataStartSector = builder.rootDirStartSector + rootSectors;
+                builder.rng = (config->seed != 0) ? config->seed : 1;
+                builder.cursor = FIRST_CLUSTER;
+                builder.nextName = 0;
+                memset(&builder.stats, 0, sizeof(builder.stats));
+                builder.fat[0] = (config->fatType == FAT_12) ? (0xF00U | IMAGE_MEDIA) :
+                                 (config->fatType == FAT_16) ? (0xFF00U | IMAGE_MEDIA) : (0x0FFFFF00U | IMAGE_MEDIA);
+                builder.fat[1] = (config->fatType == FAT_12) ? 0xFFFU :
+                                 (config->fatType == FAT_16) ? 0xFFFFU : MASK_CLUSTER_32;
+                rootClus = writeDirectory(&builder, 0, 0);
+                writeTables(&builder, rsvdSecCnt, fatSize);
+
+                /* Boot sector */
+                memset(boot, 0, sizeof(boot));
+                boot[0] = 0xEB;
+                boot[1] = 0x3C;
+                boot[2] = 0x90;
+                memcpy(&boot[0x03], "MSWIN4.1", 8);
+                putLittle(&boot[0x0B], BYTE_PER_SECTOR, 2);
+                boot[0x0D] = config->secPerClus;
+                putLittle(&boot[0x0E], rsvdSecCnt, 2);
+                boot[0x10] = IMAGE_NUM_FATS;
+                putLittle(&boot[0x11], rootEntCnt, 2);
+                putLittle(&boot[0x13], (totalSectors < 0x10000U) ? (uint32_t)totalSectors : 0, 2);
+                boot[0x15] = IMAGE_MEDIA;
+                putLittle(&boot[0x18], 63, 2);
+                putLittle(&boot[0x1A], 255, 2);
+                putLittle(&boot[0x20], (totalSectors < 0x10000U) ? 0 : (uint32_t)totalSectors, 4);
+                if(config->fatType == FAT_32)
+                {
+                    putLittle(&boot[0x24], fatSize, 4);
+                    putLittle(&boot[0x2C], rootClus, 4);
+                    putLittle(&boot[0x30], IMAGE_FSINFO_SECTOR, 2);
+                    putLittle(&boot[0x32], IMAGE_BACKUP_SECTOR, 2);
+                    boot[0x40] = 0x80;
+                    boot[0x42] = 0x29;
+                    putLittle(&boot[0x43], config->seed, 4);
+                    memcpy(&boot[0x47], "NO NAME    FAT32   ", 19);
+                }
+                else
+                {
+                    putLittle(&boot[0x16], fatSize, 2);
+                    boot[0x24] = 0x80;
+                    boot[0x26] = 0x29;
+                    putLittle(&boot[0x27], config->seed, 4);
+                    memcpy(&boot[0x2B], (config->fatType == FAT_12) ? "NO NAME    FAT12   " : "NO NAME    FAT16   ", 19);
+                }
+                boot[510] = 0x55;
+                boot[511] = 0xAA;
+                writeAt(&builder, 0, boot, BYTE_PER_SECTOR);
+
+                if(config->fatType == FAT_32)
+                {
+                    /* FSInfo with the exact free count, and the backup copies */
+                    for(index = FIRST_CLUSTER; index < numClusters + FIRST_CLUSTER; index++)
+                    {
+                        freeClusters += (builder.fat[index] == 0) ? 1 : 0;
+                    }
+
+                    memset(info, 0, sizeof(info));
+                    putLittle(&info[0], FSINFO_LEAD_SIG, 4);
+                    putLittle(&info[FSINFO_STRUC_OFFSET], FSINFO_STRUC_SIG, 4);
+                    putLittle(&info[FSINFO_FREE_COUNT], freeClusters, 4);
+                    putLittle(&info[FSINFO_NEXT_FREE], builder.cursor, 4);
+                    putLittle(&info[FSINFO_TRAIL_OFFSET], FSINFO_TRAIL_SIG, 4);
+                    writeAt(&builder, (uint64_t)IMAGE_FSINFO_SECTOR * BYTE_PER_SECTOR, info, BYTE_PER_SECTOR);
+                    writeAt(&builder, (uint64_t)IMAGE_BACKUP_SECTOR * BYTE_PER_SECTOR, boot, BYTE_PER_SECTOR);
+                    writeAt(&builder, ((uint64_t)IMAGE_BACKUP_SECTOR + IMAGE_FSINFO_SECTOR) * BYTE_PER_SECTOR, info, BYTE_PER_SECTOR);
+                }
+
+                builder.stats.dataClusters = numClusters;
+                builder.stats.totalSectors = (uint32_t)totalSectors;
+                result = (builder.failed == 0) ? 1 : 0;
+            }
+
+            if(builder.fd >= 0)
+            {
+                close(builder.fd);
+            }
+            free(builder.fat);
+            free(builder.buff);
+        }
+    }
+
+    if(stats != NULL)
+    {
+        *stats = builder.stats;
+    }
+
+    return result;
+}
@@ -0,0 +1,90 @@
+#ifndef _IMAGE_H_
+#define _IMAGE_H_
+
+/*******************************************************************************
+* Include
+*******************************************************************************/
+#include "FAT.h"
+
+/*******************************************************************************
+* Define
+*******************************************************************************/
+#define IMAGE_SIZE_UNIFORM      0U       /* File sizes spread evenly between the bounds */
+#define IMAGE_SIZE_LOG          1U       /* Log-uniform sizes: many small files, a few large ones */
+
+#define IMAGE_NUM_FATS          2U       /* FAT copies written to every image */
+#define IMAGE_RSVD_12_16        1U       /* Reserved sectors of a FAT12/16 image */
+#define IMAGE_RSVD_32           32U      /* Reserved sectors of a FAT32 image */
+#define IMAGE_ROOT_ENTRIES      512U     /* Smallest root directory of a FAT12/16 image */
+#define IMAGE_FSINFO_SECTOR     1U       /* FSInfo sector of a FAT32 image */
+#define IMAGE_BACKUP_SECTOR     6U       /* Backup boot sector of a FAT32 image */
+#define IMAGE_MAX_GAP           8U       /* Most free clusters left between two pieces of a fragmented file */
+#define IMAGE_WRITE_CHUNK       (1024U * 1024U)  /* Bytes of file contents generated per write */
+#define IMAGE_MAX_NAMES         10000000U  /* Names "D0000000" to "F9999999.DAT" */
+#define IMAGE_MEDIA             0xF8U    /* Media descriptor of a fixed disk */
+#define IMAGE_DATE              0x5821U  /* Write date of every entry, 2024-01-01 */
+#define IMAGE_TIME              0x6000U  /* Write time of every entry, 12:00:00 */
+
+typedef struct
+{
+    uint8_t     fatType;                 /* FAT_12, FAT_16 or FAT_32 */
+    uint8_t     secPerClus;              /* Sectors per cluster, a power of two */
+    uint32_t    depth;                   /* Levels of subdirectories below the root */
+    uint32_t    fanOut;                  /* Subdirectories in every directory above the last level */
+    uint32_t    filesPerDir;             /* Files in every directory, the root included */
+    uint32_t    minFileSize;             /* Smallest file in bytes */
+    uint32_t    maxFileSize;             /* Largest file in bytes */
+    uint8_t     sizeDistribution;        /* IMAGE_SIZE_UNIFORM or IMAGE_SIZE_LOG */
+    uint8_t     fragmentation;           /* Percent of cluster links that jump over a gap, 0 for contiguous files */
+    uint32_t    seed;                    /* Seed of the sizes, gaps and file contents */
+    uint32_t    spareClusters;           /* Free clusters added past the tree, 0 for the default slack */
+} t_imageConfig;
+
+typedef struct
+{
+    uint32_t    files;                   /* Files written */
+    uint32_t    directories;             /* Directories written, the root excluded */
+    uint64_t    bytes;                   /* Bytes of file data */
+    uint32_t    usedClusters;            /* Clusters allocated to files and directories */
+    uint32_t    dataClusters;            /* Clusters in the data region */
+    uint32_t    totalSectors;            /* Sectors in the image */
+} t_imageStats;
+
+typedef struct
+{
+    int         fd;                      /* The image, -1 while the layout is only measured */
+    const t_imageConfig *config;         /* The layout requested */
+    uint32_t    *fat;                    /* Next-cluster values, NULL while measuring */
+    uint32_t    dataClusters;            /* Clusters in the data region, 0 while measuring */
+    uint32_t    clusterBytes;            /* Bytes in a cluster */
+    uint32_t    rootDirStartSector;      /* First sector of the FAT12/16 root directory */
+    uint32_t    dataStartSector;         /* First sector of cluster 2 */
+    uint32_t    cursor;                  /* Next cluster handed out */
+    uint32_t    rng;                     /* State of the xorshift generator */
+    uint32_t    nextName;                /* Number of the next name */
+    uint8_t     *buff;                   /* IMAGE_WRITE_CHUNK bytes of file contents being written */
+    uint8_t     failed;                  /* Set when a write or an allocation fails */
+    t_imageStats stats;                  /* Counters of the layout */
+} t_imageBuilder;
+
+/*******************************************************************************
+* API
+*******************************************************************************/
+
+/**
+ * Name: makeImage
+ * @brief Create a FAT image with a synthetic tree: every directory holds filesPerDir files
+ *        and, above the last level, fanOut subdirectories. The same config and seed always
+ *        give the same image. The volume is sized to the tree, and never smaller than the
+ *        cluster count that selects the FAT type.
+ *
+ * @param path: The image file, replaced if it exists.
+ * @param config: The layout of the image.
+ * @param stats: Receives the counters of the image, may be NULL.
+ *
+ * @return 1 if the image was written, 0 if the tree does not fit the FAT type or a write failed.
+ */
+uint8_t makeImage(const char *path, const t_imageConfig *config, t_imageStats *stats);
+
+#endif /* _IMAGE_H_ */
+
@@ -0,0 +1,415 @@
+/*******************************************************************************
+* Include
+*******************************************************************************/
+#include "OWNER.h"
+
+/*******************************************************************************
+* Prototypes
+*******************************************************************************/
+
+/**
+ * Name: addOwner
+ * @brief Append an entry and the runs of its chain to the map.
+ *
+ * @param map The map.
+ * @param path The path of the entry.
+ * @param entry The directory entry.
+ * @param extents The runs of the chain.
+ * @param numExtents The number of runs.
+ *
+ * @return 1 if the entry was added, 0 if memory ran out.
+ */
+static uint8_t addOwner(t_ownerMap *map, const char *path, const t_direcroryEntry *entry,
+                        const t_extent *extents, uint32_t numExtents);
+
+/**
+ * Name: collectOwner
+ * @brief t_walkCallback adding every entry that has clusters to the map.
+ *
+ * @param path The path of the entry.
+ * @param entry The directory entry.
+ * @param context The t_ownerMap being built.
+ *
+ * @return 1 to continue the walk, 0 if memory ran out.
+ */
+static uint8_t collectOwner(const char *path, const t_direcroryEntry *entry, void *context);
+
+/**
+ * Name: compareExtents
+ * @brief qsort order of runs: by first cluster, then by owner.
+ *
+ * @param a The first run.
+ * @param b The second run.
+ *
+ * @return <0, 0 or >0.
+ */
+static int compareExtents(const void *a, const void *b);
+
+/**
+ * Name: firstReaching
+ * @brief Binary search of the first run whose reach includes a cluster; runs before it
+ *        all end before the cluster.
+ *
+ * @param map The map.
+ * @param cluster The cluster.
+ *
+ * @return The index of the run, numExtents if every run ends before the cluster.
+ */
+static uint32_t firstReaching(const t_ownerMap *map, uint32_t cluster);
+
+/**
+ * Name: buildOwnerMap
+ * @brief Build the cluster to entry reverse map of a volume in one walk of the tree. Each
+ *        chain is turned into its runs of contiguous clusters, and the runs of all chains
+ *        are sorted into one array, so a lookup is a binary search. The map is a snapshot,
+ *        it must be rebuilt after the volume is written.
+ *
+ * @param vol: The volume.
+ * @param numThreads: The number of walker threads, OWNER_THREADS_AUTO for one per CPU.
+ * @param map: Receives the map, to be released with releaseOwnerMap().
+ *
+ * @return 1 if the whole volume was mapped, 0 if memory ran out.
+ */
+uint8_t buildOwnerMap(t_volume *vol, uint32_t numThreads, t_ownerMap *map);
+
+/**
+ * Name: releaseOwnerMap
+ * @brief Free everything a map owns and leave it empty.
+ *
+ * @param map: The map.
+ */
+void releaseOwnerMap(t_ownerMap *map);
+
+/**
+ * Name: findClusterOwner
+ * @brief Find the entry a cluster belongs to.
+ *
+ * @param map: The map.
+ * @param cluster: The cluster.
+ * @param offset: Receives the index of the cluster in the chain of the entry, may be NULL.
+ *
+ * @return The entry, the one with the lowest run if the cluster is cross-linked, NULL if the
+ *         cluster belongs to no entry.
+ */
+const t_owner *findClusterOwner(const t_ownerMap *map, uint32_t cluster, uint32_t *offset);
+
+/**
+ * Name: findClusterRangeOwners
+ * @brief Report the runs of every chain that touch a range of clusters, in cluster order.
+ *        An entry with several runs in the range is reported once per run.
+ *
+ * @param map: The map.
+ * @param firstCluster: The first cluster of the range.
+ * @param lastCluster: The last cluster of the range, included.
+ * @param callback: Called for every run.
+ * @param context: Given to the callback.
+ *
+ * @return The number of runs reported.
+ */
+uint32_t findClusterRangeOwners(const t_ownerMap *map, uint32_t firstCluster, uint32_t lastCluster,
+                                t_ownerCallback callback, void *context);
+
+/**
+ * Name: findSectorRangeOwners
+ * @brief Report the runs of every chain that touch a range of sectors, like
+ *        findClusterRangeOwners. Sectors before the data region belong to no entry.
+ *
+ * @param map: The map.
+ * @param firstSector: The first sector of the range.
+ * @param lastSector: The last sector of the range, included.
+ * @param callback: Called for every run.
+ * @param context: Given to the callback.
+ *
+ * @return The number of runs reported.
+ */
+uint32_t findSectorRangeOwners(const t_ownerMap *map, uint32_t firstSector, uint32_t lastSector,
+                               t_ownerCallback callback, void *context);
+
+/*******************************************************************************
+* Code
+*******************************************************************************/
+static uint8_t addOwner(t_ownerMap *map, const char *path, const t_direcroryEntry *entry,
+                        const t_extent *extents, uint32_t numExtents)
+{
+    t_owner *grownOwners = NULL;
+    t_ownerExtent *grownExtents = NULL;
+    t_ownerExtent *run = NULL;
+    uint32_t capacity = 0;
+    uint32_t index = 0;
+    uint32_t offset = 0;
+    uint8_t result = 0;
+
+    pthread_mutex_lock(&map->lock);
+
+    if(map->numOwners == map->ownerCapacity)
+    {
+        capacity = (map->ownerCapacity == 0) ? OWNER_INIT_SIZE : map->ownerCapacity * 2;
+        if((grownOwners = (t_owner*)realloc(map->owners, capacity * sizeof(t_owner))) != NULL)
+        {
+            map->owners = grownOwners;
+            map->ownerCapacity = capacity;
+        }
+    }
+
+    capacity = (map->extentCapacity == 0) ? OWNER_INIT_SIZE : map->extentCapacity;
+    while(capacity - map->numExtents < numExtents)
+    {
+        capacity *= 2;
+    }
+    if(capacity != map->extentCapacity)
+    {
+        if((grownExtents = (t_ownerExtent*)realloc(map->extents, capacity * sizeof(t_ownerExtent))) != NULL)
+        {
+            map->extents = grownExtents;
+            map->extentCapacity = capacity;
+        }
+    }
+
+    if((map->numOwners < map->ownerCapacity) && (map->extentCapacity - map->numExtents >= numExtents) &&
+       ((map->owners[map->numOwners].path = strdup(path)) != NULL))
+    {
+        map->owners[map->numOwners].startCluster = entry->startCluster;
+        map->owners[map->numOwners].fileSize = entry->fileSize;
+        map->owners[map->numOwners].attributes = entry->attributes;
+
+        for(index = 0; index < numExtents; index++)
+        {
+            run = &map->extents[map->numExtents + index];
+            run->firstCluster = extents[index].firstCluster;
+            run->length = extents[index].length;
+            run->owner = map->numOwners;
+            run->offset = offset;
+            offset += extents[index].length;
+        }
+
+        map->numExtents += numExtents;
+        map->numOwners++;
+        result = 1;
+    }
+    else
+    {
+        fprintf(stderr, "The disk is empty.\n");
+        map->failed = 1;
+    }
+
+    pthread_mutex_unlock(&map->lock);
+
+    return result;
+}
+
+static uint8_t collectOwner(const char *path, const t_direcroryEntry *entry, void *context)
+{
+    t_ownerMap *map = (t_ownerMap*)context;
+    t_extent *extents = NULL;
+    uint32_t numExtents = 0;
+    uint8_t result = 1;
+
+    if(entry->startCluster >= FIRST_CLUSTER)
+    {
+        /* The chain is walked outside the lock, only the append is serialised */
+        numExtents = buildExtentList(map->vol, entry->startCluster, &extents);
+        if((numExtents > 0) && (addOwner(map, path, entry, extents, numExtents) == 0))
+        {
+            result = 0;
+        }
+        free(extents);
+    }
+
+    return result;
+}
+
+static int compareExtents(const void *a, const void *b)
+{
+    const t_ownerExtent *first = (const t_ownerExtent*)a;
+    const t_ownerExtent *second = (const t_ownerExtent*)b;
+    int result = 0;
+
+    if(first->firstCluster != second->firstCluster)
+    {
+        result = (first->firstCluster < second->firstCluster) ? -1 : 1;
+    }
+    else if(first->owner != second->owner)
+    {
+        result = (first->owner < second->owner) ? -1 : 1;
+    }
+
+    return result;
+}
+
+static uint32_t firstReaching(const t_ownerMap *map, uint32_t cluster)
+{
+    uint32_t low = 0;
+    uint32_t high = map->numExtents;
+    uint32_t middle = 0;
+
+    while(low < high)
+    {
+        middle = low + (high - low) / 2;
+        if(map->reach[middle] < cluster)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    return low;
+}
+
+uint8_t buildOwnerMap(t_volume *vol, uint32_t numThreads, t_ownerMap *map)
+{
+    t_direcroryEntry root;
+    t_extent *extents = NULL;
+    uint32_t numExtents = 0;
+    uint32_t index = 0;
+    uint32_t last = 0;
+    uint8_t result = 0;
+
+    memset(map, 0, sizeof(t_ownerMap));
+    pthread_mutex_init(&map->lock, NULL);
+    map->vol = vol;
+    map->dataStartSector = vol->local.dataStartSector;
+    map->secPerClus = vol->bootInfo.secPerClus;
+
+    /* The FAT32 root directory is a chain that no entry points to */
+    if(fatType(vol) == FAT_32)
+    {
+        memset(&root, 0, sizeof(root));
+        root.startCluster = vol->bootInfo.rootClus;
+        root.attributes = ATTR_DIRECTORY;
+        numExtents = buildExtentList(vol, root.startCluster, &extents);
+        if(numExtents > 0)
+        {
+            addOwner(map, "/", &root, extents, numExtents);
+        }
+        free(extents);
+    }
+
+    if((map->failed == 0) && (walkVolume(vol, numThreads, collectOwner, map) == 1) && (map->failed == 0))
+    {
+        map->reach = (uint32_t*)malloc((map->numExtents + 1) * sizeof(uint32_t));
+        if(map->reach == NULL)
+        {
+            fprintf(stderr, "The disk is empty.\n");
+        }
+        else
+        {
+            qsort(map->extents, map->numExtents, sizeof(t_ownerExtent), compareExtents);
+
+            /* Runs only overlap on a cross-linked volume; reach lets a search skip every run
+               that ends before the cluster looked for */
+            for(index = 0; index < map->numExtents; index++)
+            {
+                if(map->extents[index].firstCluster + map->extents[index].length - 1 > last)
+                {
+                    last = map->extents[index].firstCluster + map->extents[index].length - 1;
+                }
+                map->reach[index] = last;
+            }
+            result = 1;
+        }
+    }
+
+    if(result == 0)
+    {
+        releaseOwnerMap(map);
+    }
+
+    return result;
+}
+
+void releaseOwnerMap(t_ownerMap *map)
+{
+    uint32_t index = 0;
+
+    for(index = 0; index < map->numOwners; index++)
+    {
+        free(map->owners[index].path);
+    }
+    free(map->owners);
+    free(map->extents);
+    free(map->reach);
+    pthread_mutex_destroy(&map->lock);
+    memset(map, 0, sizeof(t_ownerMap));
+}
+
+const t_owner *findClusterOwner(const t_ownerMap *map, uint32_t cluster, uint32_t *offset)
+{
+    const t_ownerExtent *run = NULL;
+    const t_owner *owner = NULL;
+    uint32_t index = 0;
+
+    for(index = firstReaching(map, cluster);
+        (owner == NULL) && (index < map->numExtents) && (map->extents[index].firstCluster <= cluster);
+        index++)
+    {
+        run = &map->extents[index];
+        if(cluster - run->firstCluster < run->length)
+        {
+            owner = &map->owners[run->owner];
+            if(offset != NULL)
+            {
+                *offset = run->offset + (cluster - run->firstCluster);
+            }
+        }
+    }
+
+    return owner;
+}
+
+uint32_t findClusterRangeOwners(const t_ownerMap *map, uint32_t firstCluster, uint32_t lastCluster,
+                                t_ownerCallback callback, void *context)
+{
+    const t_ownerExtent *run = NULL;
+    uint32_t index = 0;
+    uint32_t from = 0;
+    uint32_t to = 0;
+    uint32_t count = 0;
+    uint8_t going = 1;
+
+    for(index = firstReaching(map, firstCluster);
+        (going == 1) && (index < map->numExtents) && (map->extents[index].firstCluster <= lastCluster);
+        index++)
+    {
+        run = &map->extents[index];
+
+        /* Clip the run to the range */
+        from = (run->firstCluster > firstCluster) ? run->firstCluster : firstCluster;
+        to = run->firstCluster + run->length - 1;
+        if(to > lastCluster)
+        {
+            to = lastCluster;
+        }
+
+        if(from <= to)
+        {
+            count++;
+            going = callback(&map->owners[run->owner], from, to - from + 1, run->offset + (from - run->firstCluster), context);
+        }
+    }
+
+    return count;
+}
+
+uint32_t findSectorRangeOwners(const t_ownerMap *map, uint32_t firstSector, uint32_t lastSector,
+                               t_ownerCallback callback, void *context)
+{
+    uint32_t count = 0;
+
+    if((lastSector >= map->dataStartSector) && (map->secPerClus > 0))
+    {
+        if(firstSector < map->dataStartSector)
+        {
+            firstSector = map->dataStartSector;
+        }
+
+        count = findClusterRangeOwners(map,
+                                       (firstSector - map->dataStartSector) / map->secPerClus + FIRST_CLUSTER,
+                                       (lastSector - map->dataStartSector) / map->secPerClus + FIRST_CLUSTER,
+                                       callback, context);
+    }
+
+    return count;
+}
@@ -0,0 +1,134 @@
+#ifndef _OWNER_H_
+#define _OWNER_H_
+
+/*******************************************************************************
+* Include
+*******************************************************************************/
+#include "WALK.h"
+
+/*******************************************************************************
+* Define
+*******************************************************************************/
+#define OWNER_THREADS_AUTO      0U       /* One walker per online CPU */
+#define OWNER_INIT_SIZE         256U     /* Initial capacity of the owner and extent arrays */
+
+typedef struct
+{
+    char        *path;                   /* Full path of the entry, "/" for the FAT32 root directory */
+    uint32_t    startCluster;            /* First cluster of the entry */
+    uint32_t    fileSize;                /* File size in bytes, 0 for a directory */
+    uint8_t     attributes;              /* Attributes of the entry */
+} t_owner;
+
+typedef struct
+{
+    uint32_t    firstCluster;            /* First cluster of a contiguous run */
+    uint32_t    length;                  /* Number of clusters in the run */
+    uint32_t    owner;                   /* Index of the entry in the owner array */
+    uint32_t    offset;                  /* Index of firstCluster in the chain of the entry */
+} t_ownerExtent;
+
+typedef struct
+{
+    t_volume    *vol;                    /* The volume mapped */
+    t_owner     *owners;                 /* Every entry that has clusters */
+    uint32_t    numOwners;               /* Number of entries */
+    uint32_t    ownerCapacity;           /* Number of entries the array can hold */
+    t_ownerExtent *extents;              /* Runs of every chain, sorted by first cluster */
+    uint32_t    *reach;                  /* reach[i]: the last cluster of extents 0 to i, never decreasing */
+    uint32_t    numExtents;              /* Number of runs */
+    uint32_t    extentCapacity;          /* Number of runs the array can hold */
+    uint32_t    dataStartSector;         /* First sector of cluster 2 */
+    uint32_t    secPerClus;              /* Sectors per cluster */
+    uint8_t     failed;                  /* Set when memory ran out during the build */
+    pthread_mutex_t lock;                /* Protects the arrays during the build */
+} t_ownerMap;
+
+/**
+ * Callback called for every run of a chain that touches a queried range.
+ *
+ * @param owner The entry the run belongs to.
+ * @param firstCluster The first cluster of the run inside the range.
+ * @param length The number of clusters of the run inside the range.
+ * @param offset The index of firstCluster in the chain of the entry, times the cluster size
+ *               gives its byte offset in the file.
+ * @param context The context given to the query.
+ *
+ * @return 1 to continue the query, 0 to stop it.
+ */
+typedef uint8_t (*t_ownerCallback)(const t_owner *owner, uint32_t firstCluster, uint32_t length,
+                                   uint32_t offset, void *context);
+
+/*******************************************************************************
+* API
+*******************************************************************************/
+
+/**
+ * Name: buildOwnerMap
+ * @brief Build the cluster to entry reverse map of a volume in one walk of the tree. Each
+ *        chain is turned into its runs of contiguous clusters, and the runs of all chains
+ *        are sorted into one array, so a lookup is a binary search. The map is a snapshot,
+ *        it must be rebuilt after the volume is written.
+ *
+ * @param vol: The volume.
+ * @param numThreads: The number of walker threads, OWNER_THREADS_AUTO for one per CPU.
+ * @param map: Receives the map, to be released with releaseOwnerMap().
+ *
+ * @return 1 if the whole volume was mapped, 0 if memory ran out.
+ */
+uint8_t buildOwnerMap(t_volume *vol, uint32_t numThreads, t_ownerMap *map);
+
+/**
+ * Name: releaseOwnerMap
+ * @brief Free everything a map owns and leave it empty.
+ *
+ * @param map: The map.
+ */
+void releaseOwnerMap(t_ownerMap *map);
+
+/**
+ * Name: findClusterOwner
+ * @brief Find the entry a cluster belongs to.
+ *
+ * @param map: The map.
+ * @param cluster: The cluster.
+ * @param offset: Receives the index of the cluster in the chain of the entry, may be NULL.
+ *
+ * @return The entry, the one with the lowest run if the cluster is cross-linked, NULL if the
+ *         cluster belongs to no entry.
+ */
+const t_owner *findClusterOwner(const t_ownerMap *map, uint32_t cluster, uint32_t *offset);
+
+/**
+ * Name: findClusterRangeOwners
+ * @brief Report the runs of every chain that touch a range of clusters, in cluster order.
+ *        An entry with several runs in the range is reported once per run.
+ *
+ * @param map: The map.
+ * @param firstCluster: The first cluster of the range.
+ * @param lastCluster: The last cluster of the range, included.
+ * @param callback: Called for every run.
+ * @param context: Given to the callback.
+ *
+ * @return The number of runs reported.
+ */
+uint32_t findClusterRangeOwners(const t_ownerMap *map, uint32_t firstCluster, uint32_t lastCluster,
+                                t_ownerCallback callback, void *context);
+
+/**
+ * Name: findSectorRangeOwners
+ * @brief Report the runs of every chain that touch a range of sectors, like
+ *        findClusterRangeOwners. Sectors before the data region belong to no entry.
+ *
+ * @param map: The map.
+ * @param firstSector: The first sector of the range.
+ * @param lastSector: The last sector of the range, included.
+ * @param callback: Called for every run.
+ * @param context: Given to the callback.
+ *
+ * @return The number of runs reported.
+ */
+uint32_t findSectorRangeOwners(const t_ownerMap *map, uint32_t firstSector, uint32_t lastSector,
+                               t_ownerCallback callback, void *context);
+
+#endif /* _OWNER_H_ */
@@ -0,0 +1,938 @@
+#include "IMAGE.h"
+#include "CHECK.h"
+#include "COMPACT.h"
+
+/*******************************************************************************
+* Define
+*******************************************************************************/
+#define REGRESS_IMAGE_DEFAULT   "regress.img"
+#define REGRESS_EXIT_PASSED     0        /* Every test passed */
+#define REGRESS_EXIT_FAILED     1        /* A test failed */
+#define REGRESS_EXIT_USAGE      2        /* The command line is not valid */
+#define REGRESS_PATH_MAX        64U      /* Longest path a test looks up */
+#define REGRESS_MAX_SLOTS       2U       /* Files and subdirectories of a directory remembered by a scan */
+#define REGRESS_WRITE_SIZE      20000U   /* Bytes of the file written by the write tests */
+#define REGRESS_GAP_OFFSET      30000U   /* Offset of the write past the end of the file */
+#define REGRESS_TRUNCATE_SIZE   25000U   /* Size the file is cut to */
+#define REGRESS_HIDDEN_FILE     (ATTR_HIDDEN | ATTR_ARCHIVE)  /* 0x22, a hidden file as Windows leaves it */
+#define REGRESS_SYSTEM_FILE     (ATTR_READ_ONLY | ATTR_HIDDEN | ATTR_SYSTEM | ATTR_ARCHIVE)  /* 0x27 */
+#define REGRESS_HIDDEN_DIR      (ATTR_HIDDEN | ATTR_DIRECTORY)  /* 0x12 */
+#define REGRESS_ARCHIVE_DIR     (ATTR_ARCHIVE | ATTR_DIRECTORY)  /* 0x30 */
+#define REGRESS_GROWN_FILES     40U      /* Files created in the directory grown between writes */
+#define REGRESS_GROWN_SIZE      600U     /* Bytes written to each of them */
+#define REGRESS_SPARE_CLUSTERS  512U     /* Free clusters of the compacted images, room for the longest chain */
+
+typedef struct
+{
+    const char  *path;                   /* The image file, replaced by every test */
+    uint8_t     keep;                    /* 1 to keep the image of the last test */
+} t_regressOptions;
+
+typedef struct
+{
+    t_volume    *vol;                    /* The volume scanned */
+    uint32_t    numFiles;                /* Files remembered */
+    uint32_t    numDirs;                 /* Subdirectories remembered */
+    t_slotPosition files[REGRESS_MAX_SLOTS];  /* Slots of the first files */
+    t_slotPosition dirs[REGRESS_MAX_SLOTS];   /* Slots of the first subdirectories */
+    uint32_t    dirClusters[REGRESS_MAX_SLOTS];  /* Their start clusters */
+    char        fileNames[REGRESS_MAX_SLOTS][NAME_MAX_LENGTH];  /* Names of the files */
+    char        dirNames[REGRESS_MAX_SLOTS][NAME_MAX_LENGTH];   /* Names of the subdirectories */
+} t_regressSlots;
+
+typedef struct
+{
+    t_volume    *vol;                    /* The volume read */
+    uint8_t     *data;                   /* Path, size and bytes of every entry, in walk order */
+    size_t      size;                    /* Bytes used in data */
+    size_t      capacity;                /* Bytes allocated for data */
+    uint32_t    files;                   /* Files read */
+    uint32_t    directories;             /* Directories read, the root excluded */
+    uint64_t    dirExtents;              /* Extents of these directories */
+    uint8_t     failed;                  /* Set when a file cannot be read or memory ran out */
+} t_regressTree;
+
+/**
+ * A test run on a fresh image of one FAT type.
+ *
+ * @param path The image file.
+ * @param fatType FAT_12, FAT_16 or FAT_32.
+ *
+ * @return 1 if the test passed, 0 otherwise.
+ */
+typedef uint8_t (*t_regressTest)(const char *path, uint8_t fatType);
+
+typedef struct
+{
+    const char      *name;               /* Name printed with the result */
+    t_regressTest   run;                 /* The test */
+} t_regressCase;
+
+/*******************************************************************************
+* Prototypes
+*******************************************************************************/
+
+/**
+ * Name: parseOptions
+ * @brief Read the command line.
+ *
+ * @param argc The number of arguments.
+ * @param argv The arguments.
+ * @param options Receives the options.
+ *
+ * @return 1 if the command line is valid, 0 otherwise.
+ */
+uint8_t parseOptions(int argc, char **argv, t_regressOptions *options);
+
+/**
+ * Name: makeTestImage
+ * @brief Create a small fragmented image: two levels of two subdirectories, three files in
+ *        every directory.
+ *
+ * @param path The image file.
+ * @param fatType FAT_12, FAT_16 or FAT_32.
+ * @param spareClusters Free clusters added past the tree.
+ * @param stats Receives the counters of the image.
+ *
+ * @return 1 if the image was written, 0 otherwise.
+ */
+uint8_t makeTestImage(const char *path, uint8_t fatType, uint32_t spareClusters, t_imageStats *stats);
+
+/**
+ * Name: mountImage
+ * @brief Mount an image with the default settings.
+ *
+ * @param path The image file.
+ * @param writable 1 to mount it read-write.
+ *
+ * @return The volume, NULL if it cannot be opened.
+ */
+t_volume *mountImage(const char *path, uint8_t writable);
+
+/**
+ * Name: rootCluster
+ * @brief Get the cluster scanSlots() takes for the root directory.
+ *
+ * @param vol The volume.
+ *
+ * @return 0 for FAT12/16, the first cluster of the root directory for FAT32.
+ */
+uint32_t rootCluster(t_volume *vol);
+
+/**
+ * Name: collectSlot
+ * @brief Slot callback remembering the first files and subdirectories of a directory.
+ *
+ * @param slot The bytes of the slot.
+ * @param position Where the slot is.
+ * @param context The t_regressSlots being filled.
+ *
+ * @return 0 at the end of the directory, 1 otherwise.
+ */
+uint8_t collectSlot(const uint8_t *slot, const t_slotPosition *position, void *context);
+
+/**
+ * Name: findSlots
+ * @brief Remember the first files and subdirectories of a directory.
+ *
+ * @param vol The volume.
+ * @param dirCluster The directory, as scanSlots() takes it.
+ * @param slots Receives the slots.
+ *
+ * @return 1 if the directory holds REGRESS_MAX_SLOTS of each, 0 otherwise.
+ */
+uint8_t findSlots(t_volume *vol, uint32_t dirCluster, t_regressSlots *slots);
+
+/**
+ * Name: setAttributes
+ * @brief Change the attributes of an entry in the write cache of a volume.
+ *
+ * @param vol The volume, mounted writable.
+ * @param position The slot of the entry.
+ * @param attributes The new attributes.
+ *
+ * @return 1 if the slot was changed, 0 if its sector cannot be read.
+ */
+uint8_t setAttributes(t_volume *vol, const t_slotPosition *position, uint8_t attributes);
+
+/**
+ * Name: isClean
+ * @brief Check an image with checkVolume().
+ *
+ * @param path The image file.
+ * @param files The files the image must hold.
+ * @param directories The directories the image must hold, the FAT32 root included.
+ *
+ * @return 1 if the image has no problem and the counts match, 0 otherwise.
+ */
+uint8_t isClean(const char *path, uint32_t files, uint32_t directories);
+
+/**
+ * Name: hideEntries
+ * @brief Create a test image, then give two subdirectories of the root, one of their
+ *        subdirectories and two files combined attribute bits (hidden, system, read-only,
+ *        archive).
+ *
+ * @param path The image file.
+ * @param fatType FAT_12, FAT_16 or FAT_32.
+ * @param stats Receives the counters of the image.
+ * @param root Receives the slots of the root directory.
+ * @param sub Receives the slots of its first subdirectory.
+ *
+ * @return 1 if the image was written and changed, 0 otherwise.
+ */
+uint8_t hideEntries(const char *path, uint8_t fatType, t_imageStats *stats, t_regressSlots *root, t_regressSlots *sub);
+
+/**
+ * Name: testAttributes
+ * @brief Give files and directories combined attribute bits (hidden, system, read-only,
+ *        archive) and check that the checker still reaches every chain.
+ *
+ * @param path The image file.
+ * @param fatType FAT_12, FAT_16 or FAT_32.
+ *
+ * @return 1 if the test passed, 0 otherwise.
+ */
+uint8_t testAttributes(const char *path, uint8_t fatType);
+
+/**
+ * Name: testLookup
+ * @brief Resolve paths through entries with combined attribute bits with fatLookup().
+ *
+ * @param path The image file.
+ * @param fatType FAT_12, FAT_16 or FAT_32.
+ *
+ * @return 1 if the test passed, 0 otherwise.
+ */
+uint8_t testLookup(const char *path, uint8_t fatType);
+
+/**
+ * Name: fillPattern
+ * @brief Fill a buffer with bytes that depend on their offset in the file.
+ *
+ * @param buff The buffer.
+ * @param offset The offset of the first byte in the file.
+ * @param size The number of bytes.
+ */
+void fillPattern(uint8_t *buff, uint32_t offset, uint32_t size);
+
+/**
+ * Name: matchFile
+ * @brief Read a file of a volume and compare it with the bytes it must hold.
+ *
+ * @param vol The volume.
+ * @param path The path of the file.
+ * @param expected The bytes.
+ * @param size The size the file must have.
+ *
+ * @return 1 if the file holds exactly these bytes, 0 otherwise.
+ */
+uint8_t matchFile(t_volume *vol, const char *path, const uint8_t *expected, uint32_t size);
+
+/**
+ * Name: testWrite
+ * @brief Create a directory and files, write, grow past the end, truncate and delete, then
+ *        check the content of the file kept and that the image is clean.
+ *
+ * @param path The image file.
+ * @param fatType FAT_12, FAT_16 or FAT_32.
+ *
+ * @return 1 if the test passed, 0 otherwise.
+ */
+uint8_t testWrite(const char *path, uint8_t fatType);
+
+/**
+ * Name: testDeleteHidden
+ * @brief Delete a hidden directory holding only a hidden file: fatDelete must refuse while
+ *        the file is there and must never write file data over the directory.
+ *
+ * @param path The image file.
+ * @param fatType FAT_12, FAT_16 or FAT_32.
+ *
+ * @return 1 if the test passed, 0 otherwise.
+ */
+uint8_t testDeleteHidden(const char *path, uint8_t fatType);
+
+/**
+ * Name: appendTree
+ * @brief Append bytes to the snapshot of a tree.
+ *
+ * @param tree The snapshot.
+ * @param bytes The bytes, NULL to only reserve them.
+ * @param size The number of bytes.
+ *
+ * @return Where the bytes start in the snapshot, NULL if memory ran out.
+ */
+uint8_t *appendTree(t_regressTree *tree, const void *bytes, size_t size);
+
+/**
+ * Name: collectTree
+ * @brief Walk callback appending the path of an entry and, for a file, its size and bytes
+ *        to the snapshot of a tree.
+ *
+ * @param path The full path of the entry.
+ * @param entry The directory entry.
+ * @param context The t_regressTree being filled.
+ *
+ * @return 1 to continue, 0 once the snapshot failed.
+ */
+uint8_t collectTree(const char *path, const t_direcroryEntry *entry, void *context);
+
+/**
+ * Name: readTree
+ * @brief Take a snapshot of every path and file byte of a volume. One worker walks the
+ *        volume, so two snapshots of the same tree are equal byte for byte.
+ *
+ * @param vol The volume.
+ * @param tree Receives the snapshot, to be released with free(tree->data).
+ *
+ * @return 1 if the whole volume was read, 0 otherwise.
+ */
+uint8_t readTree(t_volume *vol, t_regressTree *tree);
+
+/**
+ * Name: growDirectory
+ * @brief Create a directory and fill it with small files, each written before the next
+ *        one is created, so the clusters of the directory are spread between theirs.
+ *
+ * @param vol The volume, mounted writable.
+ *
+ * @return 1 if every file was created and written, 0 otherwise.
+ */
+uint8_t growDirectory(t_volume *vol);
+
+/**
+ * Name: compactImage
+ * @brief Compact a fragmented image, then check that it is clean, that every file chain, and
+ *        with compactDirs every directory chain, is one extent and that every path and file
+ *        byte is unchanged.
+ *
+ * @param path The image file.
+ * @param fatType FAT_12, FAT_16 or FAT_32.
+ * @param compactDirs 1 to move the directories too.
+ *
+ * @return 1 if the test passed, 0 otherwise.
+ */
+uint8_t compactImage(const char *path, uint8_t fatType, uint8_t compactDirs);
+
+/**
+ * Name: testCompact
+ * @brief Compact the file chains of a fragmented image.
+ *
+ * @param path The image file.
+ * @param fatType FAT_12, FAT_16 or FAT_32.
+ *
+ * @return 1 if the test passed, 0 otherwise.
+ */
+uint8_t testCompact(const char *path, uint8_t fatType);
+
+/**
+ * Name: testCompactDirs
+ * @brief Compact the file and directory chains of a fragmented image.
+ *
+ * @param path The image file.
+ * @param fatType FAT_12, FAT_16 or FAT_32.
+ *
+ * @return 1 if the test passed, 0 otherwise.
+ */
+uint8_t testCompactDirs(const char *path, uint8_t fatType);
+
+/*******************************************************************************
+* Variables
+*******************************************************************************/
+static const t_regressCase s_cases[] =
+{
+    {"attributes", testAttributes},
+    {"lookup", testLookup},
+    {"write", testWrite},
+    {"delete-hidden", testDeleteHidden},
+    {"compact", testCompact},
+    {"compact-dirs", testCompactDirs},
+};
+
+static const uint8_t s_fatTypes[] = {FAT_12, FAT_16, FAT_32};
+
+/*******************************************************************************
+* Code
+*******************************************************************************/
+int main(int argc, char **argv)
+{
+    t_regressOptions options;
+    uint32_t test = 0;
+    uint32_t type = 0;
+    uint32_t passed = 0;
+    uint32_t failed = 0;
+    int status = REGRESS_EXIT_USAGE;
+
+    if(parseOptions(argc, argv, &options) == 0)
+    {
+        printf("Usage: %s [--image PATH] [--keep]\n", argv[0]);
+    }
+    else
+    {
+        for(test = 0; test < sizeof(s_cases) / sizeof(s_cases[0]); test++)
+        {
+            for(type = 0; type < sizeof(s_fatTypes); type++)
+            {
+                if(s_cases[test].run(options.path, s_fatTypes[type]) == 1)
+                {
+                    printf("PASS\t%s\tFAT%u\n", s_cases[test].name, s_fatTypes[type]);
+                    passed++;
+                }
+                else
+                {
+                    printf("FAIL\t%s\tFAT%u\n", s_cases[test].name, s_fatTypes[type]);
+                    failed++;
+                }
+            }
+        }
+
+        printf("%u passed, %u failed\n", passed, failed);
+        status = (failed == 0) ? REGRESS_EXIT_PASSED : REGRESS_EXIT_FAILED;
+
+        if(options.keep == 0)
+        {
+            unlink(options.path);
+        }
+    }
+
+    return status;
+}
+
+uint8_t parseOptions(int argc, char **argv, t_regressOptions *options)
+{
+    int index = 0;
+    uint8_t result = 1;
+
+    memset(options, 0, sizeof(t_regressOptions));
+    options->path = REGRESS_IMAGE_DEFAULT;
+
+    for(index = 1; (result == 1) && (index < argc); index++)
+    {
+        if(strcmp(argv[index], "--keep") == 0)
+        {
+            options->keep = 1;
+        }
+        else if((strcmp(argv[index], "--image") == 0) && (index + 1 < argc))
+        {
+            options->path = argv[++index];
+        }
+        else
+        {
+            result = 0;
+        }
+    }
+
+    return result;
+}
+
+uint8_t makeTestImage(const char *path, uint8_t fatType, uint32_t spareClusters, t_imageStats *stats)
+{
+    t_imageConfig config;
+
+    memset(&config, 0, sizeof(config));
+    config.fatType = fatType;
+    config.secPerClus = 1;
+    config.depth = 2;
+    config.fanOut = 2;
+    config.filesPerDir = 3;
+    config.minFileSize = 1;
+    config.maxFileSize = 20000;
+    config.sizeDistribution = IMAGE_SIZE_LOG;
+    config.fragmentation = 20;
+    config.seed = 1;
+    config.spareClusters = spareClusters;
+
+    return makeImage(path, &config, stats);
+}
+
+t_volume *mountImage(const char *path, uint8_t writable)
+{
+    t_volumeConfig config;
+
+    defaultVolumeConfig(&config);
+    config.disk.writable = writable;
+
+    return initFileFAT(path, &config);
+}
+
+uint32_t rootCluster(t_volume *vol)
+{
+    return (fatType(vol) == FAT_32) ? vol->bootInfo.rootClus : 0;
+}
+
+uint8_t collectSlot(const uint8_t *slot, const t_slotPosition *position, void *context)
+{
+    t_regressSlots *slots = (t_regressSlots*)context;
+    t_direcroryEntry entry;
+    uint8_t attributes = slot[0x0B];
+    uint8_t result = 1;
+
+    if(slot[0] == INVALID_FILE_NAME)
+    {
+        result = 0;
+    }
+    else if((slot[0] == DELETED_FILE_NAME) || (slot[0] == '.') || ((attributes & ATTR_VOLUME_ID) != 0))
+    {
+        /* Not an entry of its own */
+    }
+    else if((attributes & ATTR_DIRECTORY) != 0)
+    {
+        if(slots->numDirs < REGRESS_MAX_SLOTS)
+        {
+            parseDirEntry(slots->vol, slot, &entry);
+            fatFormatName(&entry, slots->dirNames[slots->numDirs]);
+            slots->dirs[slots->numDirs] = *position;
+            slots->dirClusters[slots->numDirs] = entry.startCluster;
+            slots->numDirs++;
+        }
+    }
+    else if(slots->numFiles < REGRESS_MAX_SLOTS)
+    {
+        parseDirEntry(slots->vol, slot, &entry);
+        fatFormatName(&entry, slots->fileNames[slots->numFiles]);
+        slots->files[slots->numFiles] = *position;
+        slots->numFiles++;
+    }
+
+    return result;
+}
+
+uint8_t findSlots(t_volume *vol, uint32_t dirCluster, t_regressSlots *slots)
+{
+    memset(slots, 0, sizeof(t_regressSlots));
+    slots->vol = vol;
+
+    return ((scanSlots(vol, dirCluster, collectSlot, slots, NULL) == 1) &&
+            (slots->numFiles == REGRESS_MAX_SLOTS) && (slots->numDirs == REGRESS_MAX_SLOTS));
+}
+
+uint8_t setAttributes(t_volume *vol, const t_slotPosition *position, uint8_t attributes)
+{
+    uint8_t *sector = NULL;
+    uint8_t result = 0;
+
+    sector = getDirtySector(vol, position->sector, 1);
+    if(sector != NULL)
+    {
+        sector[position->offset + 0x0B] = attributes;
+        result = 1;
+    }
+
+    return result;
+}
+
+uint8_t isClean(const char *path, uint32_t files, uint32_t directories)
+{
+    t_checkReport report;
+    t_volume *vol = NULL;
+    uint64_t problems = 0;
+    uint32_t kind = 0;
+    uint8_t result = 0;
+
+    memset(&report, 0, sizeof(report));
+
+    vol = mountImage(path, 0);
+    if((vol != NULL) && (checkVolume(vol, CHECK_THREADS_AUTO, &report) == 1))
+    {
+        for(kind = 0; kind < CHECK_NUM_KINDS; kind++)
+        {
+            problems += report.counts[kind];
+        }
+
+        result = ((problems == 0) && (report.files == files) && (report.directories == directories));
+    }
+
+    releaseCheckReport(&report);
+    if(vol != NULL)
+    {
+        deinitFileFAT(vol);
+    }
+
+    return result;
+}
+
+uint8_t hideEntries(const char *path, uint8_t fatType, t_imageStats *stats, t_regressSlots *root, t_regressSlots *sub)
+{
+    t_volume *vol = NULL;
+    uint8_t result = 0;
+
+    if((makeTestImage(path, fatType, 0, stats) == 1) && ((vol = mountImage(path, 1)) != NULL))
+    {
+        /* A hidden subtree, an archive-flagged subtree and hidden or system files */
+        result = ((findSlots(vol, rootCluster(vol), root) == 1) &&
+                  (findSlots(vol, root->dirClusters[0], sub) == 1) &&
+                  (setAttributes(vol, &root->files[0], REGRESS_HIDDEN_FILE) == 1) &&
+                  (setAttributes(vol, &root->dirs[0], REGRESS_HIDDEN_DIR) == 1) &&
+                  (setAttributes(vol, &root->dirs[1], REGRESS_ARCHIVE_DIR) == 1) &&
+                  (setAttributes(vol, &sub->files[0], REGRESS_SYSTEM_FILE) == 1) &&
+                  (setAttributes(vol, &sub->dirs[0], REGRESS_HIDDEN_DIR | ATTR_SYSTEM) == 1) &&
+                  (fatFlush(vol) == 1));
+        deinitFileFAT(vol);
+    }
+
+    return result;
+}
+
+uint8_t testAttributes(const char *path, uint8_t fatType)
+{
+    t_imageStats stats;
+    t_regressSlots root;
+    t_regressSlots sub;
+    uint8_t result = 0;
+
+    if(hideEntries(path, fatType, &stats, &root, &sub) == 1)
+    {
+        result = isClean(path, stats.files, stats.directories + ((fatType == FAT_32) ? 1U : 0U));
+    }
+
+    return result;
+}
+
+uint8_t testLookup(const char *path, uint8_t fatType)
+{
+    t_imageStats stats;
+    t_regressSlots root;
+    t_regressSlots sub;
+    t_direcroryEntry entry;
+    t_volume *vol = NULL;
+    char target[REGRESS_PATH_MAX];
+    uint8_t result = 0;
+
+    if((hideEntries(path, fatType, &stats, &root, &sub) == 1) && ((vol = mountImage(path, 0)) != NULL))
+    {
+        result = 1;
+
+        /* A hidden file of the root directory */
+        snprintf(target, sizeof(target), "/%s", root.fileNames[0]);
+        if((fatLookup(vol, target, &entry) == 0) || (entry.attributes != REGRESS_HIDDEN_FILE))
+        {
+            result = 0;
+        }
+
+        /* A system file below a hidden directory */
+        snprintf(target, sizeof(target), "/%s/%s", root.dirNames[0], sub.fileNames[0]);
+        if((fatLookup(vol, target, &entry) == 0) || (entry.attributes != REGRESS_SYSTEM_FILE))
+        {
+            result = 0;
+        }
+
+        /* Back up from a hidden system directory */
+        snprintf(target, sizeof(target), "/%s/%s/..", root.dirNames[0], sub.dirNames[0]);
+        if((fatLookup(vol, target, &entry) == 0) || (entry.startCluster != root.dirClusters[0]))
+        {
+            result = 0;
+        }
+
+        /* An archive-flagged directory is still a directory */
+        snprintf(target, sizeof(target), "/%s/.", root.dirNames[1]);
+        if((fatLookup(vol, target, &entry) == 0) || (entry.startCluster != root.dirClusters[1]))
+        {
+            result = 0;
+        }
+
+        deinitFileFAT(vol);
+    }
+
+    return result;
+}
+
+void fillPattern(uint8_t *buff, uint32_t offset, uint32_t size)
+{
+    uint32_t index = 0;
+
+    for(index = 0; index < size; index++)
+    {
+        buff[index] = (uint8_t)(((offset + index) * 7U) + ((offset + index) >> 8));
+    }
+}
+
+uint8_t matchFile(t_volume *vol, const char *path, const uint8_t *expected, uint32_t size)
+{
+    t_direcroryEntry entry;
+    t_fatFile *file = NULL;
+    uint8_t *buff = NULL;
+    uint8_t result = 0;
+
+    if((fatLookup(vol, path, &entry) == 1) && (entry.fileSize == size) &&
+       ((buff = (uint8_t*)malloc(size + 1)) != NULL) &&
+       ((file = fatOpen(vol, entry.startCluster, entry.fileSize)) != NULL))
+    {
+        /* One byte more than the size, the read must stop at the end of the file */
+        result = ((fatRead(file, buff, size + 1) == size) && (memcmp(buff, expected, size) == 0));
+    }
+
+    if(file != NULL)
+    {
+        fatClose(file);
+    }
+    free(buff);
+
+    return result;
+}
+
+uint8_t testWrite(const char *path, uint8_t fatType)
+{
+    t_imageStats stats;
+    t_volume *vol = NULL;
+    uint8_t *expected = NULL;
+    uint8_t result = 0;
+
+    expected = (uint8_t*)calloc(1, REGRESS_GAP_OFFSET + REGRESS_WRITE_SIZE);
+
+    if((expected != NULL) && (makeTestImage(path, fatType, 0, &stats) == 1) &&
+       ((vol = mountImage(path, 1)) != NULL))
+    {
+        /* The bytes between the end of the first write and the second one read as zeros */
+        fillPattern(expected, 0, REGRESS_WRITE_SIZE);
+        fillPattern(&expected[REGRESS_GAP_OFFSET], REGRESS_GAP_OFFSET, REGRESS_WRITE_SIZE);
+
+        result = ((fatCreate(vol, "/NEWDIR", ATTR_DIRECTORY) == 1) &&
+                  (fatCreate(vol, "/NEWDIR/KEEP.BIN", ATTR_ARCHIVE) == 1) &&
+                  (fatCreate(vol, "/NEWDIR/DROP.BIN", ATTR_ARCHIVE) == 1) &&
+                  (fatCreate(vol, "/NEWDIR/KEEP.BIN", ATTR_ARCHIVE) == 0) &&
+                  (fatWrite(vol, "/NEWDIR/KEEP.BIN", 0, expected, REGRESS_WRITE_SIZE) == REGRESS_WRITE_SIZE) &&
+                  (fatWrite(vol, "/NEWDIR/DROP.BIN", 0, expected, REGRESS_WRITE_SIZE) == REGRESS_WRITE_SIZE) &&
+                  (fatWrite(vol, "/NEWDIR/KEEP.BIN", REGRESS_GAP_OFFSET, &expected[REGRESS_GAP_OFFSET],
+                            REGRESS_WRITE_SIZE) == REGRESS_WRITE_SIZE) &&
+                  (fatTruncate(vol, "/NEWDIR/KEEP.BIN", REGRESS_TRUNCATE_SIZE) == 1) &&
+                  (fatDelete(vol, "/NEWDIR/DROP.BIN") == 1) &&
+                  (fatDelete(vol, "/NEWDIR") == 0) &&
+                  (matchFile(vol, "/NEWDIR/KEEP.BIN", expected, REGRESS_TRUNCATE_SIZE) == 1) &&
+                  (fatFlush(vol) == 1));
+        deinitFileFAT(vol);
+        vol = NULL;
+    }
+
+    /* The content is read again from a fresh mount, then the whole image is checked */
+    if((result == 1) && ((vol = mountImage(path, 0)) != NULL))
+    {
+        result = matchFile(vol, "/NEWDIR/KEEP.BIN", expected, REGRESS_TRUNCATE_SIZE);
+        deinitFileFAT(vol);
+    }
+    else
+    {
+        result = 0;
+    }
+
+    if(result == 1)
+    {
+        result = isClean(path, stats.files + 1, stats.directories + 1 + ((fatType == FAT_32) ? 1U : 0U));
+    }
+
+    free(expected);
+
+    return result;
+}
+
+uint8_t testDeleteHidden(const char *path, uint8_t fatType)
+{
+    t_imageStats stats;
+    t_volume *vol = NULL;
+    uint8_t *data = NULL;
+    uint8_t result = 0;
+
+    data = (uint8_t*)malloc(REGRESS_WRITE_SIZE);
+
+    if((data != NULL) && (makeTestImage(path, fatType, 0, &stats) == 1) && ((vol = mountImage(path, 1)) != NULL))
+    {
+        fillPattern(data, 0, REGRESS_WRITE_SIZE);
+
+        result = ((fatCreate(vol, "/HID", REGRESS_HIDDEN_DIR) == 1) &&
+                  (fatCreate(vol, "/HID/SECRET.TXT", REGRESS_HIDDEN_FILE) == 1) &&
+                  (fatWrite(vol, "/HID/SECRET.TXT", 0, data, REGRESS_WRITE_SIZE) == REGRESS_WRITE_SIZE) &&
+                  (fatWrite(vol, "/HID", 0, data, REGRESS_WRITE_SIZE) == 0) &&
+                  (fatTruncate(vol, "/HID", 0) == 0) &&
+                  (fatDelete(vol, "/HID") == 0) &&
+                  (fatFlush(vol) == 1));
+        deinitFileFAT(vol);
+    }
+
+    /* The hidden file is still reachable, then both go */
+    if((result == 1) && (isClean(path, stats.files + 1, stats.directories + 1 + ((fatType == FAT_32) ? 1U : 0U)) == 1) &&
+       ((vol = mountImage(path, 1)) != NULL))
+    {
+        result = ((matchFile(vol, "/HID/SECRET.TXT", data, REGRESS_WRITE_SIZE) == 1) &&
+                  (fatDelete(vol, "/HID/SECRET.TXT") == 1) &&
+                  (fatDelete(vol, "/HID") == 1) &&
+                  (fatFlush(vol) == 1));
+        deinitFileFAT(vol);
+    }
+    else
+    {
+        result = 0;
+    }
+
+    if(result == 1)
+    {
+        result = isClean(path, stats.files, stats.directories + ((fatType == FAT_32) ? 1U : 0U));
+    }
+
+    free(data);
+
+    return result;
+}
+
+uint8_t *appendTree(t_regressTree *tree, const void *bytes, size_t size)
+{
+    uint8_t *grown = NULL;
+    uint8_t *start = NULL;
+    size_t capacity = 0;
+
+    if(tree->size + size > tree->capacity)
+    {
+        capacity = (tree->capacity == 0) ? 4096U : tree->capacity;
+        while(tree->size + size > capacity)
+        {
+            capacity *= 2U;
+        }
+
+        grown = (uint8_t*)realloc(tree->data, capacity);
+        if(grown != NULL)
+        {
+            tree->data = grown;
+            tree->capacity = capacity;
+        }
+    }
+
+    if(tree->size + size <= tree->capacity)
+    {
+        start = &tree->data[tree->size];
+        if(bytes != NULL)
+        {
+            memcpy(start, bytes, size);
+        }
+        tree->size += size;
+    }
+
+    return start;
+}
+
+uint8_t collectTree(const char *path, const t_direcroryEntry *entry, void *context)
+{
+    t_regressTree *tree = (t_regressTree*)context;
+    t_fatFile *file = NULL;
+    uint8_t *bytes = NULL;
+
+    if(appendTree(tree, path, strlen(path) + 1) == NULL)
+    {
+        tree->failed = 1;
+    }
+    else if((entry->attributes & ATTR_DIRECTORY) != 0)
+    {
+        tree->directories++;
+        tree->dirExtents += countExtents(tree->vol, entry->startCluster);
+    }
+    else if((appendTree(tree, &entry->fileSize, sizeof(entry->fileSize)) == NULL) ||
+            ((bytes = appendTree(tree, NULL, entry->fileSize)) == NULL) ||
+            ((file = fatOpen(tree->vol, entry->startCluster, entry->fileSize)) == NULL) ||
+            (fatRead(file, bytes, entry->fileSize) != entry->fileSize))
+    {
+        tree->failed = 1;
+    }
+    else
+    {
+        tree->files++;
+    }
+
+    if(file != NULL)
+    {
+        fatClose(file);
+    }
+
+    return (tree->failed == 0) ? 1 : 0;
+}
+
+uint8_t readTree(t_volume *vol, t_regressTree *tree)
+{
+    memset(tree, 0, sizeof(t_regressTree));
+    tree->vol = vol;
+
+    return ((walkVolume(vol, 1, collectTree, tree) == 1) && (tree->failed == 0));
+}
+
+uint8_t growDirectory(t_volume *vol)
+{
+    uint8_t data[REGRESS_GROWN_SIZE];
+    char target[REGRESS_PATH_MAX];
+    uint32_t index = 0;
+    uint8_t result = 0;
+
+    fillPattern(data, 0, REGRESS_GROWN_SIZE);
+
+    result = fatCreate(vol, "/GROWN", ATTR_DIRECTORY);
+    for(index = 0; (result == 1) && (index < REGRESS_GROWN_FILES); index++)
+    {
+        snprintf(target, sizeof(target), "/GROWN/F%02u.BIN", index);
+        result = ((fatCreate(vol, target, ATTR_ARCHIVE) == 1) &&
+                  (fatWrite(vol, target, 0, data, REGRESS_GROWN_SIZE) == REGRESS_GROWN_SIZE));
+    }
+
+    return (result == 1) ? fatFlush(vol) : 0;
+}
+
+uint8_t compactImage(const char *path, uint8_t fatType, uint8_t compactDirs)
+{
+    t_imageStats stats;
+    t_compactReport report;
+    t_regressTree before;
+    t_regressTree after;
+    t_volume *vol = NULL;
+    uint64_t chains = 0;
+    uint8_t result = 0;
+
+    memset(&report, 0, sizeof(report));
+    memset(&before, 0, sizeof(before));
+    memset(&after, 0, sizeof(after));
+
+    if((makeTestImage(path, fatType, REGRESS_SPARE_CLUSTERS, &stats) == 1) &&
+       ((vol = mountImage(path, 1)) != NULL))
+    {
+        /* The generated directories fit in one cluster, this one does not */
+        result = ((growDirectory(vol) == 1) && (readTree(vol, &before) == 1) &&
+                  (before.dirExtents > before.directories) &&
+                  (compactVolume(vol, compactDirs, &report) == 1) && (report.fragmented > 0));
+        deinitFileFAT(vol);
+        vol = NULL;
+    }
+
+    /* The tree is read again from a fresh mount, then the whole image is checked */
+    if((result == 1) && ((vol = mountImage(path, 0)) != NULL))
+    {
+        result = ((readTree(vol, &after) == 1) && (after.size == before.size) &&
+                  (memcmp(after.data, before.data, before.size) == 0));
+        deinitFileFAT(vol);
+    }
+    else
+    {
+        result = 0;
+    }
+
+    /* Every chain is one extent, except the directories that were left in place */
+    chains = (uint64_t)report.files + report.directories;
+    if(compactDirs == 0)
+    {
+        chains += after.dirExtents - after.directories;
+    }
+
+    if(result == 1)
+    {
+        result = ((report.extentsAfter == chains) &&
+                  (isClean(path, before.files, before.directories + ((fatType == FAT_32) ? 1U : 0U)) == 1));
+    }
+
+    free(before.data);
+    free(after.data);
+
+    return result;
+}
+
+uint8_t testCompact(const char *path, uint8_t fatType)
+{
+    return compactImage(path, fatType, 0);
+}
+
+uint8_t testCompactDirs(const char *path, uint8_t fatType)
+{
+    return compactImage(path, fatType, 1);
+}
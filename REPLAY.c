@@ -0,0 +1,684 @@
+#include <time.h>
+#include "FAT.h"
+
+/*******************************************************************************
+* Define
+*******************************************************************************/
+#define REPLAY_MAX_VALUES       16U      /* Most values in one comma separated option */
+#define REPLAY_FORMAT_JSON      0U       /* One JSON object per line */
+#define REPLAY_FORMAT_TSV       1U       /* A header line, then one tab separated line per setting */
+#define REPLAY_PAGE_BYTES       4096U    /* Stride used to touch mapped sectors */
+#define NS_PER_SECOND           1000000000ULL
+
+typedef struct
+{
+    t_halTraceHeader    header;          /* Header of the trace file */
+    t_halTraceRecord    *records;        /* Every record of the trace */
+    uint32_t            count;           /* Number of records */
+    uint64_t            maxBytes;        /* Largest buffer one call or one batch needs */
+    uint32_t            maxRanges;       /* Most ranges in one batch */
+} t_replayTrace;
+
+typedef struct
+{
+    uint32_t    values[REPLAY_MAX_VALUES];  /* The values to try */
+    uint32_t    count;                   /* Number of values */
+} t_replayList;
+
+typedef struct
+{
+    const char      *tracePath;          /* The trace file */
+    const char      *imagePath;          /* The image the trace is replayed against */
+    t_replayList    backends;            /* HAL_BACKEND_* to try */
+    t_replayList    cacheBytes;          /* Block cache caps to try */
+    t_replayList    blockBytes;          /* Block sizes to try */
+    t_replayList    queueDepths;         /* io_uring queue depths to try */
+    uint8_t         pace;                /* 1 to wait for the time of each record, 0 to replay at full speed */
+    uint8_t         format;              /* REPLAY_FORMAT_JSON or REPLAY_FORMAT_TSV */
+} t_replayOptions;
+
+typedef struct
+{
+    uint64_t    calls[HAL_TRACE_CATEGORIES];  /* Calls replayed per category */
+    uint64_t    bytes[HAL_TRACE_CATEGORIES];  /* Bytes asked per category */
+    uint64_t    ns[HAL_TRACE_CATEGORIES];     /* Time spent per category */
+    uint64_t    totalNs;                 /* Time of the whole replay, waits excluded */
+    uint64_t    *latencies;              /* Time of each call in ns */
+    uint64_t    numLatencies;            /* Number of calls timed */
+    uint8_t     backend;                 /* Backend the device actually used */
+    t_halCacheStats cache;               /* Block cache counters at the end */
+    t_statsSnapshot stats;               /* System calls and seeks of the replay */
+} t_replayResult;
+
+/*******************************************************************************
+* Prototypes
+*******************************************************************************/
+
+/**
+ * Name: nowNs
+ * @brief Read the monotonic clock.
+ *
+ * @return The time in ns.
+ */
+uint64_t nowNs(void);
+
+/**
+ * Name: loadTrace
+ * @brief Read a trace file into memory and check it.
+ *
+ * @param path The trace file.
+ * @param trace Receives the records.
+ *
+ * @return 1 if the trace was read, 0 if it cannot be read or is not a trace of this format.
+ */
+uint8_t loadTrace(const char *path, t_replayTrace *trace);
+
+/**
+ * Name: parseList
+ * @brief Read a comma separated list of numbers, or of backend names.
+ *
+ * @param value The option value.
+ * @param list Receives the values.
+ * @param backends 1 if the values are "pread" or "mmap".
+ *
+ * @return 1 if the list is valid, 0 otherwise.
+ */
+uint8_t parseList(const char *value, t_replayList *list, uint8_t backends);
+
+/**
+ * Name: compareNs
+ * @brief qsort order of latencies.
+ *
+ * @param a The first latency.
+ * @param b The second latency.
+ *
+ * @return <0, 0 or >0.
+ */
+int compareNs(const void *a, const void *b);
+
+/**
+ * Name: replay
+ * @brief Run every record of a trace against a device opened with one setting.
+ *
+ * @param options The options.
+ * @param trace The trace.
+ * @param config The device setting.
+ * @param buff A buffer of trace->maxBytes bytes.
+ * @param requests An array of trace->maxRanges ranges.
+ * @param result Receives the counters, its latency array holds trace->count entries.
+ *
+ * @return 1 if the image was opened, 0 otherwise.
+ */
+uint8_t replay(const t_replayOptions *options, const t_replayTrace *trace, const t_halConfig *config,
+               uint8_t *buff, t_halRequest *requests, t_replayResult *result);
+
+/**
+ * Name: report
+ * @brief Print the result of one setting.
+ *
+ * @param options The options, for the format.
+ * @param config The device setting.
+ * @param result The result.
+ */
+void report(const t_replayOptions *options, const t_halConfig *config, t_replayResult *result);
+
+/**
+ * Name: parseOptions
+ * @brief Read the command line.
+ *
+ * @param argc The number of arguments.
+ * @param argv The arguments.
+ * @param options Receives the options.
+ *
+ * @return 1 if the command line is valid, 0 otherwise.
+ */
+uint8_t parseOptions(int argc, char **argv, t_replayOptions *options);
+
+/*******************************************************************************
+* Code
+*******************************************************************************/
+int main(int argc, char **argv)
+{
+    t_replayOptions options;
+    t_replayTrace trace;
+    t_replayResult result;
+    t_halConfig config;
+    t_halRequest *requests = NULL;
+    uint8_t *buff = NULL;
+    uint32_t backend = 0;
+    uint32_t cache = 0;
+    uint32_t block = 0;
+    uint32_t queue = 0;
+    int status = 1;
+
+    memset(&trace, 0, sizeof(trace));
+    memset(&result, 0, sizeof(result));
+
+    /* The replay itself is not traced, it could overwrite the trace being replayed */
+    unsetenv(HAL_TRACE_ENV);
+
+    if(parseOptions(argc, argv, &options) == 0)
+    {
+        printf("Usage: %s TRACE IMAGE [--backend pread|mmap[,...]] [--cache BYTES[,...]]\n"
+               "          [--block BYTES[,...]] [--queue N[,...]] [--pace] [--format json|tsv]\n", argv[0]);
+    }
+    else if(loadTrace(options.tracePath, &trace) == 0)
+    {
+        printf("Cannot read the trace %s.\n", options.tracePath);
+    }
+    else if(((buff = (uint8_t*)malloc(trace.maxBytes + 1)) == NULL) ||
+            ((requests = (t_halRequest*)malloc((trace.maxRanges + 1) * sizeof(t_halRequest))) == NULL) ||
+            ((result.latencies = (uint64_t*)malloc(((uint64_t)trace.count + 1) * sizeof(uint64_t))) == NULL))
+    {
+        printf("The disk is empty.\n");
+    }
+    else
+    {
+        if(options.format == REPLAY_FORMAT_TSV)
+        {
+            printf("backend\tcache_bytes\tblock_bytes\tqueue\tcalls\tbytes\tseconds\tmb_per_s\t"
+                   "hits\tmisses\tevictions\thit_ratio\tsyscalls\tseeks\t"
+                   "fat_ns\tdir_ns\tdata_ns\tother_ns\tp50_ns\tp99_ns\tmax_ns\n");
+        }
+
+        status = 0;
+
+        /* Every combination of the settings asked */
+        for(backend = 0; backend < options.backends.count; backend++)
+        {
+            for(cache = 0; cache < options.cacheBytes.count; cache++)
+            {
+                for(block = 0; block < options.blockBytes.count; block++)
+                {
+                    for(queue = 0; queue < options.queueDepths.count; queue++)
+                    {
+                        config.backend = (uint8_t)options.backends.values[backend];
+                        config.cacheBytes = options.cacheBytes.values[cache];
+                        config.blockBytes = options.blockBytes.values[block];
+                        config.queueDepth = options.queueDepths.values[queue];
+
+                        if(replay(&options, &trace, &config, buff, requests, &result) == 0)
+                        {
+                            printf("Cannot open the image %s.\n", options.imagePath);
+                            status = 1;
+                        }
+                        else
+                        {
+                            report(&options, &config, &result);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    free(result.latencies);
+    free(requests);
+    free(buff);
+    free(trace.records);
+
+    return status;
+}
+
+uint64_t nowNs(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * NS_PER_SECOND + (uint64_t)now.tv_nsec;
+}
+
+uint8_t loadTrace(const char *path, t_replayTrace *trace)
+{
+    FILE *fp = NULL;
+    long size = 0;
+    uint64_t bytes = 0;
+    uint64_t batchBytes = 0;
+    uint32_t batchRanges = 0;
+    uint32_t sizeSector = 0;
+    uint32_t index = 0;
+    uint8_t op = 0;
+    uint8_t result = 0;
+
+    memset(trace, 0, sizeof(t_replayTrace));
+
+    if((fp = fopen(path, "rb")) == NULL)
+    {
+        printf("Failed to open the file.\n");
+    }
+    else if((fread(&trace->header, sizeof(t_halTraceHeader), 1, fp) != 1) ||
+            (memcmp(trace->header.magic, HAL_TRACE_MAGIC, sizeof(trace->header.magic)) != 0) ||
+            (trace->header.version != HAL_TRACE_VERSION))
+    {
+        printf("%s is not a trace of this version or byte order.\n", path);
+    }
+    else if((fseek(fp, 0, SEEK_END) != 0) || ((size = ftell(fp)) < (long)sizeof(t_halTraceHeader)) ||
+            (fseek(fp, sizeof(t_halTraceHeader), SEEK_SET) != 0))
+    {
+        printf("Error reading the file.\n");
+    }
+    else
+    {
+        /* A trace cut short by a crash keeps its whole records */
+        trace->count = (uint32_t)((size - sizeof(t_halTraceHeader)) / sizeof(t_halTraceRecord));
+        trace->records = (t_halTraceRecord*)malloc(((uint64_t)trace->count + 1) * sizeof(t_halTraceRecord));
+
+        if(trace->records == NULL)
+        {
+            printf("The disk is empty.\n");
+        }
+        else if(fread(trace->records, sizeof(t_halTraceRecord), trace->count, fp) != trace->count)
+        {
+            printf("Error reading the file.\n");
+        }
+        else
+        {
+            /* Size the buffers for the largest call and the largest batch */
+            sizeSector = trace->header.sizeSector;
+            for(index = 0; index < trace->count; index++)
+            {
+                op = HAL_TRACE_OP(trace->records[index].stamp);
+                bytes = (uint64_t)trace->records[index].num * sizeSector;
+
+                if(op == HAL_TRACE_SECTOR_SIZE)
+                {
+                    sizeSector = trace->records[index].num;
+                    bytes = 0;
+                }
+                else if((op == HAL_TRACE_VECTOR) || (op == HAL_TRACE_COPY) || (op == HAL_TRACE_WRITE))
+                {
+                    bytes = trace->records[index].num;
+                }
+                else if(op == HAL_TRACE_BATCH)
+                {
+                    batchBytes = 0;
+                    batchRanges = 0;
+                }
+
+                if((op == HAL_TRACE_BATCH) || (op == HAL_TRACE_BATCH_NEXT))
+                {
+                    batchBytes += bytes;
+                    batchRanges++;
+                    bytes = batchBytes;
+                    if(batchRanges > trace->maxRanges)
+                    {
+                        trace->maxRanges = batchRanges;
+                    }
+                }
+
+                if(bytes > trace->maxBytes)
+                {
+                    trace->maxBytes = bytes;
+                }
+            }
+
+            result = 1;
+        }
+    }
+
+    if(fp != NULL)
+    {
+        fclose(fp);
+    }
+
+    return result;
+}
+
+uint8_t parseList(const char *value, t_replayList *list, uint8_t backends)
+{
+    const char *cursor = NULL;
+    char *end = NULL;
+    uint8_t result = 1;
+
+    list->count = 0;
+    cursor = value;
+
+    while((result == 1) && (*cursor != '\0'))
+    {
+        if(list->count == REPLAY_MAX_VALUES)
+        {
+            result = 0;
+        }
+        else if(backends == 1)
+        {
+            if(strncmp(cursor, "pread", 5) == 0)
+            {
+                list->values[list->count++] = HAL_BACKEND_PREAD;
+                cursor += 5;
+            }
+            else if(strncmp(cursor, "mmap", 4) == 0)
+            {
+                list->values[list->count++] = HAL_BACKEND_MMAP;
+                cursor += 4;
+            }
+            else
+            {
+                result = 0;
+            }
+        }
+        else
+        {
+            list->values[list->count++] = (uint32_t)strtoul(cursor, &end, 0);
+            result = (end != cursor) ? 1 : 0;
+            cursor = end;
+        }
+
+        if((result == 1) && (*cursor == ','))
+        {
+            cursor++;
+        }
+        else if(*cursor != '\0')
+        {
+            result = 0;
+        }
+    }
+
+    return ((result == 1) && (list->count > 0)) ? 1 : 0;
+}
+
+int compareNs(const void *a, const void *b)
+{
+    uint64_t left = *(const uint64_t*)a;
+    uint64_t right = *(const uint64_t*)b;
+
+    return (left > right) - (left < right);
+}
+
+uint8_t replay(const t_replayOptions *options, const t_replayTrace *trace, const t_halConfig *config,
+               uint8_t *buff, t_halRequest *requests, t_replayResult *result)
+{
+    const t_halTraceRecord *record = NULL;
+    const uint8_t *sector = NULL;
+    t_halDevice *dev = NULL;
+    struct iovec iov;
+    struct timespec wake;
+    uint64_t begin = 0;
+    uint64_t start = 0;
+    uint64_t elapsed = 0;
+    uint64_t bytes = 0;
+    uint64_t used = 0;
+    uint64_t offset = 0;
+    uint64_t due = 0;
+    uint64_t waited = 0;
+    uint32_t index = 0;
+    uint32_t count = 0;
+    int devNull = -1;
+    uint8_t op = 0;
+    uint8_t category = 0;
+    uint8_t touched = 0;
+    uint8_t opened = 0;
+
+    memset(result->calls, 0, sizeof(result->calls));
+    memset(result->bytes, 0, sizeof(result->bytes));
+    memset(result->ns, 0, sizeof(result->ns));
+    result->numLatencies = 0;
+    result->totalNs = 0;
+
+    dev = HAL_Init(options->imagePath, config);
+    devNull = open("/dev/null", O_WRONLY);
+
+    if((dev != NULL) && (devNull >= 0))
+    {
+        /* The sector size of the trace, not the one of the image */
+        HAL_Update(dev, trace->header.sizeSector);
+        result->backend = dev->backend;
+
+        statsReset();
+        statsEnable(1);
+        begin = nowNs();
+
+        for(index = 0; index < trace->count; index += count)
+        {
+            record = &trace->records[index];
+            op = HAL_TRACE_OP(record->stamp);
+            category = HAL_TRACE_CATEGORY(record->stamp) % HAL_TRACE_CATEGORIES;
+            count = 1;
+
+            start = nowNs();
+            due = begin + HAL_TRACE_NS(record->stamp);
+            if((options->pace == 1) && (start < due))
+            {
+                /* Sleep until the record is due, the sleep is not part of the replay time */
+                wake.tv_sec = (time_t)(due / NS_PER_SECOND);
+                wake.tv_nsec = (long)(due % NS_PER_SECOND);
+                clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL);
+                waited += nowNs() - start;
+                start = nowNs();
+            }
+
+            switch(op)
+            {
+            case HAL_TRACE_SECTOR_SIZE:
+                HAL_Update(dev, record->num);
+                bytes = 0;
+                break;
+            case HAL_TRACE_VECTOR:
+                iov.iov_base = buff;
+                iov.iov_len = record->num;
+                bytes = HAL_ReadVector(dev, record->index, &iov, 1);
+                break;
+            case HAL_TRACE_BATCH:
+            case HAL_TRACE_BATCH_NEXT:
+                /* The ranges of a batch follow each other, each gets its own part of the buffer */
+                used = 0;
+                count = 0;
+                do
+                {
+                    requests[count].index = trace->records[index + count].index;
+                    requests[count].num = trace->records[index + count].num;
+                    requests[count].buff = buff + used;
+                    used += (uint64_t)requests[count].num * dev->sizeSector;
+                    count++;
+                } while((index + count < trace->count) &&
+                        (HAL_TRACE_OP(trace->records[index + count].stamp) == HAL_TRACE_BATCH_NEXT));
+
+                HAL_ReadBatch(dev, requests, count);
+                bytes = used;
+                break;
+            case HAL_TRACE_MAP:
+                sector = HAL_MapSectors(dev, record->index, record->num);
+                bytes = (uint64_t)record->num * dev->sizeSector;
+                if(sector != NULL)
+                {
+                    /* Fault the pages in like the code that asked for them */
+                    touched = 0;
+                    for(offset = 0; offset < bytes; offset += REPLAY_PAGE_BYTES)
+                    {
+                        touched ^= ((volatile const uint8_t*)sector)[offset];
+                    }
+                    buff[0] = touched;
+                }
+                else
+                {
+                    bytes = HAL_ReadMultiSector(dev, record->index, record->num, buff);
+                }
+                break;
+            case HAL_TRACE_COPY:
+                bytes = HAL_CopyToFile(dev, record->index, record->num, devNull);
+                break;
+            case HAL_TRACE_WRITE:
+                /* The replay never changes the image, writes are skipped */
+                bytes = 0;
+                break;
+            default:
+                bytes = HAL_ReadMultiSector(dev, record->index, record->num, buff);
+                break;
+            }
+            elapsed = nowNs() - start;
+
+            if((op != HAL_TRACE_SECTOR_SIZE) && (op != HAL_TRACE_WRITE))
+            {
+                result->calls[category]++;
+                result->bytes[category] += bytes;
+                result->ns[category] += elapsed;
+                result->latencies[result->numLatencies++] = elapsed;
+            }
+        }
+
+        result->totalNs = nowNs() - begin - waited;
+        statsEnable(0);
+        statsGet(&result->stats);
+        HAL_GetCacheStats(dev, &result->cache);
+        opened = 1;
+    }
+
+    if(devNull >= 0)
+    {
+        close(devNull);
+    }
+    HAL_Deinit(dev);
+
+    return opened;
+}
+
+void report(const t_replayOptions *options, const t_halConfig *config, t_replayResult *result)
+{
+    const char *backend = NULL;
+    double seconds = 0;
+    double mbPerSec = 0;
+    double hitRatio = 0;
+    uint64_t calls = 0;
+    uint64_t bytes = 0;
+    uint64_t p50 = 0;
+    uint64_t p99 = 0;
+    uint64_t max = 0;
+    uint32_t index = 0;
+
+    for(index = 0; index < HAL_TRACE_CATEGORIES; index++)
+    {
+        calls += result->calls[index];
+        bytes += result->bytes[index];
+    }
+
+    if(result->numLatencies > 0)
+    {
+        qsort(result->latencies, result->numLatencies, sizeof(uint64_t), compareNs);
+        p50 = result->latencies[(result->numLatencies - 1) * 50 / 100];
+        p99 = result->latencies[(result->numLatencies - 1) * 99 / 100];
+        max = result->latencies[result->numLatencies - 1];
+    }
+
+    seconds = (double)result->totalNs / NS_PER_SECOND;
+    if(seconds > 0)
+    {
+        mbPerSec = (double)bytes / (1024.0 * 1024.0) / seconds;
+    }
+    if(result->cache.hits + result->cache.misses > 0)
+    {
+        hitRatio = (double)result->cache.hits / (double)(result->cache.hits + result->cache.misses);
+    }
+
+    /* The backend in use, mmap falls back to pread if the image cannot be mapped */
+    backend = (result->backend == HAL_BACKEND_MMAP) ? "mmap" : "pread";
+
+    if(options->format == REPLAY_FORMAT_TSV)
+    {
+        printf("%s\t%u\t%u\t%u\t%llu\t%llu\t%.6f\t%.2f\t%llu\t%llu\t%llu\t%.4f\t%llu\t%llu\t%llu\t%llu\t%llu\t%llu\t%llu\t%llu\t%llu\n",
+               backend, config->cacheBytes, config->blockBytes, config->queueDepth,
+               (unsigned long long)calls, (unsigned long long)bytes, seconds, mbPerSec,
+               (unsigned long long)result->cache.hits, (unsigned long long)result->cache.misses,
+               (unsigned long long)result->cache.evictions, hitRatio,
+               (unsigned long long)result->stats.counters[STATS_SYSCALLS], (unsigned long long)result->stats.counters[STATS_SEEKS],
+               (unsigned long long)result->ns[HAL_TRACE_FAT], (unsigned long long)result->ns[HAL_TRACE_DIR],
+               (unsigned long long)result->ns[HAL_TRACE_DATA], (unsigned long long)result->ns[HAL_TRACE_OTHER],
+               (unsigned long long)p50, (unsigned long long)p99, (unsigned long long)max);
+    }
+    else
+    {
+        printf("{\"backend\":\"%s\",\"cache_bytes\":%u,\"block_bytes\":%u,\"queue\":%u,\"calls\":%llu,\"bytes\":%llu,"
+               "\"seconds\":%.6f,\"mb_per_s\":%.2f,\"hits\":%llu,\"misses\":%llu,\"evictions\":%llu,\"hit_ratio\":%.4f,"
+               "\"syscalls\":%llu,\"seeks\":%llu,\"fat\":{\"calls\":%llu,\"bytes\":%llu,\"ns\":%llu},"
+               "\"dir\":{\"calls\":%llu,\"bytes\":%llu,\"ns\":%llu},\"data\":{\"calls\":%llu,\"bytes\":%llu,\"ns\":%llu},"
+               "\"other\":{\"calls\":%llu,\"bytes\":%llu,\"ns\":%llu},\"p50_ns\":%llu,\"p99_ns\":%llu,\"max_ns\":%llu}\n",
+               backend, config->cacheBytes, config->blockBytes, config->queueDepth,
+               (unsigned long long)calls, (unsigned long long)bytes, seconds, mbPerSec,
+               (unsigned long long)result->cache.hits, (unsigned long long)result->cache.misses,
+               (unsigned long long)result->cache.evictions, hitRatio,
+               (unsigned long long)result->stats.counters[STATS_SYSCALLS], (unsigned long long)result->stats.counters[STATS_SEEKS],
+               (unsigned long long)result->calls[HAL_TRACE_FAT], (unsigned long long)result->bytes[HAL_TRACE_FAT],
+               (unsigned long long)result->ns[HAL_TRACE_FAT],
+               (unsigned long long)result->calls[HAL_TRACE_DIR], (unsigned long long)result->bytes[HAL_TRACE_DIR],
+               (unsigned long long)result->ns[HAL_TRACE_DIR],
+               (unsigned long long)result->calls[HAL_TRACE_DATA], (unsigned long long)result->bytes[HAL_TRACE_DATA],
+               (unsigned long long)result->ns[HAL_TRACE_DATA],
+               (unsigned long long)result->calls[HAL_TRACE_OTHER], (unsigned long long)result->bytes[HAL_TRACE_OTHER],
+               (unsigned long long)result->ns[HAL_TRACE_OTHER],
+               (unsigned long long)p50, (unsigned long long)p99, (unsigned long long)max);
+    }
+}
+
+uint8_t parseOptions(int argc, char **argv, t_replayOptions *options)
+{
+    const char *name = NULL;
+    const char *value = NULL;
+    int index = 0;
+    uint8_t result = 1;
+
+    /* The HAL setting of a volume mounted with the default config */
+    memset(options, 0, sizeof(t_replayOptions));
+    options->backends.values[0] = HAL_BACKEND_PREAD;
+    options->backends.count = 1;
+    options->cacheBytes.values[0] = DISK_CACHE_DEFAULT;
+    options->cacheBytes.count = 1;
+    options->blockBytes.values[0] = HAL_CACHE_BLOCK_SIZE;
+    options->blockBytes.count = 1;
+    options->queueDepths.values[0] = HAL_QUEUE_DEFAULT;
+    options->queueDepths.count = 1;
+    options->format = REPLAY_FORMAT_JSON;
+
+    if(argc < 3)
+    {
+        result = 0;
+    }
+    else
+    {
+        options->tracePath = argv[1];
+        options->imagePath = argv[2];
+    }
+
+    for(index = 3; (index < argc) && (result == 1); index++)
+    {
+        name = argv[index];
+        value = (index + 1 < argc) ? argv[index + 1] : NULL;
+
+        if(strcmp(name, "--pace") == 0)
+        {
+            options->pace = 1;
+        }
+        else if(value == NULL)
+        {
+            result = 0;
+        }
+        else
+        {
+            index++;
+            if(strcmp(name, "--backend") == 0)
+            {
+                result = parseList(value, &options->backends, 1);
+            }
+            else if(strcmp(name, "--cache") == 0)
+            {
+                result = parseList(value, &options->cacheBytes, 0);
+            }
+            else if(strcmp(name, "--block") == 0)
+            {
+                result = parseList(value, &options->blockBytes, 0);
+            }
+            else if(strcmp(name, "--queue") == 0)
+            {
+                result = parseList(value, &options->queueDepths, 0);
+            }
+            else if(strcmp(name, "--format") == 0)
+            {
+                options->format = (strcmp(value, "tsv") == 0) ? REPLAY_FORMAT_TSV : REPLAY_FORMAT_JSON;
+            }
+            else
+            {
+                result = 0;
+            }
+        }
+    }
+
+    return result;
+}
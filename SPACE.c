@@ -0,0 +1,679 @@
+/*******************************************************************************
+* Include
+*******************************************************************************/
+#include "SPACE.h"
+
+/*******************************************************************************
+* Define
+*******************************************************************************/
+
+/**
+ * Kernel turning groups of SPACE_GROUP little-endian FAT entries into bitmap words,
+ * bit i of a word set when entry i of its group is zero.
+ *
+ * @param raw The first entry.
+ * @param groups Number of groups to scan.
+ * @param width Bytes per entry, 2 or 4.
+ * @param topMask Mask of the last byte of an entry, 0x0F for the raw FAT32 entries.
+ * @param words Receives one word per group.
+ */
+typedef void (*t_spaceKernel)(const uint8_t *raw, uint32_t groups, uint8_t width, uint8_t topMask, uint64_t *words);
+
+/*******************************************************************************
+* Prototypes
+*******************************************************************************/
+
+/**
+ * Name: scanFreeSpace
+ * @brief Build the free cluster bitmap and the free run list of a volume. A resident FAT is
+ *        scanned in memory; otherwise the first FAT table is read in SPACE_CHUNK_BYTES pieces.
+ *        FAT16 and FAT32 entries are compared against zero a whole vector at a time.
+ *
+ * @param vol: The volume.
+ * @param kernel: SPACE_KERNEL_AUTO, or a kernel to force; one the CPU lacks falls back to scalar.
+ * @param space: Receives the bitmap, the counts and the runs, to be released with releaseFreeSpace().
+ *
+ * @return 1 if the whole FAT was scanned, 0 if a read failed or memory ran out.
+ */
+uint8_t scanFreeSpace(t_volume *vol, uint8_t kernel, t_freeSpace *space);
+
+/**
+ * Name: releaseFreeSpace
+ * @brief Free the bitmap and the runs of a scan and leave it empty.
+ *
+ * @param space: The scan result.
+ */
+void releaseFreeSpace(t_freeSpace *space);
+
+/**
+ * Name: isClusterFree
+ * @brief Look a cluster up in the bitmap of a scan.
+ *
+ * @param space: The scan result.
+ * @param cluster: The cluster.
+ *
+ * @return 1 if the cluster is free, 0 if it is used or outside the volume.
+ */
+uint8_t isClusterFree(const t_freeSpace *space, uint32_t cluster);
+
+/**
+ * Name: readFSInfo
+ * @brief Read the free cluster count kept in the FAT32 FSInfo sector, an instant estimate
+ *        that does not scan the FAT. The sector is trusted only when its three signatures
+ *        are present and the count and the hint fit the volume.
+ *
+ * @param vol: The volume.
+ * @param info: Receives the count and the hint.
+ *
+ * @return 1 if the volume is FAT32 and the sector is trustworthy, 0 otherwise.
+ */
+uint8_t readFSInfo(t_volume *vol, t_fsInfo *info);
+
+/**
+ * Name: countDataClusters
+ * @brief Count the clusters of the data region.
+ *
+ * @param vol: The volume.
+ *
+ * @return The number of data clusters, the last valid cluster number is this plus one.
+ */
+uint32_t countDataClusters(t_volume *vol);
+
+/**
+ * Name: scalarWord
+ * @brief Build one bitmap word from up to SPACE_GROUP entries, one entry at a time.
+ *
+ * @param raw The first entry.
+ * @param count Number of entries, SPACE_GROUP or less for the last word.
+ * @param width Bytes per entry, 2 or 4.
+ * @param topMask Mask of the last byte of an entry.
+ *
+ * @return The word, bit i set when entry i is zero.
+ */
+static uint64_t scalarWord(const uint8_t *raw, uint32_t count, uint8_t width, uint8_t topMask);
+
+/**
+ * Name: scanScalar
+ * @brief t_spaceKernel for any CPU.
+ */
+static void scanScalar(const uint8_t *raw, uint32_t groups, uint8_t width, uint8_t topMask, uint64_t *words);
+
+#if defined(FAT_HAVE_X86)
+/**
+ * Name: scanSSE2
+ * @brief t_spaceKernel comparing 16 bytes of entries per instruction.
+ */
+static void scanSSE2(const uint8_t *raw, uint32_t groups, uint8_t width, uint8_t topMask, uint64_t *words);
+
+/**
+ * Name: scanAVX2
+ * @brief t_spaceKernel comparing 32 bytes of entries per instruction.
+ */
+static void scanAVX2(const uint8_t *raw, uint32_t groups, uint8_t width, uint8_t topMask, uint64_t *words);
+#endif
+
+/**
+ * Name: pickKernel
+ * @brief Resolve the kernel asked for against what the CPU supports.
+ *
+ * @param kernel The SPACE_KERNEL_* asked for.
+ *
+ * @return The SPACE_KERNEL_* to use, never SPACE_KERNEL_AUTO.
+ */
+static uint8_t pickKernel(uint8_t kernel);
+
+/**
+ * Name: scanEntries
+ * @brief Turn entries into bitmap words with a kernel; the last partial group is scanned by scalarWord.
+ *
+ * @param scan The kernel.
+ * @param raw The first entry, the entry of a cluster that is a multiple of SPACE_GROUP.
+ * @param count Number of entries.
+ * @param width Bytes per entry.
+ * @param topMask Mask of the last byte of an entry.
+ * @param words Receives the words, one per started group.
+ */
+static void scanEntries(t_spaceKernel scan, const uint8_t *raw, uint32_t count, uint8_t width, uint8_t topMask, uint64_t *words);
+
+/**
+ * Name: scanFAT12
+ * @brief Build the bitmap words of packed FAT12 entries by unpacking them to 32 bits first.
+ *
+ * @param scan The kernel.
+ * @param raw The FAT bytes from entry 0.
+ * @param count Number of entries.
+ * @param words Receives the words.
+ *
+ * @return 1 if the entries were scanned, 0 if memory ran out.
+ */
+static uint8_t scanFAT12(t_spaceKernel scan, const uint8_t *raw, uint32_t count, uint64_t *words);
+
+/**
+ * Name: scanRawFAT
+ * @brief Read the first FAT table from the disk chunk by chunk and scan it.
+ *
+ * @param vol The volume.
+ * @param scan The kernel.
+ * @param count Number of entries to scan.
+ * @param words Receives the words.
+ *
+ * @return 1 if every chunk was read, 0 otherwise.
+ */
+static uint8_t scanRawFAT(t_volume *vol, t_spaceKernel scan, uint32_t count, uint64_t *words);
+
+/**
+ * Name: findBit
+ * @brief Find the next bit of the bitmap with a value, skipping whole words.
+ *
+ * @param space The scan result.
+ * @param from The first bit to look at.
+ * @param value 1 to find a free cluster, 0 to find a used one.
+ *
+ * @return The bit, numClusters if there is none.
+ */
+static uint32_t findBit(const t_freeSpace *space, uint32_t from, uint8_t value);
+
+/**
+ * Name: getLittle32
+ * @brief Read a little-endian 32-bit value.
+ *
+ * @param bytes The first byte.
+ *
+ * @return The value.
+ */
+static uint32_t getLittle32(const uint8_t *bytes);
+
+/**
+ * Name: buildRuns
+ * @brief Turn the bitmap into the list of free runs.
+ *
+ * @param space The scan result.
+ *
+ * @return 1 if the list was built, 0 if memory ran out.
+ */
+static uint8_t buildRuns(t_freeSpace *space);
+
+/*******************************************************************************
+* Code
+*******************************************************************************/
+uint32_t countDataClusters(t_volume *vol)
+{
+    uint32_t count = 0;
+
+    if(vol->bootInfo.totalSector > vol->local.dataStartSector)
+    {
+        count = (vol->bootInfo.totalSector - vol->local.dataStartSector) / vol->bootInfo.secPerClus;
+    }
+
+    return count;
+}
+
+static uint64_t scalarWord(const uint8_t *raw, uint32_t count, uint8_t width, uint8_t topMask)
+{
+    const uint8_t *entry = NULL;
+    uint64_t word = 0;
+    uint32_t index = 0;
+    uint8_t bits = 0;
+
+    for(index = 0; index < count; index++)
+    {
+        entry = raw + (uint64_t)index * width;
+        if(width == 2)
+        {
+            bits = entry[0] | (entry[1] & topMask);
+        }
+        else
+        {
+            bits = entry[0] | entry[1] | entry[2] | (entry[3] & topMask);
+        }
+
+        if(bits == 0)
+        {
+            word |= 1ULL << index;
+        }
+    }
+
+    return word;
+}
+
+static void scanScalar(const uint8_t *raw, uint32_t groups, uint8_t width, uint8_t topMask, uint64_t *words)
+{
+    uint32_t group = 0;
+
+    for(group = 0; group < groups; group++)
+    {
+        words[group] = scalarWord(raw + (uint64_t)group * SPACE_GROUP * width, SPACE_GROUP, width, topMask);
+    }
+}
+
+#if defined(FAT_HAVE_X86)
+__attribute__((target("sse2")))
+static void scanSSE2(const uint8_t *raw, uint32_t groups, uint8_t width, uint8_t topMask, uint64_t *words)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i mask = _mm_set1_epi32((int)(((uint32_t)topMask << SHIFT_24_BIT) | 0x00FFFFFFU));
+    const uint8_t *group = NULL;
+    __m128i low;
+    __m128i high;
+    uint64_t word = 0;
+    uint32_t index = 0;
+    uint32_t step = 0;
+
+    for(index = 0; index < groups; index++)
+    {
+        group = raw + (uint64_t)index * SPACE_GROUP * width;
+        word = 0;
+
+        if(width == 2)
+        {
+            /* 16 entries per step: the 16-bit compares are packed to one byte per entry */
+            for(step = 0; step < SPACE_GROUP / 16; step++)
+            {
+                low = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i*)(group + step * 32)), zero);
+                high = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i*)(group + step * 32 + 16)), zero);
+                word |= (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_packs_epi16(low, high)) << (step * 16);
+            }
+        }
+        else
+        {
+            /* 4 entries per step, the reserved high nibble of FAT32 masked off first */
+            for(step = 0; step < SPACE_GROUP / 4; step++)
+            {
+                low = _mm_and_si128(_mm_loadu_si128((const __m128i*)(group + step * 16)), mask);
+                word |= (uint64_t)(uint32_t)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(low, zero))) << (step * 4);
+            }
+        }
+
+        words[index] = word;
+    }
+}
+
+__attribute__((target("avx2")))
+static void scanAVX2(const uint8_t *raw, uint32_t groups, uint8_t width, uint8_t topMask, uint64_t *words)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i mask = _mm256_set1_epi32((int)(((uint32_t)topMask << SHIFT_24_BIT) | 0x00FFFFFFU));
+    const uint8_t *group = NULL;
+    __m256i low;
+    __m256i high;
+    uint64_t word = 0;
+    uint32_t index = 0;
+    uint32_t step = 0;
+
+    for(index = 0; index < groups; index++)
+    {
+        group = raw + (uint64_t)index * SPACE_GROUP * width;
+        word = 0;
+
+        if(width == 2)
+        {
+            /* 32 entries per step; the pack works per 128-bit lane, the permute puts the lanes back in order */
+            for(step = 0; step < SPACE_GROUP / 32; step++)
+            {
+                low = _mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i*)(group + step * 64)), zero);
+                high = _mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i*)(group + step * 64 + 32)), zero);
+                low = _mm256_permute4x64_epi64(_mm256_packs_epi16(low, high), 0xD8);
+                word |= (uint64_t)(uint32_t)_mm256_movemask_epi8(low) << (step * 32);
+            }
+        }
+        else
+        {
+            for(step = 0; step < SPACE_GROUP / 8; step++)
+            {
+                low = _mm256_and_si256(_mm256_loadu_si256((const __m256i*)(group + step * 32)), mask);
+                word |= (uint64_t)(uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(low, zero))) << (step * 8);
+            }
+        }
+
+        words[index] = word;
+    }
+}
+#endif
+
+static uint8_t pickKernel(uint8_t kernel)
+{
+    uint8_t result = SPACE_KERNEL_SCALAR;
+
+#if defined(FAT_HAVE_X86)
+    if(((kernel == SPACE_KERNEL_AUTO) || (kernel == SPACE_KERNEL_AVX2)) && __builtin_cpu_supports("avx2"))
+    {
+        result = SPACE_KERNEL_AVX2;
+    }
+    else if(((kernel == SPACE_KERNEL_AUTO) || (kernel == SPACE_KERNEL_SSE2)) && __builtin_cpu_supports("sse2"))
+    {
+        result = SPACE_KERNEL_SSE2;
+    }
+#else
+    (void)kernel;
+#endif
+
+    return result;
+}
+
+static void scanEntries(t_spaceKernel scan, const uint8_t *raw, uint32_t count, uint8_t width, uint8_t topMask, uint64_t *words)
+{
+    uint32_t groups = 0;
+
+    groups = count / SPACE_GROUP;
+    scan(raw, groups, width, topMask, words);
+
+    if(count % SPACE_GROUP != 0)
+    {
+        words[groups] = scalarWord(raw + (uint64_t)groups * SPACE_GROUP * width, count % SPACE_GROUP, width, topMask);
+    }
+}
+
+static uint8_t scanFAT12(t_spaceKernel scan, const uint8_t *raw, uint32_t count, uint64_t *words)
+{
+    uint32_t *entries = NULL;
+    uint8_t result = 0;
+
+    /* At most 4084 clusters, 16 KiB unpacked */
+    entries = (uint32_t*)malloc((uint64_t)count * sizeof(uint32_t));
+    if(entries == NULL)
+    {
+        fprintf(stderr, "The disk is empty.\n");
+    }
+    else
+    {
+        unpackFAT12(raw, 0, count, FAT12_KERNEL_AUTO, entries);
+        scanEntries(scan, (const uint8_t*)entries, count, sizeof(uint32_t), 0xFF, words);
+        free(entries);
+        result = 1;
+    }
+
+    return result;
+}
+
+static uint8_t scanRawFAT(t_volume *vol, t_spaceKernel scan, uint32_t count, uint64_t *words)
+{
+    const uint8_t *raw = NULL;
+    uint8_t *buff = NULL;
+    uint32_t bytsPerSec = vol->bootInfo.bytsPerSec;
+    uint32_t first = 0;
+    uint32_t chunk = 0;
+    uint32_t numSector = 0;
+    uint8_t width = 4;
+    uint8_t topMask = 0x0F;
+    uint8_t category = 0;
+    uint8_t result = 1;
+
+    category = HAL_TraceCategory(HAL_TRACE_FAT);
+
+    if(fatType(vol) == FAT_12)
+    {
+        /* At most 4084 clusters, the whole table is read at once */
+        numSector = (count + (count >> 1) + 1 + bytsPerSec - 1) / bytsPerSec;
+        raw = HAL_MapSectors(vol->device, vol->bootInfo.rsvdSecCnt, numSector);
+        if(raw == NULL)
+        {
+            buff = (uint8_t*)malloc((uint64_t)numSector * bytsPerSec);
+            if((buff != NULL) &&
+               (HAL_ReadMultiSector(vol->device, vol->bootInfo.rsvdSecCnt, numSector, buff) == numSector * bytsPerSec))
+            {
+                raw = buff;
+            }
+        }
+
+        if((raw == NULL) || (scanFAT12(scan, raw, count, words) == 0))
+        {
+            result = 0;
+        }
+    }
+    else
+    {
+        if(fatType(vol) == FAT_16)
+        {
+            width = 2;
+            topMask = 0xFF;
+        }
+
+        buff = (uint8_t*)malloc(SPACE_CHUNK_BYTES);
+
+        /* A chunk is a whole number of sectors and of bitmap words */
+        for(first = 0; (result == 1) && (first < count); first += chunk)
+        {
+            chunk = SPACE_CHUNK_BYTES / width;
+            if(chunk > count - first)
+            {
+                chunk = count - first;
+            }
+            numSector = (uint32_t)(((uint64_t)chunk * width + bytsPerSec - 1) / bytsPerSec);
+
+            raw = HAL_MapSectors(vol->device, vol->bootInfo.rsvdSecCnt + (uint32_t)((uint64_t)first * width / bytsPerSec), numSector);
+            if((raw == NULL) && (buff != NULL) &&
+               (HAL_ReadMultiSector(vol->device, vol->bootInfo.rsvdSecCnt + (uint32_t)((uint64_t)first * width / bytsPerSec),
+                                    numSector, buff) == numSector * bytsPerSec))
+            {
+                raw = buff;
+            }
+
+            if(raw == NULL)
+            {
+                result = 0;
+            }
+            else
+            {
+                scanEntries(scan, raw, chunk, width, topMask, &words[first / SPACE_GROUP]);
+            }
+        }
+    }
+
+    HAL_TraceCategory(category);
+    free(buff);
+
+    if(result == 0)
+    {
+        fprintf(stderr, "Read FAT Region error.\n");
+    }
+
+    return result;
+}
+
+static uint32_t findBit(const t_freeSpace *space, uint32_t from, uint8_t value)
+{
+    uint64_t word = 0;
+    uint32_t index = 0;
+    uint32_t found = 0;
+
+    found = space->numClusters;
+
+    for(index = from; index < space->numClusters; index = (index & ~(SPACE_GROUP - 1)) + SPACE_GROUP)
+    {
+        word = space->bitmap[index / SPACE_GROUP];
+        if(value == 0)
+        {
+            word = ~word;
+        }
+
+        /* Ignore the bits before the start in the first word */
+        word &= ~0ULL << (index % SPACE_GROUP);
+        if(word != 0)
+        {
+            found = (index & ~(SPACE_GROUP - 1)) + (uint32_t)__builtin_ctzll(word);
+            break;
+        }
+    }
+
+    return (found < space->numClusters) ? found : space->numClusters;
+}
+
+static uint8_t buildRuns(t_freeSpace *space)
+{
+    t_extent *grown = NULL;
+    uint32_t capacity = 0;
+    uint32_t start = 0;
+    uint32_t end = 0;
+    uint8_t result = 1;
+
+    start = findBit(space, FIRST_CLUSTER, 1);
+
+    while((result == 1) && (start < space->numClusters))
+    {
+        end = findBit(space, start, 0);
+
+        if(space->numRuns == capacity)
+        {
+            capacity = (capacity == 0) ? SPACE_RUNS_INIT_SIZE : capacity * 2;
+            grown = (t_extent*)realloc(space->runs, capacity * sizeof(t_extent));
+            if(grown == NULL)
+            {
+                fprintf(stderr, "The disk is empty.\n");
+                result = 0;
+                break;
+            }
+            space->runs = grown;
+        }
+
+        space->runs[space->numRuns].firstCluster = start;
+        space->runs[space->numRuns].length = end - start;
+        space->numRuns++;
+
+        start = findBit(space, end, 1);
+    }
+
+    return result;
+}
+
+uint8_t scanFreeSpace(t_volume *vol, uint8_t kernel, t_freeSpace *space)
+{
+    t_spaceKernel scan = scanScalar;
+    uint32_t numWords = 0;
+    uint32_t count = 0;
+    uint32_t index = 0;
+    uint8_t result = 0;
+
+    memset(space, 0, sizeof(t_freeSpace));
+    space->numClusters = countDataClusters(vol) + FIRST_CLUSTER;
+    space->kernel = pickKernel(kernel);
+
+#if defined(FAT_HAVE_X86)
+    if(space->kernel == SPACE_KERNEL_AVX2)
+    {
+        scan = scanAVX2;
+    }
+    else if(space->kernel == SPACE_KERNEL_SSE2)
+    {
+        scan = scanSSE2;
+    }
+#endif
+
+    /* Entries past the end of the FAT stay used */
+    count = (space->numClusters < vol->fatCache.numEntries) ? space->numClusters : vol->fatCache.numEntries;
+    numWords = (space->numClusters + SPACE_GROUP - 1) / SPACE_GROUP;
+
+    /* Allocate some memory */
+    space->bitmap = (uint64_t*)calloc(numWords + 1, sizeof(uint64_t));
+
+    if(space->bitmap == NULL)
+    {
+        fprintf(stderr, "The disk is empty.\n");
+    }
+    else
+    {
+        if((vol->fatCache.pageEntries == 0) && (vol->fatCache.table != NULL))
+        {
+            /* The decoded FAT is in memory; its entries are already masked */
+            scanEntries(scan, (const uint8_t*)vol->fatCache.table, count, sizeof(uint32_t), 0xFF, space->bitmap);
+            result = 1;
+        }
+        else
+        {
+            result = scanRawFAT(vol, scan, count, space->bitmap);
+        }
+
+        /* Clusters 0 and 1 are not data clusters */
+        space->bitmap[0] &= ~3ULL;
+        for(index = 0; index < numWords; index++)
+        {
+            space->freeClusters += (uint32_t)__builtin_popcountll(space->bitmap[index]);
+        }
+        space->usedClusters = space->numClusters - FIRST_CLUSTER - space->freeClusters;
+
+        if(buildRuns(space) == 0)
+        {
+            result = 0;
+        }
+    }
+
+    return result;
+}
+
+void releaseFreeSpace(t_freeSpace *space)
+{
+    free(space->bitmap);
+    free(space->runs);
+    memset(space, 0, sizeof(t_freeSpace));
+}
+
+uint8_t isClusterFree(const t_freeSpace *space, uint32_t cluster)
+{
+    uint8_t result = 0;
+
+    if((space->bitmap != NULL) && (cluster < space->numClusters))
+    {
+        result = (uint8_t)((space->bitmap[cluster / SPACE_GROUP] >> (cluster % SPACE_GROUP)) & 1U);
+    }
+
+    return result;
+}
+
+static uint32_t getLittle32(const uint8_t *bytes)
+{
+    return (uint32_t)bytes[0]
+         | ((uint32_t)bytes[1] << SHIFT_8_BIT)
+         | ((uint32_t)bytes[2] << SHIFT_16_BIT)
+         | ((uint32_t)bytes[3] << SHIFT_24_BIT);
+}
+
+uint8_t readFSInfo(t_volume *vol, t_fsInfo *info)
+{
+    uint8_t *buff = NULL;
+    uint32_t dataClusters = 0;
+    uint32_t lead = 0;
+    uint32_t struc = 0;
+    uint32_t trail = 0;
+    uint8_t result = 0;
+
+    info->freeClusters = FSINFO_UNKNOWN;
+    info->nextFree = FSINFO_UNKNOWN;
+
+    /* The structure lives in the reserved region of FAT32 volumes only */
+    if((fatType(vol) == FAT_32) && (vol->bootInfo.fsInfo != 0) &&
+       (vol->bootInfo.fsInfo < vol->bootInfo.rsvdSecCnt) && (vol->bootInfo.bytsPerSec >= BYTE_PER_SECTOR))
+    {
+        /* Allocate some memory */
+        buff = (uint8_t*)malloc(vol->bootInfo.bytsPerSec);
+
+        if(buff == NULL)
+        {
+            fprintf(stderr, "The disk is empty.\n");
+        }
+        else if(HAL_ReadSector(vol->device, vol->bootInfo.fsInfo, buff) != vol->bootInfo.bytsPerSec)
+        {
+            fprintf(stderr, "Read FSInfo error.\n");
+        }
+        else
+        {
+            lead = getLittle32(&buff[0]);
+            struc = getLittle32(&buff[FSINFO_STRUC_OFFSET]);
+            trail = getLittle32(&buff[FSINFO_TRAIL_OFFSET]);
+            info->freeClusters = getLittle32(&buff[FSINFO_FREE_COUNT]);
+            info->nextFree = getLittle32(&buff[FSINFO_NEXT_FREE]);
+
+            /* A count the last writer did not keep, or one that does not fit the volume, is not trusted */
+            dataClusters = countDataClusters(vol);
+            if((lead == FSINFO_LEAD_SIG) && (struc == FSINFO_STRUC_SIG) && (trail == FSINFO_TRAIL_SIG) &&
+               (info->freeClusters != FSINFO_UNKNOWN) && (info->freeClusters <= dataClusters) &&
+               ((info->nextFree == FSINFO_UNKNOWN) ||
+                ((info->nextFree >= FIRST_CLUSTER) && (info->nextFree < dataClusters + FIRST_CLUSTER))))
+            {
+                result = 1;
+            }
+        }
+
+        free(buff);
+    }
+
+    return result;
+}
@@ -0,0 +1,98 @@
+#ifndef _SPACE_H_
+#define _SPACE_H_
+
+/*******************************************************************************
+* Include
+*******************************************************************************/
+#include "FAT.h"
+
+/*******************************************************************************
+* Define
+*******************************************************************************/
+#define SPACE_KERNEL_AUTO       0U       /* The fastest kernel the CPU supports */
+#define SPACE_KERNEL_SCALAR     1U       /* One entry at a time, any CPU */
+#define SPACE_KERNEL_SSE2       2U       /* 4 FAT32 or 16 FAT16 entries per step */
+#define SPACE_KERNEL_AVX2       3U       /* 8 FAT32 or 32 FAT16 entries per step */
+
+#define SPACE_GROUP             64U      /* Entries turned into one bitmap word */
+#define SPACE_CHUNK_BYTES       (1024U * 1024U)  /* Bytes of raw FAT scanned per read when the FAT is not resident */
+#define SPACE_RUNS_INIT_SIZE    64U      /* Initial capacity of the free run list */
+
+typedef struct
+{
+    uint64_t    *bitmap;                 /* Bit n set when cluster n is free, clusters 0 and 1 never are */
+    uint32_t    numClusters;             /* Bits in the bitmap: the data clusters plus the two reserved entries */
+    uint32_t    freeClusters;            /* Data clusters whose entry is 0 */
+    uint32_t    usedClusters;            /* Data clusters allocated, bad or reserved */
+    t_extent    *runs;                   /* Runs of free clusters, in cluster order */
+    uint32_t    numRuns;                 /* Number of runs */
+    uint8_t     kernel;                  /* SPACE_KERNEL_* that scanned the FAT */
+} t_freeSpace;
+
+typedef struct
+{
+    uint32_t    freeClusters;            /* Free cluster count recorded by the last writer */
+    uint32_t    nextFree;                /* Where the last writer would allocate next, FSINFO_UNKNOWN if not kept */
+} t_fsInfo;
+
+/*******************************************************************************
+* API
+*******************************************************************************/
+
+/**
+ * Name: scanFreeSpace
+ * @brief Build the free cluster bitmap and the free run list of a volume. A resident FAT is
+ *        scanned in memory; otherwise the first FAT table is read in SPACE_CHUNK_BYTES pieces.
+ *        FAT16 and FAT32 entries are compared against zero a whole vector at a time.
+ *
+ * @param vol: The volume.
+ * @param kernel: SPACE_KERNEL_AUTO, or a kernel to force; one the CPU lacks falls back to scalar.
+ * @param space: Receives the bitmap, the counts and the runs, to be released with releaseFreeSpace().
+ *
+ * @return 1 if the whole FAT was scanned, 0 if a read failed or memory ran out.
+ */
+uint8_t scanFreeSpace(t_volume *vol, uint8_t kernel, t_freeSpace *space);
+
+/**
+ * Name: releaseFreeSpace
+ * @brief Free the bitmap and the runs of a scan and leave it empty.
+ *
+ * @param space: The scan result.
+ */
+void releaseFreeSpace(t_freeSpace *space);
+
+/**
+ * Name: isClusterFree
+ * @brief Look a cluster up in the bitmap of a scan.
+ *
+ * @param space: The scan result.
+ * @param cluster: The cluster.
+ *
+ * @return 1 if the cluster is free, 0 if it is used or outside the volume.
+ */
+uint8_t isClusterFree(const t_freeSpace *space, uint32_t cluster);
+
+/**
+ * Name: readFSInfo
+ * @brief Read the free cluster count kept in the FAT32 FSInfo sector, an instant estimate
+ *        that does not scan the FAT. The sector is trusted only when its three signatures
+ *        are present and the count and the hint fit the volume.
+ *
+ * @param vol: The volume.
+ * @param info: Receives the count and the hint.
+ *
+ * @return 1 if the volume is FAT32 and the sector is trustworthy, 0 otherwise.
+ */
+uint8_t readFSInfo(t_volume *vol, t_fsInfo *info);
+
+/**
+ * Name: countDataClusters
+ * @brief Count the clusters of the data region.
+ *
+ * @param vol: The volume.
+ *
+ * @return The number of data clusters, the last valid cluster number is this plus one.
+ */
+uint32_t countDataClusters(t_volume *vol);
+
+#endif /* _SPACE_H_ */
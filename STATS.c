@@ -0,0 +1,362 @@
+/*******************************************************************************
+* Include
+*******************************************************************************/
+#include "STATS.h"
+
+/*******************************************************************************
+* Variables
+*******************************************************************************/
+uint8_t g_statsEnabled = 0;
+
+static t_statsSnapshot s_stats;
+static const char *s_dumpPath = NULL;
+static pthread_once_t s_envOnce = PTHREAD_ONCE_INIT;
+static pthread_once_t s_exitOnce = PTHREAD_ONCE_INIT;
+
+static const char *const s_opNames[STATS_NUM_OPS] =
+{
+    "read", "readVector", "readBatch", "fatLookup", "fatDecode",
+    "dirLoad", "dirRead", "dirParse", "fileRead", "write", "flush", "fileWrite"
+};
+
+static const char *const s_counterNames[STATS_NUM_COUNTERS] =
+{
+    "syscalls", "seeks", "cacheHits", "cacheMisses", "dirCacheHits", "dirCacheMisses"
+};
+
+/*******************************************************************************
+* Prototypes
+*******************************************************************************/
+
+/**
+ * Name: readEnv
+ * @brief pthread_once body of statsInitFromEnv.
+ */
+static void readEnv(void);
+
+/**
+ * Name: registerDump
+ * @brief pthread_once body registering dumpAtExit.
+ */
+static void registerDump(void);
+
+/**
+ * Name: dumpAtExit
+ * @brief atexit handler writing the counters to the dump path.
+ */
+static void dumpAtExit(void);
+
+/**
+ * Name: statsEnable
+ * @brief Start or stop collecting counters. The counters keep their values.
+ *
+ * @param enable: 1 to collect, 0 to stop.
+ */
+void statsEnable(uint8_t enable);
+
+/**
+ * Name: statsInitFromEnv
+ * @brief Enable the counters and dump them at exit if STATS_ENV is set. Runs once per
+ *        process, HAL_Init() calls it.
+ */
+void statsInitFromEnv(void);
+
+/**
+ * Name: statsDumpAtExit
+ * @brief Enable the counters and write them as JSON when the process exits.
+ *
+ * @param path: The output file, "-" for stderr.
+ */
+void statsDumpAtExit(const char *path);
+
+/**
+ * Name: statsClock
+ * @brief Read the monotonic clock used by the probes.
+ *
+ * @return The time in ns, never 0.
+ */
+uint64_t statsClock(void);
+
+/**
+ * Name: statsRecord
+ * @brief Account one timed operation, use STATS_RECORD().
+ *
+ * @param op: One of STATS_OP_*.
+ * @param start: The statsClock() value when the operation started.
+ * @param bytes: The bytes moved by the operation.
+ */
+void statsRecord(uint8_t op, uint64_t start, uint64_t bytes);
+
+/**
+ * Name: statsCount
+ * @brief Add to a plain counter, use STATS_COUNT().
+ *
+ * @param counter: One of STATS_*.
+ * @param amount: The amount to add.
+ */
+void statsCount(uint8_t counter, uint64_t amount);
+
+/**
+ * Name: statsGet
+ * @brief Copy the current counters.
+ *
+ * @param snapshot: Receives the counters.
+ */
+void statsGet(t_statsSnapshot *snapshot);
+
+/**
+ * Name: statsReset
+ * @brief Set every counter back to zero.
+ */
+void statsReset(void);
+
+/**
+ * Name: statsWriteJSON
+ * @brief Write the current counters as one JSON object. Empty histogram buckets are left out.
+ *
+ * @param fp: The output stream.
+ */
+void statsWriteJSON(FILE *fp);
+
+/**
+ * Name: statsWriteJSONString
+ * @brief Write a string as a quoted JSON string. Quotes and backslashes are escaped, control
+ *        and non-ASCII bytes are written as \u escapes.
+ *
+ * @param fp: The output stream.
+ * @param text: The string.
+ */
+void statsWriteJSONString(FILE *fp, const char *text);
+
+/*******************************************************************************
+* Code
+*******************************************************************************/
+static void readEnv(void)
+{
+    const char *path = NULL;
+
+    path = getenv(STATS_ENV);
+    if((path != NULL) && (path[0] != '\0'))
+    {
+        statsDumpAtExit(path);
+    }
+}
+
+static void registerDump(void)
+{
+    atexit(dumpAtExit);
+}
+
+static void dumpAtExit(void)
+{
+    FILE *fp = NULL;
+
+    if(s_dumpPath != NULL)
+    {
+        fp = (strcmp(s_dumpPath, "-") == 0) ? stderr : fopen(s_dumpPath, "w");
+        if(fp == NULL)
+        {
+            fprintf(stderr, "Cannot write %s.\n", s_dumpPath);
+        }
+        else
+        {
+            statsWriteJSON(fp);
+            if(fp != stderr)
+            {
+                fclose(fp);
+            }
+        }
+    }
+}
+
+void statsEnable(uint8_t enable)
+{
+    __atomic_store_n(&g_statsEnabled, (enable != 0) ? 1 : 0, __ATOMIC_RELAXED);
+}
+
+void statsInitFromEnv(void)
+{
+    pthread_once(&s_envOnce, readEnv);
+}
+
+void statsDumpAtExit(const char *path)
+{
+    s_dumpPath = path;
+    pthread_once(&s_exitOnce, registerDump);
+    statsEnable(1);
+}
+
+uint64_t statsClock(void)
+{
+    struct timespec now;
+    uint64_t ns = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    ns = (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+
+    /* 0 means "not timed" to STATS_RECORD */
+    return (ns != 0) ? ns : 1;
+}
+
+void statsRecord(uint8_t op, uint64_t start, uint64_t bytes)
+{
+    t_statsOp *stat = NULL;
+    uint64_t elapsed = 0;
+    uint64_t seen = 0;
+    uint32_t bucket = 0;
+
+    if(op < STATS_NUM_OPS)
+    {
+        stat = &s_stats.ops[op];
+        elapsed = statsClock() - start;
+
+        /* The bucket is the position of the highest bit of the latency */
+        bucket = 63U - (uint32_t)__builtin_clzll(elapsed | 1U);
+        if(bucket >= STATS_BUCKETS)
+        {
+            bucket = STATS_BUCKETS - 1;
+        }
+
+        __atomic_add_fetch(&stat->count, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&stat->bytes, bytes, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&stat->totalNs, elapsed, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&stat->buckets[bucket], 1, __ATOMIC_RELAXED);
+
+        seen = __atomic_load_n(&stat->maxNs, __ATOMIC_RELAXED);
+        while((elapsed > seen) &&
+              (__atomic_compare_exchange_n(&stat->maxNs, &seen, elapsed, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED) == 0))
+        {
+            /* seen was reloaded by the failed exchange */
+        }
+    }
+}
+
+void statsCount(uint8_t counter, uint64_t amount)
+{
+    if(counter < STATS_NUM_COUNTERS)
+    {
+        __atomic_add_fetch(&s_stats.counters[counter], amount, __ATOMIC_RELAXED);
+    }
+}
+
+void statsGet(t_statsSnapshot *snapshot)
+{
+    uint32_t op = 0;
+    uint32_t index = 0;
+
+    /* Counter by counter: a snapshot taken while threads run is not one instant */
+    for(op = 0; op < STATS_NUM_OPS; op++)
+    {
+        snapshot->ops[op].count = __atomic_load_n(&s_stats.ops[op].count, __ATOMIC_RELAXED);
+        snapshot->ops[op].bytes = __atomic_load_n(&s_stats.ops[op].bytes, __ATOMIC_RELAXED);
+        snapshot->ops[op].totalNs = __atomic_load_n(&s_stats.ops[op].totalNs, __ATOMIC_RELAXED);
+        snapshot->ops[op].maxNs = __atomic_load_n(&s_stats.ops[op].maxNs, __ATOMIC_RELAXED);
+        for(index = 0; index < STATS_BUCKETS; index++)
+        {
+            snapshot->ops[op].buckets[index] = __atomic_load_n(&s_stats.ops[op].buckets[index], __ATOMIC_RELAXED);
+        }
+    }
+
+    for(index = 0; index < STATS_NUM_COUNTERS; index++)
+    {
+        snapshot->counters[index] = __atomic_load_n(&s_stats.counters[index], __ATOMIC_RELAXED);
+    }
+}
+
+void statsReset(void)
+{
+    uint32_t op = 0;
+    uint32_t index = 0;
+
+    for(op = 0; op < STATS_NUM_OPS; op++)
+    {
+        __atomic_store_n(&s_stats.ops[op].count, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&s_stats.ops[op].bytes, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&s_stats.ops[op].totalNs, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&s_stats.ops[op].maxNs, 0, __ATOMIC_RELAXED);
+        for(index = 0; index < STATS_BUCKETS; index++)
+        {
+            __atomic_store_n(&s_stats.ops[op].buckets[index], 0, __ATOMIC_RELAXED);
+        }
+    }
+
+    for(index = 0; index < STATS_NUM_COUNTERS; index++)
+    {
+        __atomic_store_n(&s_stats.counters[index], 0, __ATOMIC_RELAXED);
+    }
+}
+
+void statsWriteJSON(FILE *fp)
+{
+    t_statsSnapshot *snapshot = NULL;
+    uint32_t op = 0;
+    uint32_t index = 0;
+    uint8_t first = 0;
+
+    snapshot = (t_statsSnapshot*)malloc(sizeof(t_statsSnapshot));
+
+    if(snapshot == NULL)
+    {
+        fprintf(stderr, "The disk is empty.\n");
+    }
+    else
+    {
+        statsGet(snapshot);
+
+        fprintf(fp, "{\"counters\":{");
+        for(index = 0; index < STATS_NUM_COUNTERS; index++)
+        {
+            fprintf(fp, "%s\"%s\":%llu", (index > 0) ? "," : "", s_counterNames[index],
+                    (unsigned long long)snapshot->counters[index]);
+        }
+
+        fprintf(fp, "},\"ops\":{");
+        for(op = 0; op < STATS_NUM_OPS; op++)
+        {
+            fprintf(fp, "%s\"%s\":{\"count\":%llu,\"bytes\":%llu,\"totalNs\":%llu,\"maxNs\":%llu,\"histogramNs\":{",
+                    (op > 0) ? "," : "", s_opNames[op],
+                    (unsigned long long)snapshot->ops[op].count, (unsigned long long)snapshot->ops[op].bytes,
+                    (unsigned long long)snapshot->ops[op].totalNs, (unsigned long long)snapshot->ops[op].maxNs);
+
+            /* Keyed by the lower bound of the bucket */
+            first = 1;
+            for(index = 0; index < STATS_BUCKETS; index++)
+            {
+                if(snapshot->ops[op].buckets[index] != 0)
+                {
+                    fprintf(fp, "%s\"%llu\":%llu", (first == 1) ? "" : ",", 1ULL << index,
+                            (unsigned long long)snapshot->ops[op].buckets[index]);
+                    first = 0;
+                }
+            }
+            fprintf(fp, "}}");
+        }
+        fprintf(fp, "}}\n");
+
+        free(snapshot);
+    }
+}
+
+void statsWriteJSONString(FILE *fp, const char *text)
+{
+    const unsigned char *current = (const unsigned char*)text;
+
+    fputc('"', fp);
+    for(; *current != '\0'; current++)
+    {
+        /* Names on a damaged volume can hold any byte */
+        if((*current == '"') || (*current == '\\'))
+        {
+            fprintf(fp, "\\%c", *current);
+        }
+        else if((*current < 0x20) || (*current >= 0x7F))
+        {
+            fprintf(fp, "\\u%04x", *current);
+        }
+        else
+        {
+            fputc(*current, fp);
+        }
+    }
+    fputc('"', fp);
+}
@@ -0,0 +1,163 @@
+#ifndef _STATS_H_
+#define _STATS_H_
+
+/*******************************************************************************
+* Include
+*******************************************************************************/
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+/*******************************************************************************
+* Define
+*******************************************************************************/
+#define STATS_ENV               "FAT_STATS"  /* Set to a file name, or "-" for stderr, to dump the counters at exit */
+#define STATS_BUCKETS           40U      /* Latency buckets, bucket i counts [2^i, 2^(i+1)) ns */
+
+/* Timed operations */
+#define STATS_OP_READ           0U       /* HAL_ReadSector / HAL_ReadMultiSector */
+#define STATS_OP_READ_VECTOR    1U       /* HAL_ReadVector */
+#define STATS_OP_READ_BATCH     2U       /* HAL_ReadBatch, one per batch */
+#define STATS_OP_FAT_LOOKUP     3U       /* One next-cluster lookup in the FAT */
+#define STATS_OP_FAT_DECODE     4U       /* Decoding raw FAT bytes into next-cluster values */
+#define STATS_OP_DIR_LOAD       5U       /* loadDirEntry, from the cache or the disk */
+#define STATS_OP_DIR_READ       6U       /* readDirChain, always from the disk */
+#define STATS_OP_DIR_PARSE      7U       /* Parsing raw directory slots into entries */
+#define STATS_OP_FILE_READ      8U       /* loadFile / fatRead */
+#define STATS_OP_WRITE          9U       /* HAL_WriteMultiSector / HAL_WriteVector */
+#define STATS_OP_FLUSH          10U      /* fatFlush, writing every dirty metadata sector */
+#define STATS_OP_FILE_WRITE     11U      /* fatWrite / fatTruncate */
+#define STATS_NUM_OPS           12U
+
+/* Plain counters */
+#define STATS_SYSCALLS          0U       /* Read system calls made by the HAL */
+#define STATS_SEEKS             1U       /* Reads that did not start where the previous one ended */
+#define STATS_CACHE_HITS        2U       /* Blocks served by the HAL block cache */
+#define STATS_CACHE_MISSES      3U       /* Blocks the HAL block cache had to read */
+#define STATS_DIR_CACHE_HITS    4U       /* Directories served by the directory cache */
+#define STATS_DIR_CACHE_MISSES  5U       /* Directories the directory cache had to read */
+#define STATS_NUM_COUNTERS      6U
+
+/* Building with FAT_STATS_OFF removes every probe; otherwise a probe costs one load and
+   one branch while the counters are disabled */
+#if defined(FAT_STATS_OFF)
+#define STATS_ENABLED()                 0
+#define STATS_START()                   0ULL
+#define STATS_RECORD(op, start, bytes)  do { (void)(start); } while(0)
+#define STATS_COUNT(counter, amount)    do { } while(0)
+#else
+#define STATS_ENABLED()                 __builtin_expect(__atomic_load_n(&g_statsEnabled, __ATOMIC_RELAXED) != 0, 0)
+#define STATS_START()                   (STATS_ENABLED() ? statsClock() : 0ULL)
+#define STATS_RECORD(op, start, bytes)  do { if((start) != 0) { statsRecord((op), (start), (bytes)); } } while(0)
+#define STATS_COUNT(counter, amount)    do { if(STATS_ENABLED()) { statsCount((counter), (amount)); } } while(0)
+#endif
+
+typedef struct
+{
+    uint64_t    count;                   /* Number of operations */
+    uint64_t    bytes;                   /* Bytes moved by the operations */
+    uint64_t    totalNs;                 /* Time spent in the operations */
+    uint64_t    maxNs;                   /* Slowest operation */
+    uint64_t    buckets[STATS_BUCKETS];  /* Log2 latency histogram */
+} t_statsOp;
+
+typedef struct
+{
+    t_statsOp   ops[STATS_NUM_OPS];      /* Timed operations, indexed by STATS_OP_* */
+    uint64_t    counters[STATS_NUM_COUNTERS];  /* Plain counters, indexed by STATS_* */
+} t_statsSnapshot;
+
+/* Non-zero while the counters are collected; read by the probes, changed with statsEnable() */
+extern uint8_t g_statsEnabled;
+
+/*******************************************************************************
+* API
+*******************************************************************************/
+
+/**
+ * Name: statsEnable
+ * @brief Start or stop collecting counters. The counters keep their values.
+ *
+ * @param enable: 1 to collect, 0 to stop.
+ */
+void statsEnable(uint8_t enable);
+
+/**
+ * Name: statsInitFromEnv
+ * @brief Enable the counters and dump them at exit if STATS_ENV is set. Runs once per
+ *        process, HAL_Init() calls it.
+ */
+void statsInitFromEnv(void);
+
+/**
+ * Name: statsDumpAtExit
+ * @brief Enable the counters and write them as JSON when the process exits.
+ *
+ * @param path: The output file, "-" for stderr.
+ */
+void statsDumpAtExit(const char *path);
+
+/**
+ * Name: statsClock
+ * @brief Read the monotonic clock used by the probes.
+ *
+ * @return The time in ns, never 0.
+ */
+uint64_t statsClock(void);
+
+/**
+ * Name: statsRecord
+ * @brief Account one timed operation, use STATS_RECORD().
+ *
+ * @param op: One of STATS_OP_*.
+ * @param start: The statsClock() value when the operation started.
+ * @param bytes: The bytes moved by the operation.
+ */
+void statsRecord(uint8_t op, uint64_t start, uint64_t bytes);
+
+/**
+ * Name: statsCount
+ * @brief Add to a plain counter, use STATS_COUNT().
+ *
+ * @param counter: One of STATS_*.
+ * @param amount: The amount to add.
+ */
+void statsCount(uint8_t counter, uint64_t amount);
+
+/**
+ * Name: statsGet
+ * @brief Copy the current counters.
+ *
+ * @param snapshot: Receives the counters.
+ */
+void statsGet(t_statsSnapshot *snapshot);
+
+/**
+ * Name: statsReset
+ * @brief Set every counter back to zero.
+ */
+void statsReset(void);
+
+/**
+ * Name: statsWriteJSON
+ * @brief Write the current counters as one JSON object. Empty histogram buckets are left out.
+ *
+ * @param fp: The output stream.
+ */
+void statsWriteJSON(FILE *fp);
+
+/**
+ * Name: statsWriteJSONString
+ * @brief Write a string as a quoted JSON string. Quotes and backslashes are escaped, control
+ *        and non-ASCII bytes are written as \u escapes.
+ *
+ * @param fp: The output stream.
+ * @param text: The string.
+ */
+void statsWriteJSONString(FILE *fp, const char *text);
+
+#endif /* _STATS_H_ */
+
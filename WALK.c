@@ -0,0 +1,502 @@
+#include "WALK.h"
+
+/*******************************************************************************
+* Prototypes
+*******************************************************************************/
+
+/**
+ * Name: initDeque
+ * @brief Allocate the task ring of a deque.
+ *
+ * @param deque The deque.
+ *
+ * @return 1 if the deque is ready, 0 if memory ran out.
+ */
+static uint8_t initDeque(t_walkDeque *deque);
+
+/**
+ * Name: pushTask
+ * @brief Add a task at the tail of a deque, growing the ring if it is full.
+ *
+ * @param deque The deque.
+ * @param task The task to add.
+ *
+ * @return 1 if the task was added, 0 if memory ran out.
+ */
+static uint8_t pushTask(t_walkDeque *deque, const t_walkTask *task);
+
+/**
+ * Name: popTask
+ * @brief Take the newest task of a deque, used by its owner.
+ *
+ * @param deque The deque.
+ * @param task Receives the task.
+ *
+ * @return 1 if a task was taken, 0 if the deque is empty.
+ */
+static uint8_t popTask(t_walkDeque *deque, t_walkTask *task);
+
+/**
+ * Name: stealTask
+ * @brief Take the oldest task of a deque, used by the other workers.
+ *        The oldest directories are the closest to the root and carry the most work.
+ *
+ * @param deque The deque.
+ * @param task Receives the task.
+ *
+ * @return 1 if a task was taken, 0 if the deque is empty.
+ */
+static uint8_t stealTask(t_walkDeque *deque, t_walkTask *task);
+
+/**
+ * Name: findTask
+ * @brief Get the next task of a worker: its own newest task, or the oldest task of another worker.
+ *
+ * @param worker The worker.
+ * @param task Receives the task.
+ *
+ * @return 1 if a task was found, 0 if every deque is empty.
+ */
+static uint8_t findTask(t_walkWorker *worker, t_walkTask *task);
+
+/**
+ * Name: wakeWorkers
+ * @brief Wake the idle workers because work was queued or the walk ended.
+ *
+ * @param pool The pool.
+ */
+static void wakeWorkers(t_walkPool *pool);
+
+/**
+ * Name: queueDirectory
+ * @brief Queue a directory on the deque of a worker. On failure the walk is stopped.
+ *
+ * @param worker The worker.
+ * @param cluster The start cluster of the directory.
+ * @param path The full path of the directory.
+ */
+static void queueDirectory(t_walkWorker *worker, uint32_t cluster, const char *path);
+
+/**
+ * Name: visitDirectory
+ * @brief Read a directory, report its entries and queue its subdirectories.
+ *
+ * @param worker The worker.
+ * @param list The directory list of the worker, reused for every directory.
+ * @param task The directory to visit.
+ */
+static void visitDirectory(t_walkWorker *worker, t_dirList *list, const t_walkTask *task);
+
+/**
+ * Name: workerMain
+ * @brief Run tasks until every directory of the volume has been visited.
+ *
+ * @param arg The worker.
+ *
+ * @return NULL.
+ */
+static void *workerMain(void *arg);
+
+/**
+ * Name: walkVolume
+ * @brief Visit every file and directory of a volume, starting from the root directory
+ *        (cluster 0 for FAT12/16, rootClus for FAT32). Subdirectories are read by a pool
+ *        of worker threads; each worker works depth first on its own deque and steals
+ *        the oldest directory of another worker when it runs out. The "." and ".."
+ *        entries are not reported. The volume must not be written during the walk.
+ *
+ * @param vol: The volume.
+ * @param numThreads: The number of workers, WALK_THREADS_AUTO for one per CPU.
+ * @param callback: Called for every entry with its full path.
+ * @param context: Given to the callback.
+ *
+ * @return 1 if the whole volume was visited, 0 if the walk was stopped, a directory could not be
+ *         read or memory ran out. The entries of the readable directories are still reported.
+ */
+uint8_t walkVolume(t_volume *vol, uint32_t numThreads, t_walkCallback callback, void *context);
+
+/**
+ * Name: walkTree
+ * @brief Visit every file and directory below a directory, like walkVolume.
+ *
+ * @param vol: The volume.
+ * @param startCluster: The start cluster of the directory, 0 for the root directory.
+ * @param basePath: The path the reported paths start with, "" for paths relative to the directory.
+ * @param numThreads: The number of workers, WALK_THREADS_AUTO for one per CPU.
+ * @param callback: Called for every entry with its path.
+ * @param context: Given to the callback.
+ *
+ * @return 1 if the whole tree was visited, 0 if the walk was stopped, a directory could not be
+ *         read or memory ran out.
+ */
+uint8_t walkTree(t_volume *vol, uint32_t startCluster, const char *basePath, uint32_t numThreads,
+                 t_walkCallback callback, void *context);
+
+/*******************************************************************************
+* Code
+*******************************************************************************/
+static uint8_t initDeque(t_walkDeque *deque)
+{
+    uint8_t result = 0;
+
+    deque->tasks = (t_walkTask*)malloc(WALK_DEQUE_INIT_SIZE * sizeof(t_walkTask));
+    deque->head = 0;
+    deque->tail = 0;
+    pthread_mutex_init(&deque->lock, NULL);
+
+    if(deque->tasks == NULL)
+    {
+        fprintf(stderr, "The disk is empty.\n");
+    }
+    else
+    {
+        deque->capacity = WALK_DEQUE_INIT_SIZE;
+        result = 1;
+    }
+
+    return result;
+}
+
+static uint8_t pushTask(t_walkDeque *deque, const t_walkTask *task)
+{
+    t_walkTask *grown = NULL;
+    uint32_t count = 0;
+    uint32_t index = 0;
+    uint8_t result = 1;
+
+    pthread_mutex_lock(&deque->lock);
+
+    count = deque->tail - deque->head;
+    if(count == deque->capacity)
+    {
+        /* Unroll the ring into an array twice as large */
+        grown = (t_walkTask*)malloc(deque->capacity * 2 * sizeof(t_walkTask));
+        if(grown == NULL)
+        {
+            fprintf(stderr, "The disk is empty.\n");
+            result = 0;
+        }
+        else
+        {
+            for(index = 0; index < count; index++)
+            {
+                grown[index] = deque->tasks[(deque->head + index) & (deque->capacity - 1)];
+            }
+
+            free(deque->tasks);
+            deque->tasks = grown;
+            deque->capacity *= 2;
+            deque->head = 0;
+            deque->tail = count;
+        }
+    }
+
+    if(result == 1)
+    {
+        deque->tasks[deque->tail & (deque->capacity - 1)] = *task;
+        deque->tail++;
+    }
+
+    pthread_mutex_unlock(&deque->lock);
+
+    return result;
+}
+
+static uint8_t popTask(t_walkDeque *deque, t_walkTask *task)
+{
+    uint8_t result = 0;
+
+    pthread_mutex_lock(&deque->lock);
+    if(deque->tail != deque->head)
+    {
+        deque->tail--;
+        *task = deque->tasks[deque->tail & (deque->capacity - 1)];
+        result = 1;
+    }
+    pthread_mutex_unlock(&deque->lock);
+
+    return result;
+}
+
+static uint8_t stealTask(t_walkDeque *deque, t_walkTask *task)
+{
+    uint8_t result = 0;
+
+    pthread_mutex_lock(&deque->lock);
+    if(deque->tail != deque->head)
+    {
+        *task = deque->tasks[deque->head & (deque->capacity - 1)];
+        deque->head++;
+        result = 1;
+    }
+    pthread_mutex_unlock(&deque->lock);
+
+    return result;
+}
+
+static uint8_t findTask(t_walkWorker *worker, t_walkTask *task)
+{
+    t_walkPool *pool = NULL;
+    uint32_t index = 0;
+    uint8_t found = 0;
+
+    pool = worker->pool;
+    found = popTask(&pool->deques[worker->id], task);
+
+    /* Try the other workers, starting with the next one so thieves spread out */
+    for(index = 1; (index < pool->numThreads) && (found == 0); index++)
+    {
+        found = stealTask(&pool->deques[(worker->id + index) % pool->numThreads], task);
+    }
+
+    return found;
+}
+
+static void wakeWorkers(t_walkPool *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->generation++;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void queueDirectory(t_walkWorker *worker, uint32_t cluster, const char *path)
+{
+    t_walkPool *pool = NULL;
+    t_walkTask task = {0};
+
+    pool = worker->pool;
+    task.cluster = cluster;
+    task.path = strdup(path);
+
+    /* Count the task before it can be taken, so the walk cannot end early */
+    __atomic_add_fetch(&pool->pending, 1, __ATOMIC_SEQ_CST);
+
+    if((task.path == NULL) || (pushTask(&pool->deques[worker->id], &task) == 0))
+    {
+        fprintf(stderr, "The disk is empty.\n");
+        free(task.path);
+        __atomic_sub_fetch(&pool->pending, 1, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&pool->stop, 1, __ATOMIC_SEQ_CST);
+    }
+    else if(__atomic_load_n(&pool->idle, __ATOMIC_SEQ_CST) > 0)
+    {
+        wakeWorkers(pool);
+    }
+}
+
+static void visitDirectory(t_walkWorker *worker, t_dirList *list, const t_walkTask *task)
+{
+    t_walkPool *pool = NULL;
+    const t_direcroryEntry *entry = NULL;
+    char path[WALK_PATH_MAX];
+    char name[NAME_MAX_LENGTH];
+    uint32_t index = 0;
+    int length = 0;
+    uint8_t action = 0;
+
+    pool = worker->pool;
+    if(readDirChain(pool->vol, list, task->cluster) == 0)
+    {
+        /* The entries read are still visited, but the walk is not complete */
+        __atomic_store_n(&pool->failed, 1, __ATOMIC_RELAXED);
+    }
+
+    for(index = 0; (index < list->count) && (__atomic_load_n(&pool->stop, __ATOMIC_RELAXED) == 0); index++)
+    {
+        entry = &list->entries[index];
+        fatFormatName(entry, name);
+        length = snprintf(path, sizeof(path), "%s%c%s", task->path, PATH_SEPARATOR, name);
+
+        /* "." and ".." point back up the tree; a path too long for the buffer
+           is most likely a directory that contains itself */
+        if((strcmp(name, ".") != 0) && (strcmp(name, "..") != 0) &&
+           (length > 0) && (length < (int)sizeof(path)))
+        {
+            action = pool->callback(path, entry, pool->context);
+            if(action == 0)
+            {
+                __atomic_store_n(&pool->stop, 1, __ATOMIC_SEQ_CST);
+            }
+            else if((action != WALK_SKIP) && ((entry->attributes & ATTR_DIRECTORY) != 0) && (entry->startCluster >= FIRST_CLUSTER))
+            {
+                queueDirectory(worker, entry->startCluster, path);
+            }
+        }
+    }
+}
+
+static void *workerMain(void *arg)
+{
+    t_walkWorker *worker = NULL;
+    t_walkPool *pool = NULL;
+    t_dirList list = {NULL, 0, 0};
+    t_walkTask task = {0};
+    uint64_t seen = 0;
+    uint8_t found = 0;
+    uint8_t running = 1;
+
+    worker = (t_walkWorker*)arg;
+    pool = worker->pool;
+
+    while(running == 1)
+    {
+        found = findTask(worker, &task);
+
+        if(found == 0)
+        {
+            /* Announce the worker as idle, then look once more: work queued
+               before that was not able to wake it */
+            pthread_mutex_lock(&pool->lock);
+            __atomic_add_fetch(&pool->idle, 1, __ATOMIC_SEQ_CST);
+            seen = pool->generation;
+            pthread_mutex_unlock(&pool->lock);
+
+            found = findTask(worker, &task);
+
+            pthread_mutex_lock(&pool->lock);
+            while((found == 0) && (seen == pool->generation) &&
+                  (__atomic_load_n(&pool->pending, __ATOMIC_SEQ_CST) > 0))
+            {
+                pthread_cond_wait(&pool->wake, &pool->lock);
+            }
+            __atomic_sub_fetch(&pool->idle, 1, __ATOMIC_SEQ_CST);
+            pthread_mutex_unlock(&pool->lock);
+
+            if((found == 0) && (__atomic_load_n(&pool->pending, __ATOMIC_SEQ_CST) == 0))
+            {
+                running = 0;
+            }
+        }
+
+        if(found == 1)
+        {
+            /* Once stopped, queued directories are only drained */
+            if(__atomic_load_n(&pool->stop, __ATOMIC_RELAXED) == 0)
+            {
+                visitDirectory(worker, &list, &task);
+            }
+            free(task.path);
+
+            /* The last directory ends the walk */
+            if(__atomic_sub_fetch(&pool->pending, 1, __ATOMIC_SEQ_CST) == 0)
+            {
+                wakeWorkers(pool);
+            }
+        }
+    }
+
+    freeDirList(&list);
+
+    return NULL;
+}
+
+uint8_t walkVolume(t_volume *vol, uint32_t numThreads, t_walkCallback callback, void *context)
+{
+    /* Cluster 0 is read as rootClus on FAT32 */
+    return walkTree(vol, 0, "", numThreads, callback, context);
+}
+
+uint8_t walkTree(t_volume *vol, uint32_t startCluster, const char *basePath, uint32_t numThreads,
+                 t_walkCallback callback, void *context)
+{
+    t_walkPool pool;
+    t_walkWorker *workers = NULL;
+    pthread_t *threads = NULL;
+    uint8_t *started = NULL;
+    t_walkTask first = {0};
+    uint32_t index = 0;
+    uint32_t numReady = 0;
+    long online = 0;
+    uint8_t result = 0;
+
+    if(numThreads == WALK_THREADS_AUTO)
+    {
+        online = sysconf(_SC_NPROCESSORS_ONLN);
+        numThreads = (online > 0) ? (uint32_t)online : 1;
+    }
+    if(numThreads > WALK_THREADS_MAX)
+    {
+        numThreads = WALK_THREADS_MAX;
+    }
+
+    memset(&pool, 0, sizeof(pool));
+    pool.vol = vol;
+    pool.callback = callback;
+    pool.context = context;
+    pool.numThreads = numThreads;
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.wake, NULL);
+
+    pool.deques = (t_walkDeque*)calloc(numThreads, sizeof(t_walkDeque));
+    workers = (t_walkWorker*)calloc(numThreads, sizeof(t_walkWorker));
+    threads = (pthread_t*)calloc(numThreads, sizeof(pthread_t));
+    started = (uint8_t*)calloc(numThreads, sizeof(uint8_t));
+    first.cluster = startCluster;
+    first.path = strdup(basePath);
+
+    if((pool.deques == NULL) || (workers == NULL) || (threads == NULL) || (started == NULL) || (first.path == NULL))
+    {
+        fprintf(stderr, "The disk is empty.\n");
+        free(first.path);
+    }
+    else
+    {
+        result = 1;
+        for(index = 0; index < numThreads; index++)
+        {
+            workers[index].pool = &pool;
+            workers[index].id = index;
+            if(initDeque(&pool.deques[index]) == 0)
+            {
+                result = 0;
+            }
+            numReady++;
+        }
+
+        /* The start directory is the first task */
+        if((result == 1) && (pushTask(&pool.deques[0], &first) == 1))
+        {
+            pool.pending = 1;
+
+            /* The calling thread is worker 0; a worker that cannot be started leaves its
+               deque empty and the others do its share */
+            for(index = 1; index < numThreads; index++)
+            {
+                started[index] = (pthread_create(&threads[index], NULL, workerMain, &workers[index]) == 0);
+            }
+
+            workerMain(&workers[0]);
+
+            for(index = 1; index < numThreads; index++)
+            {
+                if(started[index] == 1)
+                {
+                    pthread_join(threads[index], NULL);
+                }
+            }
+
+            result = ((pool.stop == 0) && (pool.failed == 0)) ? 1 : 0;
+        }
+        else
+        {
+            free(first.path);
+            result = 0;
+        }
+    }
+
+    for(index = 0; index < numReady; index++)
+    {
+        free(pool.deques[index].tasks);
+        pthread_mutex_destroy(&pool.deques[index].lock);
+    }
+
+    pthread_mutex_destroy(&pool.lock);
+    pthread_cond_destroy(&pool.wake);
+    free(pool.deques);
+    free(workers);
+    free(threads);
+    free(started);
+
+    return result;
+}
@@ -0,0 +1,108 @@
+#ifndef _WALK_H_
+#define _WALK_H_
+
+/*******************************************************************************
+* Include
+*******************************************************************************/
+#include "FAT.h"
+
+/*******************************************************************************
+* Define
+*******************************************************************************/
+#define WALK_THREADS_AUTO       0U       /* One worker per online CPU */
+#define WALK_THREADS_MAX        256U     /* Largest number of workers */
+#define WALK_PATH_MAX           4096U    /* Longest path given to the callback, deeper entries are skipped */
+#define WALK_DEQUE_INIT_SIZE    64U      /* Initial capacity of the task deque of a worker */
+#define WALK_SKIP               2U       /* Callback result: continue, but do not read this directory */
+
+/**
+ * Callback called for every entry of the volume, from the worker threads.
+ * Several calls can run at the same time, the callback must protect what it shares.
+ *
+ * @param path The full path of the entry, e.g. "/DIR1/FILE.TXT".
+ * @param entry The directory entry.
+ * @param context The context given to walkVolume or walkTree.
+ *
+ * @return 1 to continue the walk, WALK_SKIP to continue without visiting the entries of
+ *         a directory entry, 0 to stop the walk.
+ */
+typedef uint8_t (*t_walkCallback)(const char *path, const t_direcroryEntry *entry, void *context);
+
+typedef struct
+{
+    uint32_t    cluster;                 /* Start cluster of the directory to read */
+    char        *path;                   /* Full path of the directory, the base path for the start directory */
+} t_walkTask;
+
+typedef struct
+{
+    t_walkTask  *tasks;                  /* Ring of tasks, the owner works at the tail, thieves take the head */
+    uint32_t    head;                    /* Oldest task */
+    uint32_t    tail;                    /* One past the newest task */
+    uint32_t    capacity;                /* Number of tasks the ring can hold, a power of two */
+    pthread_mutex_t lock;                /* Protects the ring */
+} t_walkDeque;
+
+typedef struct
+{
+    t_volume        *vol;                /* The volume being walked */
+    t_walkCallback  callback;            /* Called for every entry */
+    void            *context;            /* Given to the callback */
+    t_walkDeque     *deques;             /* One deque per worker */
+    uint32_t        numThreads;          /* Number of workers */
+    uint64_t        pending;             /* Directories queued or being read */
+    uint32_t        idle;                /* Workers waiting for work */
+    uint8_t         stop;                /* Set when the callback or an allocation stops the walk */
+    uint8_t         failed;              /* Set when a directory could not be read, the walk goes on */
+    uint64_t        generation;          /* Bumped when new work is queued or the walk ends */
+    pthread_mutex_t lock;                /* Protects generation for the sleeping workers */
+    pthread_cond_t  wake;                /* Signalled when generation changes */
+} t_walkPool;
+
+typedef struct
+{
+    t_walkPool  *pool;                   /* The pool the worker belongs to */
+    uint32_t    id;                      /* Index of the worker and of its deque */
+} t_walkWorker;
+
+/*******************************************************************************
+* API
+*******************************************************************************/
+
+/**
+ * Name: walkVolume
+ * @brief Visit every file and directory of a volume, starting from the root directory
+ *        (cluster 0 for FAT12/16, rootClus for FAT32). Subdirectories are read by a pool
+ *        of worker threads; each worker works depth first on its own deque and steals
+ *        the oldest directory of another worker when it runs out. The "." and ".."
+ *        entries are not reported. The volume must not be written during the walk.
+ *
+ * @param vol: The volume.
+ * @param numThreads: The number of workers, WALK_THREADS_AUTO for one per CPU.
+ * @param callback: Called for every entry with its full path.
+ * @param context: Given to the callback.
+ *
+ * @return 1 if the whole volume was visited, 0 if the walk was stopped, a directory could not be
+ *         read or memory ran out. The entries of the readable directories are still reported.
+ */
+uint8_t walkVolume(t_volume *vol, uint32_t numThreads, t_walkCallback callback, void *context);
+
+/**
+ * Name: walkTree
+ * @brief Visit every file and directory below a directory, like walkVolume.
+ *
+ * @param vol: The volume.
+ * @param startCluster: The start cluster of the directory, 0 for the root directory.
+ * @param basePath: The path the reported paths start with, "" for paths relative to the directory.
+ * @param numThreads: The number of workers, WALK_THREADS_AUTO for one per CPU.
+ * @param callback: Called for every entry with its path.
+ * @param context: Given to the callback.
+ *
+ * @return 1 if the whole tree was visited, 0 if the walk was stopped, a directory could not be
+ *         read or memory ran out.
+ */
+uint8_t walkTree(t_volume *vol, uint32_t startCluster, const char *basePath, uint32_t numThreads,
+                 t_walkCallback callback, void *context);
+
+#endif /* _WALK_H_ */
+
@@ -0,0 +1,1506 @@
+/*******************************************************************************
+* Include
+*******************************************************************************/
+#include "WRITE.h"
+
+/*******************************************************************************
+* Variables
+*******************************************************************************/
+
+/* Source of the zeros written when a file grows */
+static const uint8_t s_zeros[WRITE_ZERO_CHUNK];
+
+/*******************************************************************************
+* Prototypes
+*******************************************************************************/
+
+/**
+ * Name: initAllocator
+ * @brief Build the free cluster bitmap of the volume on the first allocation. A FAT that is not
+ *        resident is scanned on the disk, so the pending FAT sectors are flushed first.
+ *
+ * @param vol The volume.
+ *
+ * @return 1 if the bitmap is ready, 0 if the scan failed.
+ */
+static uint8_t initAllocator(t_volume *vol);
+
+/**
+ * Name: findFreeCluster
+ * @brief Find the first free cluster of a range, 64 clusters per step.
+ *
+ * @param cache The write cache holding the bitmap.
+ * @param from The first cluster of the range.
+ * @param limit One past the last cluster of the range.
+ *
+ * @return The free cluster, limit if there is none.
+ */
+static uint32_t findFreeCluster(const t_writeCache *cache, uint32_t from, uint32_t limit);
+
+/**
+ * Name: findUsedCluster
+ * @brief Find the first used cluster of a range, 64 clusters per step.
+ *
+ * @param cache The write cache holding the bitmap.
+ * @param from The first cluster of the range.
+ * @param limit One past the last cluster of the range.
+ *
+ * @return The used cluster, limit if there is none.
+ */
+static uint32_t findUsedCluster(const t_writeCache *cache, uint32_t from, uint32_t limit);
+
+/**
+ * Name: findFreeRun
+ * @brief Find the first free run of at least count clusters, looking from nextFree to the end
+ *        of the volume and then from the start. Without one, the longest run is returned.
+ *
+ * @param cache The write cache holding the bitmap.
+ * @param count The clusters wanted.
+ * @param length Receives the clusters of the run to use, at most count, 0 if nothing is free.
+ *
+ * @return The first cluster of the run.
+ */
+static uint32_t findFreeRun(const t_writeCache *cache, uint32_t count, uint32_t *length);
+
+/**
+ * Name: isDataCluster
+ * @brief Check that a cluster number is a cluster of the data region.
+ *
+ * @param vol The volume.
+ * @param cluster The cluster.
+ *
+ * @return 1 if the cluster is in the data region, 0 for free, bad, end of chain or out of range values.
+ */
+static uint8_t isDataCluster(t_volume *vol, uint32_t cluster);
+
+/**
+ * Name: extentsInData
+ * @brief Check that every cluster of an extent list is in the data region. The list only stops
+ *        at the end of the FAT, so a damaged link can point past the last data cluster.
+ *
+ * @param vol The volume.
+ * @param extents The extents.
+ * @param numExtents The number of extents.
+ *
+ * @return 1 if every extent is in the data region, 0 otherwise.
+ */
+static uint8_t extentsInData(t_volume *vol, const t_extent *extents, uint32_t numExtents);
+
+/**
+ * Name: isValidName
+ * @brief Check that a name can be stored as an 8.3 name without changing its meaning.
+ *
+ * @param name The name, not terminated.
+ * @param length The number of characters of the name.
+ *
+ * @return 1 if the name is valid, 0 otherwise.
+ */
+static uint8_t isValidName(const char *name, uint32_t length);
+
+/**
+ * Name: scanDirectory
+ * @brief Look for a name and for the first free slot in the raw slots of a directory.
+ *
+ * @param vol The volume.
+ * @param dirCluster The start cluster of the directory, 0 for the FAT12/16 root.
+ * @param packed The packed 8.3 name.
+ * @param scan Receives what was found.
+ *
+ * @return 1 if the directory was read, 0 if a read failed or memory ran out.
+ */
+static uint8_t scanDirectory(t_volume *vol, uint32_t dirCluster, const uint8_t *packed, t_dirScan *scan);
+
+/**
+ * Name: matchSlot
+ * @brief Slot callback of scanDirectory: record the first free slot and the long name slots
+ *        in front of each entry, and stop at the entry with the name looked for.
+ *
+ * @param slot The raw slot.
+ * @param position The position of the slot.
+ * @param context The t_dirScanContext of the scan.
+ *
+ * @return 0 at the entry or the end of the directory, 1 otherwise.
+ */
+static uint8_t matchSlot(const uint8_t *slot, const t_slotPosition *position, void *context);
+
+/**
+ * Name: findChildSlot
+ * @brief Slot callback of fatDelete: look for an entry other than "." and ".." in a directory.
+ *        Every slot is looked at, never used ones included, so entries left behind a stray
+ *        unused slot still count.
+ *
+ * @param slot The raw slot.
+ * @param position The position of the slot.
+ * @param context The uint8_t set to 1 when an entry is found.
+ *
+ * @return 0 at the first entry, 1 otherwise.
+ */
+static uint8_t findChildSlot(const uint8_t *slot, const t_slotPosition *position, void *context);
+
+/**
+ * Name: locateEntry
+ * @brief Resolve the directory of a path and scan it for the last component.
+ *
+ * @param vol The volume.
+ * @param path The path.
+ * @param packed Receives the packed name of the last component.
+ * @param scan Receives what was found.
+ *
+ * @return 1 if the directory exists and was scanned, 0 otherwise.
+ */
+static uint8_t locateEntry(t_volume *vol, const char *path, uint8_t *packed, t_dirScan *scan);
+
+/**
+ * Name: stampEntry
+ * @brief Set the write time and date of an entry to now.
+ *
+ * @param entry The entry.
+ */
+static void stampEntry(t_direcroryEntry *entry);
+
+/**
+ * Name: storeSlot
+ * @brief Write an entry into its slot in the write cache.
+ *
+ * @param vol The volume.
+ * @param slot The position of the slot.
+ * @param entry The entry.
+ * @param clear 1 to zero the slot first, for a new entry.
+ *
+ * @return 1 if the slot was written, 0 otherwise.
+ */
+static uint8_t storeSlot(t_volume *vol, const t_slotPosition *slot, const t_direcroryEntry *entry, uint8_t clear);
+
+/**
+ * Name: zeroCluster
+ * @brief Fill a cluster that becomes part of a directory with zeros, in the write cache.
+ *
+ * @param vol The volume.
+ * @param cluster The cluster.
+ *
+ * @return 1 if every sector was cleared, 0 otherwise.
+ */
+static uint8_t zeroCluster(t_volume *vol, uint32_t cluster);
+
+/**
+ * Name: writeByteRange
+ * @brief Write bytes starting at a byte offset from a sector. Whole sectors are written straight
+ *        from the caller buffer, partial first and last sectors are read, patched and written back.
+ *
+ * @param vol The volume.
+ * @param sector The first sector of the run.
+ * @param byteOffset The byte offset of the write from that sector.
+ * @param size The number of bytes.
+ * @param buff The bytes, NULL to write zeros.
+ * @param bounce A buffer of one sector.
+ *
+ * @return 1 if every byte was written, 0 otherwise.
+ */
+static uint8_t writeByteRange(t_volume *vol, uint32_t sector, uint32_t byteOffset, uint32_t size,
+                              const uint8_t *buff, uint8_t *bounce);
+
+/**
+ * Name: writeExtents
+ * @brief Write a byte range of a file into the extents of its chain.
+ *
+ * @param vol The volume.
+ * @param extents The extents of the chain.
+ * @param numExtents The number of extents.
+ * @param offset The byte offset in the file.
+ * @param buff The bytes, NULL to write zeros.
+ * @param size The number of bytes.
+ * @param bounce A buffer of one sector.
+ *
+ * @return 1 if every byte was written, 0 if a write failed or the chain is too short.
+ */
+static uint8_t writeExtents(t_volume *vol, const t_extent *extents, uint32_t numExtents, uint32_t offset,
+                            const uint8_t *buff, uint32_t size, uint8_t *bounce);
+
+/**
+ * Name: writeFileRange
+ * @brief Write bytes into a file found by a scan, growing its chain first and filling the
+ *        bytes between its old size and the offset with zeros, then update its slot.
+ *
+ * @param vol The volume.
+ * @param scan The scan that found the file, its entry is updated.
+ * @param offset The byte offset in the file.
+ * @param buff The bytes, NULL to write zeros.
+ * @param size The number of bytes.
+ *
+ * @return 1 if the file was written, 0 otherwise; clusters allocated for it are given back.
+ */
+static uint8_t writeFileRange(t_volume *vol, t_dirScan *scan, uint32_t offset, const uint8_t *buff, uint32_t size);
+
+/**
+ * Name: fatCreate
+ * @brief Create an empty file, or a directory holding "." and "..", in an existing directory.
+ *        The first free slot of the directory is used; a full directory grows by one cluster,
+ *        except the fixed root directory of FAT12/16. Like every write, the change stays in the
+ *        write cache of the volume until fatFlush(). Writes must not run while other threads
+ *        use the volume.
+ *
+ * @param vol: The volume, mounted writable.
+ * @param path: The path of the new entry, its name an 8.3 name.
+ * @param attributes: The attributes of the entry, a directory when ATTR_DIRECTORY is set; the
+ *                    volume bit is refused.
+ *
+ * @return 1 if the entry was created, 0 if it exists, the path or the name is invalid, or the volume is full.
+ */
+uint8_t fatCreate(t_volume *vol, const char *path, uint8_t attributes);
+
+/**
+ * Name: fatWrite
+ * @brief Write bytes into a file at an offset, growing the file if they end past its size.
+ *        The clusters a file needs are allocated in as few runs as possible, starting right
+ *        after its last cluster when that one is free. File data is written through to the
+ *        disk at once; the FAT entries and the directory slot go to the write cache. Bytes
+ *        between the old size and the offset read as zeros.
+ *
+ * @param vol: The volume, mounted writable.
+ * @param path: The path of the file.
+ * @param offset: The byte offset to write at.
+ * @param buff: The bytes.
+ * @param size: The number of bytes.
+ *
+ * @return The number of bytes written: size, or 0 if the file does not exist, is a directory,
+ *         or the volume is full.
+ */
+uint32_t fatWrite(t_volume *vol, const char *path, uint32_t offset, const uint8_t *buff, uint32_t size);
+
+/**
+ * Name: fatTruncate
+ * @brief Set the size of a file. Clusters past the new size are freed; a larger size is
+ *        filled with zeros.
+ *
+ * @param vol: The volume, mounted writable.
+ * @param path: The path of the file.
+ * @param size: The new size in bytes.
+ *
+ * @return 1 if the size was set, 0 if the file does not exist, is a directory, or the volume is full.
+ */
+uint8_t fatTruncate(t_volume *vol, const char *path, uint32_t size);
+
+/**
+ * Name: fatDelete
+ * @brief Delete a file or an empty directory: its chain is freed and its slot, with the
+ *        long name slots in front of it, is marked deleted.
+ *
+ * @param vol: The volume, mounted writable.
+ * @param path: The path of the entry.
+ *
+ * @return 1 if the entry was deleted, 0 if it does not exist or is a directory that is not empty.
+ */
+uint8_t fatDelete(t_volume *vol, const char *path);
+
+/**
+ * Name: scanSlots
+ * @brief Call a function for every raw slot of a directory, deleted, long name and unused
+ *        slots included, in order. The slots are read through the write cache, so pending
+ *        changes are seen.
+ *
+ * @param vol: The volume.
+ * @param dirCluster: The start cluster of the directory, 0 for the FAT12/16 root.
+ * @param callback: Called for every slot, returns 0 to stop.
+ * @param context: Given to the callback.
+ * @param lastCluster: Receives the last cluster of the directory chain, 0 for the FAT12/16 root, may be NULL.
+ *
+ * @return 1 if the directory was read, 0 if a read failed or memory ran out.
+ */
+uint8_t scanSlots(t_volume *vol, uint32_t dirCluster, t_slotCallback callback, void *context, uint32_t *lastCluster);
+
+/**
+ * Name: allocateChain
+ * @brief Allocate clusters and link them after a cluster. A free run long enough for all of
+ *        them is preferred, starting right after prevCluster when that one is free, then from
+ *        where the last allocation stopped; without such a run the longest runs are used.
+ *        The free cluster bitmap is built from scanFreeSpace() on the first allocation and kept
+ *        up to date by setFATEntry().
+ *
+ * @param vol: The volume, mounted writable.
+ * @param prevCluster: The last cluster of the chain to extend, 0 to start a new chain.
+ * @param count: The number of clusters, 1 or more.
+ *
+ * @return The first cluster allocated, 0 if the volume does not have count free clusters.
+ */
+uint32_t allocateChain(t_volume *vol, uint32_t prevCluster, uint32_t count);
+
+/**
+ * Name: allocateRun
+ * @brief Allocate a new chain of clusters that are all contiguous, from the first free run
+ *        long enough, looking from where the last allocation stopped.
+ *
+ * @param vol: The volume, mounted writable.
+ * @param count: The number of clusters, 1 or more.
+ *
+ * @return The first cluster of the chain, 0 if no free run holds count clusters.
+ */
+uint32_t allocateRun(t_volume *vol, uint32_t count);
+
+/**
+ * Name: freeChain
+ * @brief Free every cluster of a chain. The walk stops at the first cluster that is already
+ *        free, so a chain that loops is freed once.
+ *
+ * @param vol: The volume, mounted writable.
+ * @param startCluster: The first cluster of the chain.
+ *
+ * @return The number of clusters freed.
+ */
+uint32_t freeChain(t_volume *vol, uint32_t startCluster);
+
+/**
+ * Name: endOfChain
+ * @brief Get the end of chain value written to the FAT of a volume.
+ *
+ * @param vol: The volume.
+ *
+ * @return END_CRUSTER_12, END_CRUSTER_16 or END_CRUSTER_32.
+ */
+uint32_t endOfChain(t_volume *vol);
+
+/*******************************************************************************
+* Code
+*******************************************************************************/
+
+uint32_t endOfChain(t_volume *vol)
+{
+    uint32_t value = 0;
+
+    switch(fatType(vol))
+    {
+    case FAT_12:
+        value = END_CRUSTER_12;
+        break;
+    case FAT_16:
+        value = END_CRUSTER_16;
+        break;
+    case FAT_32:
+        value = END_CRUSTER_32;
+        break;
+    default:
+        break;
+    }
+
+    return value;
+}
+
+static uint8_t isDataCluster(t_volume *vol, uint32_t cluster)
+{
+    return ((cluster >= FIRST_CLUSTER) && (cluster - FIRST_CLUSTER < countDataClusters(vol))) ? 1 : 0;
+}
+
+static uint8_t extentsInData(t_volume *vol, const t_extent *extents, uint32_t numExtents)
+{
+    uint32_t index = 0;
+    uint8_t result = 1;
+
+    for(index = 0; (index < numExtents) && (result == 1); index++)
+    {
+        result = ((isDataCluster(vol, extents[index].firstCluster) == 1) &&
+                  (isDataCluster(vol, extents[index].firstCluster + extents[index].length - 1) == 1)) ? 1 : 0;
+    }
+
+    return result;
+}
+
+static uint8_t initAllocator(t_volume *vol)
+{
+    t_writeCache *cache = &vol->writeCache;
+    t_freeSpace space;
+    t_fsInfo info;
+    uint8_t result = 1;
+
+    memset(&space, 0, sizeof(space));
+
+    if(cache->freeMap == NULL)
+    {
+        if((vol->fatCache.pageEntries != 0) && (cache->fatChanged == 1) && (fatFlush(vol) == 0))
+        {
+            result = 0;
+        }
+        else if(scanFreeSpace(vol, SPACE_KERNEL_AUTO, &space) == 0)
+        {
+            fprintf(stderr, "Cannot scan the free space.\n");
+            result = 0;
+        }
+        else
+        {
+            /* The bitmap of the scan becomes the allocator bitmap */
+            cache->freeMap = space.bitmap;
+            cache->numClusters = space.numClusters;
+            cache->freeClusters = space.freeClusters;
+            cache->nextFree = FIRST_CLUSTER;
+            space.bitmap = NULL;
+
+            /* Start where the last writer stopped */
+            if((readFSInfo(vol, &info) == 1) && (info.nextFree >= FIRST_CLUSTER) && (info.nextFree < cache->numClusters))
+            {
+                cache->nextFree = info.nextFree;
+            }
+        }
+
+        releaseFreeSpace(&space);
+    }
+
+    return result;
+}
+
+static uint32_t findFreeCluster(const t_writeCache *cache, uint32_t from, uint32_t limit)
+{
+    uint64_t word = 0;
+    uint32_t cluster = from;
+
+    while(cluster < limit)
+    {
+        word = cache->freeMap[cluster / FREE_MAP_GROUP] >> (cluster % FREE_MAP_GROUP);
+        if(word != 0)
+        {
+            cluster += (uint32_t)__builtin_ctzll(word);
+            break;
+        }
+
+        /* Nothing free in the rest of this word */
+        cluster = ((cluster / FREE_MAP_GROUP) + 1) * FREE_MAP_GROUP;
+    }
+
+    return (cluster < limit) ? cluster : limit;
+}
+
+static uint32_t findUsedCluster(const t_writeCache *cache, uint32_t from, uint32_t limit)
+{
+    uint64_t word = 0;
+    uint32_t cluster = from;
+
+    while(cluster < limit)
+    {
+        word = (~cache->freeMap[cluster / FREE_MAP_GROUP]) >> (cluster % FREE_MAP_GROUP);
+        if(word != 0)
+        {
+            cluster += (uint32_t)__builtin_ctzll(word);
+            break;
+        }
+
+        /* Everything free in the rest of this word */
+        cluster = ((cluster / FREE_MAP_GROUP) + 1) * FREE_MAP_GROUP;
+    }
+
+    return (cluster < limit) ? cluster : limit;
+}
+
+static uint32_t findFreeRun(const t_writeCache *cache, uint32_t count, uint32_t *length)
+{
+    uint32_t best = 0;
+    uint32_t bestLength = 0;
+    uint32_t pass = 0;
+    uint32_t cluster = 0;
+    uint32_t limit = 0;
+    uint32_t runStart = 0;
+    uint32_t runEnd = 0;
+
+    for(pass = 0; (pass < 2) && (bestLength < count); pass++)
+    {
+        /* From the hint to the end, then from the start to the hint */
+        cluster = (pass == 0) ? cache->nextFree : FIRST_CLUSTER;
+        limit = (pass == 0) ? cache->numClusters : cache->nextFree;
+
+        while((cluster < limit) && (bestLength < count))
+        {
+            runStart = findFreeCluster(cache, cluster, limit);
+            runEnd = findUsedCluster(cache, runStart, limit);
+            if(runEnd - runStart > bestLength)
+            {
+                best = runStart;
+                bestLength = runEnd - runStart;
+            }
+            cluster = runEnd;
+        }
+    }
+
+    *length = (bestLength > count) ? count : bestLength;
+
+    return best;
+}
+
+uint32_t allocateChain(t_volume *vol, uint32_t prevCluster, uint32_t count)
+{
+    t_writeCache *cache = &vol->writeCache;
+    uint32_t first = 0;
+    uint32_t last = 0;
+    uint32_t remain = 0;
+    uint32_t runStart = 0;
+    uint32_t runLength = 0;
+    uint32_t index = 0;
+    uint32_t eoc = 0;
+    uint8_t failed = 0;
+
+    eoc = endOfChain(vol);
+    last = prevCluster;
+    remain = count;
+
+    if(initAllocator(vol) == 0)
+    {
+        /* No bitmap to allocate from */
+    }
+    else if(cache->freeClusters < count)
+    {
+        fprintf(stderr, "The disk is full.\n");
+    }
+    else
+    {
+        while((remain > 0) && (failed == 0))
+        {
+            /* Grow the chain in place when the cluster after it is free */
+            if((last >= FIRST_CLUSTER) && (last + 1 < cache->numClusters) &&
+               (findFreeCluster(cache, last + 1, last + 2) == last + 1))
+            {
+                runStart = last + 1;
+                runLength = findUsedCluster(cache, runStart, cache->numClusters) - runStart;
+                if(runLength > remain)
+                {
+                    runLength = remain;
+                }
+            }
+            else
+            {
+                runStart = findFreeRun(cache, remain, &runLength);
+            }
+
+            if(runLength == 0)
+            {
+                failed = 1;
+            }
+
+            /* Each cluster ends the chain until the next one is linked after it */
+            for(index = 0; (index < runLength) && (failed == 0); index++)
+            {
+                if((setFATEntry(vol, runStart + index, eoc) == 0) ||
+                   ((last != 0) && (setFATEntry(vol, last, runStart + index) == 0)))
+                {
+                    failed = 1;
+                }
+                else
+                {
+                    if(first == 0)
+                    {
+                        first = runStart + index;
+                    }
+                    last = runStart + index;
+                }
+            }
+
+            remain -= runLength;
+            cache->nextFree = runStart + runLength;
+            if(cache->nextFree >= cache->numClusters)
+            {
+                cache->nextFree = FIRST_CLUSTER;
+            }
+        }
+
+        if(failed == 1)
+        {
+            /* Give back what was taken */
+            if(prevCluster >= FIRST_CLUSTER)
+            {
+                setFATEntry(vol, prevCluster, eoc);
+            }
+            if(first != 0)
+            {
+                freeChain(vol, first);
+            }
+            first = 0;
+        }
+    }
+
+    return first;
+}
+
+uint32_t allocateRun(t_volume *vol, uint32_t count)
+{
+    t_writeCache *cache = &vol->writeCache;
+    uint32_t first = 0;
+    uint32_t length = 0;
+    uint32_t index = 0;
+    uint32_t eoc = 0;
+
+    eoc = endOfChain(vol);
+
+    if((count > 0) && (initAllocator(vol) == 1))
+    {
+        first = findFreeRun(cache, count, &length);
+    }
+
+    if(length < count)
+    {
+        first = 0;
+    }
+    else
+    {
+        for(index = 0; index < count; index++)
+        {
+            if(setFATEntry(vol, first + index, (index + 1 < count) ? (first + index + 1) : eoc) == 0)
+            {
+                /* Give back the clusters already linked */
+                freeChain(vol, first);
+                first = 0;
+                break;
+            }
+        }
+
+        if(first != 0)
+        {
+            cache->nextFree = first + count;
+            if(cache->nextFree >= cache->numClusters)
+            {
+                cache->nextFree = FIRST_CLUSTER;
+            }
+        }
+    }
+
+    return first;
+}
+
+uint32_t freeChain(t_volume *vol, uint32_t startCluster)
+{
+    uint32_t cluster = startCluster;
+    uint32_t next = 0;
+    uint32_t count = 0;
+
+    while(isDataCluster(vol, cluster) == 1)
+    {
+        next = getFATEntry(vol, cluster);
+
+        /* A free cluster ends the walk, even when a loop comes back to it */
+        if((next == FREE_CLUSTER) || (setFATEntry(vol, cluster, FREE_CLUSTER) == 0))
+        {
+            break;
+        }
+
+        count++;
+        cluster = next;
+    }
+
+    return count;
+}
+
+static uint8_t isValidName(const char *name, uint32_t length)
+{
+    uint32_t index = 0;
+    uint8_t result = 1;
+
+    for(index = 0; (index < length) && (result == 1); index++)
+    {
+        /* Only the dot between the base and the extension, fatPackName checks there is one */
+        if(((unsigned char)name[index] <= ' ') || ((unsigned char)name[index] >= 0x7F) ||
+           ((name[index] != '.') && (strchr(WRITE_INVALID_CHARS, name[index]) != NULL)))
+        {
+            result = 0;
+        }
+    }
+
+    return result;
+}
+
+uint8_t scanSlots(t_volume *vol, uint32_t dirCluster, t_slotCallback callback, void *context, uint32_t *lastCluster)
+{
+    t_extent *extents = NULL;
+    t_slotPosition position;
+    uint8_t *buff = NULL;
+    uint32_t bytsPerSec = vol->bootInfo.bytsPerSec;
+    uint32_t numExtents = 0;
+    uint32_t numUnits = 0;
+    uint32_t unitSectors = 0;
+    uint32_t unit = 0;
+    uint32_t firstSector = 0;
+    uint32_t byte = 0;
+    uint32_t extent = 0;
+    uint32_t cluster = 0;
+    uint8_t done = 0;
+    uint8_t result = 1;
+
+    /* The FAT12/16 root directory is one fixed region, other directories are read a cluster at a time */
+    if(dirCluster == 0)
+    {
+        unitSectors = vol->local.sectorInRootDir;
+        numUnits = 1;
+    }
+    else
+    {
+        unitSectors = vol->bootInfo.secPerClus;
+        numExtents = buildExtentList(vol, dirCluster, &extents);
+        for(extent = 0; extent < numExtents; extent++)
+        {
+            numUnits += extents[extent].length;
+        }
+
+        /* A directory has at least one cluster, without the list its slots and its end are unknown */
+        if(numExtents == 0)
+        {
+            result = 0;
+        }
+    }
+
+    if(lastCluster != NULL)
+    {
+        *lastCluster = (numExtents > 0) ? (extents[numExtents - 1].firstCluster + extents[numExtents - 1].length - 1) : 0;
+    }
+
+    buff = (uint8_t*)malloc((unitSectors > 0 ? unitSectors : 1) * bytsPerSec);
+
+    if((buff == NULL) && (result == 1))
+    {
+        fprintf(stderr, "The disk is empty.\n");
+        result = 0;
+    }
+
+    extent = 0;
+    cluster = (numExtents > 0) ? extents[0].firstCluster : 0;
+    for(unit = 0; (result == 1) && (done == 0) && (unit < numUnits); unit++)
+    {
+        if(dirCluster == 0)
+        {
+            firstSector = vol->local.rootDirStartSector;
+        }
+        else
+        {
+            /* Move to the next extent once this one is used up */
+            if(cluster == extents[extent].firstCluster + extents[extent].length)
+            {
+                extent++;
+                cluster = extents[extent].firstCluster;
+            }
+            firstSector = ((cluster - FIRST_CLUSTER) * vol->bootInfo.secPerClus) + vol->local.dataStartSector;
+            cluster++;
+        }
+
+        if(fatReadSectors(vol, firstSector, unitSectors, buff) == 0)
+        {
+            fprintf(stderr, "Read Directory Entry error.\n");
+            result = 0;
+        }
+
+        for(byte = 0; (result == 1) && (done == 0) && (byte < unitSectors * bytsPerSec); byte += SIZE_ROOT_ENTRY)
+        {
+            position.sector = firstSector + (byte / bytsPerSec);
+            position.offset = byte % bytsPerSec;
+            done = (callback(&buff[byte], &position, context) == 0);
+        }
+    }
+
+    free(buff);
+    free(extents);
+
+    return result;
+}
+
+static uint8_t matchSlot(const uint8_t *slot, const t_slotPosition *position, void *context)
+{
+    t_dirScanContext *match = (t_dirScanContext*)context;
+    t_dirScan *scan = match->scan;
+    uint8_t attributes = 0;
+    uint8_t result = 1;
+
+    attributes = slot[0x0B];
+
+    if((slot[0] == INVALID_FILE_NAME) || (slot[0] == DELETED_FILE_NAME))
+    {
+        if(scan->hasFree == 0)
+        {
+            scan->hasFree = 1;
+            scan->freeSlot = *position;
+        }
+
+        /* Nothing follows the first never used slot */
+        result = (slot[0] == DELETED_FILE_NAME);
+        match->numLong = 0;
+    }
+    else if(attributes == ATTR_LONG_FILE_NAME)
+    {
+        /* A run longer than a name can need is not one name */
+        if(match->numLong == WRITE_MAX_LONG_SLOTS)
+        {
+            match->numLong = 0;
+        }
+        scan->longSlots[match->numLong] = *position;
+        match->numLong++;
+    }
+    else if(((attributes & ATTR_VOLUME_ID) == 0) && (memcmp(slot, match->packed, SIZE_OF_NAME) == 0))
+    {
+        scan->found = 1;
+        scan->slot = *position;
+        scan->numLongSlots = match->numLong;
+        parseDirEntry(match->vol, slot, &scan->entry);
+        result = 0;
+    }
+    else
+    {
+        match->numLong = 0;
+    }
+
+    return result;
+}
+
+static uint8_t findChildSlot(const uint8_t *slot, const t_slotPosition *position, void *context)
+{
+    uint8_t *found = (uint8_t*)context;
+
+    (void)position;
+
+    /* Unused and deleted slots, ".", "..", long name slots and the volume label are not entries */
+    if((slot[0] != INVALID_FILE_NAME) && (slot[0] != DELETED_FILE_NAME) && (slot[0] != '.') &&
+       ((slot[0x0B] & ATTR_VOLUME_ID) == 0))
+    {
+        *found = 1;
+    }
+
+    return (*found == 0);
+}
+
+static uint8_t scanDirectory(t_volume *vol, uint32_t dirCluster, const uint8_t *packed, t_dirScan *scan)
+{
+    t_dirScanContext match;
+
+    memset(scan, 0, sizeof(t_dirScan));
+    scan->dirCluster = dirCluster;
+
+    match.vol = vol;
+    match.packed = packed;
+    match.scan = scan;
+    match.numLong = 0;
+
+    return scanSlots(vol, dirCluster, matchSlot, &match, &scan->lastCluster);
+}
+
+static uint8_t locateEntry(t_volume *vol, const char *path, uint8_t *packed, t_dirScan *scan)
+{
+    t_direcroryEntry dir;
+    char *parent = NULL;
+    uint32_t length = 0;
+    uint32_t nameStart = 0;
+    uint8_t result = 0;
+
+    /* The last component, without trailing separators */
+    length = (uint32_t)strlen(path);
+    while((length > 0) && (path[length - 1] == PATH_SEPARATOR))
+    {
+        length--;
+    }
+    nameStart = length;
+    while((nameStart > 0) && (path[nameStart - 1] != PATH_SEPARATOR))
+    {
+        nameStart--;
+    }
+
+    if((length == nameStart) || (fatPackName(&path[nameStart], length - nameStart, packed) == 0) ||
+       (packed[0] == '.'))
+    {
+        fprintf(stderr, "Invalid name %s.\n", path);
+    }
+    else if((parent = (char*)malloc(nameStart + 1)) == NULL)
+    {
+        fprintf(stderr, "The disk is empty.\n");
+    }
+    else
+    {
+        /* A path without a directory is in the root directory */
+        memcpy(parent, path, nameStart);
+        parent[nameStart] = '\0';
+
+        if((fatLookup(vol, parent, &dir) == 0) || ((dir.attributes & ATTR_DIRECTORY) == 0))
+        {
+            fprintf(stderr, "Directory of %s not found.\n", path);
+        }
+        else
+        {
+            result = scanDirectory(vol, dir.startCluster, packed, scan);
+        }
+
+        free(parent);
+    }
+
+    return result;
+}
+
+static void stampEntry(t_direcroryEntry *entry)
+{
+    struct tm local;
+    time_t now = 0;
+
+    now = time(NULL);
+    localtime_r(&now, &local);
+
+    if(local.tm_year + 1900 < (int)SET_YEAR)
+    {
+        local.tm_year = (int)SET_YEAR - 1900;
+    }
+
+    /* Two second resolution */
+    entry->writeTime = (uint16_t)(((uint32_t)local.tm_hour << SHIFT_11_BIT) | ((uint32_t)local.tm_min << SHIFT_5_BIT) |
+                                  ((uint32_t)local.tm_sec >> SHIFT_1_BIT));
+    entry->writeDate = (uint16_t)(((uint32_t)(local.tm_year + 1900 - (int)SET_YEAR) << SHIFT_9_BIT) |
+                                  ((uint32_t)(local.tm_mon + 1) << SHIFT_5_BIT) | (uint32_t)local.tm_mday);
+}
+
+static uint8_t storeSlot(t_volume *vol, const t_slotPosition *slot, const t_direcroryEntry *entry, uint8_t clear)
+{
+    uint8_t *buff = NULL;
+    uint8_t result = 0;
+
+    buff = getDirtySector(vol, slot->sector, 1);
+
+    if(buff != NULL)
+    {
+        if(clear == 1)
+        {
+            memset(buff + slot->offset, 0, SIZE_ROOT_ENTRY);
+        }
+        storeDirEntry(vol, entry, buff + slot->offset);
+        result = 1;
+    }
+
+    return result;
+}
+
+static uint8_t zeroCluster(t_volume *vol, uint32_t cluster)
+{
+    uint32_t sector = 0;
+    uint32_t index = 0;
+    uint8_t result = 1;
+
+    sector = ((cluster - FIRST_CLUSTER) * vol->bootInfo.secPerClus) + vol->local.dataStartSector;
+    for(index = 0; (result == 1) && (index < vol->bootInfo.secPerClus); index++)
+    {
+        if(getDirtySector(vol, sector + index, 0) == NULL)
+        {
+            result = 0;
+        }
+    }
+
+    return result;
+}
+
+static uint8_t writeByteRange(t_volume *vol, uint32_t sector, uint32_t byteOffset, uint32_t size,
+                              const uint8_t *buff, uint8_t *bounce)
+{
+    uint32_t bytsPerSec = vol->bootInfo.bytsPerSec;
+    uint32_t done = 0;
+    uint32_t offset = 0;
+    uint32_t length = 0;
+    uint32_t numSector = 0;
+    uint8_t failed = 0;
+
+    sector += byteOffset / bytsPerSec;
+    offset = byteOffset % bytsPerSec;
+
+    /* Head: a partial first sector is read, patched and written back */
+    if((size > 0) && ((offset != 0) || (size < bytsPerSec)))
+    {
+        length = bytsPerSec - offset;
+        if(length > size)
+        {
+            length = size;
+        }
+
+        if(HAL_ReadSector(vol->device, sector, bounce) != bytsPerSec)
+        {
+            failed = 1;
+        }
+        else
+        {
+            if(buff != NULL)
+            {
+                memcpy(bounce + offset, buff, length);
+            }
+            else
+            {
+                memset(bounce + offset, 0, length);
+            }
+            failed = (HAL_WriteMultiSector(vol->device, sector, 1, bounce) != bytsPerSec);
+        }
+
+        done = length;
+        sector++;
+    }
+
+    /* Body: whole sectors are written straight from the caller buffer, or from the zeros */
+    while((failed == 0) && (size - done >= bytsPerSec))
+    {
+        numSector = (size - done) / bytsPerSec;
+        if((buff == NULL) && (numSector > WRITE_ZERO_CHUNK / bytsPerSec))
+        {
+            numSector = WRITE_ZERO_CHUNK / bytsPerSec;
+        }
+
+        length = numSector * bytsPerSec;
+        failed = (HAL_WriteMultiSector(vol->device, sector, numSector, (buff != NULL) ? (buff + done) : s_zeros) != length);
+        done += length;
+        sector += numSector;
+    }
+
+    /* Tail: a partial last sector is read, patched and written back */
+    if((failed == 0) && (done < size))
+    {
+        if(HAL_ReadSector(vol->device, sector, bounce) != bytsPerSec)
+        {
+            failed = 1;
+        }
+        else
+        {
+            if(buff != NULL)
+            {
+                memcpy(bounce, buff + done, size - done);
+            }
+            else
+            {
+                memset(bounce, 0, size - done);
+            }
+            failed = (HAL_WriteMultiSector(vol->device, sector, 1, bounce) != bytsPerSec);
+        }
+    }
+
+    return (failed == 0) ? 1 : 0;
+}
+
+static uint8_t writeExtents(t_volume *vol, const t_extent *extents, uint32_t numExtents, uint32_t offset,
+                            const uint8_t *buff, uint32_t size, uint8_t *bounce)
+{
+    uint64_t clusterBytes = 0;
+    uint64_t extentStart = 0;
+    uint64_t extentEnd = 0;
+    uint64_t from = 0;
+    uint64_t to = 0;
+    uint64_t done = 0;
+    uint32_t index = 0;
+    uint32_t sector = 0;
+    uint8_t result = 1;
+
+    clusterBytes = (uint64_t)vol->bootInfo.bytsPerSec * vol->bootInfo.secPerClus;
+
+    for(index = 0; (result == 1) && (index < numExtents) && (done < size); index++)
+    {
+        extentEnd = extentStart + (extents[index].length * clusterBytes);
+
+        /* The part of the range this extent holds */
+        from = (offset > extentStart) ? offset : extentStart;
+        to = ((uint64_t)offset + size < extentEnd) ? ((uint64_t)offset + size) : extentEnd;
+        if(from < to)
+        {
+            sector = ((extents[index].firstCluster - FIRST_CLUSTER) * vol->bootInfo.secPerClus) + vol->local.dataStartSector;
+            result = writeByteRange(vol, sector, (uint32_t)(from - extentStart), (uint32_t)(to - from),
+                                    (buff != NULL) ? (buff + (from - offset)) : NULL, bounce);
+            done += to - from;
+        }
+
+        extentStart = extentEnd;
+    }
+
+    if(done < size)
+    {
+        result = 0;
+    }
+
+    return result;
+}
+
+static uint8_t writeFileRange(t_volume *vol, t_dirScan *scan, uint32_t offset, const uint8_t *buff, uint32_t size)
+{
+    t_extent *extents = NULL;
+    uint8_t *bounce = NULL;
+    uint64_t clusterBytes = 0;
+    uint32_t oldSize = 0;
+    uint32_t newSize = 0;
+    uint32_t numExtents = 0;
+    uint32_t have = 0;
+    uint32_t need = 0;
+    uint32_t first = 0;
+    uint32_t last = 0;
+    uint32_t index = 0;
+    uint8_t listed = 1;
+    uint8_t category = 0;
+    uint8_t result = 0;
+
+    clusterBytes = (uint64_t)vol->bootInfo.bytsPerSec * vol->bootInfo.secPerClus;
+    oldSize = scan->entry.fileSize;
+    newSize = (offset + size > oldSize) ? (offset + size) : oldSize;
+    need = (uint32_t)((newSize + clusterBytes - 1) / clusterBytes);
+
+    if(isDataCluster(vol, scan->entry.startCluster) == 1)
+    {
+        numExtents = buildExtentList(vol, scan->entry.startCluster, &extents);
+        listed = (numExtents > 0);
+    }
+    for(index = 0; index < numExtents; index++)
+    {
+        have += extents[index].length;
+    }
+    if(numExtents > 0)
+    {
+        last = extents[numExtents - 1].firstCluster + extents[numExtents - 1].length - 1;
+    }
+
+    bounce = (uint8_t*)malloc(vol->bootInfo.bytsPerSec);
+
+    if(bounce == NULL)
+    {
+        fprintf(stderr, "The disk is empty.\n");
+    }
+    else if(listed == 0)
+    {
+        /* Memory ran out: new clusters linked after a cluster in the middle of the chain would cut it */
+    }
+    else if(extentsInData(vol, extents, numExtents) == 0)
+    {
+        /* Writing there would go past the data region and grow the image */
+        fprintf(stderr, "The cluster chain leaves the data region.\n");
+    }
+    else if((have < need) && ((first = allocateChain(vol, last, need - have)) == 0))
+    {
+        /* The volume is full */
+    }
+    else
+    {
+        if(first != 0)
+        {
+            /* A file without clusters starts with the new chain */
+            if(numExtents == 0)
+            {
+                scan->entry.startCluster = first;
+            }
+            free(extents);
+            numExtents = buildExtentList(vol, scan->entry.startCluster, &extents);
+        }
+
+        category = HAL_TraceCategory(HAL_TRACE_DATA);
+        result = (numExtents > 0) ? 1 : 0;
+        if((result == 1) && (offset > oldSize))
+        {
+            result = writeExtents(vol, extents, numExtents, oldSize, NULL, offset - oldSize, bounce);
+        }
+        if((result == 1) && (size > 0))
+        {
+            result = writeExtents(vol, extents, numExtents, offset, buff, size, bounce);
+        }
+        HAL_TraceCategory(category);
+
+        if(result == 1)
+        {
+            scan->entry.fileSize = newSize;
+            stampEntry(&scan->entry);
+            result = storeSlot(vol, &scan->slot, &scan->entry, 0);
+            invalidateDirCache(vol, scan->dirCluster);
+        }
+        else if(first != 0)
+        {
+            /* Give the new clusters back, the old chain ends where it ended */
+            if(last != 0)
+            {
+                setFATEntry(vol, last, endOfChain(vol));
+            }
+            else
+            {
+                scan->entry.startCluster = 0;
+            }
+            freeChain(vol, first);
+        }
+    }
+
+    free(bounce);
+    free(extents);
+
+    return result;
+}
+
+uint8_t fatCreate(t_volume *vol, const char *path, uint8_t attributes)
+{
+    t_dirScan scan;
+    t_direcroryEntry entry;
+    t_slotPosition dots;
+    uint8_t packed[SIZE_OF_NAME];
+    uint32_t cluster = 0;
+    uint32_t grown = 0;
+    uint32_t nameStart = 0;
+    uint8_t result = 0;
+
+    /* The name of the last component, for the character check */
+    nameStart = (uint32_t)strlen(path);
+    while((nameStart > 0) && (path[nameStart - 1] == PATH_SEPARATOR))
+    {
+        nameStart--;
+    }
+    while((nameStart > 0) && (path[nameStart - 1] != PATH_SEPARATOR))
+    {
+        nameStart--;
+    }
+
+    memset(&entry, 0, sizeof(entry));
+
+    /* The volume bit would turn the entry into a label or a long name slot */
+    if((attributes & ~WRITE_VALID_ATTRIBUTES) != 0)
+    {
+        fprintf(stderr, "Invalid attributes 0x%02X.\n", attributes);
+    }
+    else if(vol->device->writable == 0)
+    {
+        fprintf(stderr, "The image is read-only.\n");
+    }
+    else if(locateEntry(vol, path, packed, &scan) == 0)
+    {
+        /* No directory to create the entry in */
+    }
+    else if(scan.found == 1)
+    {
+        fprintf(stderr, "%s already exists.\n", path);
+    }
+    else if(isValidName(&path[nameStart], (uint32_t)strcspn(&path[nameStart], "/")) == 0)
+    {
+        fprintf(stderr, "Invalid name %s.\n", path);
+    }
+    else if((scan.hasFree == 0) && (scan.dirCluster == 0))
+    {
+        fprintf(stderr, "The root directory is full.\n");
+    }
+    /* A directory gets its first cluster with "." and ".." */
+    else if(((attributes & ATTR_DIRECTORY) != 0) &&
+            (((cluster = allocateChain(vol, 0, 1)) == 0) || (zeroCluster(vol, cluster) == 0)))
+    {
+        /* The volume is full */
+    }
+    /* A full directory grows by one cluster */
+    else if((scan.hasFree == 0) &&
+            (((grown = allocateChain(vol, scan.lastCluster, 1)) == 0) || (zeroCluster(vol, grown) == 0)))
+    {
+        /* The volume is full */
+    }
+    else
+    {
+        if(grown != 0)
+        {
+            scan.freeSlot.sector = ((grown - FIRST_CLUSTER) * vol->bootInfo.secPerClus) + vol->local.dataStartSector;
+            scan.freeSlot.offset = 0;
+        }
+
+        memcpy(entry.fileName, packed, SIZE_OF_NAME);
+        entry.attributes = attributes;
+        entry.startCluster = cluster;
+        stampEntry(&entry);
+        result = 1;
+
+        if(cluster != 0)
+        {
+            /* ".." of a first level directory holds 0, even on FAT32 */
+            dots.sector = ((cluster - FIRST_CLUSTER) * vol->bootInfo.secPerClus) + vol->local.dataStartSector;
+            dots.offset = 0;
+            memset(entry.fileName, ' ', SIZE_OF_NAME);
+            entry.fileName[0] = '.';
+            entry.attributes = ATTR_DIRECTORY;
+            result = storeSlot(vol, &dots, &entry, 1);
+
+            dots.offset = SIZE_ROOT_ENTRY;
+            entry.fileName[1] = '.';
+            entry.startCluster = (scan.dirCluster == vol->bootInfo.rootClus) ? 0 : scan.dirCluster;
+            if(result == 1)
+            {
+                result = storeSlot(vol, &dots, &entry, 1);
+            }
+
+            memcpy(entry.fileName, packed, SIZE_OF_NAME);
+            entry.attributes = attributes;
+            entry.startCluster = cluster;
+        }
+
+        if(result == 1)
+        {
+            result = storeSlot(vol, &scan.freeSlot, &entry, 1);
+        }
+        invalidateDirCache(vol, scan.dirCluster);
+    }
+
+    if((result == 0) && (cluster != 0))
+    {
+        freeChain(vol, cluster);
+    }
+
+    return result;
+}
+
+uint32_t fatWrite(t_volume *vol, const char *path, uint32_t offset, const uint8_t *buff, uint32_t size)
+{
+    t_dirScan scan;
+    uint8_t packed[SIZE_OF_NAME];
+    uint64_t start = 0;
+    uint32_t written = 0;
+
+    start = STATS_START();
+
+    if(vol->device->writable == 0)
+    {
+        fprintf(stderr, "The image is read-only.\n");
+    }
+    else if((locateEntry(vol, path, packed, &scan) == 0) || (scan.found == 0))
+    {
+        fprintf(stderr, "File %s not found.\n", path);
+    }
+    else if((scan.entry.attributes & ATTR_DIRECTORY) != 0)
+    {
+        fprintf(stderr, "%s is a directory.\n", path);
+    }
+    else if((scan.entry.attributes & ATTR_READ_ONLY) != 0)
+    {
+        fprintf(stderr, "%s is read-only.\n", path);
+    }
+    else if((uint64_t)offset + size > UINT32_MAX)
+    {
+        fprintf(stderr, "A file cannot be larger than 4 GiB.\n");
+    }
+    else if(writeFileRange(vol, &scan, offset, buff, size) == 1)
+    {
+        written = size;
+    }
+
+    STATS_RECORD(STATS_OP_FILE_WRITE, start, written);
+
+    return written;
+}
+
+uint8_t fatTruncate(t_volume *vol, const char *path, uint32_t size)
+{
+    t_dirScan scan;
+    uint8_t packed[SIZE_OF_NAME];
+    uint64_t start = 0;
+    uint64_t clusterBytes = 0;
+    uint32_t keep = 0;
+    uint32_t cluster = 0;
+    uint32_t next = 0;
+    uint32_t index = 0;
+    uint8_t result = 0;
+
+    start = STATS_START();
+    clusterBytes = (uint64_t)vol->bootInfo.bytsPerSec * vol->bootInfo.secPerClus;
+
+    if(vol->device->writable == 0)
+    {
+        fprintf(stderr, "The image is read-only.\n");
+    }
+    else if((locateEntry(vol, path, packed, &scan) == 0) || (scan.found == 0))
+    {
+        fprintf(stderr, "File %s not found.\n", path);
+    }
+    else if((scan.entry.attributes & ATTR_DIRECTORY) != 0)
+    {
+        fprintf(stderr, "%s is a directory.\n", path);
+    }
+    else if((scan.entry.attributes & ATTR_READ_ONLY) != 0)
+    {
+        fprintf(stderr, "%s is read-only.\n", path);
+    }
+    else if(size > scan.entry.fileSize)
+    {
+        /* Growing writes zeros up to the new size */
+        result = writeFileRange(vol, &scan, size, NULL, 0);
+    }
+    else
+    {
+        keep = (uint32_t)((size + clusterBytes - 1) / clusterBytes);
+        result = 1;
+
+        if(keep == 0)
+        {
+            freeChain(vol, scan.entry.startCluster);
+            scan.entry.startCluster = 0;
+        }
+        else
+        {
+            /* Find the last cluster kept, the chain may be shorter than the size says */
+            cluster = scan.entry.startCluster;
+            for(index = 1; (index < keep) && (isDataCluster(vol, cluster) == 1); index++)
+            {
+                cluster = getFATEntry(vol, cluster);
+            }
+
+            if(isDataCluster(vol, cluster) == 1)
+            {
+                next = getFATEntry(vol, cluster);
+                if(isDataCluster(vol, next) == 1)
+                {
+                    result = setFATEntry(vol, cluster, endOfChain(vol));
+                    freeChain(vol, next);
+                }
+            }
+        }
+
+        if(result == 1)
+        {
+            scan.entry.fileSize = size;
+            stampEntry(&scan.entry);
+            result = storeSlot(vol, &scan.slot, &scan.entry, 0);
+            invalidateDirCache(vol, scan.dirCluster);
+        }
+    }
+
+    STATS_RECORD(STATS_OP_FILE_WRITE, start, 0);
+
+    return result;
+}
+
+uint8_t fatDelete(t_volume *vol, const char *path)
+{
+    t_dirScan scan;
+    uint8_t packed[SIZE_OF_NAME];
+    uint8_t *buff = NULL;
+    uint32_t index = 0;
+    uint8_t isDirectory = 0;
+    uint8_t notEmpty = 0;
+    uint8_t result = 0;
+
+    if(vol->device->writable == 0)
+    {
+        fprintf(stderr, "The image is read-only.\n");
+    }
+    else if((locateEntry(vol, path, packed, &scan) == 0) || (scan.found == 0))
+    {
+        fprintf(stderr, "%s not found.\n", path);
+    }
+    else
+    {
+        /* A directory must only hold "." and "..", whatever the attributes of its entries */
+        isDirectory = ((scan.entry.attributes & ATTR_DIRECTORY) != 0);
+        if((isDirectory == 1) && (isDataCluster(vol, scan.entry.startCluster) == 1) &&
+           (scanSlots(vol, scan.entry.startCluster, findChildSlot, &notEmpty, NULL) == 0))
+        {
+            /* A directory that cannot be read is not known to be empty */
+            notEmpty = 1;
+        }
+
+        if(notEmpty == 1)
+        {
+            fprintf(stderr, "%s is not empty.\n", path);
+        }
+        else if((buff = getDirtySector(vol, scan.slot.sector, 1)) != NULL)
+        {
+            buff[scan.slot.offset] = DELETED_FILE_NAME;
+            result = 1;
+
+            /* The long name of the entry goes with it */
+            for(index = 0; (result == 1) && (index < scan.numLongSlots); index++)
+            {
+                buff = getDirtySector(vol, scan.longSlots[index].sector, 1);
+                if(buff == NULL)
+                {
+                    result = 0;
+                }
+                else
+                {
+                    buff[scan.longSlots[index].offset] = DELETED_FILE_NAME;
+                }
+            }
+
+            freeChain(vol, scan.entry.startCluster);
+            invalidateDirCache(vol, scan.dirCluster);
+            if(isDirectory == 1)
+            {
+                invalidateDirCache(vol, scan.entry.startCluster);
+            }
+        }
+    }
+
+    return result;
+}
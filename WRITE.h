@@ -0,0 +1,187 @@
+#ifndef _WRITE_H_
+#define _WRITE_H_
+
+/*******************************************************************************
+* Include
+*******************************************************************************/
+#include <time.h>
+#include "SPACE.h"
+
+/*******************************************************************************
+* Define
+*******************************************************************************/
+#define WRITE_ZERO_CHUNK        (64U * 1024U)  /* Bytes of zeros written per request when a file grows */
+#define WRITE_MAX_LONG_SLOTS    20U      /* Long name slots in front of one entry */
+#define WRITE_VALID_ATTRIBUTES  (ATTR_READ_ONLY | ATTR_HIDDEN | ATTR_SYSTEM | ATTR_DIRECTORY | ATTR_ARCHIVE)  /* Bits fatCreate accepts */
+#define WRITE_INVALID_CHARS     "\"*+,./:;<=>?[\\]|"  /* Characters an 8.3 name cannot hold, besides the dot */
+
+typedef struct
+{
+    uint32_t    sector;                  /* Sector holding the slot */
+    uint32_t    offset;                  /* Byte offset of the slot in the sector */
+} t_slotPosition;
+
+typedef struct
+{
+    uint32_t        dirCluster;          /* Start cluster of the directory, 0 for the FAT12/16 root */
+    uint32_t        lastCluster;         /* Last cluster of the directory chain, 0 for the FAT12/16 root */
+    uint8_t         found;               /* 1 if the name is in the directory */
+    t_slotPosition  slot;                /* Slot of the entry when found */
+    t_direcroryEntry entry;              /* The entry when found */
+    uint32_t        numLongSlots;        /* Long name slots in front of the entry */
+    t_slotPosition  longSlots[WRITE_MAX_LONG_SLOTS];  /* Their positions */
+    uint8_t         hasFree;             /* 1 if a free slot was seen before the entry or the end */
+    t_slotPosition  freeSlot;            /* First free slot */
+} t_dirScan;
+
+typedef struct
+{
+    t_volume    *vol;                    /* The volume scanned */
+    const uint8_t *packed;               /* The packed 8.3 name looked for */
+    t_dirScan   *scan;                   /* Receives what was found */
+    uint32_t    numLong;                 /* Long name slots seen since the last entry */
+} t_dirScanContext;
+
+/**
+ * Callback called for every raw slot of a directory.
+ *
+ * @param slot The SIZE_ROOT_ENTRY bytes of the slot.
+ * @param position Where the slot is on the disk.
+ * @param context The context given to the scan.
+ *
+ * @return 1 to continue the scan, 0 to stop it.
+ */
+typedef uint8_t (*t_slotCallback)(const uint8_t *slot, const t_slotPosition *position, void *context);
+
+/*******************************************************************************
+* API
+*******************************************************************************/
+
+/**
+ * Name: fatCreate
+ * @brief Create an empty file, or a directory holding "." and "..", in an existing directory.
+ *        The first free slot of the directory is used; a full directory grows by one cluster,
+ *        except the fixed root directory of FAT12/16. Like every write, the change stays in the
+ *        write cache of the volume until fatFlush(). Writes must not run while other threads
+ *        use the volume.
+ *
+ * @param vol: The volume, mounted writable.
+ * @param path: The path of the new entry, its name an 8.3 name.
+ * @param attributes: The attributes of the entry, a directory when ATTR_DIRECTORY is set; the
+ *                    volume bit is refused.
+ *
+ * @return 1 if the entry was created, 0 if it exists, the path or the name is invalid, or the volume is full.
+ */
+uint8_t fatCreate(t_volume *vol, const char *path, uint8_t attributes);
+
+/**
+ * Name: fatWrite
+ * @brief Write bytes into a file at an offset, growing the file if they end past its size.
+ *        The clusters a file needs are allocated in as few runs as possible, starting right
+ *        after its last cluster when that one is free. File data is written through to the
+ *        disk at once; the FAT entries and the directory slot go to the write cache. Bytes
+ *        between the old size and the offset read as zeros.
+ *
+ * @param vol: The volume, mounted writable.
+ * @param path: The path of the file.
+ * @param offset: The byte offset to write at.
+ * @param buff: The bytes.
+ * @param size: The number of bytes.
+ *
+ * @return The number of bytes written: size, or 0 if the file does not exist, is a directory,
+ *         or the volume is full.
+ */
+uint32_t fatWrite(t_volume *vol, const char *path, uint32_t offset, const uint8_t *buff, uint32_t size);
+
+/**
+ * Name: fatTruncate
+ * @brief Set the size of a file. Clusters past the new size are freed; a larger size is
+ *        filled with zeros.
+ *
+ * @param vol: The volume, mounted writable.
+ * @param path: The path of the file.
+ * @param size: The new size in bytes.
+ *
+ * @return 1 if the size was set, 0 if the file does not exist, is a directory, or the volume is full.
+ */
+uint8_t fatTruncate(t_volume *vol, const char *path, uint32_t size);
+
+/**
+ * Name: fatDelete
+ * @brief Delete a file or an empty directory: its chain is freed and its slot, with the
+ *        long name slots in front of it, is marked deleted.
+ *
+ * @param vol: The volume, mounted writable.
+ * @param path: The path of the entry.
+ *
+ * @return 1 if the entry was deleted, 0 if it does not exist or is a directory that is not empty.
+ */
+uint8_t fatDelete(t_volume *vol, const char *path);
+
+/**
+ * Name: scanSlots
+ * @brief Call a function for every raw slot of a directory, deleted, long name and unused
+ *        slots included, in order. The slots are read through the write cache, so pending
+ *        changes are seen.
+ *
+ * @param vol: The volume.
+ * @param dirCluster: The start cluster of the directory, 0 for the FAT12/16 root.
+ * @param callback: Called for every slot, returns 0 to stop.
+ * @param context: Given to the callback.
+ * @param lastCluster: Receives the last cluster of the directory chain, 0 for the FAT12/16 root, may be NULL.
+ *
+ * @return 1 if the directory was read, 0 if a read failed or memory ran out.
+ */
+uint8_t scanSlots(t_volume *vol, uint32_t dirCluster, t_slotCallback callback, void *context, uint32_t *lastCluster);
+
+/**
+ * Name: allocateChain
+ * @brief Allocate clusters and link them after a cluster. A free run long enough for all of
+ *        them is preferred, starting right after prevCluster when that one is free, then from
+ *        where the last allocation stopped; without such a run the longest runs are used.
+ *        The free cluster bitmap is built from scanFreeSpace() on the first allocation and kept
+ *        up to date by setFATEntry().
+ *
+ * @param vol: The volume, mounted writable.
+ * @param prevCluster: The last cluster of the chain to extend, 0 to start a new chain.
+ * @param count: The number of clusters, 1 or more.
+ *
+ * @return The first cluster allocated, 0 if the volume does not have count free clusters.
+ */
+uint32_t allocateChain(t_volume *vol, uint32_t prevCluster, uint32_t count);
+
+/**
+ * Name: allocateRun
+ * @brief Allocate a new chain of clusters that are all contiguous, from the first free run
+ *        long enough, looking from where the last allocation stopped.
+ *
+ * @param vol: The volume, mounted writable.
+ * @param count: The number of clusters, 1 or more.
+ *
+ * @return The first cluster of the chain, 0 if no free run holds count clusters.
+ */
+uint32_t allocateRun(t_volume *vol, uint32_t count);
+
+/**
+ * Name: freeChain
+ * @brief Free every cluster of a chain. The walk stops at the first cluster that is already
+ *        free, so a chain that loops is freed once.
+ *
+ * @param vol: The volume, mounted writable.
+ * @param startCluster: The first cluster of the chain.
+ *
+ * @return The number of clusters freed.
+ */
+uint32_t freeChain(t_volume *vol, uint32_t startCluster);
+
+/**
+ * Name: endOfChain
+ * @brief Get the end of chain value written to the FAT of a volume.
+ *
+ * @param vol: The volume.
+ *
+ * @return END_CRUSTER_12, END_CRUSTER_16 or END_CRUSTER_32.
+ */
+uint32_t endOfChain(t_volume *vol);
+
+#endif /* _WRITE_H_ */
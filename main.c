@@ -1,284 +1,894 @@
-#include "FAT.h"
+#include <ctype.h>
+#include <fnmatch.h>
+#include "EXTRACT.h"
+
+/*******************************************************************************
+* Define
+*******************************************************************************/
+#define CLI_OUTPUT_BUFFER       (64U * 1024U)  /* Bytes of output buffered before a write */
+#define CLI_READ_CHUNK          (64U * 1024U)  /* Bytes read per fatRead by cat */
+#define CLI_LINE_MAX            4096U    /* Longest command line read in batch mode */
+#define CLI_PATH_MAX            4096U    /* Longest path printed, deeper entries are skipped */
+#define CLI_MAX_ARGS            16U      /* Words of one command in batch mode */
+#define CLI_FORMAT_TSV          0U       /* One tab separated line per entry */
+#define CLI_FORMAT_JSON         1U       /* One JSON object per line */
+#define CLI_TYPE_ANY            0U       /* find: files and directories */
+#define CLI_TYPE_FILE           1U       /* find -type f */
+#define CLI_TYPE_DIR            2U       /* find -type d */
+#define CLI_EXIT_OK             0        /* Every command succeeded */
+#define CLI_EXIT_FAILED         1        /* A command failed, e.g. a path was not found */
+#define CLI_EXIT_ERROR          2        /* Bad usage, or the image could not be opened */
+
+typedef struct
+{
+    const char      *imagePath;          /* The image to query */
+    t_volumeConfig  volume;              /* Mount options */
+    uint8_t         format;              /* CLI_FORMAT_TSV or CLI_FORMAT_JSON */
+    int             firstCommand;        /* Index of the command in argv, argc to read commands from stdin */
+} t_cliOptions;
+
+typedef struct
+{
+    t_volume    *vol;                    /* The volume queried */
+    uint8_t     format;                  /* CLI_FORMAT_TSV or CLI_FORMAT_JSON */
+    uint8_t     batch;                   /* 1 when the commands come from stdin */
+    uint64_t    records;                 /* Entries printed by the current command */
+    uint8_t     *buff;                   /* CLI_READ_CHUNK bytes for cat */
+} t_cliContext;
+
+typedef struct
+{
+    char        pattern[CLI_PATH_MAX];   /* Upper case name pattern, "" for any name */
+    uint8_t     type;                    /* CLI_TYPE_* */
+    uint8_t     recursive;               /* 1 to visit the subdirectories */
+} t_cliFilter;
 
 /*******************************************************************************
 * Prototypes
 *******************************************************************************/
 
 /**
- * Name: countNode
- * @brief Counts the number of nodes in the linked list.
+ * Name: parseOptions
+ * @brief Read the command line up to the command.
+ *
+ * @param argc The number of arguments.
+ * @param argv The arguments.
+ * @param options Receives the options.
+ *
+ * @return 1 if the command line is valid, 0 otherwise.
+ */
+uint8_t parseOptions(int argc, char **argv, t_cliOptions *options);
+
+/**
+ * Name: runBatch
+ * @brief Run one command per line of a stream until its end. Empty lines and lines starting
+ *        with '#' are skipped. The output of each command ends with an "end" record holding
+ *        its exit status, and is flushed, so a caller can wait for the answer of each query.
+ *
+ * @param context The volume and the output settings.
+ * @param input The stream.
+ *
+ * @return CLI_EXIT_OK if every command succeeded, CLI_EXIT_FAILED otherwise.
+ */
+int runBatch(t_cliContext *context, FILE *input);
+
+/**
+ * Name: runCommand
+ * @brief Run one command: ls, cat, stat, find or extract.
+ *
+ * @param context The volume and the output settings.
+ * @param argc The number of words, the command included.
+ * @param argv The words.
+ *
+ * @return The exit status of the command.
+ */
+int runCommand(t_cliContext *context, int argc, char **argv);
+
+/**
+ * Name: commandList
+ * @brief ls [-R] [PATH]: print the entries of a directory, or the entry of a file.
+ *
+ * @param context The volume and the output settings.
+ * @param argc The number of words.
+ * @param argv The words.
+ *
+ * @return The exit status of the command.
+ */
+int commandList(t_cliContext *context, int argc, char **argv);
+
+/**
+ * Name: commandCat
+ * @brief cat PATH: write the content of a file. In batch mode the content is framed by a
+ *        "data" record with its size and a newline after the last byte.
  *
- * @param head The head of the linked list.
+ * @param context The volume and the output settings.
+ * @param argc The number of words.
+ * @param argv The words.
  *
- * @return The number of nodes in the linked list.
+ * @return The exit status of the command.
  */
-uint8_t countNode(p_EntryList head);
+int commandCat(t_cliContext *context, int argc, char **argv);
 
 /**
- * Name: converCharToInt
- * @brief Converts a character array representing a number to an integer.
+ * Name: commandStat
+ * @brief stat PATH: print the entry of a path with the number of extents of its chain.
  *
- * @param arr Pointer to the character array to be converted to an integer.
+ * @param context The volume and the output settings.
+ * @param argc The number of words.
+ * @param argv The words.
  *
- * @return The converted integer value.
- *         If the array contains non-numeric characters, the function returns -1.
+ * @return The exit status of the command.
  */
-uint8_t converCharToInt(char *arr);
+int commandStat(t_cliContext *context, int argc, char **argv);
 
 /**
- * Name: display
- * @brief Display the information of files and directories stored in the linked list of directory entries.
+ * Name: commandFind
+ * @brief find [PATH] [-name PATTERN] [-type f|d]: print every entry below a directory that
+ *        matches. The pattern is a shell pattern compared without case.
  *
- * @param head: The head of the linked list containing directory entries.
+ * @param context The volume and the output settings.
+ * @param argc The number of words.
+ * @param argv The words.
+ *
+ * @return The exit status of the command.
  */
-void display(p_EntryList head);
+int commandFind(t_cliContext *context, int argc, char **argv);
 
 /**
- * Name: APP
- * @brief Main application function to manage the file system and user interaction.
+ * Name: commandExtract
+ * @brief extract [--threads N] [--buffered] PATH HOSTDIR: copy a file or a directory tree to a
+ *        directory of the host with extractTree(), then print one record with the counters.
+ *        Contiguous extents are copied inside the kernel unless --buffered is given.
+ *
+ * @param context The volume and the output settings.
+ * @param argc The number of words.
+ * @param argv The words.
  *
- * @param filePath: The path to the disk file.
- * @param fp: A pointer to the opened file.
+ * @return The exit status of the command.
  */
-void APP(const char * FileFath, FILE *fp);
+int commandExtract(t_cliContext *context, int argc, char **argv);
+
+/**
+ * Name: listDirectory
+ * @brief Print the entries of a directory that pass a filter, in directory order, each
+ *        subdirectory followed by its own entries when the filter is recursive.
+ *
+ * @param context The volume and the output settings.
+ * @param command The command name, for the error messages.
+ * @param path The path of the directory, "" for the root directory.
+ * @param cluster The start cluster of the directory.
+ * @param filter The filter.
+ *
+ * @return CLI_EXIT_OK, or CLI_EXIT_FAILED if a directory could not be read. The other
+ *         directories are still listed.
+ */
+int listDirectory(t_cliContext *context, const char *command, const char *path, uint32_t cluster,
+                  const t_cliFilter *filter);
+
+/**
+ * Name: matchFilter
+ * @brief Check an entry against a filter.
+ *
+ * @param filter The filter.
+ * @param entry The entry.
+ *
+ * @return 1 if the entry passes, 0 otherwise.
+ */
+uint8_t matchFilter(const t_cliFilter *filter, const t_direcroryEntry *entry);
+
+/**
+ * Name: printEntry
+ * @brief Print one entry as a TSV line (path, type, size, date, cluster, attributes and,
+ *        for stat, extents) or as one JSON object.
+ *
+ * @param context The volume and the output settings.
+ * @param path The full path of the entry.
+ * @param entry The entry.
+ * @param withExtents 1 to count and print the extents of its chain.
+ */
+void printEntry(t_cliContext *context, const char *path, const t_direcroryEntry *entry, uint8_t withExtents);
+
+/**
+ * Name: printError
+ * @brief Print why a command failed on stderr.
+ *
+ * @param command The command.
+ * @param path The path it was given, may be NULL.
+ * @param message The reason.
+ */
+void printError(const char *command, const char *path, const char *message);
+
+/**
+ * Name: lookupPath
+ * @brief Resolve a path and print an error when it does not exist.
+ *
+ * @param context The volume and the output settings.
+ * @param command The command, for the error.
+ * @param path The path.
+ * @param entry Receives the entry.
+ *
+ * @return 1 if the path was found, 0 otherwise.
+ */
+uint8_t lookupPath(t_cliContext *context, const char *command, const char *path, t_direcroryEntry *entry);
+
+/**
+ * Name: trimPath
+ * @brief Copy a path without its trailing separators, so that names can be appended.
+ *
+ * @param path The path.
+ * @param out Receives the path, "" for the root directory, CLI_PATH_MAX bytes.
+ */
+void trimPath(const char *path, char *out);
 
 /*******************************************************************************
 * Code
 *******************************************************************************/
-int main()
+int main(int argc, char **argv)
 {
-    char *filePath = NULL;
-    FILE *fp = NULL;
-    filePath = "fat32.img";
+    t_cliOptions options;
+    t_cliContext context;
+    int status = CLI_EXIT_ERROR;
+
+    memset(&context, 0, sizeof(context));
 
-    APP(filePath, fp);
+    if(parseOptions(argc, argv, &options) == 0)
+    {
+        fprintf(stderr, "Usage: %s IMAGE [--format tsv|json] [--fat-cache BYTES] [COMMAND [ARGS...]]\n"
+                        "Commands: ls [-R] [PATH], cat PATH, stat PATH, find [PATH] [-name PATTERN] [-type f|d],\n"
+                        "          extract [--threads N] [--buffered] PATH HOSTDIR\n"
+                        "Without a command, one command per line is read from stdin.\n", argv[0]);
+    }
+    else if((context.vol = initFileFAT(options.imagePath, &options.volume)) == NULL)
+    {
+        fprintf(stderr, "Cannot open the image %s.\n", options.imagePath);
+    }
+    else if((context.buff = (uint8_t*)malloc(CLI_READ_CHUNK)) == NULL)
+    {
+        fprintf(stderr, "The disk is empty.\n");
+    }
+    else
+    {
+        /* Full buffering, the output is written in large blocks */
+        setvbuf(stdout, NULL, _IOFBF, CLI_OUTPUT_BUFFER);
+        context.format = options.format;
+
+        if(options.firstCommand < argc)
+        {
+            status = runCommand(&context, argc - options.firstCommand, &argv[options.firstCommand]);
+        }
+        else
+        {
+            context.batch = 1;
+            status = runBatch(&context, stdin);
+        }
+
+        fflush(stdout);
+    }
+
+    free(context.buff);
+    if(context.vol != NULL)
+    {
+        deinitFileFAT(context.vol);
+    }
 
-    fclose(fp);
+    return status;
 }
 
-uint8_t countNode(p_EntryList head)
+uint8_t parseOptions(int argc, char **argv, t_cliOptions *options)
 {
-    p_EntryList current = NULL;
-    uint8_t count = 0;
+    const char *name = NULL;
+    const char *value = NULL;
+    int index = 0;
+    uint8_t result = 1;
+
+    memset(options, 0, sizeof(t_cliOptions));
+    defaultVolumeConfig(&options->volume);
+    options->format = CLI_FORMAT_TSV;
+    options->firstCommand = argc;
+
+    /* The options come before the command, the first other word after the image starts it */
+    for(index = 1; (result == 1) && (index < argc) && (options->firstCommand == argc); index++)
+    {
+        name = argv[index];
+        value = (index + 1 < argc) ? argv[index + 1] : NULL;
 
-    current = head;
+        if(name[0] != '-')
+        {
+            if(options->imagePath == NULL)
+            {
+                options->imagePath = name;
+            }
+            else
+            {
+                options->firstCommand = index;
+            }
+        }
+        else if(value == NULL)
+        {
+            result = 0;
+        }
+        else
+        {
+            if((strcmp(name, "--format") == 0) && (strcmp(value, "tsv") == 0))
+            {
+                options->format = CLI_FORMAT_TSV;
+            }
+            else if((strcmp(name, "--format") == 0) && (strcmp(value, "json") == 0))
+            {
+                options->format = CLI_FORMAT_JSON;
+            }
+            else if(strcmp(name, "--fat-cache") == 0)
+            {
+                options->volume.fatCacheLimit = (uint32_t)strtoul(value, NULL, 0);
+            }
+            else
+            {
+                result = 0;
+            }
+            index++;
+        }
+    }
 
-    /* Count until null pointer is encountered */
-    while (current != NULL)
+    if(options->imagePath == NULL)
     {
-        count++;
-        current = current->next;  /* Move to the next node in the list */
+        result = 0;
     }
 
-    return count;
+    return result;
 }
 
-uint8_t converCharToInt(char *arr)
+int runBatch(t_cliContext *context, FILE *input)
 {
-    uint8_t index = 0;
-    uint8_t inter = 0;
-    uint8_t flag = 0;
-    uint8_t value = 0;
-    uint8_t size = 0;
+    char line[CLI_LINE_MAX];
+    char *words[CLI_MAX_ARGS];
+    char *word = NULL;
+    char *save = NULL;
+    int numWords = 0;
+    int status = CLI_EXIT_OK;
+    int result = 0;
+
+    while(fgets(line, sizeof(line), input) != NULL)
+    {
+        numWords = 0;
+
+        /* A line longer than the buffer is dropped whole rather than run in pieces */
+        if((strchr(line, '\n') == NULL) && (feof(input) == 0))
+        {
+            while((fgets(line, sizeof(line), input) != NULL) && (strchr(line, '\n') == NULL))
+            {
+            }
+            printError("batch", NULL, "line too long");
+            line[0] = '\0';
+            status = CLI_EXIT_FAILED;
+        }
+
+        for(word = strtok_r(line, " \t\r\n", &save); (word != NULL) && (numWords < (int)CLI_MAX_ARGS);
+            word = strtok_r(NULL, " \t\r\n", &save))
+        {
+            words[numWords] = word;
+            numWords++;
+        }
 
-    size = strlen(arr);   /* Determine the size of the character array */
+        if((numWords == 0) || (words[0][0] == '#'))
+        {
+            continue;
+        }
 
-    /* convert char array to int */
-    for( index = 0 ; index < size; index++){
-        if ((arr[index] >= '0') &&  (arr[index] <= '9'))
+        result = runCommand(context, numWords, words);
+        if(result != CLI_EXIT_OK)
         {
-            inter = arr[index] - '0';
-            value = value * 10 + inter;
+            status = CLI_EXIT_FAILED;
+        }
 
-            printf("value %d: %d", index, value);
+        /* The end of every answer, flushed so the caller does not wait for the buffer to fill */
+        if(context->format == CLI_FORMAT_JSON)
+        {
+            printf("{\"end\":true,\"status\":%d,\"records\":%llu}\n", result, (unsigned long long)context->records);
         }
-        else {
-            flag = 1;
+        else
+        {
+            printf("end\t%d\t%llu\n", result, (unsigned long long)context->records);
         }
+        fflush(stdout);
     }
 
-    /* If non-numeric characters are found */
-    if (flag)
+    return status;
+}
+
+int runCommand(t_cliContext *context, int argc, char **argv)
+{
+    int status = CLI_EXIT_FAILED;
+
+    context->records = 0;
+
+    if(strcmp(argv[0], "ls") == 0)
+    {
+        status = commandList(context, argc, argv);
+    }
+    else if(strcmp(argv[0], "cat") == 0)
+    {
+        status = commandCat(context, argc, argv);
+    }
+    else if(strcmp(argv[0], "stat") == 0)
+    {
+        status = commandStat(context, argc, argv);
+    }
+    else if(strcmp(argv[0], "find") == 0)
     {
-        value = -1;
+        status = commandFind(context, argc, argv);
+    }
+    else if(strcmp(argv[0], "extract") == 0)
+    {
+        status = commandExtract(context, argc, argv);
+    }
+    else
+    {
+        printError(argv[0], NULL, "unknown command");
+        status = CLI_EXIT_ERROR;
     }
 
-    return value;
+    return status;
 }
 
-void display(p_EntryList head)
+int commandList(t_cliContext *context, int argc, char **argv)
 {
-    p_EntryList current = NULL;
-    uint16_t count = 0;
-    uint16_t year = 0;
-    uint8_t month = 0;
-    uint8_t day = 0;
-    uint8_t hour = 0;
-    uint8_t min = 0;
-    uint8_t sec = 0;
-    uint8_t index = 0;
+    t_cliFilter filter;
+    t_direcroryEntry entry;
+    const char *path = "/";
+    char base[CLI_PATH_MAX];
+    int index = 0;
+    int status = CLI_EXIT_OK;
 
-    printf("\n-------------------------------------------------------------------\n");
-    printf("No.  Name\t\tSize\t\tDate\t\tTime\n");
+    memset(&filter, 0, sizeof(filter));
 
-    current = head;
+    for(index = 1; (status == CLI_EXIT_OK) && (index < argc); index++)
+    {
+        if(strcmp(argv[index], "-R") == 0)
+        {
+            filter.recursive = 1;
+        }
+        else if((argv[index][0] == '-') || (index + 1 < argc))
+        {
+            printError(argv[0], argv[index], "usage: ls [-R] [PATH]");
+            status = CLI_EXIT_ERROR;
+        }
+        else
+        {
+            path = argv[index];
+        }
+    }
+
+    if(status != CLI_EXIT_OK)
+    {
+        /* Bad usage */
+    }
+    else if(lookupPath(context, argv[0], path, &entry) == 0)
+    {
+        status = CLI_EXIT_FAILED;
+    }
+    else if((entry.attributes & ATTR_DIRECTORY) == 0)
+    {
+        printEntry(context, path, &entry, 0);
+    }
+    else
+    {
+        trimPath(path, base);
+        status = listDirectory(context, argv[0], base, entry.startCluster, &filter);
+    }
 
-    /* Loop through all entries in the linked list and display the information */
-    while(current != NULL)
+    return status;
+}
+
+int commandCat(t_cliContext *context, int argc, char **argv)
+{
+    t_direcroryEntry entry;
+    t_fatFile *file = NULL;
+    uint32_t byteRead = 0;
+    uint32_t total = 0;
+    int status = CLI_EXIT_FAILED;
+
+    if(argc != 2)
+    {
+        printError(argv[0], NULL, "usage: cat PATH");
+        status = CLI_EXIT_ERROR;
+    }
+    else if(lookupPath(context, argv[0], argv[1], &entry) == 0)
+    {
+        /* Not found */
+    }
+    else if((entry.attributes & ATTR_DIRECTORY) != 0)
+    {
+        printError(argv[0], argv[1], "is a directory");
+    }
+    else if((entry.fileSize > 0) && ((file = fatOpen(context->vol, entry.startCluster, entry.fileSize)) == NULL))
     {
-        printf(" %d   ", ++count);
+        printError(argv[0], argv[1], "cannot open");
+    }
+    else
+    {
+        /* In batch mode the reader needs the size to find the end of the content */
+        if(context->batch == 1)
+        {
+            if(context->format == CLI_FORMAT_JSON)
+            {
+                printf("{\"data\":");
+                statsWriteJSONString(stdout, argv[1]);
+                printf(",\"size\":%u}\n", entry.fileSize);
+            }
+            else
+            {
+                printf("data\t%s\t%u\n", argv[1], entry.fileSize);
+            }
+        }
 
-        /* Print name of file in folder */
-        for(index = 0; index < 8; index++)
+        while((file != NULL) && ((byteRead = fatRead(file, context->buff, CLI_READ_CHUNK)) > 0))
         {
-            printf("%c", current->entry.fileName[index]);
+            fwrite(context->buff, sizeof(uint8_t), byteRead, stdout);
+            total += byteRead;
         }
 
-        /* Print dot if it's not a directory */
-        if(current->entry.attributes != ATTR_DIRECTORY)
+        if(total == entry.fileSize)
         {
-            printf (".");
-            /* Print type of file */
-            for(index = 8; index < SIZE_OF_NAME; index++)
+            context->records = 1;
+            status = CLI_EXIT_OK;
+        }
+        else
+        {
+            /* Keep the framing: the size promised is always written */
+            for(; total < entry.fileSize; total++)
             {
-            printf("%c", current->entry.fileName[index]);
+                putchar('\0');
             }
+            printError(argv[0], argv[1], "read error");
         }
-        else
+
+        if(context->batch == 1)
         {
-            printf("");
+            putchar('\n');
         }
+    }
 
-        /* Print size of file */
-        if(current->entry.attributes != ATTR_DIRECTORY)
+    fatClose(file);
+
+    return status;
+}
+
+int commandStat(t_cliContext *context, int argc, char **argv)
+{
+    t_direcroryEntry entry;
+    int status = CLI_EXIT_FAILED;
+
+    if(argc != 2)
+    {
+        printError(argv[0], NULL, "usage: stat PATH");
+        status = CLI_EXIT_ERROR;
+    }
+    else if(lookupPath(context, argv[0], argv[1], &entry) == 1)
+    {
+        printEntry(context, argv[1], &entry, 1);
+        status = CLI_EXIT_OK;
+    }
+
+    return status;
+}
+
+int commandFind(t_cliContext *context, int argc, char **argv)
+{
+    t_cliFilter filter;
+    t_direcroryEntry entry;
+    const char *path = "/";
+    char base[CLI_PATH_MAX];
+    uint32_t index = 0;
+    int word = 0;
+    int status = CLI_EXIT_OK;
+
+    memset(&filter, 0, sizeof(filter));
+    filter.recursive = 1;
+
+    for(word = 1; (status == CLI_EXIT_OK) && (word < argc); word++)
+    {
+        if((strcmp(argv[word], "-name") == 0) && (word + 1 < argc) && (strlen(argv[word + 1]) < CLI_PATH_MAX))
         {
-            printf ("\t%i\t\t", current->entry.fileSize);
+            /* Names are compared in upper case, like the 8.3 names are stored */
+            word++;
+            for(index = 0; argv[word][index] != '\0'; index++)
+            {
+                filter.pattern[index] = (char)toupper((unsigned char)argv[word][index]);
+            }
+            filter.pattern[index] = '\0';
+        }
+        else if((strcmp(argv[word], "-type") == 0) && (word + 1 < argc) && (strcmp(argv[word + 1], "f") == 0))
+        {
+            filter.type = CLI_TYPE_FILE;
+            word++;
+        }
+        else if((strcmp(argv[word], "-type") == 0) && (word + 1 < argc) && (strcmp(argv[word + 1], "d") == 0))
+        {
+            filter.type = CLI_TYPE_DIR;
+            word++;
+        }
+        else if((word == 1) && (argv[word][0] != '-'))
+        {
+            path = argv[word];
         }
         else
         {
-            printf("\t\t\t\t");
+            printError(argv[0], argv[word], "usage: find [PATH] [-name PATTERN] [-type f|d]");
+            status = CLI_EXIT_ERROR;
         }
+    }
 
-        /* Print the last date and time recorded */
-        year = (current->entry.writeDate >> SHIFT_9_BIT) + SET_YEAR;
-        month = (current->entry.writeDate >> SHIFT_5_BIT) & MASK_MONTH;
-        day = current->entry.writeDate & MASK_DAY;
+    if(status != CLI_EXIT_OK)
+    {
+        /* Bad usage */
+    }
+    else if(lookupPath(context, argv[0], path, &entry) == 0)
+    {
+        status = CLI_EXIT_FAILED;
+    }
+    else if((entry.attributes & ATTR_DIRECTORY) == 0)
+    {
+        printError(argv[0], path, "is not a directory");
+        status = CLI_EXIT_FAILED;
+    }
+    else
+    {
+        trimPath(path, base);
+        status = listDirectory(context, argv[0], base, entry.startCluster, &filter);
+    }
 
-        hour = current->entry.writeTime >> SHIFT_11_BIT;
-        min  = (current->entry.writeTime >> SHIFT_5_BIT) & MASK_MINUTE;
-        sec = current->entry.writeTime & MASK_SECOND;
+    return status;
+}
 
-        printf("%02d/%02d/%04d ",day, month, year);
-        printf("\t%02d:%02d:%02d\n",hour, min, sec);
+int commandExtract(t_cliContext *context, int argc, char **argv)
+{
+    t_extractConfig config;
+    t_extractStats stats;
+    t_direcroryEntry entry;
+    const char *path = NULL;
+    const char *hostDir = NULL;
+    int index = 0;
+    int status = CLI_EXIT_OK;
+
+    memset(&config, 0, sizeof(config));
+    memset(&stats, 0, sizeof(stats));
+    config.numThreads = EXTRACT_THREADS_AUTO;
+    config.copyMode = EXTRACT_COPY_KERNEL;
+
+    for(index = 1; (status == CLI_EXIT_OK) && (index < argc); index++)
+    {
+        if((strcmp(argv[index], "--threads") == 0) && (index + 1 < argc))
+        {
+            config.numThreads = (uint32_t)strtoul(argv[++index], NULL, 0);
+        }
+        else if(strcmp(argv[index], "--buffered") == 0)
+        {
+            config.copyMode = EXTRACT_COPY_BUFFERED;
+        }
+        else if((argv[index][0] != '-') && (path == NULL))
+        {
+            path = argv[index];
+        }
+        else if((argv[index][0] != '-') && (hostDir == NULL))
+        {
+            hostDir = argv[index];
+        }
+        else
+        {
+            status = CLI_EXIT_ERROR;
+        }
+    }
 
-        current = current->next;
+    if((status != CLI_EXIT_OK) || (hostDir == NULL))
+    {
+        printError(argv[0], NULL, "usage: extract [--threads N] [--buffered] PATH HOSTDIR");
+        status = CLI_EXIT_ERROR;
+    }
+    else if(lookupPath(context, argv[0], path, &entry) == 0)
+    {
+        status = CLI_EXIT_FAILED;
     }
+    else
+    {
+        /* extractTree() reports each failed entry itself, the counters say how many */
+        if(extractTree(context->vol, path, hostDir, &config, &stats) == 0)
+        {
+            printError(argv[0], path, "not every entry was extracted");
+            status = CLI_EXIT_FAILED;
+        }
 
-    printf(" %d   Exit program!\n", (count + 1));
+        if(context->format == CLI_FORMAT_JSON)
+        {
+            printf("{\"extract\":");
+            statsWriteJSONString(stdout, path);
+            printf(",\"hostDir\":");
+            statsWriteJSONString(stdout, hostDir);
+            printf(",\"files\":%u,\"directories\":%u,\"bytes\":%llu,\"kernelBytes\":%llu,\"errors\":%u}\n",
+                   stats.files, stats.directories, (unsigned long long)stats.bytes,
+                   (unsigned long long)stats.kernelBytes, stats.errors);
+        }
+        else
+        {
+            printf("%s\t%s\t%u\t%u\t%llu\t%llu\t%u\n", path, hostDir, stats.files, stats.directories,
+                   (unsigned long long)stats.bytes, (unsigned long long)stats.kernelBytes, stats.errors);
+        }
+        context->records++;
+    }
 
-    printf("-------------------------------------------------------------------\n");
+    return status;
 }
 
-void APP(const char * filePath, FILE *fp)
+int listDirectory(t_cliContext *context, const char *command, const char *path, uint32_t cluster,
+                  const t_cliFilter *filter)
 {
-    t_location local = {0};
-    t_bootSector bootInfo = {0};
-    p_EntryList head = NULL;
-    p_EntryList temp = NULL;
-    uint8_t* buff = NULL;
-    uint8_t thisFatType = 0;
-    char str[10];
-    uint32_t startEntry = 0;
-    uint32_t select = 0;
-    uint8_t count = 0;
-    uint8_t ans = 0;
-    uint8_t flagExit = 0;
-    uint32_t index = 0;
+    t_dirList list = {NULL, 0, 0};
+    const t_direcroryEntry *current = NULL;
+    char name[NAME_MAX_LENGTH];
+    char *child = NULL;
+    uint32_t count = 0;
+    int status = CLI_EXIT_OK;
+
+    child = (char*)malloc(CLI_PATH_MAX);
 
-    bootInfo = initFileFAT(filePath, fp);
-    local = localEachRegion();
-    thisFatType = fatType();
-
-    /* Based on the FAT type, read the directory entry information */
-    switch(thisFatType)
-    {
-    case FAT_12:
-    case FAT_16:
-        startEntry = 0;
-        loadDirEntry(&head, startEntry);
-        break;
-    case FAT_32:
-        startEntry = bootInfo.rootClus;
-        loadDirEntry(&head, startEntry);
-        break;
-    default:
-        break;
-    }
-
-    while(flagExit == 0)
-    {
-        temp = head;
-        ans = countNode(temp) + 1;
-        do
-        {
-            display(head);
-            printf("Enter your option (1 - %d): ", ans);
-            gets(str);
-            select = converCharToInt(str);
-            printf("%d\n", converCharToInt(str));
-            system("cls");
-
-            /* Check if the user input is valid or if it's the exit option */
-            if(select == ans)
+    if(child == NULL)
+    {
+        fprintf(stderr, "The disk is empty.\n");
+        status = CLI_EXIT_FAILED;
+    }
+    else
+    {
+        if(loadDirEntry(context->vol, &list, cluster) == 0)
+        {
+            printError(command, (path[0] == '\0') ? "/" : path, "cannot read the directory");
+            status = CLI_EXIT_FAILED;
+        }
+
+        for(count = 0; count < list.count; count++)
+        {
+            current = &list.entries[count];
+            fatFormatName(current, name);
+
+            /* Skip "." and "..", and paths too long to print */
+            if((current->fileName[0] == '.') ||
+               (snprintf(child, CLI_PATH_MAX, "%s/%s", path, name) >= (int)CLI_PATH_MAX))
             {
-                system("cls");
-                printf("\nGood bye!\n");
-                flagExit = 1;
+                continue;
             }
 
-        } while((select > ans) || (select < 1));
+            if(matchFilter(filter, current) == 1)
+            {
+                printEntry(context, child, current, 0);
+            }
 
-        while(temp != NULL)
-        {
-            if(count == select - 1)
+            if((filter->recursive == 1) && ((current->attributes & ATTR_DIRECTORY) != 0))
             {
-                /* Check if the selected entry is a directory or a file */
-                if(temp->entry.attributes == ATTR_DIRECTORY)
+                if(listDirectory(context, command, child, current->startCluster, filter) != CLI_EXIT_OK)
                 {
-                    loadDirEntry(&temp, temp->entry.startCluster);
-                    head = temp;
-                }
-                else
-                {
-                    if(temp->entry.fileSize > 0)
-                    {
-                        buff = (uint8_t *)malloc(((temp->entry.fileSize/bootInfo.bytsPerSec) + 1)
-                                                 * bootInfo.bytsPerSec
-                                                 * bootInfo.secPerClus);
-
-                        if(buff == NULL)
-                        {
-                            printf("The disk is empty.\n");
-                            flagExit = 1;
-                        }
-                        else
-                        {
-                            loadFile(buff, temp->entry.startCluster);
-
-                            /* Display the file content on the screen */
-                            for (index = 0; index < temp->entry.fileSize; index++)
-                            {
-                                printf("%c", buff[index]);
-                            }
-
-                            free(buff);
-                        }
-                    }
+                    status = CLI_EXIT_FAILED;
                 }
             }
-            count++;
-            temp = temp->next;
         }
-        count = 0;
     }
+
+    freeDirList(&list);
+    free(child);
+
+    return status;
+}
+
+uint8_t matchFilter(const t_cliFilter *filter, const t_direcroryEntry *entry)
+{
+    char name[NAME_MAX_LENGTH];
+    uint32_t index = 0;
+    uint8_t result = 1;
+
+    if((filter->type == CLI_TYPE_FILE) && ((entry->attributes & ATTR_DIRECTORY) != 0))
+    {
+        result = 0;
+    }
+    else if((filter->type == CLI_TYPE_DIR) && ((entry->attributes & ATTR_DIRECTORY) == 0))
+    {
+        result = 0;
+    }
+    else if(filter->pattern[0] != '\0')
+    {
+        fatFormatName(entry, name);
+        for(index = 0; name[index] != '\0'; index++)
+        {
+            name[index] = (char)toupper((unsigned char)name[index]);
+        }
+        result = (fnmatch(filter->pattern, name, 0) == 0);
+    }
+
+    return result;
+}
+
+void printEntry(t_cliContext *context, const char *path, const t_direcroryEntry *entry, uint8_t withExtents)
+{
+    const char *type = NULL;
+    char date[24];
+    uint32_t extents = 0;
+
+    type = ((entry->attributes & ATTR_DIRECTORY) != 0) ? "dir" : "file";
+
+    /* The time is stored in 2 second units */
+    snprintf(date, sizeof(date), "%04u-%02u-%02u %02u:%02u:%02u",
+             (unsigned)((entry->writeDate >> SHIFT_9_BIT) + SET_YEAR),
+             (unsigned)((entry->writeDate >> SHIFT_5_BIT) & MASK_MONTH),
+             (unsigned)(entry->writeDate & MASK_DAY),
+             (unsigned)(entry->writeTime >> SHIFT_11_BIT),
+             (unsigned)((entry->writeTime >> SHIFT_5_BIT) & MASK_MINUTE),
+             (unsigned)((entry->writeTime & MASK_SECOND) << SHIFT_1_BIT));
+
+    if(withExtents == 1)
+    {
+        extents = countExtents(context->vol, entry->startCluster);
+    }
+
+    if(context->format == CLI_FORMAT_JSON)
+    {
+        printf("{\"path\":");
+        statsWriteJSONString(stdout, path);
+        printf(",\"type\":\"%s\",\"size\":%u,\"date\":\"%s\",\"cluster\":%u,\"attributes\":%u",
+               type, entry->fileSize, date, entry->startCluster, entry->attributes);
+        if(withExtents == 1)
+        {
+            printf(",\"extents\":%u", extents);
+        }
+        printf("}\n");
+    }
+    else
+    {
+        printf("%s\t%s\t%u\t%s\t%u\t0x%02X", path, type, entry->fileSize, date, entry->startCluster, entry->attributes);
+        if(withExtents == 1)
+        {
+            printf("\t%u", extents);
+        }
+        putchar('\n');
+    }
+
+    context->records++;
+}
+
+void printError(const char *command, const char *path, const char *message)
+{
+    if(path != NULL)
+    {
+        fprintf(stderr, "%s: %s: %s\n", command, path, message);
+    }
+    else
+    {
+        fprintf(stderr, "%s: %s\n", command, message);
+    }
+}
+
+uint8_t lookupPath(t_cliContext *context, const char *command, const char *path, t_direcroryEntry *entry)
+{
+    uint8_t result = 0;
+
+    result = fatLookup(context->vol, path, entry);
+    if(result == 0)
+    {
+        printError(command, path, "not found");
+    }
+
+    return result;
+}
+
+void trimPath(const char *path, char *out)
+{
+    uint32_t length = 0;
+
+    length = (uint32_t)strlen(path);
+    while((length > 0) && (path[length - 1] == PATH_SEPARATOR))
+    {
+        length--;
+    }
+    if(length >= CLI_PATH_MAX)
+    {
+        length = CLI_PATH_MAX - 1;
+    }
+
+    memcpy(out, path, length);
+    out[length] = '\0';
 }